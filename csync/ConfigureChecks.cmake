@@ -52,6 +52,7 @@ check_function_exists(timegm HAVE_TIMEGM)
 check_function_exists(strerror_r HAVE_STRERROR_R)
 check_function_exists(utimes HAVE_UTIMES)
 check_function_exists(lstat HAVE_LSTAT)
+check_function_exists(fstatat HAVE_FSTATAT)
 check_function_exists(asprintf HAVE_ASPRINTF)
 if (WIN32)
 	check_function_exists(__mingw_asprintf HAVE___MINGW_ASPRINTF)
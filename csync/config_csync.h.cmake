@@ -20,6 +20,7 @@
 #cmakedefine HAVE_STRERROR_R 1
 #cmakedefine HAVE_UTIMES 1
 #cmakedefine HAVE_LSTAT 1
+#cmakedefine HAVE_FSTATAT 1
 #cmakedefine HAVE_FNMATCH 1
 #cmakedefine HAVE_ICONV 1
 #cmakedefine HAVE_ICONV_CONST 1
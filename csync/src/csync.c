@@ -58,37 +58,6 @@
 #include "csync_rename.h"
 #include "c_jhash.h"
 
-static int _key_cmp(const void *key, const void *data) {
-  uint64_t a;
-  csync_file_stat_t *b;
-
-  a = *(uint64_t *) (key);
-  b = (csync_file_stat_t *) data;
-
-  if (a < b->phash) {
-    return -1;
-  } else if (a > b->phash) {
-    return 1;
-  }
-
-  return 0;
-}
-
-static int _data_cmp(const void *key, const void *data) {
-  csync_file_stat_t *a, *b;
-
-  a = (csync_file_stat_t *) key;
-  b = (csync_file_stat_t *) data;
-
-  if (a->phash < b->phash) {
-    return -1;
-  } else if (a->phash > b->phash) {
-    return 1;
-  }
-
-  return 0;
-}
-
 int csync_create(CSYNC **csync, const char *local, const char *remote) {
   CSYNC *ctx;
   size_t len = 0;
@@ -150,18 +119,24 @@ int csync_init(CSYNC *ctx) {
 
   ctx->remote.type = REMOTE_REPLICA;
 
-  if (c_rbtree_create(&ctx->local.tree, _key_cmp, _data_cmp) < 0) {
+  if (c_hashtable_create(&ctx->local.tree) < 0) {
     ctx->status_code = CSYNC_STATUS_TREE_ERROR;
     rc = -1;
     goto out;
   }
 
-  if (c_rbtree_create(&ctx->remote.tree, _key_cmp, _data_cmp) < 0) {
+  if (c_hashtable_create(&ctx->remote.tree) < 0) {
     ctx->status_code = CSYNC_STATUS_TREE_ERROR;
     rc = -1;
     goto out;
   }
 
+  if (c_arena_create(&ctx->arena) < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    rc = -1;
+    goto out;
+  }
+
   ctx->remote.root_perms = 0;
 
   ctx->status = CSYNC_STATUS_INIT;
@@ -175,9 +150,25 @@ out:
   return rc;
 }
 
-int csync_update(CSYNC *ctx) {
+static int _csync_update_new_local_walk(CSYNC *ctx) {
+  /* csync_update_remote() works on ctx while the copy walks the local replica */
+  ctx->local_walk = csync_walk_new(ctx);
+  return ctx->local_walk != NULL ? 0 : -1;
+}
+
+/* Free the walk context of csync_update_local(), after moving its file stats
+ * and, if it failed, its error to ctx. The local replica is walked first in a
+ * sequential update, so its error wins. */
+static void _csync_update_merge_local_walk(CSYNC *ctx) {
+  if (ctx->local_walk == NULL) {
+    return;
+  }
+  csync_walk_merge(ctx, ctx->local_walk);
+  ctx->local_walk = NULL;
+}
+
+int csync_update_start(CSYNC *ctx) {
   int rc = -1;
-  struct timespec start, finish;
 
   if (ctx == NULL) {
     errno = EBADF;
@@ -199,6 +190,12 @@ int csync_update(CSYNC *ctx) {
       return rc;
     }
 
+  /* update and reconcile look up every file, answer them from memory */
+  if (csync_statedb_load_snapshot(ctx) < 0 && ctx->remote.changes) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "No db snapshot to apply the remote changes to, listing every directory.");
+    csync_remote_changes_destroy(ctx);
+  }
+
   ctx->status_code = CSYNC_STATUS_OK;
 
   csync_memstat_check();
@@ -206,27 +203,72 @@ int csync_update(CSYNC *ctx) {
   if (!ctx->excludes) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "No exclude file loaded or defined!");
   }
+  /* the walkers only read the compiled matcher from here on */
+  csync_exclude_compile(ctx);
+
+  _csync_update_merge_local_walk(ctx);
+  if (_csync_update_new_local_walk(ctx) < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    csync_statedb_close(ctx);
+    return -1;
+  }
+
+  return 0;
+}
+
+int csync_update_walks_in_parallel(CSYNC *ctx) {
+  if (ctx == NULL || ctx->local_walk == NULL) {
+    return 0;
+  }
+  /* without the snapshot the walks query the shared statedb connection */
+  return ctx->statedb.snapshot != NULL;
+}
+
+int csync_update_local(CSYNC *ctx) {
+  CSYNC *walk = NULL;
+  int rc = -1;
+  struct timespec start, finish;
+
+  if (ctx == NULL || ctx->local_walk == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+  walk = ctx->local_walk;
 
   /* update detection for local replica */
   csync_gettime(&start);
-  ctx->current = LOCAL_REPLICA;
-  ctx->replica = ctx->local.type;
+  walk->current = LOCAL_REPLICA;
+  walk->replica = walk->local.type;
 
-  rc = csync_ftw(ctx, ctx->local.uri, csync_walker, MAX_DEPTH);
+  rc = csync_ftw_parallel(walk, walk->local.uri, MAX_DEPTH);
   if (rc < 0) {
-    if(ctx->status_code == CSYNC_STATUS_OK) {
-        ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_UPDATE_ERROR);
+    if(walk->status_code == CSYNC_STATUS_OK) {
+        walk->status_code = csync_errno_to_status(errno, CSYNC_STATUS_UPDATE_ERROR);
     }
-    goto out;
+    return rc;
   }
+  /* directories that were ignored leave their status behind, it is no error */
+  walk->status_code = CSYNC_STATUS_OK;
 
   csync_gettime(&finish);
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
             "Update detection for local replica took %.2f seconds walking %zu files.",
-            c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
+            c_secdiff(finish, start), c_hashtable_size(walk->local.tree));
   csync_memstat_check();
 
+  return 0;
+}
+
+int csync_update_remote(CSYNC *ctx) {
+  int rc = -1;
+  struct timespec start, finish;
+
+  if (ctx == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
   /* update detection for remote replica */
   csync_gettime(&start);
   ctx->current = REMOTE_REPLICA;
@@ -237,7 +279,7 @@ int csync_update(CSYNC *ctx) {
       if(ctx->status_code == CSYNC_STATUS_OK) {
           ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_UPDATE_ERROR);
       }
-      goto out;
+      return rc;
   }
 
   csync_gettime(&finish);
@@ -245,18 +287,45 @@ int csync_update(CSYNC *ctx) {
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
             "Update detection for remote replica took %.2f seconds "
             "walking %zu files.",
-            c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+            c_secdiff(finish, start), c_hashtable_size(ctx->remote.tree));
   csync_memstat_check();
 
-  ctx->status |= CSYNC_STATUS_UPDATE;
+  return 0;
+}
 
-  rc = 0;
+int csync_update_finish(CSYNC *ctx, int rc) {
+  if (ctx == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  _csync_update_merge_local_walk(ctx);
+
+  if (rc >= 0) {
+    ctx->status |= CSYNC_STATUS_UPDATE;
+    rc = 0;
+  }
 
-out:
   csync_statedb_close(ctx);
   return rc;
 }
 
+int csync_update(CSYNC *ctx) {
+  int rc = -1;
+
+  rc = csync_update_start(ctx);
+  if (rc < 0) {
+    return rc;
+  }
+
+  rc = csync_update_local(ctx);
+  if (rc >= 0) {
+    rc = csync_update_remote(ctx);
+  }
+
+  return csync_update_finish(ctx, rc);
+}
+
 int csync_reconcile(CSYNC *ctx) {
   int rc = -1;
   struct timespec start, finish;
@@ -284,7 +353,7 @@ int csync_reconcile(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Reconciliation for local replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
+      c_secdiff(finish, start), c_hashtable_size(ctx->local.tree));
 
   if (rc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
@@ -305,7 +374,7 @@ int csync_reconcile(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Reconciliation for remote replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+      c_secdiff(finish, start), c_hashtable_size(ctx->remote.tree));
 
   if (rc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
@@ -330,11 +399,11 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
     int rc = 0;
     csync_file_stat_t *cur         = NULL;
     CSYNC *ctx                     = NULL;
-    c_rbtree_visit_func *visitor   = NULL;
+    csync_treewalk_visit_func *visitor = NULL;
     _csync_treewalk_context *twctx = NULL;
     TREE_WALK_FILE trav;
-    c_rbtree_t *other_tree = NULL;
-    c_rbnode_t *other_node = NULL;
+    c_hashtable_t *other_tree = NULL;
+    csync_file_stat_t *other_stat = NULL;
 
     cur = (csync_file_stat_t *) obj;
     ctx = (CSYNC *) data;
@@ -355,9 +424,9 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
         break;
     }
 
-    other_node = c_rbtree_find(other_tree, &cur->phash);
+    other_stat = c_hashtable_find(other_tree, cur->phash);
 
-    if (!other_node) {
+    if (!other_stat) {
         /* Check the renamed path as well. */
         int len;
         uint64_t h = 0;
@@ -366,12 +435,12 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
         if (!c_streq(renamed_path, cur->path)) {
             len = strlen( renamed_path );
             h = c_jhash64((uint8_t *) renamed_path, len, 0);
-            other_node = c_rbtree_find(other_tree, &h);
+            other_stat = c_hashtable_find(other_tree, h);
         }
         SAFE_FREE(renamed_path);
     }
 
-    if (!other_node) {
+    if (!other_stat) {
         /* Check the source path as well. */
         int len;
         uint64_t h = 0;
@@ -380,7 +449,7 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
         if (!c_streq(renamed_path, cur->path)) {
             len = strlen( renamed_path );
             h = c_jhash64((uint8_t *) renamed_path, len, 0);
-            other_node = c_rbtree_find(other_tree, &h);
+            other_stat = c_hashtable_find(other_tree, h);
         }
         SAFE_FREE(renamed_path);
     }
@@ -402,7 +471,7 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
         return 0;
     }
 
-    visitor = (c_rbtree_visit_func*)(twctx->user_visitor);
+    visitor = twctx->user_visitor;
     if (visitor != NULL) {
       trav.path         = cur->path;
       trav.size         = cur->size;
@@ -424,8 +493,7 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
       trav.checksum = cur->checksum;
       trav.checksumTypeId = cur->checksumTypeId;
 
-      if( other_node ) {
-          csync_file_stat_t *other_stat = (csync_file_stat_t*)other_node->data;
+      if( other_stat ) {
           trav.other.etag = other_stat->etag;
           trav.other.file_id = other_stat->file_id;
           trav.other.instruction = other_stat->instruction;
@@ -442,8 +510,7 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
       rc = (*visitor)(&trav, twctx->userdata);
       cur->instruction = trav.instruction;
       if (trav.etag != cur->etag) { // FIXME It would be nice to have this documented
-          SAFE_FREE(cur->etag);
-          cur->etag = c_strdup(trav.etag);
+          cur->etag = c_arena_strdup(ctx->arena, trav.etag);
       }
 
       return rc;
@@ -456,11 +523,11 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
  * treewalk function, called from its wrappers below.
  *
  * it encapsulates the user visitor function, the filter and the userdata
- * into a treewalk_context structure and calls the rb treewalk function,
+ * into a treewalk_context structure and calls the hash table walk function,
  * which calls the local _csync_treewalk_visitor in this module.
  * The user visitor is called from there.
  */
-static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_func *visitor, int filter)
+static int _csync_walk_tree(CSYNC *ctx, c_hashtable_t *tree, csync_treewalk_visit_func *visitor, int filter)
 {
     _csync_treewalk_context tw_ctx;
     int rc = -1;
@@ -481,7 +548,7 @@ static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_f
 
     ctx->callbacks.userdata = &tw_ctx;
 
-    rc = c_rbtree_walk(tree, (void*) ctx, _csync_treewalk_visitor);
+    rc = c_hashtable_walk(tree, (void*) ctx, _csync_treewalk_visitor);
     if( rc < 0 ) {
       if( ctx->status_code == CSYNC_STATUS_OK )
           ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_TREE_ERROR);
@@ -496,7 +563,7 @@ static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_f
  */
 int csync_walk_remote_tree(CSYNC *ctx,  csync_treewalk_visit_func *visitor, int filter)
 {
-    c_rbtree_t *tree = NULL;
+    c_hashtable_t *tree = NULL;
     int rc = -1;
 
     if(ctx != NULL) {
@@ -515,7 +582,7 @@ int csync_walk_remote_tree(CSYNC *ctx,  csync_treewalk_visit_func *visitor, int
  */
 int csync_walk_local_tree(CSYNC *ctx, csync_treewalk_visit_func *visitor, int filter)
 {
-    c_rbtree_t *tree = NULL;
+    c_hashtable_t *tree = NULL;
     int rc = -1;
 
     if (ctx != NULL) {
@@ -529,31 +596,26 @@ int csync_walk_local_tree(CSYNC *ctx, csync_treewalk_visit_func *visitor, int fi
     return rc;  
 }
 
-static void _tree_destructor(void *data) {
-  csync_file_stat_t *freedata = NULL;
-
-  freedata = (csync_file_stat_t *) data;
-  csync_file_stat_free(freedata);
-}
-
 /* reset all the list to empty.
  * used by csync_commit and csync_destroy */
 static void _csync_clean_ctx(CSYNC *ctx)
 {
-    /* destroy the rbtrees */
-    if (c_rbtree_size(ctx->local.tree) > 0) {
-        c_rbtree_destroy(ctx->local.tree, _tree_destructor);
-    }
+    /* in case csync_update_finish() was not called */
+    _csync_update_merge_local_walk(ctx);
 
-    if (c_rbtree_size(ctx->remote.tree) > 0) {
-        c_rbtree_destroy(ctx->remote.tree, _tree_destructor);
-    }
+    /* destroy the trees, their file stats all live in the arena */
+    c_hashtable_free(ctx->local.tree);
+    c_hashtable_free(ctx->remote.tree);
+    ctx->local.tree = NULL;
+    ctx->remote.tree = NULL;
 
-    csync_rename_destroy(ctx);
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Releasing %zu bytes of file stats.", c_arena_size(ctx->arena));
+    c_arena_free(ctx->arena);
+    ctx->arena = NULL;
 
-    /* free memory */
-    c_rbtree_free(ctx->local.tree);
-    c_rbtree_free(ctx->remote.tree);
+    csync_rename_destroy(ctx);
+    csync_remote_changes_destroy(ctx);
+    csync_statedb_free_snapshot(ctx);
 
     SAFE_FREE(ctx->statedb.file);
     SAFE_FREE(ctx->remote.root_perms);
@@ -578,24 +640,31 @@ int csync_commit(CSYNC *ctx) {
   _csync_clean_ctx(ctx);
 
   ctx->remote.read_from_db = 0;
+  ctx->local.read_from_db = 0;
   ctx->read_remote_from_db = true;
   ctx->db_is_empty = false;
   ctx->ignore_hidden_files = true; // do NOT sync hidden files by default.
 
 
   /* Create new trees */
-  rc = c_rbtree_create(&ctx->local.tree, _key_cmp, _data_cmp);
+  rc = c_hashtable_create(&ctx->local.tree);
   if (rc < 0) {
     ctx->status_code = CSYNC_STATUS_TREE_ERROR;
     goto out;
   }
 
-  rc = c_rbtree_create(&ctx->remote.tree, _key_cmp, _data_cmp);
+  rc = c_hashtable_create(&ctx->remote.tree);
   if (rc < 0) {
     ctx->status_code = CSYNC_STATUS_TREE_ERROR;
     goto out;
   }
 
+  rc = c_arena_create(&ctx->arena);
+  if (rc < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    goto out;
+  }
+
 
   ctx->status = CSYNC_STATUS_INIT;
   SAFE_FREE(ctx->error_string);
@@ -731,7 +800,8 @@ void csync_resume(CSYNC *ctx)
 int  csync_abort_requested(CSYNC *ctx)
 {
   if (ctx != NULL) {
-    return ctx->abort;
+    /* a walk context of csync_update_local() is aborted with its parent */
+    return ctx->abort || (ctx->parent != NULL && ctx->parent->abort);
   } else {
     return (1 == 0);
   }
@@ -748,3 +818,26 @@ void csync_file_stat_free(csync_file_stat_t *st)
     SAFE_FREE(st);
   }
 }
+
+csync_file_stat_t *csync_file_stat_new(CSYNC *ctx, size_t pathlen)
+{
+  return c_arena_alloc(ctx->arena, sizeof(csync_file_stat_t) + pathlen + 1);
+}
+
+csync_file_stat_t *csync_file_stat_dup(CSYNC *ctx, const csync_file_stat_t *st)
+{
+  csync_file_stat_t *dup = csync_file_stat_new(ctx, st->pathlen);
+
+  if (dup == NULL) {
+    return NULL;
+  }
+  memcpy(dup, st, sizeof(csync_file_stat_t) + st->pathlen);
+  dup->path[st->pathlen] = '\0';
+  dup->destpath = c_arena_strdup(ctx->arena, st->destpath);
+  dup->etag = c_arena_strdup(ctx->arena, st->etag);
+  dup->directDownloadUrl = c_arena_strdup(ctx->arena, st->directDownloadUrl);
+  dup->directDownloadCookies = c_arena_strdup(ctx->arena, st->directDownloadCookies);
+  dup->checksum = c_arena_strdup(ctx->arena, st->checksum);
+
+  return dup;
+}
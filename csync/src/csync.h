@@ -298,6 +298,8 @@ typedef void (*csync_update_callback) (bool local,
 typedef void csync_vio_handle_t;
 typedef csync_vio_handle_t* (*csync_vio_opendir_hook) (const char *url,
                                     void *userdata);
+/* Returns NULL at the end of the directory, with errno set if the listing
+ * could not be read completely. */
 typedef csync_vio_file_stat_t* (*csync_vio_readdir_hook) (csync_vio_handle_t *dhhandle,
                                                               void *userdata);
 typedef void (*csync_vio_closedir_hook) (csync_vio_handle_t *dhhandle,
@@ -309,6 +311,11 @@ typedef int (*csync_vio_stat_hook) (csync_vio_handle_t *dhhandle,
 typedef const char* (*csync_checksum_hook) (
         const char *path, uint32_t checksumTypeId, void *userdata);
 
+/* Call job(data, i) for every i in [0, count), possibly on several threads at
+ * the same time, and return when all of the calls returned. */
+typedef void (*csync_parallel_for_hook) (
+        void (*job)(void *data, int index), void *data, int count, void *userdata);
+
 /**
  * @brief Allocate a csync context.
  *
@@ -338,6 +345,106 @@ int csync_init(CSYNC *ctx);
  */
 int csync_update(CSYNC *ctx);
 
+/**
+ * @brief Start an update detection that walks the replicas separately
+ *
+ * csync_update() is csync_update_start(), csync_update_local(),
+ * csync_update_remote() and csync_update_finish(). The local and the remote
+ * update can run at the same time on two threads, they do not share any
+ * state they write to, see csync_update_walks_in_parallel().
+ *
+ * @param ctx  The context to run the update detection on.
+ *
+ * @return  0 on success, less than 0 if an error occured. Nothing needs to
+ *          be finished then.
+ */
+int csync_update_start(CSYNC *ctx);
+
+/**
+ * @brief Whether the walks of an update detection may run at the same time
+ *
+ * Only if csync_update_start() could load the journal into memory. Without
+ * it, both walks would query the journal through the same connection, and
+ * they have to run one after the other.
+ *
+ * @param ctx  The context csync_update_start() was called on.
+ *
+ * @return  1 if csync_update_local() and csync_update_remote() may run on
+ *          two threads, 0 otherwise.
+ */
+int csync_update_walks_in_parallel(CSYNC *ctx);
+
+/**
+ * @brief Update detection for the local replica, see csync_update_start()
+ *
+ * @param ctx  The context to run the update detection on.
+ *
+ * @return  0 on success, less than 0 if an error occured.
+ */
+int csync_update_local(CSYNC *ctx);
+
+/**
+ * @brief Update detection for the remote replica, see csync_update_start()
+ *
+ * @param ctx  The context to run the update detection on.
+ *
+ * @return  0 on success, less than 0 if an error occured.
+ */
+int csync_update_remote(CSYNC *ctx);
+
+/**
+ * @brief Finish an update detection, see csync_update_start()
+ *
+ * Must be called once both csync_update_local() and csync_update_remote()
+ * returned. If the local update failed, its error is the one of the context.
+ *
+ * @param ctx  The context to run the update detection on.
+ * @param rc   Less than 0 if one of the walks failed.
+ *
+ * @return  0 on success, less than 0 if an error occured.
+ */
+int csync_update_finish(CSYNC *ctx, int rc);
+
+/**
+ * @brief Discover the remote replica from the changes since the last sync
+ *
+ * Once a change set exists, csync_update_remote() does not ask the vio hooks
+ * for listings. The listing of a remote directory is made up from its entries
+ * in the statedb, as they were at the end of the last sync, and the changes
+ * recorded with csync_remote_changes_add(). Directories without any change
+ * below them are read from the statedb.
+ *
+ * The change set has to be complete before csync_update_start() is called.
+ * It is dropped there if the statedb can not be loaded into memory, the
+ * remote replica is then discovered with the hooks. csync_commit() drops it
+ * as well.
+ *
+ * @param ctx  The context to record the changes in.
+ *
+ * @return  0 on success, less than 0 if an error occured.
+ */
+int csync_remote_changes_init(CSYNC *ctx);
+
+/**
+ * @brief Record a remote change, see csync_remote_changes_init()
+ *
+ * @param ctx   The context.
+ * @param path  The path relative to the sync root, without leading slash.
+ * @param fs    The new metadata of path, NULL if it was removed. The
+ *              context takes ownership of it.
+ *
+ * @return  0 on success, less than 0 if an error occured.
+ */
+int csync_remote_changes_add(CSYNC *ctx, const char *path, csync_vio_file_stat_t *fs);
+
+/**
+ * @brief Drop the recorded remote changes, the next remote update asks the
+ * vio hooks again.
+ *
+ * @param ctx  The context.
+ */
+void csync_remote_changes_destroy(CSYNC *ctx);
+
 /**
  * @brief Reconciliation
  *
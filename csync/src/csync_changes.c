@@ -0,0 +1,328 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016 by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config_csync.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "c_lib.h"
+#include "c_jhash.h"
+#include "csync_private.h"
+#include "csync_changes.h"
+#include "csync_statedb.h"
+
+#define CSYNC_LOG_CATEGORY_NAME "csync.changes"
+#include "csync_log.h"
+
+typedef struct csync_remote_change_s csync_remote_change_t;
+
+/* A path the server reported, fs is NULL if it was removed */
+struct csync_remote_change_s {
+  char *path;
+  csync_vio_file_stat_t *fs;
+  csync_remote_change_t *next_sibling;
+};
+
+/* A directory with changes below it */
+typedef struct csync_remote_change_dir_s {
+  char *path;
+  csync_remote_change_t *children; /* the changes directly inside */
+} csync_remote_change_dir_t;
+
+/* Both tables are keyed by the path hash, like the replica trees */
+struct csync_remote_changes_s {
+  c_hashtable_t *by_path;
+  c_hashtable_t *dirs;
+};
+
+typedef struct csync_remote_changes_listing_s {
+  csync_vio_file_stat_t **entries;
+  size_t count;
+  size_t allocated;
+  size_t pos;
+  struct csync_remote_changes_s *changes;
+} csync_remote_changes_listing_t;
+
+static uint64_t _csync_remote_changes_hash(const char *path, size_t len) {
+  return c_jhash64((uint8_t *) path, len, 0);
+}
+
+static void _csync_remote_change_destroy(void *data) {
+  csync_remote_change_t *change = data;
+
+  csync_vio_file_stat_destroy(change->fs);
+  SAFE_FREE(change->path);
+  SAFE_FREE(change);
+}
+
+static void _csync_remote_change_dir_destroy(void *data) {
+  csync_remote_change_dir_t *dir = data;
+
+  SAFE_FREE(dir->path);
+  SAFE_FREE(dir);
+}
+
+/* The entry of the directory path[0..len), created with the ones of its
+ * parents if it is not there yet. */
+static csync_remote_change_dir_t *_csync_remote_changes_dir(struct csync_remote_changes_s *changes,
+                                                            const char *path, size_t len) {
+  uint64_t h = _csync_remote_changes_hash(path, len);
+  csync_remote_change_dir_t *dir = c_hashtable_find(changes->dirs, h);
+  const char *slash;
+
+  if (dir) {
+    return dir;
+  }
+
+  dir = c_malloc(sizeof(csync_remote_change_dir_t));
+  if (dir == NULL) {
+    return NULL;
+  }
+  dir->path = c_strndup(path, len);
+  if (dir->path == NULL || c_hashtable_insert(changes->dirs, h, dir) < 0) {
+    _csync_remote_change_dir_destroy(dir);
+    return NULL;
+  }
+
+  if (len > 0) {
+    /* all the way up to the root, which is "" */
+    for (slash = path + len - 1; slash > path && *slash != '/'; slash--) {
+    }
+    if (_csync_remote_changes_dir(changes, path, slash - path) == NULL) {
+      return NULL;
+    }
+  }
+  return dir;
+}
+
+int csync_remote_changes_init(CSYNC *ctx) {
+  struct csync_remote_changes_s *changes;
+
+  if (ctx == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+  csync_remote_changes_destroy(ctx);
+
+  changes = c_malloc(sizeof(struct csync_remote_changes_s));
+  if (changes == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return -1;
+  }
+  if (c_hashtable_create(&changes->by_path) < 0
+      || c_hashtable_create(&changes->dirs) < 0) {
+    c_hashtable_free(changes->by_path);
+    SAFE_FREE(changes);
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return -1;
+  }
+  ctx->remote.changes = changes;
+
+  return 0;
+}
+
+int csync_remote_changes_add(CSYNC *ctx, const char *path, csync_vio_file_stat_t *fs) {
+  struct csync_remote_changes_s *changes;
+  csync_remote_change_t *change;
+  csync_remote_change_dir_t *parent;
+  const char *name;
+  size_t len;
+  uint64_t h;
+
+  if (ctx == NULL || path == NULL || ctx->remote.changes == NULL) {
+    csync_vio_file_stat_destroy(fs);
+    errno = EINVAL;
+    return -1;
+  }
+  changes = ctx->remote.changes;
+
+  len = strlen(path);
+  if (len == 0) {
+    /* the root is never part of a listing */
+    csync_vio_file_stat_destroy(fs);
+    return 0;
+  }
+  name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+
+  if (fs) {
+    /* the entry of a listing is named like the file, not like its path */
+    SAFE_FREE(fs->name);
+    fs->name = c_strdup(name);
+  }
+
+  h = _csync_remote_changes_hash(path, len);
+  change = c_hashtable_find(changes->by_path, h);
+  if (change) {
+    /* reported again, the last report wins */
+    csync_vio_file_stat_destroy(change->fs);
+    change->fs = fs;
+    return 0;
+  }
+
+  change = c_malloc(sizeof(csync_remote_change_t));
+  if (change == NULL) {
+    csync_vio_file_stat_destroy(fs);
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return -1;
+  }
+  change->path = c_strdup(path);
+  change->fs = fs;
+  parent = _csync_remote_changes_dir(changes, path, name == path ? 0 : (size_t) (name - path - 1));
+  if (change->path == NULL || parent == NULL
+      || c_hashtable_insert(changes->by_path, h, change) < 0) {
+    _csync_remote_change_destroy(change);
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return -1;
+  }
+  change->next_sibling = parent->children;
+  parent->children = change;
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Remote change: %s%s", path, fs ? "" : " (removed)");
+  return 0;
+}
+
+void csync_remote_changes_destroy(CSYNC *ctx) {
+  struct csync_remote_changes_s *changes;
+
+  if (ctx == NULL || ctx->remote.changes == NULL) {
+    return;
+  }
+  changes = ctx->remote.changes;
+
+  c_hashtable_destroy(changes->by_path, _csync_remote_change_destroy);
+  c_hashtable_destroy(changes->dirs, _csync_remote_change_dir_destroy);
+  SAFE_FREE(changes);
+  ctx->remote.changes = NULL;
+}
+
+bool csync_remote_changes_below(CSYNC *ctx, const char *path) {
+  if (ctx == NULL || path == NULL || ctx->remote.changes == NULL) {
+    return false;
+  }
+  return c_hashtable_find(ctx->remote.changes->dirs,
+                          _csync_remote_changes_hash(path, strlen(path))) != NULL;
+}
+
+static int _csync_remote_changes_listing_append(csync_remote_changes_listing_t *listing,
+                                                csync_vio_file_stat_t *fs) {
+  if (listing->count == listing->allocated) {
+    size_t allocated = listing->allocated ? 2 * listing->allocated : 16;
+    csync_vio_file_stat_t **entries = c_realloc(listing->entries, allocated * sizeof(csync_vio_file_stat_t *));
+    if (entries == NULL) {
+      csync_vio_file_stat_destroy(fs);
+      return -1;
+    }
+    listing->entries = entries;
+    listing->allocated = allocated;
+  }
+  listing->entries[listing->count++] = fs;
+  return 0;
+}
+
+/* csync_statedb_get_children() visitor: keeps the entries the server did
+ * not report */
+static int _csync_remote_changes_visit_db_child(const char *path, csync_vio_file_stat_t *fs, void *data) {
+  csync_remote_changes_listing_t *listing = data;
+
+  if (c_hashtable_find(listing->changes->by_path, _csync_remote_changes_hash(path, strlen(path)))) {
+    csync_vio_file_stat_destroy(fs);
+    return 0;
+  }
+  return _csync_remote_changes_listing_append(listing, fs);
+}
+
+csync_vio_handle_t *csync_remote_changes_opendir(CSYNC *ctx, const char *path) {
+  csync_remote_changes_listing_t *listing;
+  csync_remote_change_dir_t *dir;
+  csync_remote_change_t *change;
+  size_t db_count;
+
+  if (ctx == NULL || path == NULL || ctx->remote.changes == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  listing = c_malloc(sizeof(csync_remote_changes_listing_t));
+  if (listing == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  ZERO_STRUCTP(listing);
+  listing->changes = ctx->remote.changes;
+
+  if (csync_statedb_get_children(ctx, path, _csync_remote_changes_visit_db_child, listing) < 0) {
+    csync_remote_changes_closedir(ctx, listing);
+    errno = EIO;
+    return NULL;
+  }
+  db_count = listing->count;
+
+  dir = c_hashtable_find(ctx->remote.changes->dirs, _csync_remote_changes_hash(path, strlen(path)));
+  for (change = dir ? dir->children : NULL; change; change = change->next_sibling) {
+    csync_vio_file_stat_t *fs;
+
+    if (change->fs == NULL) {
+      continue;
+    }
+    fs = csync_vio_file_stat_copy(change->fs);
+    if (fs == NULL || _csync_remote_changes_listing_append(listing, fs) < 0) {
+      csync_remote_changes_closedir(ctx, listing);
+      errno = ENOMEM;
+      return NULL;
+    }
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Listing of %s: %zu entries from the db, %zu changed",
+            path, db_count, listing->count - db_count);
+  return listing;
+}
+
+csync_vio_file_stat_t *csync_remote_changes_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
+  csync_remote_changes_listing_t *listing = dhandle;
+  csync_vio_file_stat_t *fs;
+
+  (void) ctx;
+
+  if (listing == NULL || listing->pos == listing->count) {
+    return NULL;
+  }
+  /* the caller owns what it read */
+  fs = listing->entries[listing->pos];
+  listing->entries[listing->pos++] = NULL;
+  return fs;
+}
+
+void csync_remote_changes_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
+  csync_remote_changes_listing_t *listing = dhandle;
+  size_t i;
+
+  (void) ctx;
+
+  if (listing == NULL) {
+    return;
+  }
+  for (i = listing->pos; i < listing->count; i++) {
+    csync_vio_file_stat_destroy(listing->entries[i]);
+  }
+  SAFE_FREE(listing->entries);
+  SAFE_FREE(listing);
+}
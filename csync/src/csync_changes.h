@@ -0,0 +1,69 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016 by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _CSYNC_CHANGES_H
+#define _CSYNC_CHANGES_H
+
+#include "csync_private.h"
+
+/**
+ * @file csync_changes.h
+ *
+ * @brief The remote changes reported by the server since the last sync
+ *
+ * See csync_remote_changes_init(). While a change set is recorded, the
+ * remote update walks listings made up from the statedb snapshot and the
+ * changes instead of asking the vio hooks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Whether a change was recorded at or below a path.
+ *
+ * @param ctx   The csync context.
+ * @param path  The path relative to the sync root.
+ *
+ * @return true if the directory at path has to be listed.
+ */
+bool csync_remote_changes_below(CSYNC *ctx, const char *path);
+
+/**
+ * @brief Open the listing of a remote directory made up from the changes.
+ *
+ * The listing is the entries of the directory in the statedb snapshot,
+ * without the ones that changed or were removed, followed by the changed
+ * entries that are still there.
+ *
+ * @param ctx   The csync context.
+ * @param path  The path of the directory relative to the sync root.
+ *
+ * @return The handle, NULL with errno set on error.
+ */
+csync_vio_handle_t *csync_remote_changes_opendir(CSYNC *ctx, const char *path);
+
+csync_vio_file_stat_t *csync_remote_changes_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle);
+
+void csync_remote_changes_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle);
+
+/**
+ * }@
+ */
+#endif /* _CSYNC_CHANGES_H */
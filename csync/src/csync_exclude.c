@@ -117,19 +117,347 @@ out:
   return rc;
 }
 
+/*
+ * The compiled exclude list.
+ *
+ * Every pattern becomes an entry, in list order: when several patterns match
+ * a path the earliest one decides the exclude type, like it did when the
+ * list was walked pattern by pattern. Patterns without wildcards, '*suffix'
+ * and 'prefix*' patterns are found through hash tables, only the remaining
+ * globs go through csync_fnmatch.
+ */
+enum _csync_exclude_kind_e {
+  EXCLUDE_LITERAL, /* 'name' */
+  EXCLUDE_SUFFIX,  /* '*suffix' */
+  EXCLUDE_PREFIX,  /* 'prefix*' */
+  EXCLUDE_GLOB
+};
+
+struct _csync_exclude_entry_s {
+  enum _csync_exclude_kind_e kind;
+  char *pattern;      /* without the leading ']' and the trailing '/' */
+  const char *key;    /* the literal part used for the hash tables */
+  size_t key_len;
+  char *needle;       /* a literal run every match of a glob contains, or NULL */
+  bool remove;        /* ']' prefix: remove files if they block a directory */
+  bool dirs_only;     /* '/' suffix */
+};
+
+struct _csync_exclude_table_s {
+  size_t *slots;      /* entry index + 1, 0 marks an empty slot */
+  size_t mask;
+  size_t *lengths;    /* the distinct key lengths in the table */
+  size_t lengths_count;
+};
+
+struct csync_exclude_matcher_s {
+  struct _csync_exclude_entry_s *entries;
+  size_t count;
+
+  struct _csync_exclude_table_s literals;
+  struct _csync_exclude_table_s suffixes;
+  struct _csync_exclude_table_s prefixes;
+  size_t *globs;      /* entry indexes, ascending */
+  size_t globs_count;
+  size_t *full_paths; /* entries with a '/', also matched against the whole path */
+  size_t full_paths_count;
+
+  char *conflict_pattern;
+
+  /* the list this was compiled from, see csync_exclude_compile() */
+  const c_strlist_t *source;
+  size_t source_count;
+};
+
+#ifdef _WIN32
+/* PathMatchSpec, used by csync_fnmatch on Windows, ignores the case */
+#define EXCLUDE_FOLD(c) ((c) >= 'A' && (c) <= 'Z' ? (c) - 'A' + 'a' : (c))
+#else
+#define EXCLUDE_FOLD(c) (c)
+#endif
+
+static uint32_t _csync_exclude_hash(const char *key, size_t len) {
+  uint32_t h = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) EXCLUDE_FOLD(key[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static bool _csync_exclude_key_equal(const char *a, const char *b, size_t len) {
+#ifdef _WIN32
+  return c_strncasecmp(a, b, len) == 0;
+#else
+  return memcmp(a, b, len) == 0;
+#endif
+}
+
+static bool _csync_exclude_is_special(char c) {
+  switch (c) {
+  case '*':
+  case '?':
+  case '[':
+  case '\\':
+#ifdef _WIN32
+  case ';':
+#endif
+    return true;
+  default:
+    break;
+  }
+#ifdef _WIN32
+  /* The tables only fold ASCII, leave the rest to PathMatchSpec */
+  if ((unsigned char) c >= 0x80) {
+    return true;
+  }
+#endif
+  return false;
+}
+
+static void _csync_exclude_table_init(struct _csync_exclude_table_s *table, size_t entries) {
+  size_t size = 8;
+
+  if (entries == 0) {
+    return;
+  }
+  while (size < 2 * entries) {
+    size *= 2;
+  }
+  table->slots = c_malloc(size * sizeof(size_t));
+  table->mask = size - 1;
+  table->lengths = c_malloc(entries * sizeof(size_t));
+}
+
+static void _csync_exclude_table_insert(struct _csync_exclude_table_s *table,
+                                        const struct _csync_exclude_entry_s *entry,
+                                        size_t index) {
+  size_t slot;
+  size_t i;
+
+  if (table->slots == NULL || table->lengths == NULL) {
+    return;
+  }
+
+  slot = _csync_exclude_hash(entry->key, entry->key_len) & table->mask;
+  while (table->slots[slot]) {
+    slot = (slot + 1) & table->mask;
+  }
+  table->slots[slot] = index + 1;
+
+  for (i = 0; i < table->lengths_count; i++) {
+    if (table->lengths[i] == entry->key_len) {
+      return;
+    }
+  }
+  table->lengths[table->lengths_count++] = entry->key_len;
+}
+
+static void _csync_exclude_table_destroy(struct _csync_exclude_table_s *table) {
+  SAFE_FREE(table->slots);
+  SAFE_FREE(table->lengths);
+}
+
+/* The longest run of characters without wildcards, NULL if there is none
+ * or the pattern is too complex to tell. */
+static char *_csync_exclude_needle(const char *pattern) {
+  const char *p;
+  const char *run = pattern;
+  const char *best = NULL;
+  size_t best_len = 0;
+
+#ifdef _WIN32
+  /* strstr would not ignore the case */
+  return NULL;
+#endif
+
+  if (strpbrk(pattern, "[\\")) {
+    return NULL;
+  }
+  for (p = pattern; ; p++) {
+    if (*p == '\0' || *p == '*' || *p == '?') {
+      if ((size_t) (p - run) > best_len) {
+        best = run;
+        best_len = p - run;
+      }
+      if (*p == '\0') {
+        break;
+      }
+      run = p + 1;
+    }
+  }
+  if (best_len == 0) {
+    return NULL;
+  }
+  return c_strndup(best, best_len);
+}
+
+csync_exclude_matcher_t *csync_exclude_matcher_new(c_strlist_t *excludes) {
+  csync_exclude_matcher_t *matcher;
+  size_t literals = 0;
+  size_t suffixes = 0;
+  size_t prefixes = 0;
+  size_t i;
+
+  matcher = c_malloc(sizeof(csync_exclude_matcher_t));
+  if (matcher == NULL) {
+    return NULL;
+  }
+  matcher->source = excludes;
+
+  if (getenv("CSYNC_CONFLICT_FILE_USERNAME")) {
+    if (asprintf(&matcher->conflict_pattern, "*_conflict_%s-*", getenv("CSYNC_CONFLICT_FILE_USERNAME")) < 0) {
+      matcher->conflict_pattern = NULL;
+    }
+  }
+
+  if (excludes == NULL || excludes->count == 0) {
+    return matcher;
+  }
+  matcher->source_count = excludes->count;
+
+  matcher->entries = c_malloc(excludes->count * sizeof(struct _csync_exclude_entry_s));
+  matcher->globs = c_malloc(excludes->count * sizeof(size_t));
+  matcher->full_paths = c_malloc(excludes->count * sizeof(size_t));
+  if (matcher->entries == NULL || matcher->globs == NULL || matcher->full_paths == NULL) {
+    csync_exclude_matcher_free(matcher);
+    return NULL;
+  }
+
+  for (i = 0; i < excludes->count; i++) {
+    const char *pattern = excludes->vector[i];
+    struct _csync_exclude_entry_s *entry = &matcher->entries[matcher->count];
+    size_t len;
+    size_t specials = 0;
+    size_t j;
+
+    /* Excludes starting with ']' means it can be cleanup */
+    if (pattern[0] == ']') {
+      entry->remove = true;
+      ++pattern;
+    }
+    len = strlen(pattern);
+    if (len == 0) { /* empty pattern */
+      continue;
+    }
+    /* Check if the pattern applies to pathes only. */
+    if (pattern[len - 1] == '/') {
+      entry->dirs_only = true;
+      --len;
+    }
+    entry->pattern = c_strndup(pattern, len);
+    if (entry->pattern == NULL) {
+      csync_exclude_matcher_free(matcher);
+      return NULL;
+    }
+
+    for (j = 0; j < len; j++) {
+      if (_csync_exclude_is_special(entry->pattern[j])) {
+        specials++;
+      }
+    }
+    entry->key = entry->pattern;
+    entry->key_len = len;
+    if (specials == 0) {
+      entry->kind = EXCLUDE_LITERAL;
+      literals++;
+    } else if (specials == 1 && entry->pattern[0] == '*') {
+      entry->kind = EXCLUDE_SUFFIX;
+      entry->key++;
+      entry->key_len--;
+      suffixes++;
+    } else if (specials == 1 && entry->pattern[len - 1] == '*') {
+      entry->kind = EXCLUDE_PREFIX;
+      entry->key_len--;
+      prefixes++;
+    } else {
+      entry->kind = EXCLUDE_GLOB;
+      entry->needle = _csync_exclude_needle(entry->pattern);
+      matcher->globs[matcher->globs_count++] = matcher->count;
+    }
+
+    if (strchr(entry->pattern, '/')) {
+      matcher->full_paths[matcher->full_paths_count++] = matcher->count;
+    }
+    matcher->count++;
+  }
+
+  _csync_exclude_table_init(&matcher->literals, literals);
+  _csync_exclude_table_init(&matcher->suffixes, suffixes);
+  _csync_exclude_table_init(&matcher->prefixes, prefixes);
+  for (i = 0; i < matcher->count; i++) {
+    const struct _csync_exclude_entry_s *entry = &matcher->entries[i];
+    switch (entry->kind) {
+    case EXCLUDE_LITERAL:
+      _csync_exclude_table_insert(&matcher->literals, entry, i);
+      break;
+    case EXCLUDE_SUFFIX:
+      _csync_exclude_table_insert(&matcher->suffixes, entry, i);
+      break;
+    case EXCLUDE_PREFIX:
+      _csync_exclude_table_insert(&matcher->prefixes, entry, i);
+      break;
+    case EXCLUDE_GLOB:
+      break;
+    }
+  }
+
+  return matcher;
+}
+
+void csync_exclude_matcher_free(csync_exclude_matcher_t *matcher) {
+  size_t i;
+
+  if (matcher == NULL) {
+    return;
+  }
+  for (i = 0; i < matcher->count; i++) {
+    SAFE_FREE(matcher->entries[i].pattern);
+    SAFE_FREE(matcher->entries[i].needle);
+  }
+  SAFE_FREE(matcher->entries);
+  _csync_exclude_table_destroy(&matcher->literals);
+  _csync_exclude_table_destroy(&matcher->suffixes);
+  _csync_exclude_table_destroy(&matcher->prefixes);
+  SAFE_FREE(matcher->globs);
+  SAFE_FREE(matcher->full_paths);
+  SAFE_FREE(matcher->conflict_pattern);
+  SAFE_FREE(matcher);
+}
+
+csync_exclude_matcher_t *csync_exclude_compile(CSYNC *ctx) {
+  size_t count = ctx->excludes ? ctx->excludes->count : 0;
+
+  if (ctx->exclude_matcher
+      && ctx->exclude_matcher->source == ctx->excludes
+      && ctx->exclude_matcher->source_count == count) {
+    return ctx->exclude_matcher;
+  }
+
+  csync_exclude_matcher_free(ctx->exclude_matcher);
+  ctx->exclude_matcher = csync_exclude_matcher_new(ctx->excludes);
+  return ctx->exclude_matcher;
+}
+
 void csync_exclude_clear(CSYNC *ctx) {
   c_strlist_clear(ctx->excludes);
+  csync_exclude_matcher_free(ctx->exclude_matcher);
+  ctx->exclude_matcher = NULL;
 }
 
 void csync_exclude_destroy(CSYNC *ctx) {
   c_strlist_destroy(ctx->excludes);
+  csync_exclude_matcher_free(ctx->exclude_matcher);
+  ctx->exclude_matcher = NULL;
 }
 
 CSYNC_EXCLUDE_TYPE csync_excluded(CSYNC *ctx, const char *path, int filetype) {
 
     CSYNC_EXCLUDE_TYPE match = CSYNC_NOT_EXCLUDED;
 
-    match = csync_excluded_no_ctx( ctx->excludes, path, filetype );
+    match = csync_excluded_no_ctx( csync_exclude_compile(ctx), path, filetype );
 
     return match;
 }
@@ -169,14 +497,84 @@ bool csync_is_windows_reserved_word(const char* filename) {
   return false;
 }
 
-static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const char *path, int filetype, bool check_leading_dirs) {
+/* Remember the entry if it is the earliest match so far. */
+static void _csync_exclude_consider(const csync_exclude_matcher_t *matcher, size_t index,
+                                    bool is_bname, int filetype, size_t *best) {
+    if (index >= *best) {
+        return;
+    }
+    /* a pattern that requires a dir never matches the name of a file */
+    if (is_bname && matcher->entries[index].dirs_only && filetype == CSYNC_FTW_TYPE_FILE) {
+        return;
+    }
+    *best = index;
+}
+
+static void _csync_exclude_table_lookup(const csync_exclude_matcher_t *matcher,
+                                        const struct _csync_exclude_table_s *table,
+                                        const char *key, size_t len,
+                                        bool is_bname, int filetype, size_t *best) {
+    size_t slot;
+
+    if (table->slots == NULL) {
+        return;
+    }
+    slot = _csync_exclude_hash(key, len) & table->mask;
+    for (; table->slots[slot]; slot = (slot + 1) & table->mask) {
+        size_t index = table->slots[slot] - 1;
+        const struct _csync_exclude_entry_s *entry = &matcher->entries[index];
+        if (entry->key_len == len && _csync_exclude_key_equal(entry->key, key, len)) {
+            _csync_exclude_consider(matcher, index, is_bname, filetype, best);
+        }
+    }
+}
+
+/* Match one path component or leading directory, name[len] must be '\0'. */
+static void _csync_exclude_match_name(const csync_exclude_matcher_t *matcher,
+                                      const char *name, size_t len,
+                                      bool is_bname, int filetype, size_t *best) {
+    size_t i;
+
+    _csync_exclude_table_lookup(matcher, &matcher->literals, name, len, is_bname, filetype, best);
+    for (i = 0; i < matcher->suffixes.lengths_count; i++) {
+        size_t key_len = matcher->suffixes.lengths[i];
+        if (key_len <= len) {
+            _csync_exclude_table_lookup(matcher, &matcher->suffixes, name + len - key_len, key_len,
+                                        is_bname, filetype, best);
+        }
+    }
+    for (i = 0; i < matcher->prefixes.lengths_count; i++) {
+        size_t key_len = matcher->prefixes.lengths[i];
+        if (key_len <= len) {
+            _csync_exclude_table_lookup(matcher, &matcher->prefixes, name, key_len,
+                                        is_bname, filetype, best);
+        }
+    }
+
+    for (i = 0; i < matcher->globs_count && matcher->globs[i] < *best; i++) {
+        const struct _csync_exclude_entry_s *entry = &matcher->entries[matcher->globs[i]];
+        if (is_bname && entry->dirs_only && filetype == CSYNC_FTW_TYPE_FILE) {
+            continue;
+        }
+        if (entry->needle && !strstr(name, entry->needle)) {
+            continue;
+        }
+        if (csync_fnmatch(entry->pattern, name, 0) == 0) {
+            *best = matcher->globs[i];
+            break;
+        }
+    }
+}
+
+static CSYNC_EXCLUDE_TYPE _csync_excluded_common(const csync_exclude_matcher_t *matcher, const char *path, int filetype, bool check_leading_dirs) {
     size_t i = 0;
     const char *bname = NULL;
     size_t blen = 0;
-    char *conflict = NULL;
+    size_t best = 0;
     int rc = -1;
+    const char *conflict = NULL;
+    char *own_conflict = NULL;
     CSYNC_EXCLUDE_TYPE match = CSYNC_NOT_EXCLUDED;
-    CSYNC_EXCLUDE_TYPE type  = CSYNC_NOT_EXCLUDED;
 
     /* split up the path */
     bname = strrchr(path, '/');
@@ -248,30 +646,66 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const ch
         goto out;
     }
 
-    if (getenv("CSYNC_CONFLICT_FILE_USERNAME")) {
-        rc = asprintf(&conflict, "*_conflict_%s-*", getenv("CSYNC_CONFLICT_FILE_USERNAME"));
-        if (rc < 0) {
+    /* The matcher has the pattern for the conflict files of this user built
+     * already, without one it is built for this call only. */
+    if (matcher) {
+        conflict = matcher->conflict_pattern;
+    } else if (getenv("CSYNC_CONFLICT_FILE_USERNAME")) {
+        if (asprintf(&own_conflict, "*_conflict_%s-*", getenv("CSYNC_CONFLICT_FILE_USERNAME")) < 0) {
             goto out;
         }
+        conflict = own_conflict;
+    }
+    if (conflict) {
         rc = csync_fnmatch(conflict, path, 0);
+        SAFE_FREE(own_conflict);
         if (rc == 0) {
             match = CSYNC_FILE_SILENTLY_EXCLUDED;
-            SAFE_FREE(conflict);
             goto out;
         }
-        SAFE_FREE(conflict);
     }
 
-    if( ! excludes ) {
+    if( ! matcher ) {
         goto out;
     }
 
-    c_strlist_t *path_components = NULL;
+    if (matcher->count == 0) {
+        goto out;
+    }
+    best = matcher->count; /* no match */
+
+    /* patterns containing a / are compared to the whole path */
+    for (i = 0; i < matcher->full_paths_count; i++) {
+        const struct _csync_exclude_entry_s *entry = &matcher->entries[matcher->full_paths[i]];
+        /* if the pattern requires a dir, but path is not, its still not excluded. */
+        if (entry->dirs_only && filetype != CSYNC_FTW_TYPE_DIR) {
+            continue;
+        }
+        if (csync_fnmatch(entry->pattern, path, FNM_PATHNAME) == 0) {
+            best = matcher->full_paths[i];
+            break;
+        }
+    }
+
     if (check_leading_dirs) {
-        /* Build a list of path components to check. */
-        path_components = c_strlist_new(32);
-        char *path_split = strdup(path);
-        size_t len = strlen(path_split);
+        /* Check each component and leading directory of the path. Work on a
+         * copy so it can be cut off at the separators, on the stack unless
+         * the path is unusually long. */
+        char stack_buf[1024];
+        char *path_split = stack_buf;
+        size_t len = strlen(path);
+        size_t end = len;
+        size_t j = 0;
+
+        if (len >= sizeof(stack_buf)) {
+            path_split = c_strdup(path);
+            if (path_split == NULL) {
+                goto out;
+            }
+        } else {
+            memcpy(path_split, path, len + 1);
+        }
+
         for (i = len; ; --i) {
             // read backwards until a path separator is found
             if (i != 0 && path_split[i-1] != '/') {
@@ -280,7 +714,8 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const ch
 
             // check 'basename', i.e. for "/foo/bar/fi" we'd check 'fi', 'bar', 'foo'
             if (path_split[i] != 0) {
-                c_strlist_add_grow(&path_components, path_split + i);
+                _csync_exclude_match_name(matcher, path_split + i, end - i, j == 0, filetype, &best);
+                j++;
             }
 
             if (i == 0) {
@@ -289,84 +724,34 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const ch
 
             // check 'dirname', i.e. for "/foo/bar/fi" we'd check '/foo/bar', '/foo'
             path_split[i-1] = '\0';
-            c_strlist_add_grow(&path_components, path_split);
-        }
-        SAFE_FREE(path_split);
-    }
-
-    /* Loop over all exclude patterns and evaluate the given path */
-    for (i = 0; match == CSYNC_NOT_EXCLUDED && i < excludes->count; i++) {
-        bool match_dirs_only = false;
-        char *pattern = excludes->vector[i];
-
-        type = CSYNC_FILE_EXCLUDE_LIST;
-        if (!pattern[0]) { /* empty pattern */
-            continue;
-        }
-        /* Excludes starting with ']' means it can be cleanup */
-        if (pattern[0] == ']') {
-            ++pattern;
-            if (filetype == CSYNC_FTW_TYPE_FILE) {
-                type = CSYNC_FILE_EXCLUDE_AND_REMOVE;
-            }
-        }
-        /* Check if the pattern applies to pathes only. */
-        if (pattern[strlen(pattern)-1] == '/') {
-            if (!check_leading_dirs && filetype == CSYNC_FTW_TYPE_FILE) {
-                continue;
-            }
-            match_dirs_only = true;
-            pattern[strlen(pattern)-1] = '\0'; /* Cut off the slash */
+            end = i - 1;
+            _csync_exclude_match_name(matcher, path_split, end, j == 0, filetype, &best);
+            j++;
         }
 
-        /* check if the pattern contains a / and if, compare to the whole path */
-        if (strchr(pattern, '/')) {
-            rc = csync_fnmatch(pattern, path, FNM_PATHNAME);
-            if( rc == 0 ) {
-                match = type;
-            }
-            /* if the pattern requires a dir, but path is not, its still not excluded. */
-            if (match_dirs_only && filetype != CSYNC_FTW_TYPE_DIR) {
-                match = CSYNC_NOT_EXCLUDED;
-            }
+        if (path_split != stack_buf) {
+            SAFE_FREE(path_split);
         }
+    } else {
+        _csync_exclude_match_name(matcher, bname, blen, true, filetype, &best);
+    }
 
-        /* if still not excluded, check each component and leading directory of the path */
-        if (match == CSYNC_NOT_EXCLUDED && check_leading_dirs) {
-            size_t j = 0;
-            if (match_dirs_only && filetype == CSYNC_FTW_TYPE_FILE) {
-                j = 1; // skip the first entry, which is bname
-            }
-            for (; j < path_components->count; ++j) {
-                rc = csync_fnmatch(pattern, path_components->vector[j], 0);
-                if (rc == 0) {
-                    match = type;
-                    break;
-                }
-            }
-        } else if (match == CSYNC_NOT_EXCLUDED && !check_leading_dirs) {
-            rc = csync_fnmatch(pattern, bname, 0);
-            if (rc == 0) {
-                match = type;
-            }
-        }
-        if (match_dirs_only) {
-            /* restore the '/' */
-            pattern[strlen(pattern)] = '/';
+    if (best < matcher->count) {
+        match = CSYNC_FILE_EXCLUDE_LIST;
+        if (matcher->entries[best].remove && filetype == CSYNC_FTW_TYPE_FILE) {
+            match = CSYNC_FILE_EXCLUDE_AND_REMOVE;
         }
     }
-    c_strlist_destroy(path_components);
 
   out:
 
     return match;
 }
 
-CSYNC_EXCLUDE_TYPE csync_excluded_traversal(c_strlist_t *excludes, const char *path, int filetype) {
-  return _csync_excluded_common(excludes, path, filetype, false);
+CSYNC_EXCLUDE_TYPE csync_excluded_traversal(const csync_exclude_matcher_t *matcher, const char *path, int filetype) {
+  return _csync_excluded_common(matcher, path, filetype, false);
 }
 
-CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx(c_strlist_t *excludes, const char *path, int filetype) {
-  return _csync_excluded_common(excludes, path, filetype, true);
+CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx(const csync_exclude_matcher_t *matcher, const char *path, int filetype) {
+  return _csync_excluded_common(matcher, path, filetype, true);
 }
-
@@ -33,6 +33,16 @@ enum csync_exclude_type_e {
 };
 typedef enum csync_exclude_type_e CSYNC_EXCLUDE_TYPE;
 
+/**
+ * An exclude list compiled for matching.
+ *
+ * Literal names, '*suffix' and 'prefix*' patterns are kept in hash tables,
+ * only the remaining globs are evaluated with fnmatch. A matcher is never
+ * modified after it was created, so it can be queried from several
+ * threads at the same time.
+ */
+typedef struct csync_exclude_matcher_s csync_exclude_matcher_t;
+
 #ifdef NDEBUG
 int _csync_exclude_add(c_strlist_t **inList, const char *string);
 #endif
@@ -47,6 +57,35 @@ int _csync_exclude_add(c_strlist_t **inList, const char *string);
  */
 int csync_exclude_load(const char *fname, c_strlist_t **list);
 
+/**
+ * @brief Compile an exclude list into a matcher.
+ *
+ * The patterns are copied, later changes to the list do not affect the
+ * matcher.
+ *
+ * @param excludes  The exclude patterns, may be NULL.
+ *
+ * @return  The matcher, free it with csync_exclude_matcher_free().
+ */
+csync_exclude_matcher_t *csync_exclude_matcher_new(c_strlist_t *excludes);
+
+/**
+ * @brief Free a matcher created by csync_exclude_matcher_new().
+ */
+void csync_exclude_matcher_free(csync_exclude_matcher_t *matcher);
+
+/**
+ * @brief Get the matcher for the exclude list of the context.
+ *
+ * Recompiles ctx->excludes if it changed since the last call. Call it once
+ * before starting the update so the walkers only read the matcher.
+ *
+ * @param ctx   The synchronizer context.
+ *
+ * @return  The compiled matcher, owned by the context.
+ */
+csync_exclude_matcher_t *csync_exclude_compile(CSYNC *ctx);
+
 /**
  * @brief Clear the exclude list in memory.
  *
@@ -88,21 +127,25 @@ CSYNC_EXCLUDE_TYPE csync_excluded(CSYNC *ctx, const char *path, int filetype);
  * That means for '/foo/bar/file' only ('/foo/bar/file', 'file') is checked
  * against the exclude patterns.
  *
- * @param ctx   The synchronizer context.
- * @param path  The patch to check.
+ * @param matcher  The compiled exclude list, may be NULL.
+ * @param path     The patch to check.
  *
  * @return  2 if excluded and needs cleanup, 1 if excluded, 0 if not.
  */
-CSYNC_EXCLUDE_TYPE csync_excluded_traversal(c_strlist_t *excludes, const char *path, int filetype);
+CSYNC_EXCLUDE_TYPE csync_excluded_traversal(const csync_exclude_matcher_t *matcher, const char *path, int filetype);
 
 /**
- * @brief csync_excluded_no_ctx
- * @param excludes
- * @param path
- * @param filetype
- * @return
+ * @brief Check if the given path should be excluded, without a context.
+ *
+ * Same as csync_excluded(), but takes the compiled matcher directly.
+ *
+ * @param matcher   The compiled exclude list, may be NULL.
+ * @param path      The path to check.
+ * @param filetype  The csync_ftw_type_e of the path.
+ *
+ * @return  The reason the path is excluded, CSYNC_NOT_EXCLUDED if it is not.
  */
-CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx(c_strlist_t *excludes, const char *path, int filetype);
+CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx(const csync_exclude_matcher_t *matcher, const char *path, int filetype);
 #endif /* _CSYNC_EXCLUDE_H */
 
 /**
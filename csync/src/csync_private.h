@@ -91,6 +91,11 @@ struct csync_s {
       int (*checkSelectiveSyncBlackListHook)(void*, const char*);
       int (*checkSelectiveSyncNewFolderHook)(void*, const char*);
 
+      /* hook for the partial local discovery (uses the update_callback_userdata).
+       * Returns non-zero if the local directory, or anything below it, changed since
+       * the last sync. If it is not set, the whole local tree is read from disk. */
+      int (*checkLocalDirectoryChangedHook)(void*, const char*);
+
 
       csync_vio_opendir_hook remote_opendir_hook;
       csync_vio_readdir_hook remote_readdir_hook;
@@ -101,8 +106,15 @@ struct csync_s {
       csync_checksum_hook checksum_hook;
       void *checksum_userdata;
 
+      /* hook for reconciling independent subtrees at the same time. If it is
+       * not set, the subtrees are reconciled one after the other. */
+      csync_parallel_for_hook parallel_for_hook;
+      void *parallel_for_userdata;
+
   } callbacks;
   c_strlist_t *excludes;
+  /* compiled from excludes by csync_exclude_compile() */
+  struct csync_exclude_matcher_s *exclude_matcher;
 
   // needed for SSL client certificate support
   struct csync_client_certs_s *clientCerts;
@@ -117,22 +129,31 @@ struct csync_s {
     sqlite3_stmt* by_inode_stmt;
 
     int lastReturnValue;
+
+    /* the metadata table, loaded once per sync by csync_statedb_load_snapshot() */
+    struct csync_statedb_snapshot_s *snapshot;
   } statedb;
 
   struct {
     char *uri;
-    c_rbtree_t *tree;
+    c_hashtable_t *tree;
     enum csync_replica_e type;
+    int  read_from_db;
   } local;
 
   struct {
     char *uri;
-    c_rbtree_t *tree;
+    c_hashtable_t *tree;
     enum csync_replica_e type;
     int  read_from_db;
     const char *root_perms; /* Permission of the root folder. (Since the root folder is not in the db tree, we need to keep a separate entry.) */
+    /* the changes reported since the last sync, see csync_remote_changes_init() */
+    struct csync_remote_changes_s *changes;
   } remote;
 
+  /* the file stats of both trees and their strings, released at once in _csync_clean_ctx */
+  c_arena_t *arena;
+
 
 #if defined(HAVE_ICONV) && defined(WITH_ICONV)
   struct {
@@ -159,6 +180,13 @@ struct csync_s {
   volatile int abort;
   void *rename_info;
 
+  /* The copy of the context csync_update_local() walks on, from
+   * csync_update_start() until csync_update_finish() */
+  CSYNC *local_walk;
+
+  /* For a walk context, the context the update runs on */
+  CSYNC *parent;
+
   /**
    * Specify if it is allowed to read the remote tree from the DB (default to enabled)
    */
@@ -189,6 +217,7 @@ struct csync_file_stat_s {
   unsigned int should_update_metadata : 1; /*specify that the etag, or the remote perm or fileid has
                                 changed and need to be updated on the db even for INSTRUCTION_NONE */
   unsigned int has_ignored_files      : 1; /* specify that a directory, or child directory contains ignored files */
+  unsigned int local_from_db          : 1; /* local entry that was read from the db instead of the file system */
 
   char *destpath;   /* for renames */
   const char *etag;
@@ -215,6 +244,13 @@ __attribute__ ((packed))
 
 void csync_file_stat_free(csync_file_stat_t *st);
 
+/* Allocate a file stat with room for a path of pathlen bytes for the trees
+ * of ctx. It lives until the trees are destroyed, never free it. */
+csync_file_stat_t *csync_file_stat_new(CSYNC *ctx, size_t pathlen);
+
+/* Copy a file stat and its strings for the trees of ctx. */
+csync_file_stat_t *csync_file_stat_dup(CSYNC *ctx, const csync_file_stat_t *st);
+
 /*
  * context for the treewalk function
  */
@@ -20,11 +20,17 @@
 
 #include "config_csync.h"
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "csync_private.h"
 #include "csync_reconcile.h"
 #include "csync_util.h"
 #include "csync_statedb.h"
 #include "csync_rename.h"
+#include "csync_update.h"
+#include "csync_exclude.h"
 #include "c_jhash.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.reconciler"
@@ -32,11 +38,43 @@
 
 #include "inttypes.h"
 
-/* Check if a file is ignored because one parent is ignored.
- * return the node of the ignored directoy if it's the case, or NULL if it is not ignored */
-static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, const char *path, int pathlen) {
+/* The number of jobs the entries are split into when the reconcile runs in
+ * parallel. More jobs than threads, so a large subtree does not leave the
+ * other threads idle at the end. */
+#define CSYNC_RECONCILE_JOBS 64
+
+/* State of one job of a csync_reconcile_updates() pass */
+typedef struct {
+    CSYNC *ctx;
+    /* hash of a directory -> the stat of its nearest ancestor (or itself)
+     * that is in the opposite tree, or _no_ancestor */
+    c_hashtable_t *ancestors;
+
+    /* the entries to merge, whole top-level subtrees */
+    csync_file_stat_t **items;
+    size_t count;
+
+    /* set while the jobs run at the same time. Entries whose merge touches
+     * another subtree or the statedb are collected in deferred instead. */
+    bool parallel;
+    csync_file_stat_t **deferred;
+    size_t deferred_count;
+    size_t deferred_size;
+
+    int rc;
+} csync_reconcile_t;
+
+static char _no_ancestor;
+
+/* The stat of the nearest parent of path in tree, or NULL if there is none.
+ * The trees do not change shape during the reconcile, so the answers are
+ * remembered for every directory on the way up and the files of a new
+ * directory only hash their parent. */
+static csync_file_stat_t *_csync_nearest_ancestor(c_hashtable_t *tree, c_hashtable_t *ancestors,
+                                                  const char *path, int pathlen) {
     uint64_t h = 0;
-    c_rbnode_t *node = NULL;
+    csync_file_stat_t *n = NULL;
+    void *known = NULL;
 
     /* compute the size of the parent directory */
     int parentlen = pathlen - 1;
@@ -48,20 +86,57 @@ static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, const char *path, int
     }
 
     h = c_jhash64((uint8_t *) path, parentlen, 0);
-    node = c_rbtree_find(tree, &h);
-    if (node) {
-        csync_file_stat_t *n = (csync_file_stat_t*)node->data;
-        if (n->instruction == CSYNC_INSTRUCTION_IGNORE) {
-            /* Yes, we are ignored */
-            return node;
-        } else {
-            /* Not ignored */
-            return NULL;
+    known = c_hashtable_find(ancestors, h);
+    if (known) {
+        return known == &_no_ancestor ? NULL : known;
+    }
+
+    n = c_hashtable_find(tree, h);
+    if (!n) {
+        n = _csync_nearest_ancestor(tree, ancestors, path, parentlen);
+    }
+    c_hashtable_insert(ancestors, h, n ? (void *) n : (void *) &_no_ancestor);
+    return n;
+}
+
+/* Check if a file is ignored because one parent is ignored.
+ * return the stat of the ignored directoy if it's the case, or NULL if it is not ignored */
+static csync_file_stat_t *_csync_check_ignored(c_hashtable_t *tree, c_hashtable_t *ancestors,
+                                               const char *path, int pathlen) {
+    csync_file_stat_t *n = _csync_nearest_ancestor(tree, ancestors, path, pathlen);
+
+    if (n && n->instruction == CSYNC_INSTRUCTION_IGNORE) {
+        /* Yes, we are ignored */
+        return n;
+    }
+    return NULL;
+}
+
+/* Leave cur for the serial pass after the parallel jobs */
+static int _csync_reconcile_defer(csync_reconcile_t *reconcile, csync_file_stat_t *cur) {
+    if (reconcile->deferred_count == reconcile->deferred_size) {
+        size_t size = reconcile->deferred_size ? 2 * reconcile->deferred_size : 16;
+        csync_file_stat_t **deferred = c_realloc(reconcile->deferred, size * sizeof(csync_file_stat_t *));
+        if (deferred == NULL) {
+            errno = ENOMEM;
+            return -1;
         }
-    } else {
-        /* Try if the parent itself is ignored */
-        return _csync_check_ignored(tree, path, parentlen);
+        reconcile->deferred = deferred;
+        reconcile->deferred_size = size;
     }
+    reconcile->deferred[reconcile->deferred_count++] = cur;
+    return 0;
+}
+
+/* The length of the top-level directory of path, or of path itself */
+static size_t _csync_toplevel_len(const char *path) {
+    const char *slash = strchr(path, '/');
+    return slash ? (size_t) (slash - path) : strlen(path);
+}
+
+static bool _csync_same_toplevel(const char *a, const char *b) {
+    size_t len = _csync_toplevel_len(a);
+    return len == _csync_toplevel_len(b) && strncmp(a, b, len) == 0;
 }
 
 /*
@@ -84,12 +159,11 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
     uint64_t h = 0;
     int len = 0;
 
-    CSYNC *ctx = NULL;
-    c_rbtree_t *tree = NULL;
-    c_rbnode_t *node = NULL;
+    csync_reconcile_t *reconcile = (csync_reconcile_t *) data;
+    CSYNC *ctx = reconcile->ctx;
+    c_hashtable_t *tree = NULL;
 
     cur = (csync_file_stat_t *) obj;
-    ctx = (CSYNC *) data;
 
     /* we need the opposite tree! */
     switch (ctx->current) {
@@ -103,26 +177,31 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
         break;
     }
 
-    node = c_rbtree_find(tree, &cur->phash);
+    other = c_hashtable_find(tree, cur->phash);
 
-    if (!node) {
+    if (!other) {
         /* Check the renamed path as well. */
         char *renamed_path = csync_rename_adjust_path(ctx, cur->path);
         if (!c_streq(renamed_path, cur->path)) {
             len = strlen( renamed_path );
             h = c_jhash64((uint8_t *) renamed_path, len, 0);
-            node = c_rbtree_find(tree, &h);
+            other = c_hashtable_find(tree, h);
+            if (other && reconcile->parallel && !_csync_same_toplevel(cur->path, renamed_path)) {
+                /* other belongs to the job of another subtree */
+                SAFE_FREE(renamed_path);
+                return _csync_reconcile_defer(reconcile, cur);
+            }
         }
         SAFE_FREE(renamed_path);
     }
-    if (!node) {
+    if (!other) {
         /* Check if it is ignored */
-        node = _csync_check_ignored(tree, cur->path, cur->pathlen);
+        other = _csync_check_ignored(tree, reconcile->ancestors, cur->path, cur->pathlen);
         /* If it is ignored, other->instruction will be  IGNORE so this one will also be ignored */
     }
 
     /* file only found on current replica */
-    if (node == NULL) {
+    if (other == NULL) {
         switch(cur->instruction) {
         /* file has been modified */
         case CSYNC_INSTRUCTION_EVAL:
@@ -134,6 +213,12 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
                 /* Do not remove a directory that has ignored files */
                 break;
             }
+            if (cur->local_from_db && cur->type == CSYNC_FTW_TYPE_DIR
+                    && csync_local_dir_has_ignored_files(ctx, cur->path)) {
+                /* The contents were read from the db, which does not know about ignored files */
+                cur->has_ignored_files = true;
+                break;
+            }
             if (cur->child_modified) {
                 /* re-create directory that has modified contents */
                 cur->instruction = CSYNC_INSTRUCTION_NEW;
@@ -142,6 +227,11 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
             cur->instruction = CSYNC_INSTRUCTION_REMOVE;
             break;
         case CSYNC_INSTRUCTION_EVAL_RENAME:
+            if (reconcile->parallel) {
+                /* the origin can be in any subtree, and the statedb and the
+                 * arena can only be used by one thread */
+                return _csync_reconcile_defer(reconcile, cur);
+            }
             if(ctx->current == LOCAL_REPLICA ) {
                 /* use the old name to find the "other" node */
                 tmp = csync_statedb_get_stat_by_inode(ctx, cur->inode);
@@ -160,17 +250,14 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
                 if( len > 0 ) {
                     h = c_jhash64((uint8_t *) tmp->path, len, 0);
                     /* First, check that the file is NOT in our tree (another file with the same name was added) */
-                    node = c_rbtree_find(ctx->current == REMOTE_REPLICA ? ctx->remote.tree : ctx->local.tree, &h);
-                    if (node) {
+                    if (c_hashtable_find(ctx->current == REMOTE_REPLICA ? ctx->remote.tree : ctx->local.tree, h)) {
                         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Origin found in our tree : %s", tmp->path);
                     } else {
                         /* Find the temporar file in the other tree. */
-                        node = c_rbtree_find(tree, &h);
+                        other = c_hashtable_find(tree, h);
                         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "PHash of temporary opposite (%s): %" PRIu64 " %s",
-                                tmp->path , h, node ? "found": "not found" );
-                        if (node) {
-                            other = (csync_file_stat_t*)node->data;
-                        } else {
+                                tmp->path , h, other ? "found": "not found" );
+                        if (!other) {
                             /* the renamed file could not be found in the opposite tree. That is because it
                             * is not longer existing there, maybe because it was renamed or deleted.
                             * The journal is cleaned up later after propagation.
@@ -190,7 +277,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
                 } else if (other->instruction == CSYNC_INSTRUCTION_NONE
                            || cur->type == CSYNC_FTW_TYPE_DIR) {
                     other->instruction = CSYNC_INSTRUCTION_RENAME;
-                    other->destpath = c_strdup( cur->path );
+                    other->destpath = c_arena_strdup(ctx->arena, cur->path);
                     if( !c_streq(cur->file_id, "") ) {
                         csync_vio_set_file_id( other->file_id, cur->file_id );
                     }
@@ -199,7 +286,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
                     cur->instruction = CSYNC_INSTRUCTION_NONE;
                 } else if (other->instruction == CSYNC_INSTRUCTION_REMOVE) {
                     other->instruction = CSYNC_INSTRUCTION_RENAME;
-                    other->destpath = c_strdup( cur->path );
+                    other->destpath = c_arena_strdup(ctx->arena, cur->path);
 
                     if( !c_streq(cur->file_id, "") ) {
                         csync_vio_set_file_id( other->file_id, cur->file_id );
@@ -226,8 +313,6 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
         /*
      * file found on the other replica
      */
-        other = (csync_file_stat_t *) node->data;
-
         switch (cur->instruction) {
         case CSYNC_INSTRUCTION_EVAL_RENAME:
             /* If the file already exist on the other side, we have a conflict.
@@ -341,9 +426,101 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
     return 0;
 }
 
+static int _csync_reconcile_collect_visitor(void *obj, void *data) {
+    csync_reconcile_t *all = (csync_reconcile_t *) data;
+
+    all->items[all->count++] = (csync_file_stat_t *) obj;
+    return 0;
+}
+
+static void _csync_reconcile_job(void *data, int index) {
+    csync_reconcile_t *job = (csync_reconcile_t *) data + index;
+    size_t i;
+
+    for (i = 0; i < job->count && job->rc >= 0; i++) {
+        job->rc = _csync_merge_algorithm_visitor(job->items[i], job);
+    }
+}
+
+static int _csync_reconcile_phash_cmp(const void *a, const void *b) {
+    uint64_t ha = (*(csync_file_stat_t * const *) a)->phash;
+    uint64_t hb = (*(csync_file_stat_t * const *) b)->phash;
+
+    return ha < hb ? -1 : ha > hb;
+}
+
+/* Order the entries by top-level subtree and cut them into at most
+ * CSYNC_RECONCILE_JOBS jobs of about the same size, without splitting a
+ * subtree. Returns the number of jobs, or -1 on error. */
+static int _csync_reconcile_split(csync_reconcile_t *all, csync_reconcile_t *jobs,
+                                  csync_file_stat_t **sorted) {
+    c_hashtable_t *subtrees = NULL;
+    size_t *subtree_of = NULL;
+    size_t *offsets = NULL;
+    size_t subtree_count = 0;
+    size_t target = all->count / CSYNC_RECONCILE_JOBS + 1;
+    size_t begin = 0;
+    size_t i;
+    int job_count = 0;
+    int rc = -1;
+
+    subtree_of = c_malloc(all->count * sizeof(size_t));
+    offsets = c_malloc((all->count + 1) * sizeof(size_t));
+    if (subtree_of == NULL || offsets == NULL || c_hashtable_create(&subtrees) < 0) {
+        errno = ENOMEM;
+        goto out;
+    }
+
+    /* number the subtrees, the table stores the number plus one */
+    for (i = 0; i < all->count; i++) {
+        const char *path = all->items[i]->path;
+        uint64_t h = c_jhash64((uint8_t *) path, _csync_toplevel_len(path), 0);
+        uintptr_t n = (uintptr_t) c_hashtable_find(subtrees, h);
+
+        if (n == 0) {
+            n = ++subtree_count;
+            if (c_hashtable_insert(subtrees, h, (void *) n) < 0) {
+                goto out;
+            }
+        }
+        subtree_of[i] = n - 1;
+        offsets[n]++;
+    }
+
+    /* counting sort by subtree, the entries of a subtree stay in key order */
+    for (i = 1; i <= subtree_count; i++) {
+        offsets[i] += offsets[i - 1];
+    }
+    for (i = 0; i < all->count; i++) {
+        sorted[offsets[subtree_of[i]]++] = all->items[i];
+    }
+
+    /* offsets[s] is now the end of subtree s */
+    for (i = 0; i < subtree_count; i++) {
+        if (offsets[i] - begin >= target || i == subtree_count - 1) {
+            jobs[job_count].items = sorted + begin;
+            jobs[job_count].count = offsets[i] - begin;
+            job_count++;
+            begin = offsets[i];
+        }
+    }
+    rc = job_count;
+
+out:
+    c_hashtable_free(subtrees);
+    SAFE_FREE(subtree_of);
+    SAFE_FREE(offsets);
+    return rc;
+}
+
 int csync_reconcile_updates(CSYNC *ctx) {
-  int rc;
-  c_rbtree_t *tree = NULL;
+  int rc = -1;
+  c_hashtable_t *tree = NULL;
+  csync_reconcile_t all;
+  csync_reconcile_t *jobs = NULL;
+  csync_file_stat_t **sorted = NULL;
+  int job_count = 0;
+  int i;
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
@@ -356,10 +533,71 @@ int csync_reconcile_updates(CSYNC *ctx) {
       break;
   }
 
-  rc = c_rbtree_walk(tree, (void *) ctx, _csync_merge_algorithm_visitor);
+  ZERO_STRUCT(all);
+  all.ctx = ctx;
+  all.items = c_malloc((c_hashtable_size(tree) + 1) * sizeof(csync_file_stat_t *));
+  jobs = c_malloc(CSYNC_RECONCILE_JOBS * sizeof(csync_reconcile_t));
+  if (all.items == NULL || jobs == NULL || c_hashtable_create(&all.ancestors) < 0) {
+    errno = ENOMEM;
+    goto out;
+  }
+
+  if (c_hashtable_walk(tree, (void *) &all, _csync_reconcile_collect_visitor) < 0) {
+    goto out;
+  }
+
+  if (ctx->callbacks.parallel_for_hook && all.count > CSYNC_RECONCILE_JOBS) {
+    sorted = c_malloc(all.count * sizeof(csync_file_stat_t *));
+    if (sorted == NULL) {
+      errno = ENOMEM;
+      goto out;
+    }
+    job_count = _csync_reconcile_split(&all, jobs, sorted);
+    if (job_count < 0) {
+      goto out;
+    }
+    for (i = 0; i < job_count; i++) {
+      jobs[i].ctx = ctx;
+      jobs[i].parallel = true;
+      if (c_hashtable_create(&jobs[i].ancestors) < 0) {
+        errno = ENOMEM;
+        goto out;
+      }
+    }
+
+    /* the matcher is compiled on first use */
+    csync_exclude_compile(ctx);
+
+    ctx->callbacks.parallel_for_hook(_csync_reconcile_job, jobs, job_count,
+                                     ctx->callbacks.parallel_for_userdata);
+
+    /* the serial pass over what the jobs left, in the order of a serial walk */
+    all.count = 0;
+    for (i = 0; i < job_count; i++) {
+      if (jobs[i].rc < 0) {
+        goto out;
+      }
+      memcpy(all.items + all.count, jobs[i].deferred, jobs[i].deferred_count * sizeof(csync_file_stat_t *));
+      all.count += jobs[i].deferred_count;
+    }
+    qsort(all.items, all.count, sizeof(csync_file_stat_t *), _csync_reconcile_phash_cmp);
+  }
+
+  _csync_reconcile_job(&all, 0);
+  rc = all.rc;
+
+out:
   if( rc < 0 ) {
     ctx->status_code = CSYNC_STATUS_RECONCILE_ERROR;
   }
+  for (i = 0; i < job_count; i++) {
+    c_hashtable_free(jobs[i].ancestors);
+    SAFE_FREE(jobs[i].deferred);
+  }
+  c_hashtable_free(all.ancestors);
+  SAFE_FREE(all.items);
+  SAFE_FREE(jobs);
+  SAFE_FREE(sorted);
   return rc;
 }
 
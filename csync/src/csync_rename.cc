@@ -21,18 +21,106 @@
 extern "C" {
 #include "csync_private.h"
 }
+#include "csync_rename.h"
 
+#include <cstring>
 #include <map>
 #include <string>
 #include <vector>
-#include <algorithm>
 
-static std::string _parentDir(const std::string &path) {
-    int len = path.length();
-    while(len > 0 && path[len-1]!='/') len--;
-    while(len > 0 && path[len-1]=='/') len--;
-    return path.substr(0, len);
-}
+/* The renamed folders indexed by their path components. Adjusting a path
+ * walks down its components once, instead of building and looking up the
+ * string of every parent directory. */
+struct RenameTrie {
+    struct Node {
+        std::map<std::string, size_t> children; // component -> index in nodes
+        std::string target;
+        bool renamed;
+        Node() : renamed(false) {}
+    };
+    std::vector<Node> nodes; // nodes[0] is the root
+
+    RenameTrie() : nodes(1) {}
+
+    void insert(const char *path, const char *target) {
+        size_t node = 0;
+        std::string component;
+        for (const char *p = path; *p; ) {
+            const char *end = strchr(p, '/');
+            if (!end) {
+                end = p + strlen(p);
+            }
+            if (end != p) {
+                component.assign(p, end - p);
+                std::map<std::string, size_t>::iterator it = nodes[node].children.find(component);
+                if (it == nodes[node].children.end()) {
+                    size_t child = nodes.size();
+                    nodes.push_back(Node()); // invalidates references into nodes
+                    it = nodes[node].children.insert(std::make_pair(component, child)).first;
+                }
+                node = it->second;
+            }
+            p = *end ? end + 1 : end;
+        }
+        nodes[node].target = target;
+        nodes[node].renamed = true;
+    }
+
+    /* The path with its deepest renamed parent directory replaced,
+     * or NULL if none of its parents was renamed. */
+    char *adjust(const char *path) const {
+        const Node *match = 0;
+        const char *matchEnd = 0;
+        size_t node = 0;
+        std::string component;
+
+        if (nodes.size() == 1) {
+            return 0;
+        }
+        for (const char *p = path; ; ) {
+            const char *end = strchr(p, '/');
+            if (!end) {
+                break; // the last component is not a parent
+            }
+            if (end != p) {
+                component.assign(p, end - p);
+                std::map<std::string, size_t>::const_iterator it = nodes[node].children.find(component);
+                if (it == nodes[node].children.end()) {
+                    break;
+                }
+                node = it->second;
+                if (nodes[node].renamed) {
+                    match = &nodes[node];
+                    matchEnd = end;
+                }
+            }
+            p = end + 1;
+        }
+        if (!match) {
+            return 0;
+        }
+        std::string rep = match->target + matchEnd;
+        return c_strdup(rep.c_str());
+    }
+
+    /* Calls f(from, to) for every recorded rename below node */
+    template <typename F>
+    void forEach(size_t node, std::string &path, F f) const {
+        if (nodes[node].renamed) {
+            f(path, nodes[node].target);
+        }
+        for (std::map<std::string, size_t>::const_iterator it = nodes[node].children.begin();
+                it != nodes[node].children.end(); ++it) {
+            size_t len = path.length();
+            if (len) {
+                path += '/';
+            }
+            path += it->first;
+            forEach(it->second, path, f);
+            path.resize(len);
+        }
+    }
+};
 
 struct csync_rename_s {
     static csync_rename_s *get(CSYNC *ctx) {
@@ -42,16 +130,15 @@ struct csync_rename_s {
         return reinterpret_cast<csync_rename_s *>(ctx->rename_info);
     }
 
-    std::map<std::string, std::string> folder_renamed_to; // map from->to
-    std::map<std::string, std::string> folder_renamed_from; // map to->from
+    RenameTrie folder_renamed_to; // from->to
+    RenameTrie folder_renamed_from; // to->from
+};
 
-    struct renameop {
-        csync_file_stat_t *st;
-        bool operator<(const renameop &other) const {
-            return strlen(st->destpath) < strlen(other.st->destpath);
-        }
-    };
-    std::vector<renameop> todo;
+struct RecordRename {
+    CSYNC *ctx;
+    void operator()(const std::string &from, const std::string &to) const {
+        csync_rename_record(ctx, from.c_str(), to.c_str());
+    }
 };
 
 extern "C" {
@@ -63,34 +150,39 @@ void csync_rename_destroy(CSYNC* ctx)
 
 void csync_rename_record(CSYNC* ctx, const char* from, const char* to)
 {
-    csync_rename_s::get(ctx)->folder_renamed_to[from] = to;
-    csync_rename_s::get(ctx)->folder_renamed_from[to] = from;
+    csync_rename_s::get(ctx)->folder_renamed_to.insert(from, to);
+    csync_rename_s::get(ctx)->folder_renamed_from.insert(to, from);
 }
 
-char* csync_rename_adjust_path(CSYNC* ctx, const char* path)
+void csync_rename_merge(CSYNC *ctx, CSYNC *other)
 {
-    csync_rename_s* d = csync_rename_s::get(ctx);
-    for (std::string p = _parentDir(path); !p.empty(); p = _parentDir(p)) {
-        std::map< std::string, std::string >::iterator it = d->folder_renamed_to.find(p);
-        if (it != d->folder_renamed_to.end()) {
-            std::string rep = it->second + (path + p.length());
-            return c_strdup(rep.c_str());
-        }
+    csync_rename_s* d = reinterpret_cast<csync_rename_s *>(ctx->rename_info);
+    if (!other->rename_info) {
+        return;
     }
-    return c_strdup(path);
+    /* the renames recorded in ctx win, as if they were recorded last */
+    if (d) {
+        std::string path;
+        RecordRename record = { other };
+        d->folder_renamed_to.forEach(0, path, record);
+        csync_rename_destroy(ctx);
+    }
+    ctx->rename_info = other->rename_info;
+    other->rename_info = 0;
+}
+
+char* csync_rename_adjust_path(CSYNC* ctx, const char* path)
+{
+    csync_rename_s* d = reinterpret_cast<csync_rename_s *>(ctx->rename_info);
+    char *rep = d ? d->folder_renamed_to.adjust(path) : 0;
+    return rep ? rep : c_strdup(path);
 }
 
 char* csync_rename_adjust_path_source(CSYNC* ctx, const char* path)
 {
-    csync_rename_s* d = csync_rename_s::get(ctx);
-    for (std::string p = _parentDir(path); !p.empty(); p = _parentDir(p)) {
-        std::map< std::string, std::string >::iterator it = d->folder_renamed_from.find(p);
-        if (it != d->folder_renamed_from.end()) {
-            std::string rep = it->second + (path + p.length());
-            return c_strdup(rep.c_str());
-        }
-    }
-    return c_strdup(path);
+    csync_rename_s* d = reinterpret_cast<csync_rename_s *>(ctx->rename_info);
+    char *rep = d ? d->folder_renamed_from.adjust(path) : 0;
+    return rep ? rep : c_strdup(path);
 }
 
 
@@ -32,6 +32,8 @@ char *csync_rename_adjust_path(CSYNC *ctx, const char *path);
 char *csync_rename_adjust_path_source(CSYNC *ctx, const char *path);
 void csync_rename_destroy(CSYNC *ctx);
 void csync_rename_record(CSYNC *ctx, const char *from, const char *to);
+/* Move the renames recorded in other to ctx, the ones of ctx win */
+void csync_rename_merge(CSYNC *ctx, CSYNC *other);
 
 #ifdef __cplusplus
 }
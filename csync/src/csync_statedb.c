@@ -228,11 +228,23 @@ int csync_statedb_close(CSYNC *ctx) {
 
 #define METADATA_COLUMNS "phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId"
 
+/* The stats for the trees are allocated from the arena of the sync, the ones
+ * returned by csync_statedb_get_stat_by_* from the heap for the caller to free. */
+static void *_csync_statedb_alloc(c_arena_t *arena, size_t size)
+{
+    return arena ? c_arena_alloc(arena, size) : c_malloc(size);
+}
+
+static char *_csync_statedb_strdup(c_arena_t *arena, const char *str)
+{
+    return arena ? c_arena_strdup(arena, str) : c_strdup(str);
+}
+
 // This funciton parses a line from the metadata table into the given csync_file_stat
-// structure which it is also allocating.
+// structure which it is also allocating, from arena if it is not NULL.
 // Note that this function calls laso sqlite3_step to actually get the info from db and
 // returns the sqlite return type.
-static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3_stmt *stmt )
+static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3_stmt *stmt, c_arena_t *arena )
 {
     int rc = SQLITE_ERROR;
     int column_count;
@@ -253,7 +265,7 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
 
             /* phash, pathlen, path, inode, uid, gid, mode, modtime */
             len = sqlite3_column_int(stmt, 1);
-            *st = c_malloc(sizeof(csync_file_stat_t) + len + 1);
+            *st = _csync_statedb_alloc(arena, sizeof(csync_file_stat_t) + len + 1);
             /* clear the whole structure */
             ZERO_STRUCTP(*st);
 
@@ -272,7 +284,7 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
             }
 
             if(column_count > 9 && sqlite3_column_text(stmt, 9)) {
-                (*st)->etag = c_strdup( (char*) sqlite3_column_text(stmt, 9) );
+                (*st)->etag = _csync_statedb_strdup(arena, (char*) sqlite3_column_text(stmt, 9) );
             }
             if(column_count > 10 && sqlite3_column_text(stmt,10)) {
                 csync_vio_set_file_id((*st)->file_id, (char*) sqlite3_column_text(stmt, 10));
@@ -289,7 +301,7 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
                 (*st)->has_ignored_files = sqlite3_column_int(stmt, 13);
             }
             if(column_count > 15 && sqlite3_column_int(stmt, 15)) {
-                (*st)->checksum = c_strdup( (char*) sqlite3_column_text(stmt, 14));
+                (*st)->checksum = _csync_statedb_strdup(arena, (char*) sqlite3_column_text(stmt, 14));
                 (*st)->checksumTypeId = sqlite3_column_int(stmt, 15);
             }
 
@@ -302,6 +314,373 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
     return rc;
 }
 
+/*
+ * The snapshot keeps one compact row per metadata entry. All strings live in
+ * one pool and are referenced by offset, offset 0 stands for NULL. The hash
+ * indexes store row index + 1, 0 marks an empty slot.
+ */
+typedef struct csync_statedb_row_s {
+  uint64_t phash;
+  uint64_t inode;
+  int64_t size;
+  int64_t modtime;
+  uint32_t path;
+  uint32_t pathlen;
+  uint32_t etag;
+  uint32_t file_id;
+  uint32_t remote_perm;
+  uint32_t checksum;
+  uint32_t mode;
+  uint32_t checksum_type_id;
+  uint8_t type;
+  uint8_t has_ignored_files;
+} csync_statedb_row_t;
+
+typedef struct csync_statedb_index_s {
+  uint32_t *slots;
+  size_t mask;
+} csync_statedb_index_t;
+
+struct csync_statedb_snapshot_s {
+  csync_statedb_row_t *rows;
+  size_t count;
+  size_t allocated;
+
+  char *pool;
+  size_t pool_size;
+  size_t pool_allocated;
+
+  uint32_t *by_path; /* row indexes sorted by path */
+  csync_statedb_index_t by_hash;
+  csync_statedb_index_t by_inode;
+  csync_statedb_index_t by_file_id;
+};
+
+typedef struct csync_statedb_path_ref_s {
+  const char *path;
+  uint32_t row;
+} csync_statedb_path_ref_t;
+
+static size_t _csync_statedb_mix(uint64_t key) {
+  return (size_t) ((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
+}
+
+static size_t _csync_statedb_string_hash(const char *str) {
+  return c_jhash((const uint8_t *) str, strlen(str), 0);
+}
+
+/* Appends str to the pool, returns its offset or 0 for NULL. Sets *ok to
+ * false if the pool could not grow. */
+static uint32_t _csync_statedb_pool_add(struct csync_statedb_snapshot_s *snapshot,
+                                        const char *str, bool *ok) {
+  size_t len;
+  size_t offset;
+
+  if (str == NULL) {
+    return 0;
+  }
+  len = strlen(str) + 1;
+  if (snapshot->pool_size + len > UINT32_MAX) {
+    *ok = false;
+    return 0;
+  }
+  if (snapshot->pool_size + len > snapshot->pool_allocated) {
+    size_t allocated = snapshot->pool_allocated ? snapshot->pool_allocated : 64 * 1024;
+    char *pool;
+    while (snapshot->pool_size + len > allocated) {
+      allocated *= 2;
+    }
+    pool = c_realloc(snapshot->pool, allocated);
+    if (pool == NULL) {
+      *ok = false;
+      return 0;
+    }
+    snapshot->pool = pool;
+    snapshot->pool_allocated = allocated;
+  }
+  offset = snapshot->pool_size;
+  memcpy(snapshot->pool + offset, str, len);
+  snapshot->pool_size += len;
+  return (uint32_t) offset;
+}
+
+static const char *_csync_statedb_pool_string(const struct csync_statedb_snapshot_s *snapshot,
+                                              uint32_t offset) {
+  return offset ? snapshot->pool + offset : NULL;
+}
+
+static bool _csync_statedb_index_init(csync_statedb_index_t *index, size_t count) {
+  size_t size = 16;
+
+  while (size < 2 * count) {
+    size *= 2;
+  }
+  index->slots = c_malloc(size * sizeof(uint32_t));
+  index->mask = size - 1;
+  return index->slots != NULL;
+}
+
+static const csync_statedb_row_t *_csync_statedb_find_by_hash(const struct csync_statedb_snapshot_s *snapshot,
+                                                              uint64_t phash, size_t *free_slot) {
+  size_t slot = _csync_statedb_mix(phash) & snapshot->by_hash.mask;
+
+  for (; snapshot->by_hash.slots[slot]; slot = (slot + 1) & snapshot->by_hash.mask) {
+    const csync_statedb_row_t *row = &snapshot->rows[snapshot->by_hash.slots[slot] - 1];
+    if (row->phash == phash) {
+      return row;
+    }
+  }
+  if (free_slot) {
+    *free_slot = slot;
+  }
+  return NULL;
+}
+
+static const csync_statedb_row_t *_csync_statedb_find_by_inode(const struct csync_statedb_snapshot_s *snapshot,
+                                                               uint64_t inode, size_t *free_slot) {
+  size_t slot = _csync_statedb_mix(inode) & snapshot->by_inode.mask;
+
+  for (; snapshot->by_inode.slots[slot]; slot = (slot + 1) & snapshot->by_inode.mask) {
+    const csync_statedb_row_t *row = &snapshot->rows[snapshot->by_inode.slots[slot] - 1];
+    if (row->inode == inode) {
+      return row;
+    }
+  }
+  if (free_slot) {
+    *free_slot = slot;
+  }
+  return NULL;
+}
+
+static const csync_statedb_row_t *_csync_statedb_find_by_file_id(const struct csync_statedb_snapshot_s *snapshot,
+                                                                 const char *file_id, size_t *free_slot) {
+  size_t slot = _csync_statedb_string_hash(file_id) & snapshot->by_file_id.mask;
+
+  for (; snapshot->by_file_id.slots[slot]; slot = (slot + 1) & snapshot->by_file_id.mask) {
+    const csync_statedb_row_t *row = &snapshot->rows[snapshot->by_file_id.slots[slot] - 1];
+    if (c_streq(snapshot->pool + row->file_id, file_id)) {
+      return row;
+    }
+  }
+  if (free_slot) {
+    *free_slot = slot;
+  }
+  return NULL;
+}
+
+static int _csync_statedb_path_ref_cmp(const void *a, const void *b) {
+  return strcmp(((const csync_statedb_path_ref_t *) a)->path,
+                ((const csync_statedb_path_ref_t *) b)->path);
+}
+
+/* Like the query in csync_statedb_get_below_path, the first row of the scan
+ * wins if several rows share an inode or a file id. */
+static bool _csync_statedb_build_indexes(struct csync_statedb_snapshot_s *snapshot) {
+  csync_statedb_path_ref_t *refs;
+  size_t i;
+
+  if (!_csync_statedb_index_init(&snapshot->by_hash, snapshot->count)
+      || !_csync_statedb_index_init(&snapshot->by_inode, snapshot->count)
+      || !_csync_statedb_index_init(&snapshot->by_file_id, snapshot->count)) {
+    return false;
+  }
+
+  for (i = 0; i < snapshot->count; i++) {
+    const csync_statedb_row_t *row = &snapshot->rows[i];
+    size_t slot;
+
+    if (!_csync_statedb_find_by_hash(snapshot, row->phash, &slot)) {
+      snapshot->by_hash.slots[slot] = i + 1;
+    }
+    if (row->inode && !_csync_statedb_find_by_inode(snapshot, row->inode, &slot)) {
+      snapshot->by_inode.slots[slot] = i + 1;
+    }
+    if (row->file_id && snapshot->pool[row->file_id]
+        && !_csync_statedb_find_by_file_id(snapshot, snapshot->pool + row->file_id, &slot)) {
+      snapshot->by_file_id.slots[slot] = i + 1;
+    }
+  }
+
+  if (snapshot->count == 0) {
+    return true;
+  }
+  refs = c_malloc(snapshot->count * sizeof(csync_statedb_path_ref_t));
+  snapshot->by_path = c_malloc(snapshot->count * sizeof(uint32_t));
+  if (refs == NULL || snapshot->by_path == NULL) {
+    SAFE_FREE(refs);
+    return false;
+  }
+  for (i = 0; i < snapshot->count; i++) {
+    refs[i].path = snapshot->pool + snapshot->rows[i].path;
+    refs[i].row = i;
+  }
+  /* strcmp orders like sqlite's default BINARY collation */
+  qsort(refs, snapshot->count, sizeof(csync_statedb_path_ref_t), _csync_statedb_path_ref_cmp);
+  for (i = 0; i < snapshot->count; i++) {
+    snapshot->by_path[i] = refs[i].row;
+  }
+  SAFE_FREE(refs);
+
+  return true;
+}
+
+static void _csync_statedb_snapshot_destroy(struct csync_statedb_snapshot_s *snapshot) {
+  if (snapshot == NULL) {
+    return;
+  }
+  SAFE_FREE(snapshot->rows);
+  SAFE_FREE(snapshot->pool);
+  SAFE_FREE(snapshot->by_path);
+  SAFE_FREE(snapshot->by_hash.slots);
+  SAFE_FREE(snapshot->by_inode.slots);
+  SAFE_FREE(snapshot->by_file_id.slots);
+  SAFE_FREE(snapshot);
+}
+
+int csync_statedb_load_snapshot(CSYNC *ctx) {
+  struct csync_statedb_snapshot_s *snapshot = NULL;
+  sqlite3_stmt *stmt = NULL;
+  struct timespec start, finish;
+  bool ok = true;
+  int rc;
+
+  if (!ctx) {
+    return -1;
+  }
+  csync_statedb_free_snapshot(ctx);
+  if (ctx->db_is_empty || !ctx->statedb.db) {
+    return -1;
+  }
+
+  csync_gettime(&start);
+
+  const char *query = "SELECT " METADATA_COLUMNS " FROM metadata";
+  SQLITE_BUSY_HANDLED(sqlite3_prepare_v2(ctx->statedb.db, query, -1, &stmt, NULL));
+  ctx->statedb.lastReturnValue = rc;
+  if (rc != SQLITE_OK || stmt == NULL) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Unable to create stmt for snapshot query.");
+    return -1;
+  }
+
+  snapshot = c_malloc(sizeof(struct csync_statedb_snapshot_s));
+  if (snapshot == NULL) {
+    sqlite3_finalize(stmt);
+    return -1;
+  }
+  /* offset 0 is reserved for NULL */
+  _csync_statedb_pool_add(snapshot, "", &ok);
+
+  for (;;) {
+    csync_statedb_row_t *row;
+
+    SQLITE_BUSY_HANDLED( sqlite3_step(stmt) );
+    if (rc != SQLITE_ROW || !ok) {
+      break;
+    }
+
+    if (snapshot->count == snapshot->allocated) {
+      size_t allocated = snapshot->allocated ? 2 * snapshot->allocated : 1024;
+      csync_statedb_row_t *rows = c_realloc(snapshot->rows, allocated * sizeof(csync_statedb_row_t));
+      if (rows == NULL) {
+        ok = false;
+        break;
+      }
+      snapshot->rows = rows;
+      snapshot->allocated = allocated;
+    }
+    row = &snapshot->rows[snapshot->count++];
+    ZERO_STRUCTP(row);
+
+    row->phash = sqlite3_column_int64(stmt, 0);
+    row->path = _csync_statedb_pool_add(snapshot, (const char *) sqlite3_column_text(stmt, 2), &ok);
+    if (!row->path) {
+      row->path = _csync_statedb_pool_add(snapshot, "", &ok);
+    }
+    row->pathlen = (uint32_t) strlen(snapshot->pool + row->path);
+    row->inode = sqlite3_column_int64(stmt, 3);
+    row->mode = sqlite3_column_int(stmt, 6);
+    if (sqlite3_column_text(stmt, 7)) {
+      row->modtime = strtoul((const char *) sqlite3_column_text(stmt, 7), NULL, 10);
+    }
+    row->type = sqlite3_column_int(stmt, 8);
+    row->etag = _csync_statedb_pool_add(snapshot, (const char *) sqlite3_column_text(stmt, 9), &ok);
+    row->file_id = _csync_statedb_pool_add(snapshot, (const char *) sqlite3_column_text(stmt, 10), &ok);
+    row->remote_perm = _csync_statedb_pool_add(snapshot, (const char *) sqlite3_column_text(stmt, 11), &ok);
+    row->size = sqlite3_column_int64(stmt, 12);
+    row->has_ignored_files = sqlite3_column_int(stmt, 13);
+    if (sqlite3_column_int(stmt, 15) && sqlite3_column_text(stmt, 14)) {
+      row->checksum = _csync_statedb_pool_add(snapshot, (const char *) sqlite3_column_text(stmt, 14), &ok);
+      row->checksum_type_id = sqlite3_column_int(stmt, 15);
+    }
+  }
+  sqlite3_finalize(stmt);
+  ctx->statedb.lastReturnValue = rc;
+
+  if (rc != SQLITE_DONE || !ok || !_csync_statedb_build_indexes(snapshot)) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Could not load the metadata snapshot (%d), querying the db instead.", rc);
+    _csync_statedb_snapshot_destroy(snapshot);
+    return -1;
+  }
+  ctx->statedb.snapshot = snapshot;
+
+  csync_gettime(&finish);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Loaded %zu entries from db into memory in %.2f seconds.",
+            snapshot->count, c_secdiff(finish, start));
+
+  return 0;
+}
+
+void csync_statedb_free_snapshot(CSYNC *ctx) {
+  if (!ctx) {
+    return;
+  }
+  _csync_statedb_snapshot_destroy(ctx->statedb.snapshot);
+  ctx->statedb.snapshot = NULL;
+}
+
+/* Same as _csync_file_stat_from_metadata_table, for a row of the snapshot. */
+static csync_file_stat_t *_csync_file_stat_from_snapshot(const struct csync_statedb_snapshot_s *snapshot,
+                                                         const csync_statedb_row_t *row,
+                                                         c_arena_t *arena) {
+  csync_file_stat_t *st;
+  const char *str;
+
+  if (row == NULL) {
+    return NULL;
+  }
+
+  st = _csync_statedb_alloc(arena, sizeof(csync_file_stat_t) + row->pathlen + 1);
+  if (st == NULL) {
+    return NULL;
+  }
+  ZERO_STRUCTP(st);
+
+  st->phash = row->phash;
+  st->pathlen = row->pathlen;
+  memcpy(st->path, snapshot->pool + row->path, row->pathlen + 1);
+  st->inode = row->inode;
+  st->mode = row->mode;
+  st->modtime = row->modtime;
+  st->type = row->type;
+  if ((str = _csync_statedb_pool_string(snapshot, row->etag))) {
+    st->etag = _csync_statedb_strdup(arena, str);
+  }
+  if ((str = _csync_statedb_pool_string(snapshot, row->file_id))) {
+    csync_vio_set_file_id(st->file_id, str);
+  }
+  if ((str = _csync_statedb_pool_string(snapshot, row->remote_perm))) {
+    strncpy(st->remotePerm, str, REMOTE_PERM_BUF_SIZE);
+  }
+  st->size = row->size;
+  st->has_ignored_files = row->has_ignored_files;
+  if ((str = _csync_statedb_pool_string(snapshot, row->checksum))) {
+    st->checksum = _csync_statedb_strdup(arena, str);
+    st->checksumTypeId = row->checksum_type_id;
+  }
+
+  return st;
+}
+
 /* caller must free the memory */
 csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
                                                   uint64_t phash)
@@ -313,6 +692,11 @@ csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
       return NULL;
   }
 
+  if( ctx->statedb.snapshot ) {
+      return _csync_file_stat_from_snapshot(ctx->statedb.snapshot,
+                                            _csync_statedb_find_by_hash(ctx->statedb.snapshot, phash, NULL), NULL);
+  }
+
   if( ctx->statedb.by_hash_stmt == NULL ) {
       const char *hash_query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE phash=?1";
 
@@ -330,7 +714,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
 
   sqlite3_bind_int64(ctx->statedb.by_hash_stmt, 1, (long long signed int)phash);
 
-  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_hash_stmt);
+  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_hash_stmt, NULL);
   ctx->statedb.lastReturnValue = rc;
   if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) )  {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata: %d!", rc);
@@ -356,6 +740,11 @@ csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
         return NULL;
     }
 
+    if( ctx->statedb.snapshot ) {
+        return _csync_file_stat_from_snapshot(ctx->statedb.snapshot,
+                                              _csync_statedb_find_by_file_id(ctx->statedb.snapshot, file_id, NULL), NULL);
+    }
+
     if( ctx->statedb.by_fileid_stmt == NULL ) {
         const char *query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE fileid=?1";
 
@@ -370,7 +759,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
     /* bind the query value */
     sqlite3_bind_text(ctx->statedb.by_fileid_stmt, 1, file_id, -1, SQLITE_STATIC);
 
-    rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_fileid_stmt);
+    rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_fileid_stmt, NULL);
     ctx->statedb.lastReturnValue = rc;
     if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) ) {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata: %d!", rc);
@@ -396,6 +785,11 @@ csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
       return NULL;
   }
 
+  if( ctx->statedb.snapshot ) {
+      return _csync_file_stat_from_snapshot(ctx->statedb.snapshot,
+                                            _csync_statedb_find_by_inode(ctx->statedb.snapshot, inode, NULL), NULL);
+  }
+
   if( ctx->statedb.by_inode_stmt == NULL ) {
       const char *inode_query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE inode=?1";
 
@@ -413,7 +807,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
 
   sqlite3_bind_int64(ctx->statedb.by_inode_stmt, 1, (long long signed int)inode);
 
-  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_inode_stmt);
+  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_inode_stmt, NULL);
   ctx->statedb.lastReturnValue = rc;
   if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) ) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata by inode: %d!", rc);
@@ -423,6 +817,98 @@ csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
   return st;
 }
 
+/* Puts an entry read by csync_statedb_get_below_path into the tree of the
+ * current replica. Returns 1 if it was added, 0 if it was dropped and -1 if
+ * the tree could not take it. st is allocated from the arena. */
+static int _csync_statedb_add_below_path_entry(CSYNC *ctx, csync_file_stat_t *st) {
+    /* Check for exclusion from the tree.
+     * Note that this is only a safety net in case the ignore list changes
+     * without a full remote discovery being triggered. */
+    CSYNC_EXCLUDE_TYPE excluded = csync_excluded_traversal(ctx->exclude_matcher, st->path, st->type);
+    if (excluded != CSYNC_NOT_EXCLUDED) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s excluded (%d)", st->path, excluded);
+
+        if (excluded == CSYNC_FILE_EXCLUDE_AND_REMOVE
+                || excluded == CSYNC_FILE_SILENTLY_EXCLUDED) {
+            return 0;
+        }
+
+        st->instruction = CSYNC_INSTRUCTION_IGNORE;
+    }
+
+    if (ctx->current == LOCAL_REPLICA) {
+        /* Only keep what the walk through the file system would have found,
+         * the rest of the record describes the remote file. */
+        st->etag = NULL;
+        st->checksum = NULL;
+        st->checksumTypeId = 0;
+        st->file_id[0] = '\0';
+        st->remotePerm[0] = '\0';
+        st->has_ignored_files = 0;
+        st->local_from_db = 1;
+    }
+
+    /* store into result list. */
+    if (c_hashtable_insert(ctx->current == LOCAL_REPLICA ? ctx->local.tree : ctx->remote.tree,
+                           st->phash, (void *) st) < 0) {
+        ctx->status_code = CSYNC_STATUS_TREE_ERROR;
+        return -1;
+    }
+    return 1;
+}
+
+/* csync_statedb_get_below_path on the snapshot: the rows below path are a
+ * contiguous range of the path index. */
+static int _csync_statedb_snapshot_get_below_path(CSYNC *ctx, const char *path) {
+    const struct csync_statedb_snapshot_s *snapshot = ctx->statedb.snapshot;
+    char *prefix = NULL;
+    size_t prefix_len;
+    size_t lo = 0;
+    size_t hi = snapshot->count;
+    int64_t cnt = 0;
+
+    if (asprintf(&prefix, "%s/", path) < 0) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        return -1;
+    }
+    prefix_len = strlen(prefix);
+
+    /* find the first path greater than path+'/' */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(snapshot->pool + snapshot->rows[snapshot->by_path[mid]].path, prefix) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (; lo < snapshot->count; lo++) {
+        const csync_statedb_row_t *row = &snapshot->rows[snapshot->by_path[lo]];
+        csync_file_stat_t *st;
+        int rc;
+
+        if (strncmp(snapshot->pool + row->path, prefix, prefix_len) != 0) {
+            break;
+        }
+        st = _csync_file_stat_from_snapshot(snapshot, row, ctx->arena);
+        if (st == NULL) {
+            ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+            break;
+        }
+        rc = _csync_statedb_add_below_path_entry(ctx, st);
+        if (rc < 0) {
+            break;
+        }
+        cnt += rc;
+    }
+
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "%" PRId64 " entries read below path %s from db snapshot.", cnt, path);
+    SAFE_FREE(prefix);
+
+    return 0;
+}
+
 int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
     int rc;
     sqlite3_stmt *stmt = NULL;
@@ -436,6 +922,10 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
         return -1;
     }
 
+    if( ctx->statedb.snapshot ) {
+        return _csync_statedb_snapshot_get_below_path(ctx, path);
+    }
+
     /*  Select the entries for anything that starts with  (path+'/')
      * In other words, anything that is between  path+'/' and path+'0',
      * (because '0' follows '/' in ascii)
@@ -461,31 +951,13 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
     do {
         csync_file_stat_t *st = NULL;
 
-        rc = _csync_file_stat_from_metadata_table( &st, stmt);
+        rc = _csync_file_stat_from_metadata_table( &st, stmt, ctx->arena);
         if( st ) {
-            /* Check for exclusion from the tree.
-             * Note that this is only a safety net in case the ignore list changes
-             * without a full remote discovery being triggered. */
-            CSYNC_EXCLUDE_TYPE excluded = csync_excluded_traversal(ctx->excludes, st->path, st->type);
-            if (excluded != CSYNC_NOT_EXCLUDED) {
-                CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s excluded (%d)", st->path, excluded);
-
-                if (excluded == CSYNC_FILE_EXCLUDE_AND_REMOVE
-                        || excluded == CSYNC_FILE_SILENTLY_EXCLUDED) {
-                    SAFE_FREE(st);
-                    continue;
-                }
-
-                st->instruction = CSYNC_INSTRUCTION_IGNORE;
-            }
-
-            /* store into result list. */
-            if (c_rbtree_insert(ctx->remote.tree, (void *) st) < 0) {
-                SAFE_FREE(st);
-                ctx->status_code = CSYNC_STATUS_TREE_ERROR;
+            int added = _csync_statedb_add_below_path_entry(ctx, st);
+            if (added < 0) {
                 break;
             }
-            cnt++;
+            cnt += added;
         }
     } while( rc == SQLITE_ROW );
 
@@ -500,6 +972,131 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
     return 0;
 }
 
+/* The listing entry for a row: what the remote discovery would have
+ * reported for it at the end of the last sync. */
+static csync_vio_file_stat_t *_csync_statedb_vio_stat_from_snapshot(const struct csync_statedb_snapshot_s *snapshot,
+                                                                   const csync_statedb_row_t *row,
+                                                                   const char *name) {
+    csync_vio_file_stat_t *fs = csync_vio_file_stat_new();
+    const char *str;
+
+    if (fs == NULL) {
+        return NULL;
+    }
+    fs->name = c_strdup(name);
+    switch (row->type) {
+    case CSYNC_FTW_TYPE_DIR:
+        fs->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+        break;
+    case CSYNC_FTW_TYPE_SLINK:
+        fs->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
+        break;
+    default:
+        fs->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+        break;
+    }
+    fs->mtime = row->modtime;
+    fs->size = row->size;
+    fs->fields = CSYNC_VIO_FILE_STAT_FIELDS_TYPE | CSYNC_VIO_FILE_STAT_FIELDS_MTIME
+            | CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+    if ((str = _csync_statedb_pool_string(snapshot, row->etag))) {
+        fs->etag = c_strdup(str);
+        fs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
+    }
+    if ((str = _csync_statedb_pool_string(snapshot, row->file_id))) {
+        csync_vio_file_stat_set_file_id(fs, str);
+    }
+    if ((str = _csync_statedb_pool_string(snapshot, row->remote_perm))) {
+        strncpy(fs->remotePerm, str, REMOTE_PERM_BUF_SIZE);
+        fs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
+    }
+    return fs;
+}
+
+/* the first position of the path index whose path is not less than key */
+static size_t _csync_statedb_snapshot_seek(const struct csync_statedb_snapshot_s *snapshot,
+                                           size_t lo, const char *key) {
+    size_t hi = snapshot->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(snapshot->pool + snapshot->rows[snapshot->by_path[mid]].path, key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int csync_statedb_get_children(CSYNC *ctx, const char *path,
+                               csync_statedb_children_visit_func *visitor, void *data) {
+    const struct csync_statedb_snapshot_s *snapshot;
+    char *prefix = NULL;
+    size_t prefix_len;
+    size_t pos;
+    int rc = 0;
+
+    if (!ctx || !path || !visitor || !ctx->statedb.snapshot) {
+        return -1;
+    }
+    snapshot = ctx->statedb.snapshot;
+
+    if (asprintf(&prefix, path[0] ? "%s/" : "%s", path) < 0) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        return -1;
+    }
+    prefix_len = strlen(prefix);
+
+    pos = _csync_statedb_snapshot_seek(snapshot, 0, prefix);
+    while (pos < snapshot->count) {
+        const csync_statedb_row_t *row = &snapshot->rows[snapshot->by_path[pos]];
+        const char *row_path = snapshot->pool + row->path;
+        const char *name = row_path + prefix_len;
+        const char *slash;
+        csync_vio_file_stat_t *fs;
+
+        if (strncmp(row_path, prefix, prefix_len) != 0) {
+            break;
+        }
+        if (name[0] == '\0') {
+            pos++;
+            continue;
+        }
+
+        slash = strchr(name, '/');
+        if (slash) {
+            /* A row below a child, skip the rest of the child's subtree: it
+             * ends before child+'0' because '0' follows '/' in ascii. */
+            char *end = c_strndup(row_path, slash - row_path + 1);
+            if (end == NULL) {
+                ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+                rc = -1;
+                break;
+            }
+            end[slash - row_path] = '0';
+            pos = _csync_statedb_snapshot_seek(snapshot, pos + 1, end);
+            SAFE_FREE(end);
+            continue;
+        }
+
+        fs = _csync_statedb_vio_stat_from_snapshot(snapshot, row, name);
+        if (fs == NULL) {
+            ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+            rc = -1;
+            break;
+        }
+        if (visitor(row_path, fs, data) < 0) {
+            rc = -1;
+            break;
+        }
+        pos++;
+    }
+    SAFE_FREE(prefix);
+
+    return rc;
+}
+
 /* query the statedb, caller must free the memory */
 c_strlist_t *csync_statedb_query(sqlite3 *db,
                                  const char *statement) {
@@ -60,6 +60,29 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb);
 
 int csync_statedb_close(CSYNC *ctx);
 
+/**
+ * @brief Load the metadata table into memory.
+ *
+ * Reads all rows in one scan and indexes them by phash, inode, file id and
+ * path. As long as the snapshot exists, csync_statedb_get_stat_by_hash(),
+ * _by_inode(), _by_file_id() and csync_statedb_get_below_path() answer from
+ * memory instead of querying the database. It survives csync_statedb_close()
+ * so the update and the reconcile phase share it.
+ *
+ * @param ctx      The csync context with an open statedb.
+ *
+ * @return 0 on success, -1 if the table could not be read. The lookups
+ *         query the database then.
+ */
+int csync_statedb_load_snapshot(CSYNC *ctx);
+
+/**
+ * @brief Free the snapshot loaded by csync_statedb_load_snapshot().
+ *
+ * @param ctx      The csync context.
+ */
+void csync_statedb_free_snapshot(CSYNC *ctx);
+
 csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx, uint64_t phash);
 
 csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx, uint64_t inode);
@@ -87,6 +110,35 @@ char *csync_statedb_get_etag(CSYNC *ctx, uint64_t jHash);
  */
 int csync_statedb_get_below_path(CSYNC *ctx, const char *path);
 
+/**
+ * @brief Visit function for csync_statedb_get_children().
+ *
+ * @param path   The path of the entry, relative to the sync root.
+ * @param fs     The entry, owned by the visitor from now on.
+ * @param data   The data passed to csync_statedb_get_children().
+ *
+ * @return 0 to continue, < 0 to stop.
+ */
+typedef int csync_statedb_children_visit_func(const char *path, csync_vio_file_stat_t *fs, void *data);
+
+/**
+ * @brief List the entries directly inside a path.
+ *
+ * Calls the visitor with the remote listing entry of every row directly
+ * inside path ("" for the root) as it was at the end of the last sync. The
+ * subtrees of the children are skipped with a seek on the path index.
+ *
+ * @param ctx        The csync context.
+ * @param path       The path.
+ * @param visitor    The function to call for every entry.
+ * @param data       Passed to the visitor.
+ *
+ * @return 0 on success, -1 if there is no snapshot, on error or if the
+ *         visitor stopped.
+ */
+int csync_statedb_get_children(CSYNC *ctx, const char *path,
+                               csync_statedb_children_visit_func *visitor, void *data);
+
 /**
  * @brief A generic statedb query.
  *
@@ -39,10 +39,12 @@
 #include "csync_exclude.h"
 #include "csync_statedb.h"
 #include "csync_update.h"
+#include "csync_changes.h"
 #include "csync_util.h"
 #include "csync_misc.h"
 
 #include "vio/csync_vio.h"
+#include "vio/csync_vio_local.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.updater"
 #include "csync_log.h"
@@ -127,7 +129,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
     const csync_vio_file_stat_t *fs, const int type) {
   uint64_t h = 0;
   size_t len = 0;
-  size_t size = 0;
   const char *path = NULL;
   csync_file_stat_t *st = NULL;
   csync_file_stat_t *tmp = NULL;
@@ -167,7 +168,7 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
       excluded =CSYNC_FILE_EXCLUDE_STAT_FAILED;
   } else {
     /* Check if file is excluded */
-    excluded = csync_excluded_traversal(ctx->excludes, path, type);
+    excluded = csync_excluded_traversal(ctx->exclude_matcher, path, type);
   }
 
   if( excluded == CSYNC_NOT_EXCLUDED ) {
@@ -200,9 +201,11 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
   if( h == 0 ) {
     return -1;
   }
-  size = sizeof(csync_file_stat_t) + len + 1;
-
-  st = c_malloc(size);
+  st = csync_file_stat_new(ctx, len);
+  if (st == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return -1;
+  }
 
   /* Set instruction by default to none */
   st->instruction = CSYNC_INSTRUCTION_NONE;
@@ -218,8 +221,7 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
 
       tmp = csync_statedb_get_stat_by_hash(ctx, h);
       if(_last_db_return_error(ctx)) {
-          SAFE_FREE(st);
-          SAFE_FREE(tmp);
+          csync_file_stat_free(tmp);
           ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
           return -1;
       }
@@ -228,11 +230,16 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "file: %s - not found in db, IGNORE!", path);
         st->instruction = CSYNC_INSTRUCTION_IGNORE;
       } else {
-        SAFE_FREE(st);
-        st = tmp;
+        /* the db entry becomes the tree entry, so it has to go into the arena */
+        st = csync_file_stat_dup(ctx, tmp);
+        csync_file_stat_free(tmp);
+        tmp = NULL;
+        if (st == NULL) {
+          ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+          return -1;
+        }
         st->instruction = CSYNC_INSTRUCTION_NONE;
         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "file: %s - tmp non zero, mtime %lu", path, st->modtime );
-        tmp = NULL;
       }
       goto fastout; /* Skip copying of the etag. That's an important difference to upstream
                      * without etags. */
@@ -257,7 +264,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
     tmp = csync_statedb_get_stat_by_hash(ctx, h);
 
     if(_last_db_return_error(ctx)) {
-        SAFE_FREE(st);
         ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
         return -1;
     }
@@ -281,9 +287,11 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
 
             if (fs->size == tmp->size && tmp->checksumTypeId) {
                 if (ctx->callbacks.checksum_hook) {
-                    st->checksum = ctx->callbacks.checksum_hook(
+                    char *checksum = (char *) ctx->callbacks.checksum_hook(
                                 file, tmp->checksumTypeId,
                                 ctx->callbacks.checksum_userdata);
+                    st->checksum = c_arena_strdup(ctx->arena, checksum);
+                    SAFE_FREE(checksum);
                 }
                 bool checksumIdentical = false;
                 if (st->checksum) {
@@ -303,7 +311,8 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
                                                             || !c_streq(fs->remotePerm, tmp->remotePerm)))
                              || (ctx->current == LOCAL_REPLICA && fs->inode != tmp->inode);
         if (type == CSYNC_FTW_TYPE_DIR && ctx->current == REMOTE_REPLICA
-                && !metadata_differ && ctx->read_remote_from_db) {
+                && !metadata_differ && ctx->read_remote_from_db
+                && !csync_remote_changes_below(ctx, path)) {
             /* If both etag and file id are equal for a directory, read all contents from
              * the database.
              * The metadata comparison ensure that we fetch all the file id or permission when
@@ -312,6 +321,16 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
             CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Reading from database: %s", path);
             ctx->remote.read_from_db = true;
         }
+        if (type == CSYNC_FTW_TYPE_DIR && ctx->current == LOCAL_REPLICA
+                && !metadata_differ && ctx->callbacks.checkLocalDirectoryChangedHook
+                && !ctx->callbacks.checkLocalDirectoryChangedHook(ctx->callbacks.update_callback_userdata, path)) {
+            /* Nothing was reported to have changed in or below this directory since the
+             * last sync, so the contents are the ones recorded in the database.
+             */
+            CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Reading local contents from database: %s", path);
+            ctx->local.read_from_db = true;
+            st->local_from_db = true;
+        }
         if (metadata_differ) {
             /* file id or permissions has changed. Which means we need to update them in the DB. */
             CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Need to update metadata for: %s", path);
@@ -337,7 +356,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
             tmp = csync_statedb_get_stat_by_inode(ctx, fs->inode);
 
             if(_last_db_return_error(ctx)) {
-                SAFE_FREE(st);
                 ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
                 return -1;
             }
@@ -374,7 +392,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
             tmp = csync_statedb_get_stat_by_file_id(ctx, fs->file_id);
 
             if(_last_db_return_error(ctx)) {
-                SAFE_FREE(st);
                 ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
                 return -1;
             }
@@ -404,7 +421,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
 
                 if (fs->type == CSYNC_VIO_FILE_TYPE_DIRECTORY && ctx->current == REMOTE_REPLICA && ctx->callbacks.checkSelectiveSyncNewFolderHook) {
                     if (ctx->callbacks.checkSelectiveSyncNewFolderHook(ctx->callbacks.update_callback_userdata, path)) {
-                        SAFE_FREE(st);
                         return 1;
                     }
                 }
@@ -414,7 +430,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
     }
   } else  {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Unable to open statedb" );
-      SAFE_FREE(st);
       ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
       return -1;
   }
@@ -453,17 +468,14 @@ out:
   st->type  = type;
   st->etag   = NULL;
   if( fs->etag ) {
-      SAFE_FREE(st->etag);
-      st->etag  = c_strdup(fs->etag);
+      st->etag  = c_arena_strdup(ctx->arena, fs->etag);
   }
   csync_vio_set_file_id(st->file_id, fs->file_id);
   if (fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADURL) {
-      SAFE_FREE(st->directDownloadUrl);
-      st->directDownloadUrl = c_strdup(fs->directDownloadUrl);
+      st->directDownloadUrl = c_arena_strdup(ctx->arena, fs->directDownloadUrl);
   }
   if (fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADCOOKIES) {
-      SAFE_FREE(st->directDownloadCookies);
-      st->directDownloadCookies = c_strdup(fs->directDownloadCookies);
+      st->directDownloadCookies = c_arena_strdup(ctx->arena, fs->directDownloadCookies);
   }
   if (fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_PERM) {
       strncpy(st->remotePerm, fs->remotePerm, REMOTE_PERM_BUF_SIZE);
@@ -476,15 +488,13 @@ fastout:  /* target if the file information is read from database into st */
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      if (c_rbtree_insert(ctx->local.tree, (void *) st) < 0) {
-        SAFE_FREE(st);
+      if (c_hashtable_insert(ctx->local.tree, st->phash, (void *) st) < 0) {
         ctx->status_code = CSYNC_STATUS_TREE_ERROR;
         return -1;
       }
       break;
     case REMOTE_REPLICA:
-      if (c_rbtree_insert(ctx->remote.tree, (void *) st) < 0) {
-        SAFE_FREE(st);
+      if (c_hashtable_insert(ctx->remote.tree, st->phash, (void *) st) < 0) {
         ctx->status_code = CSYNC_STATUS_TREE_ERROR;
         return -1;
       }
@@ -505,7 +515,7 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
   csync_file_stat_t *st = NULL;
   uint64_t h;
 
-  if (ctx->abort) {
+  if (csync_abort_requested(ctx)) {
     CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Aborted!");
     ctx->status_code = CSYNC_STATUS_ABORTED;
     return -1;
@@ -564,13 +574,14 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
 static bool fill_tree_from_db(CSYNC *ctx, const char *uri)
 {
     const char *path = NULL;
+    const char *base_uri = ctx->current == LOCAL_REPLICA ? ctx->local.uri : ctx->remote.uri;
 
-    if( strlen(uri) < strlen(ctx->remote.uri)+1) {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "name does not contain remote uri!");
+    if( strlen(uri) < strlen(base_uri)+1) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "name does not contain the replica uri!");
         return false;
     }
 
-    path = uri + strlen(ctx->remote.uri)+1;
+    path = uri + strlen(base_uri)+1;
 
     if( csync_statedb_get_below_path(ctx, path) < 0 ) {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "StateDB could not be read!");
@@ -600,19 +611,269 @@ static bool mark_current_item_ignored( CSYNC *ctx, csync_file_stat_t *previous_f
     return false;
 }
 
-/* File tree walker */
-int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
+bool csync_local_dir_has_ignored_files(CSYNC *ctx, const char *path)
+{
+  char *uri = NULL;
+  csync_vio_handle_t *dh = NULL;
+  csync_vio_file_stat_t *dirent = NULL;
+  bool found = false;
+
+  if (asprintf(&uri, "%s/%s", ctx->local.uri, path) < 0) {
+    /* Can't tell, so better keep the directory */
+    return true;
+  }
+
+  dh = csync_vio_local_opendir(uri);
+  if (dh == NULL) {
+    /* A directory that can't be read would have been ignored by the walker */
+    found = (errno != ENOENT);
+    SAFE_FREE(uri);
+    return found;
+  }
+
+  while (!found && (dirent = csync_vio_local_readdir(dh))) {
+    char *filename = NULL;
+    const char *d_name = dirent->name;
+    CSYNC_EXCLUDE_TYPE excluded;
+    int type;
+
+    if (d_name == NULL) {
+      found = true;
+      csync_vio_file_stat_destroy(dirent);
+      break;
+    }
+    if ((d_name[0] == '.' && d_name[1] == '\0')
+        || (d_name[0] == '.' && d_name[1] == '.' && d_name[2] == '\0')) {
+      csync_vio_file_stat_destroy(dirent);
+      continue;
+    }
+
+    if (asprintf(&filename, "%s/%s", uri, d_name) < 0
+        || (!(dirent->fields & CSYNC_VIO_FILE_STAT_FIELDS_INODE) && csync_vio_local_stat(filename, dirent) < 0)
+        || dirent->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
+      found = true;
+    } else if (dirent->type == CSYNC_VIO_FILE_TYPE_DIRECTORY
+               || dirent->type == CSYNC_VIO_FILE_TYPE_REGULAR) {
+      /* Same rules as in _csync_detect_update */
+      const char *relative = filename + strlen(ctx->local.uri) + 1;
+      type = dirent->type == CSYNC_VIO_FILE_TYPE_DIRECTORY ? CSYNC_FTW_TYPE_DIR : CSYNC_FTW_TYPE_FILE;
+      excluded = csync_excluded_traversal(csync_exclude_compile(ctx), relative, type);
+      if (excluded == CSYNC_FILE_EXCLUDE_AND_REMOVE || excluded == CSYNC_FILE_SILENTLY_EXCLUDED) {
+        /* not reported as ignored */
+      } else if (excluded != CSYNC_NOT_EXCLUDED) {
+        found = true;
+      } else if (ctx->ignore_hidden_files
+                 && (d_name[0] == '.' || (dirent->flags & CSYNC_VIO_FILE_FLAGS_HIDDEN))) {
+        found = true;
+      } else if (type == CSYNC_FTW_TYPE_DIR) {
+        found = csync_local_dir_has_ignored_files(ctx, relative);
+      }
+    }
+
+    SAFE_FREE(filename);
+    csync_vio_file_stat_destroy(dirent);
+  }
+
+  csync_vio_local_closedir(dh);
+  SAFE_FREE(uri);
+  return found;
+}
+
+CSYNC *csync_walk_new(CSYNC *ctx) {
+  CSYNC *walk = c_malloc(sizeof(CSYNC));
+
+  if (walk == NULL) {
+    return NULL;
+  }
+  *walk = *ctx;
+  walk->parent = ctx->parent ? ctx->parent : ctx;
+  walk->local_walk = NULL;
+  walk->current_fs = NULL;
+  walk->status_code = CSYNC_STATUS_OK;
+  walk->error_string = NULL;
+  walk->rename_info = NULL;
+  walk->statedb.by_hash_stmt = NULL;
+  walk->statedb.by_fileid_stmt = NULL;
+  walk->statedb.by_inode_stmt = NULL;
+  if (c_arena_create(&walk->arena) < 0) {
+    SAFE_FREE(walk);
+    return NULL;
+  }
+
+  return walk;
+}
+
+void csync_walk_merge(CSYNC *ctx, CSYNC *walk) {
+  c_arena_merge(ctx->arena, walk->arena);
+
+  if (walk->status_code != CSYNC_STATUS_OK) {
+    ctx->status_code = walk->status_code;
+    if (walk->error_string) {
+      SAFE_FREE(ctx->error_string);
+      ctx->error_string = walk->error_string;
+      walk->error_string = NULL;
+    }
+  }
+  SAFE_FREE(walk->error_string);
+
+  /* the remote renames are recorded last in a sequential update */
+  csync_rename_merge(ctx, walk);
+
+  /* only used if there was no snapshot */
+  if (walk->statedb.by_hash_stmt) {
+    sqlite3_finalize(walk->statedb.by_hash_stmt);
+  }
+  if (walk->statedb.by_fileid_stmt) {
+    sqlite3_finalize(walk->statedb.by_fileid_stmt);
+  }
+  if (walk->statedb.by_inode_stmt) {
+    sqlite3_finalize(walk->statedb.by_inode_stmt);
+  }
+
+  SAFE_FREE(walk);
+}
+
+/* A directory csync_ftw_parallel() still has to list, or has listed */
+typedef struct csync_ftw_dir_s {
+  struct csync_ftw_dir_s *parent;
+  /* NULL for the directory the walk starts at */
+  csync_file_stat_t *fs;
+  unsigned int depth;
+  int read_from_db;
+  int local_read_from_db;
+  char uri[1];
+} csync_ftw_dir_t;
+
+typedef struct csync_ftw_dirs_s {
+  csync_ftw_dir_t **dirs;
+  size_t count;
+  size_t size;
+} csync_ftw_dirs_t;
+
+/* One of the walks csync_ftw_parallel() runs at the same time */
+typedef struct csync_ftw_task_s {
+  /* a walk context with a tree of its own */
+  CSYNC *ctx;
+  /* the directory being listed */
+  csync_ftw_dir_t *dir;
+  /* the directories left to list, the last one first */
+  csync_ftw_dirs_t pending;
+  /* the directories found, parents before their children */
+  csync_ftw_dirs_t created;
+  size_t entries;
+  int rc;
+} csync_ftw_task_t;
+
+/* The most walks csync_ftw_parallel() runs at the same time */
+#define CSYNC_FTW_TASKS 64
+
+/* The entries a walk lists before it hands back the directories it did not
+ * get to, so the next round can spread them over the other walks */
+#define CSYNC_FTW_TASK_ENTRIES 2000
+
+static int _csync_ftw_dirs_push(csync_ftw_dirs_t *dirs, csync_ftw_dir_t *dir) {
+  if (dirs->count == dirs->size) {
+    size_t size = dirs->size ? 2 * dirs->size : 64;
+    csync_ftw_dir_t **buf = c_realloc(dirs->dirs, size * sizeof(csync_ftw_dir_t *));
+
+    if (buf == NULL) {
+      return -1;
+    }
+    dirs->dirs = buf;
+    dirs->size = size;
+  }
+  dirs->dirs[dirs->count++] = dir;
+
+  return 0;
+}
+
+static csync_ftw_dir_t *_csync_ftw_dir_new(csync_ftw_dir_t *parent, const char *uri,
+    CSYNC *ctx, unsigned int depth) {
+  size_t len = strlen(uri);
+  csync_ftw_dir_t *dir = c_malloc(sizeof(csync_ftw_dir_t) + len);
+
+  if (dir == NULL) {
+    return NULL;
+  }
+  dir->parent = parent;
+  dir->fs = ctx->current_fs;
+  dir->depth = depth;
+  dir->read_from_db = ctx->remote.read_from_db;
+  dir->local_read_from_db = ctx->local.read_from_db;
+  memcpy(dir->uri, uri, len + 1);
+
+  return dir;
+}
+
+/* Leave the directory to csync_ftw_parallel() instead of walking into it */
+static int _csync_ftw_task_defer(csync_ftw_task_t *task, CSYNC *ctx, const char *uri,
     unsigned int depth) {
+  csync_ftw_dir_t *dir = _csync_ftw_dir_new(task->dir, uri, ctx, depth);
+
+  if (dir == NULL) {
+    return -1;
+  }
+  if (_csync_ftw_dirs_push(&task->created, dir) < 0) {
+    SAFE_FREE(dir);
+    return -1;
+  }
+  /* the created list owns it */
+  if (_csync_ftw_dirs_push(&task->pending, dir) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Once all of the directory fs is walked */
+static void _csync_ftw_finish_dir(CSYNC *ctx, csync_file_stat_t *fs,
+    csync_file_stat_t *parent_fs) {
+  if (fs && !fs->child_modified && fs->instruction == CSYNC_INSTRUCTION_EVAL) {
+    fs->instruction = CSYNC_INSTRUCTION_NONE;
+    if (ctx->current == REMOTE_REPLICA) {
+      fs->should_update_metadata = true;
+    }
+  }
+
+  if (fs && parent_fs && fs->has_ignored_files) {
+      /* If a directory has ignored files, put the flag on the parent directory as well */
+      parent_fs->has_ignored_files = fs->has_ignored_files;
+  }
+}
+
+/* For every entry, after _csync_ftw_finish_dir() for a directory */
+static void _csync_ftw_finish_entry(int flag, csync_file_stat_t *fs,
+    csync_file_stat_t *parent_fs) {
+  if (fs && parent_fs && fs->child_modified) {
+      /* If a directory has modified files, put the flag on the parent directory as well */
+      parent_fs->child_modified = fs->child_modified;
+  }
+
+  if (flag == CSYNC_FTW_FLAG_DIR && fs
+      && (fs->instruction == CSYNC_INSTRUCTION_EVAL ||
+          fs->instruction == CSYNC_INSTRUCTION_NEW)) {
+      fs->should_update_metadata = true;
+  }
+}
+
+/* File tree walker */
+static int _csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
+    unsigned int depth, csync_ftw_task_t *task) {
   char *filename = NULL;
+  size_t filename_size = 0;
+  size_t uri_len = 0;
   char *d_name = NULL;
   csync_vio_handle_t *dh = NULL;
   csync_vio_file_stat_t *dirent = NULL;
   csync_file_stat_t *previous_fs = NULL;
   int read_from_db = 0;
+  int local_read_from_db = 0;
   int rc = 0;
   int res = 0;
+  bool deferred;
 
-  bool do_read_from_db = (ctx->current == REMOTE_REPLICA && ctx->remote.read_from_db);
+  bool do_read_from_db = (ctx->current == REMOTE_REPLICA && ctx->remote.read_from_db)
+          || (ctx->current == LOCAL_REPLICA && ctx->local.read_from_db);
 
   if (uri[0] == '\0') {
     errno = ENOENT;
@@ -621,6 +882,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
   }
 
   read_from_db = ctx->remote.read_from_db;
+  local_read_from_db = ctx->local.read_from_db;
 
   // if the etag of this dir is still the same, its content is restored from the
   // database.
@@ -643,7 +905,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
   }
 
   if ((dh = csync_vio_opendir(ctx, uri_for_vio)) == NULL) {
-      if (ctx->abort) {
+      if (csync_abort_requested(ctx)) {
           CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Aborted!");
           ctx->status_code = CSYNC_STATUS_ABORTED;
           goto error;
@@ -687,9 +949,12 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       goto error;
   }
 
+  uri_len = strlen(uri);
+
   while ((dirent = csync_vio_readdir(ctx, dh))) {
     const char *path = NULL;
     size_t ulen = 0;
+    size_t name_len;
     int flen;
     int flag;
 
@@ -715,13 +980,34 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       continue;
     }
 
-    flen = asprintf(&filename, "%s/%s", uri, d_name);
-    if (flen < 0) {
-      csync_vio_file_stat_destroy(dirent);
-      dirent = NULL;
-      ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
-      goto error;
+    if (task) {
+      task->entries++;
+    }
+
+    /* All entries of the directory share one buffer for their full path,
+     * the walker copies what it keeps. */
+    name_len = strlen(d_name);
+    if (uri_len + name_len + 2 > filename_size) {
+      size_t size = filename_size ? 2 * filename_size : uri_len + 256;
+      char *buf;
+
+      while (size < uri_len + name_len + 2) {
+        size *= 2;
+      }
+      buf = c_realloc(filename, size);
+      if (buf == NULL) {
+        csync_vio_file_stat_destroy(dirent);
+        dirent = NULL;
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        goto error;
+      }
+      filename = buf;
+      filename_size = size;
+      memcpy(filename, uri, uri_len);
+      filename[uri_len] = '/';
     }
+    memcpy(filename + uri_len + 1, d_name, name_len + 1);
+    flen = uri_len + 1 + name_len;
 
     /* Create relative path */
     switch (ctx->current) {
@@ -755,12 +1041,12 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
             || c_streq(path, ".csync_journal.db-journal")) {
         csync_vio_file_stat_destroy(dirent);
         dirent = NULL;
-        SAFE_FREE(filename);
         continue;
     }
 
-    /* Only for the local replica we have to stat(), for the remote one we have all data already */
-    if (ctx->replica == LOCAL_REPLICA) {
+    /* Only for the local replica we have to stat(), for the remote one we have all data already.
+     * The local readdir may have done it already. */
+    if (ctx->replica == LOCAL_REPLICA && !(dirent->fields & CSYNC_VIO_FILE_STAT_FIELDS_INODE)) {
         res = csync_vio_stat(ctx, filename, dirent);
     } else {
         res = 0;
@@ -813,46 +1099,49 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       goto error;
     }
 
+    deferred = false;
     if (flag == CSYNC_FTW_FLAG_DIR && depth && rc == 0
         && (!ctx->current_fs || ctx->current_fs->instruction != CSYNC_INSTRUCTION_IGNORE)) {
-      rc = csync_ftw(ctx, filename, fn, depth - 1);
-      if (rc < 0) {
-        ctx->current_fs = previous_fs;
-        goto error;
-      }
-
-      if (ctx->current_fs && !ctx->current_fs->child_modified
-          && ctx->current_fs->instruction == CSYNC_INSTRUCTION_EVAL) {
-        ctx->current_fs->instruction = CSYNC_INSTRUCTION_NONE;
-        if (ctx->current == REMOTE_REPLICA) {
-          ctx->current_fs->should_update_metadata = true;
+      if (task) {
+        /* listed by this or another task, and finished after all of the walk */
+        if (_csync_ftw_task_defer(task, ctx, filename, depth - 1) < 0) {
+          ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+          ctx->current_fs = previous_fs;
+          goto error;
         }
-      }
-
-      if (ctx->current_fs && previous_fs && ctx->current_fs->has_ignored_files) {
-          /* If a directory has ignored files, put the flag on the parent directory as well */
-          previous_fs->has_ignored_files = ctx->current_fs->has_ignored_files;
+        deferred = true;
+      } else {
+        rc = _csync_ftw(ctx, filename, fn, depth - 1, NULL);
+        if (rc < 0) {
+          ctx->current_fs = previous_fs;
+          goto error;
+        }
+        _csync_ftw_finish_dir(ctx, ctx->current_fs, previous_fs);
       }
     }
 
-    if (ctx->current_fs && previous_fs && ctx->current_fs->child_modified) {
-        /* If a directory has modified files, put the flag on the parent directory as well */
-        previous_fs->child_modified = ctx->current_fs->child_modified;
-    }
-
-    if (flag == CSYNC_FTW_FLAG_DIR && ctx->current_fs
-        && (ctx->current_fs->instruction == CSYNC_INSTRUCTION_EVAL ||
-            ctx->current_fs->instruction == CSYNC_INSTRUCTION_NEW)) {
-        ctx->current_fs->should_update_metadata = true;
+    if (!deferred) {
+      _csync_ftw_finish_entry(flag, ctx->current_fs, previous_fs);
     }
 
     ctx->current_fs = previous_fs;
     ctx->remote.read_from_db = read_from_db;
-    SAFE_FREE(filename);
+    ctx->local.read_from_db = local_read_from_db;
     csync_vio_file_stat_destroy(dirent);
     dirent = NULL;
   }
 
+  /* The remote listing arrives while it is read, it can still fail after
+   * some of its entries. Treating it as complete would delete the rest. */
+  if (ctx->replica == REMOTE_REPLICA && errno != 0) {
+    if (csync_abort_requested(ctx)) {
+      ctx->status_code = CSYNC_STATUS_ABORTED;
+    } else {
+      ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_READDIR_ERROR);
+    }
+    goto error;
+  }
+
   csync_vio_closedir(ctx, dh);
   CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, " <= Closing walk for %s with read_from_db %d", uri, read_from_db);
 
@@ -862,6 +1151,7 @@ done:
   return rc;
 error:
   ctx->remote.read_from_db = read_from_db;
+  ctx->local.read_from_db = local_read_from_db;
   if (dh != NULL) {
     csync_vio_closedir(ctx, dh);
   }
@@ -869,4 +1159,182 @@ error:
   return -1;
 }
 
+int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
+    unsigned int depth) {
+  return _csync_ftw(ctx, uri, fn, depth, NULL);
+}
+
+static void _csync_ftw_task_run(void *data, int index) {
+  csync_ftw_task_t *task = &((csync_ftw_task_t *) data)[index];
+  CSYNC *ctx = task->ctx;
+  int read_from_db = ctx->remote.read_from_db;
+  int local_read_from_db = ctx->local.read_from_db;
+
+  task->entries = 0;
+  task->rc = 0;
+  while (task->pending.count > 0 && task->entries < CSYNC_FTW_TASK_ENTRIES) {
+    csync_ftw_dir_t *dir = task->pending.dirs[--task->pending.count];
+
+    /* the state csync_ftw() has when it walks into the directory */
+    task->dir = dir;
+    ctx->current_fs = dir->fs;
+    ctx->remote.read_from_db = dir->read_from_db;
+    ctx->local.read_from_db = dir->local_read_from_db;
+    task->rc = _csync_ftw(ctx, dir->uri, csync_walker, dir->depth, task);
+    ctx->current_fs = NULL;
+    ctx->remote.read_from_db = read_from_db;
+    ctx->local.read_from_db = local_read_from_db;
+    if (task->rc < 0) {
+      /* errno does not make it to the thread that merges the walks */
+      if (CSYNC_STATUS_IS_OK(ctx->status_code)) {
+        ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_UPDATE_ERROR);
+      }
+      break;
+    }
+  }
+  task->dir = NULL;
+}
+
+static int _csync_ftw_merge_tree(void *obj, void *data) {
+  csync_file_stat_t *st = (csync_file_stat_t *) obj;
+  CSYNC *ctx = (CSYNC *) data;
+
+  if (c_hashtable_insert(ctx->local.tree, st->phash, st) < 0) {
+    ctx->status_code = CSYNC_STATUS_TREE_ERROR;
+    return -1;
+  }
+
+  return 0;
+}
+
+int csync_ftw_parallel(CSYNC *ctx, const char *uri, unsigned int depth) {
+  csync_ftw_task_t *tasks = NULL;
+  csync_ftw_dirs_t dirs;
+  csync_ftw_dirs_t frontier;
+  csync_ftw_dir_t *root = NULL;
+  int task_count = 0;
+  int rc = -1;
+  size_t i;
+  int t;
+
+  if (ctx->callbacks.parallel_for_hook == NULL || ctx->statedb.snapshot == NULL
+      || ctx->current != LOCAL_REPLICA) {
+    return csync_ftw(ctx, uri, csync_walker, depth);
+  }
+
+  ZERO_STRUCT(dirs);
+  ZERO_STRUCT(frontier);
+
+  tasks = c_malloc(CSYNC_FTW_TASKS * sizeof(csync_ftw_task_t));
+  root = _csync_ftw_dir_new(NULL, uri, ctx, depth);
+  if (tasks == NULL || root == NULL || _csync_ftw_dirs_push(&dirs, root) < 0) {
+    SAFE_FREE(root);
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    goto out;
+  }
+  if (_csync_ftw_dirs_push(&frontier, root) < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    goto out;
+  }
+
+  while (frontier.count > 0) {
+    int count = MIN(frontier.count, CSYNC_FTW_TASKS);
+
+    for (t = task_count; t < count; t++) {
+      tasks[t].ctx = csync_walk_new(ctx);
+      if (tasks[t].ctx == NULL) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        goto out;
+      }
+      task_count++;
+      if (c_hashtable_create(&tasks[t].ctx->local.tree) < 0) {
+        tasks[t].ctx->local.tree = NULL;
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        goto out;
+      }
+    }
+
+    /* deal the directories out, each task starts with the first ones it got */
+    for (i = frontier.count; i-- > 0; ) {
+      if (_csync_ftw_dirs_push(&tasks[i % count].pending, frontier.dirs[i]) < 0) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        goto out;
+      }
+    }
+    frontier.count = 0;
+
+    ctx->callbacks.parallel_for_hook(_csync_ftw_task_run, tasks, count,
+                                     ctx->callbacks.parallel_for_userdata);
+
+    for (t = 0; t < count; t++) {
+      csync_ftw_task_t *task = &tasks[t];
+
+      for (i = 0; i < task->created.count; i++) {
+        if (_csync_ftw_dirs_push(&dirs, task->created.dirs[i]) < 0) {
+          /* the rest still belongs to the task */
+          memmove(task->created.dirs, task->created.dirs + i,
+                  (task->created.count - i) * sizeof(csync_ftw_dir_t *));
+          task->created.count -= i;
+          ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+          goto out;
+        }
+      }
+      task->created.count = 0;
+      if (task->rc < 0) {
+        goto out;
+      }
+      for (i = 0; i < task->pending.count; i++) {
+        if (_csync_ftw_dirs_push(&frontier, task->pending.dirs[i]) < 0) {
+          ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+          goto out;
+        }
+      }
+      task->pending.count = 0;
+    }
+  }
+
+  /* what csync_ftw() does after walking into a directory, the deepest first;
+   * the directory the walk starts at has nothing to finish */
+  for (i = dirs.count; i-- > 1; ) {
+    csync_ftw_dir_t *dir = dirs.dirs[i];
+
+    _csync_ftw_finish_dir(ctx, dir->fs, dir->parent->fs);
+    _csync_ftw_finish_entry(CSYNC_FTW_FLAG_DIR, dir->fs, dir->parent->fs);
+  }
+  rc = 0;
+
+out:
+  for (t = 0; t < task_count; t++) {
+    csync_ftw_task_t *task = &tasks[t];
+
+    if (task->ctx->local.tree) {
+      if (c_hashtable_walk(task->ctx->local.tree, ctx, _csync_ftw_merge_tree) < 0) {
+        rc = -1;
+      }
+      c_hashtable_free(task->ctx->local.tree);
+    }
+    if (task->rc < 0) {
+      rc = -1;
+    }
+    /* the first error wins */
+    if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
+      task->ctx->status_code = CSYNC_STATUS_OK;
+    }
+    csync_walk_merge(ctx, task->ctx);
+    for (i = 0; i < task->created.count; i++) {
+      SAFE_FREE(task->created.dirs[i]);
+    }
+    SAFE_FREE(task->created.dirs);
+    SAFE_FREE(task->pending.dirs);
+  }
+  for (i = 0; i < dirs.count; i++) {
+    SAFE_FREE(dirs.dirs[i]);
+  }
+  SAFE_FREE(dirs.dirs);
+  SAFE_FREE(frontier.dirs);
+  SAFE_FREE(tasks);
+
+  return rc;
+}
+
 /* vim: set ts=8 sw=2 et cindent: */
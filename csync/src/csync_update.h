@@ -94,6 +94,70 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
 int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     unsigned int depth);
 
+/**
+ * @brief The file tree walker for the local replica, on several threads.
+ *
+ * Walks like csync_ftw() with the walker csync_walker(). The directories are
+ * listed by tasks that ctx->callbacks.parallel_for_hook runs in rounds. A task
+ * goes depth first through the directories it was given. Once it listed
+ * enough entries for the round, it stops and hands the directories it did
+ * not reach to the next round, where the other tasks share them. What
+ * csync_ftw() does for a directory after walking its children is done
+ * afterwards, for all directories from the deepest up.
+ *
+ * Falls back to csync_ftw() if there is no parallel_for_hook, or if the
+ * journal was not loaded into the snapshot, as the tasks can not share the
+ * statedb connection.
+ *
+ * @param  ctx          The walk context of the local replica.
+ *
+ * @param  uri          The uri/path to the directory tree to walk.
+ *
+ * @param  depth        The max depth to walk down the tree.
+ *
+ * @return 0 on success, < 0 on error with the status code of ctx set.
+ */
+int csync_ftw_parallel(CSYNC *ctx, const char *uri, unsigned int depth);
+
+/**
+ * @brief Create a context to walk a replica on another thread.
+ *
+ * The copy has an arena, error state and rename info of its own. Apart from
+ * that it shares the read-only data of ctx, and its trees. It is aborted
+ * together with ctx.
+ *
+ * @param  ctx          The context to copy.
+ *
+ * @return The walk context, NULL if there is no memory left.
+ */
+CSYNC *csync_walk_new(CSYNC *ctx);
+
+/**
+ * @brief Merge a walk context of csync_walk_new() back into its context.
+ *
+ * Moves the file stats and the renames of walk to ctx, and if walk failed,
+ * its error. Frees walk.
+ *
+ * @param  ctx          The context walk was created from.
+ *
+ * @param  walk         The walk context to merge and free.
+ */
+void csync_walk_merge(CSYNC *ctx, CSYNC *walk);
+
+/**
+ * @brief Check the file system for ignored files below a local directory.
+ *
+ * The database does not know about ignored files, so this is needed before
+ * removing a local directory whose contents were read from the database.
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @param  path         The path of the directory, relative to the local uri.
+ *
+ * @return true if the directory contains files the walker would have ignored.
+ */
+bool csync_local_dir_has_ignored_files(CSYNC *ctx, const char *path);
+
 #endif /* _CSYNC_UPDATE_H */
 
 /* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
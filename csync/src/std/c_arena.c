@@ -0,0 +1,186 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2016 by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c_alloc.h"
+#include "c_macro.h"
+#include "c_arena.h"
+
+#define C_ARENA_BLOCK_SIZE (64 * 1024)
+#define C_ARENA_ALIGN 8
+
+struct c_arena_block_s {
+  c_arena_block_t *next;
+  size_t size;
+  size_t used;
+  /* keeps data aligned */
+  union {
+    char data[1];
+    int64_t align_i;
+    double align_d;
+    void *align_p;
+  } u;
+};
+
+static c_arena_block_t *_arena_block_new(size_t size) {
+  c_arena_block_t *block;
+
+  /* c_malloc zeroes the memory */
+  block = c_malloc(offsetof(c_arena_block_t, u) + size);
+  if (block == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  block->size = size;
+
+  return block;
+}
+
+int c_arena_create(c_arena_t **arena) {
+  c_arena_t *a;
+
+  if (arena == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  a = c_malloc(sizeof(c_arena_t));
+  if (a == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  a->block_size = C_ARENA_BLOCK_SIZE;
+
+  *arena = a;
+
+  return 0;
+}
+
+void c_arena_free(c_arena_t *arena) {
+  c_arena_block_t *block;
+
+  if (arena == NULL) {
+    return;
+  }
+
+  block = arena->blocks;
+  while (block != NULL) {
+    c_arena_block_t *next = block->next;
+    SAFE_FREE(block);
+    block = next;
+  }
+  SAFE_FREE(arena);
+}
+
+static void *_arena_alloc(c_arena_t *arena, size_t size, size_t align) {
+  c_arena_block_t *block;
+  size_t offset;
+
+  if (arena == NULL || size == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  block = arena->blocks;
+  if (block != NULL) {
+    offset = (block->used + align - 1) & ~(align - 1);
+    if (offset <= block->size && size <= block->size - offset) {
+      block->used = offset + size;
+      arena->used += size;
+      return block->u.data + offset;
+    }
+  }
+
+  if (size > arena->block_size / 4) {
+    /* Big allocations get a block of their own. It goes behind the
+     * current block so that block can still be filled. */
+    block = _arena_block_new(size);
+    if (block == NULL) {
+      return NULL;
+    }
+    if (arena->blocks != NULL) {
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+    } else {
+      arena->blocks = block;
+    }
+  } else {
+    block = _arena_block_new(arena->block_size);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+
+  block->used = size;
+  arena->used += size;
+
+  return block->u.data;
+}
+
+void *c_arena_alloc(c_arena_t *arena, size_t size) {
+  return _arena_alloc(arena, size, C_ARENA_ALIGN);
+}
+
+char *c_arena_strdup(c_arena_t *arena, const char *str) {
+  char *ret;
+  size_t len;
+
+  if (str == NULL) {
+    return NULL;
+  }
+
+  len = strlen(str);
+  /* strings do not need any alignment */
+  ret = _arena_alloc(arena, len + 1, 1);
+  if (ret == NULL) {
+    return NULL;
+  }
+  memcpy(ret, str, len + 1);
+
+  return ret;
+}
+
+void c_arena_merge(c_arena_t *arena, c_arena_t *other) {
+  c_arena_block_t *last;
+
+  if (arena == NULL || other == NULL) {
+    return;
+  }
+
+  if (other->blocks != NULL) {
+    /* keep filling the current block of arena, the blocks of other go behind it */
+    for (last = other->blocks; last->next != NULL; last = last->next);
+    if (arena->blocks != NULL) {
+      last->next = arena->blocks->next;
+      arena->blocks->next = other->blocks;
+    } else {
+      arena->blocks = other->blocks;
+    }
+  }
+  arena->used += other->used;
+
+  SAFE_FREE(other);
+}
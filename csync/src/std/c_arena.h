@@ -0,0 +1,115 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2016 by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file c_arena.h
+ *
+ * @brief Interface of the cynapses libc arena allocator
+ *
+ * An arena hands out memory from big blocks by bumping a pointer. The
+ * allocations can not be freed one by one, all of them are released at
+ * once with c_arena_free(). This suits data that lives for the same time,
+ * like the file stats of one sync run.
+ *
+ * @defgroup cynArenaInternals cynapses libc arena functions
+ * @ingroup cynLibraryAPI
+ *
+ * @{
+ */
+#ifndef _C_ARENA_H
+#define _C_ARENA_H
+
+#include <stddef.h>
+
+/* Forward declarations */
+struct c_arena_s; typedef struct c_arena_s c_arena_t;
+struct c_arena_block_s; typedef struct c_arena_block_s c_arena_block_t;
+
+/**
+ * Structure that represents an arena
+ */
+struct c_arena_s {
+  c_arena_block_t *blocks; /* the block that is filled first */
+  size_t block_size;
+  size_t used; /* bytes handed out, for statistics */
+};
+
+/**
+ * @brief Create an arena.
+ *
+ * @param arena   The pointer to assign the allocated memory.
+ *
+ * @return        0 on success, -1 if an error occured with errno set.
+ */
+int c_arena_create(c_arena_t **arena);
+
+/**
+ * @brief Free an arena and everything that was allocated from it.
+ *
+ * @param arena  The arena to free, may be NULL.
+ */
+void c_arena_free(c_arena_t *arena);
+
+/**
+ * @brief Allocate memory from an arena.
+ *
+ * The memory is set to zero and aligned for any of the types csync uses.
+ *
+ * @param arena  The arena to allocate from.
+ * @param size   Size in bytes to allocate.
+ *
+ * @return A pointer to the memory, which stays valid until the arena is
+ *         freed, or NULL with errno set.
+ */
+void *c_arena_alloc(c_arena_t *arena, size_t size);
+
+/**
+ * @brief Duplicate a string into an arena.
+ *
+ * @param arena  The arena to allocate from.
+ * @param str    String to duplicate, may be NULL.
+ *
+ * @return The copy, NULL if str is NULL or there is no memory left.
+ */
+char *c_arena_strdup(c_arena_t *arena, const char *str);
+
+/**
+ * @brief Move everything allocated from one arena into another.
+ *
+ * The memory of other stays valid and is released with arena from then on.
+ * other is freed. This lets two threads fill arenas of their own that are
+ * joined afterwards.
+ *
+ * @param arena  The arena to merge into.
+ * @param other  The arena to merge and free, may be NULL.
+ */
+void c_arena_merge(c_arena_t *arena, c_arena_t *other);
+
+/**
+ * @brief Get the number of bytes handed out by an arena.
+ *
+ * @param T  The arena to get the size from.
+ */
+#define c_arena_size(T) ((T) == NULL ? 0 : (T)->used)
+
+/**
+ * }@
+ */
+#endif /* _C_ARENA_H */
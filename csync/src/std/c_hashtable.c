@@ -0,0 +1,243 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2016 by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c_alloc.h"
+#include "c_macro.h"
+#include "c_hashtable.h"
+
+#define C_HASHTABLE_INITIAL_SHIFT 6 /* 64 slots */
+
+/* Fibonacci hashing: spreads the key over the top bits of the product */
+static size_t _hashtable_slot(const c_hashtable_t *table, uint64_t key) {
+  return (size_t) ((key * UINT64_C(0x9E3779B97F4A7C15)) >> table->shift);
+}
+
+static c_hashtable_entry_t *_hashtable_lookup(c_hashtable_entry_t *entries, const c_hashtable_t *table,
+                                              uint64_t key) {
+  size_t mask = table->capacity - 1;
+  size_t slot = _hashtable_slot(table, key);
+
+  while (entries[slot].data != NULL && entries[slot].key != key) {
+    slot = (slot + 1) & mask;
+  }
+  return &entries[slot];
+}
+
+static int _hashtable_grow(c_hashtable_t *table) {
+  c_hashtable_entry_t *old = table->entries;
+  size_t old_capacity = table->capacity;
+  c_hashtable_entry_t *entries;
+  size_t i;
+
+  entries = c_malloc(2 * old_capacity * sizeof(c_hashtable_entry_t));
+  if (entries == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  table->entries = entries;
+  table->capacity = 2 * old_capacity;
+  table->shift--;
+
+  for (i = 0; i < old_capacity; i++) {
+    if (old[i].data != NULL) {
+      *_hashtable_lookup(entries, table, old[i].key) = old[i];
+    }
+  }
+  SAFE_FREE(old);
+
+  return 0;
+}
+
+int c_hashtable_create(c_hashtable_t **table) {
+  c_hashtable_t *t;
+
+  if (table == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  t = c_malloc(sizeof(c_hashtable_t));
+  if (t == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  t->shift = 64 - C_HASHTABLE_INITIAL_SHIFT;
+  t->capacity = (size_t) 1 << C_HASHTABLE_INITIAL_SHIFT;
+  t->entries = c_malloc(t->capacity * sizeof(c_hashtable_entry_t));
+  if (t->entries == NULL) {
+    SAFE_FREE(t);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  *table = t;
+
+  return 0;
+}
+
+void c_hashtable_free(c_hashtable_t *table) {
+  if (table == NULL) {
+    return;
+  }
+  SAFE_FREE(table->entries);
+  SAFE_FREE(table->sorted);
+  SAFE_FREE(table);
+}
+
+void c_hashtable_destroy(c_hashtable_t *table, c_hashtable_destructor_func *destructor) {
+  size_t i;
+
+  if (table == NULL) {
+    return;
+  }
+  if (destructor != NULL) {
+    for (i = 0; i < table->capacity; i++) {
+      if (table->entries[i].data != NULL) {
+        destructor(table->entries[i].data);
+      }
+    }
+  }
+  c_hashtable_free(table);
+}
+
+int c_hashtable_insert(c_hashtable_t *table, uint64_t key, void *data) {
+  c_hashtable_entry_t *entry;
+
+  if (table == NULL || data == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* keep the load factor at or below 1/2 */
+  if (2 * (table->size + 1) > table->capacity) {
+    if (_hashtable_grow(table) < 0) {
+      return -1;
+    }
+  }
+
+  entry = _hashtable_lookup(table->entries, table, key);
+  if (entry->data != NULL) {
+    return 1;
+  }
+  entry->key = key;
+  entry->data = data;
+  table->size++;
+
+  return 0;
+}
+
+void *c_hashtable_find(const c_hashtable_t *table, uint64_t key) {
+  if (table == NULL) {
+    return NULL;
+  }
+  return _hashtable_lookup(table->entries, table, key)->data;
+}
+
+/* LSD radix sort of the entries by key, one byte per pass. Passes where
+ * all keys share the byte are skipped. */
+static int _hashtable_sort(c_hashtable_t *table) {
+  c_hashtable_entry_t *sorted;
+  c_hashtable_entry_t *tmp;
+  size_t n = 0;
+  size_t i;
+  unsigned int pass;
+
+  SAFE_FREE(table->sorted);
+  table->sorted_size = 0;
+  if (table->size == 0) {
+    return 0;
+  }
+
+  sorted = c_malloc(table->size * sizeof(c_hashtable_entry_t));
+  tmp = c_malloc(table->size * sizeof(c_hashtable_entry_t));
+  if (sorted == NULL || tmp == NULL) {
+    SAFE_FREE(sorted);
+    SAFE_FREE(tmp);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  for (i = 0; i < table->capacity; i++) {
+    if (table->entries[i].data != NULL) {
+      sorted[n++] = table->entries[i];
+    }
+  }
+
+  for (pass = 0; pass < 8; pass++) {
+    unsigned int shift = pass * 8;
+    size_t count[256];
+    size_t offset = 0;
+    c_hashtable_entry_t *swap;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+      count[(sorted[i].key >> shift) & 0xff]++;
+    }
+    if (count[(sorted[0].key >> shift) & 0xff] == n) {
+      continue;
+    }
+    for (i = 0; i < 256; i++) {
+      size_t c = count[i];
+      count[i] = offset;
+      offset += c;
+    }
+    for (i = 0; i < n; i++) {
+      tmp[count[(sorted[i].key >> shift) & 0xff]++] = sorted[i];
+    }
+    swap = sorted;
+    sorted = tmp;
+    tmp = swap;
+  }
+  SAFE_FREE(tmp);
+
+  table->sorted = sorted;
+  table->sorted_size = n;
+
+  return 0;
+}
+
+int c_hashtable_walk(c_hashtable_t *table, void *data, c_hashtable_visit_func *visitor) {
+  size_t i;
+
+  if (table == NULL || data == NULL || visitor == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (table->sorted_size != table->size) {
+    if (_hashtable_sort(table) < 0) {
+      return -1;
+    }
+  }
+
+  for (i = 0; i < table->sorted_size; i++) {
+    if (visitor(table->sorted[i].data, data) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2016 by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file c_hashtable.h
+ *
+ * @brief Interface of the cynapses libc hash table implementation
+ *
+ * A hash table mapping 64 bit keys, usually hashes themselves, to data
+ * pointers. The entries are stored inline in one array with open addressing
+ * and linear probing, so a lookup touches one or two cache lines instead of
+ * following a pointer per tree level like c_rbtree does.
+ *
+ * c_hashtable_walk() visits the entries in ascending key order, the order of
+ * c_rbtree_walk() for the same keys. The order is computed with a radix sort
+ * when the table is walked for the first time after an insert.
+ *
+ * Entries can not be removed, the table only grows until it is destroyed.
+ *
+ * @defgroup cynHashtableInternals cynapses libc hash table functions
+ * @ingroup cynLibraryAPI
+ *
+ * @{
+ */
+#ifndef _C_HASHTABLE_H
+#define _C_HASHTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Forward declarations */
+struct c_hashtable_s; typedef struct c_hashtable_s c_hashtable_t;
+struct c_hashtable_entry_s; typedef struct c_hashtable_entry_s c_hashtable_entry_t;
+
+/**
+ * @brief Visit function for the c_hashtable_walk() function.
+ *
+ * @param obj    The entry data that will be passed by c_hashtable_walk().
+ * @param data   Generic data pointer.
+ *
+ * @return 0 on success, < 0 on error. You should set errno.
+ */
+typedef int c_hashtable_visit_func(void *obj, void *data);
+
+/**
+ * @brief Destructor for the data of the entries, see c_hashtable_destroy().
+ */
+typedef void c_hashtable_destructor_func(void *data);
+
+/**
+ * Structure that represents an entry of the hash table
+ */
+struct c_hashtable_entry_s {
+  uint64_t key;
+  void *data; /* NULL marks an empty slot */
+};
+
+/**
+ * Structure that represents a hash table
+ */
+struct c_hashtable_s {
+  c_hashtable_entry_t *entries;
+  size_t capacity; /* a power of two */
+  unsigned int shift;
+  size_t size;
+
+  /* the entries in key order, valid while sorted_size == size */
+  c_hashtable_entry_t *sorted;
+  size_t sorted_size;
+};
+
+/**
+ * @brief Create the hash table
+ *
+ * @param table   The pointer to assign the allocated memory.
+ *
+ * @return        0 on success, -1 if an error occured with errno set.
+ */
+int c_hashtable_create(c_hashtable_t **table);
+
+/**
+ * @brief Free the structure of a hash table.
+ *
+ * The data of the entries is not touched, use c_hashtable_destroy() to free
+ * it as well.
+ *
+ * @param table  The table to free.
+ */
+void c_hashtable_free(c_hashtable_t *table);
+
+/**
+ * @brief Call the destructor on the data of every entry and free the table.
+ *
+ * @param table       The table to destroy.
+ * @param destructor  The destructor to call on the data of each entry.
+ */
+void c_hashtable_destroy(c_hashtable_t *table, c_hashtable_destructor_func *destructor);
+
+/**
+ * @brief Insert data into a hash table.
+ *
+ * @param table  The table to insert into.
+ * @param key    The key of the data.
+ * @param data   The data to insert, must not be NULL.
+ *
+ * @return  0 on success, 1 if the key was already there and < 0 if an error
+ *          occured with errno set.
+ *          EINVAL if a null pointer has been passed as table or data.
+ *          ENOMEM if there is no memory left.
+ */
+int c_hashtable_insert(c_hashtable_t *table, uint64_t key, void *data);
+
+/**
+ * @brief Find data in a hash table.
+ *
+ * @param table  The table to search.
+ * @param key    The key to search for.
+ *
+ * @return  The data stored for the key, NULL if it was not found.
+ */
+void *c_hashtable_find(const c_hashtable_t *table, uint64_t key);
+
+/**
+ * @brief Get the number of entries in the hash table.
+ *
+ * @param T  The table to get the size from.
+ *
+ * @return  The number of entries.
+ */
+#define c_hashtable_size(T) ((T) == NULL ? 0 : (T)->size)
+
+/**
+ * @brief Walk over a hash table in ascending key order.
+ *
+ * The visitor must not insert into the table it walks.
+ *
+ * @param table    Table to walk.
+ * @param data     Data which should be passed to the visitor function.
+ * @param visitor  Visitor function. This will be called for each entry.
+ *
+ * @return   0 on sucess, less than 0 if an error occured.
+ */
+int c_hashtable_walk(c_hashtable_t *table, void *data, c_hashtable_visit_func *visitor);
+
+/**
+ * }@
+ */
+#endif /* _C_HASHTABLE_H */
@@ -23,6 +23,8 @@
 
 #include "c_macro.h"
 #include "c_alloc.h"
+#include "c_arena.h"
+#include "c_hashtable.h"
 #include "c_path.h"
 #include "c_rbtree.h"
 #include "c_string.h"
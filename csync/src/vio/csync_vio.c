@@ -31,6 +31,7 @@
 #include "vio/csync_vio.h"
 #include "vio/csync_vio_local.h"
 #include "csync_statedb.h"
+#include "csync_changes.h"
 #include "std/c_jhash.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.vio.main"
@@ -43,6 +44,9 @@ csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
       if(ctx->remote.read_from_db) {
           CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Read from db flag is true, should not!" );
       }
+      if (ctx->remote.changes) {
+          return csync_remote_changes_opendir(ctx, name);
+      }
       return ctx->callbacks.remote_opendir_hook(name, ctx->callbacks.vio_userdata);
       break;
     case LOCAL_REPLICA:
@@ -71,7 +75,11 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
       if( ctx->remote.read_from_db ) {
           CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Remote ReadFromDb is true, should not!");
       }
-      ctx->callbacks.remote_closedir_hook(dhandle, ctx->callbacks.vio_userdata);
+      if (ctx->remote.changes) {
+          csync_remote_changes_closedir(ctx, dhandle);
+      } else {
+          ctx->callbacks.remote_closedir_hook(dhandle, ctx->callbacks.vio_userdata);
+      }
       rc = 0;
       break;
   case LOCAL_REPLICA:
@@ -90,6 +98,10 @@ csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle
       if( ctx->remote.read_from_db ) {
           CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Remote readfromdb is true, should not!");
       }
+      errno = 0; /* the hook sets it if the listing is incomplete */
+      if (ctx->remote.changes) {
+          return csync_remote_changes_readdir(ctx, dhandle);
+      }
       return ctx->callbacks.remote_readdir_hook(dhandle, ctx->callbacks.vio_userdata);
       break;
     case LOCAL_REPLICA:
@@ -0,0 +1,253 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016 by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <string.h>
+
+#include "torture.h"
+
+#include "csync_private.h"
+#include "csync_changes.h"
+#include "csync_statedb.h"
+#include "std/c_jhash.h"
+
+#define TESTDB "/tmp/check_csync_changes/journal.db"
+
+typedef struct listing_s {
+    char names[16][64];
+    char etags[16][64];
+    int count;
+} listing_t;
+
+static void statedb_insert(sqlite3 *db, const char *path, int type, const char *etag)
+{
+    char *stmt = sqlite3_mprintf("INSERT INTO metadata"
+                                 "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize) VALUES"
+                                 "(%lld, %d, '%q', 0, 0, 0, 0, 42, %d, '%q', '%q', 'RDNVW', 4);",
+                                 (long long signed int) c_jhash64((uint8_t *) path, strlen(path), 0),
+                                 (int) strlen(path), path, type, etag, path);
+    int rc = sqlite3_exec(db, stmt, NULL, NULL, NULL);
+    sqlite3_free(stmt);
+    assert_int_equal(rc, SQLITE_OK);
+}
+
+static void setup(void **state)
+{
+    CSYNC *csync;
+    sqlite3 *db = NULL;
+    int rc;
+
+    rc = system("rm -rf /tmp/check_csync_changes && mkdir -p /tmp/check_csync_changes");
+    assert_int_equal(rc, 0);
+
+    rc = sqlite3_open(TESTDB, &db);
+    assert_int_equal(rc, SQLITE_OK);
+    rc = sqlite3_exec(db, "CREATE TABLE metadata("
+                          "phash INTEGER(8), pathlen INTEGER, path VARCHAR(4096), inode INTEGER,"
+                          "uid INTEGER, gid INTEGER, mode INTEGER, modtime INTEGER(8), type INTEGER,"
+                          "md5 VARCHAR(32), fileid VARCHAR(128), remotePerm VARCHAR(128),"
+                          "filesize BIGINT, ignoredChildrenRemote INT, contentChecksum TEXT,"
+                          "contentChecksumTypeId INTEGER, PRIMARY KEY(phash));", NULL, NULL, NULL);
+    assert_int_equal(rc, SQLITE_OK);
+    statedb_insert(db, "a", CSYNC_FTW_TYPE_DIR, "ea");
+    statedb_insert(db, "a/x", CSYNC_FTW_TYPE_FILE, "ex");
+    statedb_insert(db, "a/y", CSYNC_FTW_TYPE_FILE, "ey");
+    statedb_insert(db, "a/sub", CSYNC_FTW_TYPE_DIR, "esub");
+    statedb_insert(db, "a/sub/z", CSYNC_FTW_TYPE_FILE, "ez");
+    /* sorts between "a" and "a/x" */
+    statedb_insert(db, "a b", CSYNC_FTW_TYPE_FILE, "eab");
+    statedb_insert(db, "b", CSYNC_FTW_TYPE_DIR, "eb");
+    statedb_insert(db, "b/w", CSYNC_FTW_TYPE_FILE, "ew");
+    statedb_insert(db, "c", CSYNC_FTW_TYPE_FILE, "ec");
+    sqlite3_close(db);
+
+    rc = csync_create(&csync, "/tmp/check_csync_changes", "owncloud://server/dav");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+    rc = csync_statedb_load(csync, TESTDB, &csync->statedb.db);
+    assert_int_equal(rc, 0);
+    rc = csync_statedb_load_snapshot(csync);
+    assert_int_equal(rc, 0);
+
+    *state = csync;
+}
+
+static void teardown(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+
+    rc = system("rm -rf /tmp/check_csync_changes");
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
+static int collect_child(const char *path, csync_vio_file_stat_t *fs, void *data)
+{
+    listing_t *listing = data;
+
+    (void) path;
+    strcpy(listing->names[listing->count], fs->name);
+    strcpy(listing->etags[listing->count], fs->etag ? fs->etag : "");
+    listing->count++;
+    csync_vio_file_stat_destroy(fs);
+
+    return 0;
+}
+
+static void read_listing(CSYNC *csync, const char *path, listing_t *listing)
+{
+    csync_vio_handle_t *dh;
+    csync_vio_file_stat_t *fs;
+
+    memset(listing, 0, sizeof(listing_t));
+    dh = csync_remote_changes_opendir(csync, path);
+    assert_non_null(dh);
+    while ((fs = csync_remote_changes_readdir(csync, dh))) {
+        collect_child(NULL, fs, listing);
+    }
+    csync_remote_changes_closedir(csync, dh);
+}
+
+static int find_name(const listing_t *listing, const char *name)
+{
+    int i;
+
+    for (i = 0; i < listing->count; i++) {
+        if (strcmp(listing->names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static csync_vio_file_stat_t *new_stat(const char *etag, enum csync_vio_file_type_e type)
+{
+    csync_vio_file_stat_t *fs = csync_vio_file_stat_new();
+
+    fs->name = c_strdup("ignored");
+    fs->etag = c_strdup(etag);
+    fs->type = type;
+    fs->fields = CSYNC_VIO_FILE_STAT_FIELDS_TYPE | CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
+    return fs;
+}
+
+static void check_csync_statedb_get_children(void **state)
+{
+    CSYNC *csync = *state;
+    listing_t listing;
+    int rc;
+
+    memset(&listing, 0, sizeof(listing));
+    rc = csync_statedb_get_children(csync, "", collect_child, &listing);
+    assert_int_equal(rc, 0);
+    assert_int_equal(listing.count, 4);
+    assert_true(find_name(&listing, "a") >= 0);
+    assert_true(find_name(&listing, "a b") >= 0);
+    assert_true(find_name(&listing, "b") >= 0);
+    assert_true(find_name(&listing, "c") >= 0);
+
+    memset(&listing, 0, sizeof(listing));
+    rc = csync_statedb_get_children(csync, "a", collect_child, &listing);
+    assert_int_equal(rc, 0);
+    assert_int_equal(listing.count, 3);
+    assert_string_equal(listing.etags[find_name(&listing, "sub")], "esub");
+    assert_string_equal(listing.etags[find_name(&listing, "x")], "ex");
+    assert_true(find_name(&listing, "y") >= 0);
+
+    memset(&listing, 0, sizeof(listing));
+    rc = csync_statedb_get_children(csync, "c", collect_child, &listing);
+    assert_int_equal(rc, 0);
+    assert_int_equal(listing.count, 0);
+}
+
+static void check_csync_remote_changes_below(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    assert_false(csync_remote_changes_below(csync, ""));
+
+    rc = csync_remote_changes_init(csync);
+    assert_int_equal(rc, 0);
+    rc = csync_remote_changes_add(csync, "n/m/f", new_stat("ef", CSYNC_VIO_FILE_TYPE_REGULAR));
+    assert_int_equal(rc, 0);
+
+    assert_true(csync_remote_changes_below(csync, ""));
+    assert_true(csync_remote_changes_below(csync, "n"));
+    assert_true(csync_remote_changes_below(csync, "n/m"));
+    assert_false(csync_remote_changes_below(csync, "n/m/f"));
+    assert_false(csync_remote_changes_below(csync, "a"));
+
+    csync_remote_changes_destroy(csync);
+    assert_null(csync->remote.changes);
+    assert_false(csync_remote_changes_below(csync, "n"));
+}
+
+static void check_csync_remote_changes_listing(void **state)
+{
+    CSYNC *csync = *state;
+    listing_t listing;
+    int rc;
+
+    rc = csync_remote_changes_init(csync);
+    assert_int_equal(rc, 0);
+    rc = csync_remote_changes_add(csync, "a/y", NULL);
+    assert_int_equal(rc, 0);
+    rc = csync_remote_changes_add(csync, "a/x", new_stat("ex2", CSYNC_VIO_FILE_TYPE_REGULAR));
+    assert_int_equal(rc, 0);
+    rc = csync_remote_changes_add(csync, "a/new", new_stat("enew", CSYNC_VIO_FILE_TYPE_REGULAR));
+    assert_int_equal(rc, 0);
+    /* reported twice, the last one wins */
+    rc = csync_remote_changes_add(csync, "a/new", new_stat("enew2", CSYNC_VIO_FILE_TYPE_REGULAR));
+    assert_int_equal(rc, 0);
+    rc = csync_remote_changes_add(csync, "", new_stat("eroot", CSYNC_VIO_FILE_TYPE_DIRECTORY));
+    assert_int_equal(rc, 0);
+
+    read_listing(csync, "a", &listing);
+    assert_int_equal(listing.count, 3);
+    assert_string_equal(listing.etags[find_name(&listing, "sub")], "esub");
+    assert_string_equal(listing.etags[find_name(&listing, "x")], "ex2");
+    assert_string_equal(listing.etags[find_name(&listing, "new")], "enew2");
+    assert_int_equal(find_name(&listing, "y"), -1);
+
+    /* unchanged directories list what the db has */
+    read_listing(csync, "b", &listing);
+    assert_int_equal(listing.count, 1);
+    assert_string_equal(listing.names[0], "w");
+
+    read_listing(csync, "", &listing);
+    assert_int_equal(listing.count, 4);
+    assert_string_equal(listing.etags[find_name(&listing, "a")], "ea");
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_statedb_get_children, setup, teardown),
+        unit_test_setup_teardown(check_csync_remote_changes_below, setup, teardown),
+        unit_test_setup_teardown(check_csync_remote_changes_listing, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
@@ -171,45 +171,45 @@ static void check_csync_excluded_traversal(void **state)
     _csync_exclude_add( &(csync->excludes), "/exclude" );
 
     /* Check toplevel dir, the pattern only works for toplevel dir. */
-    rc = csync_excluded_traversal(csync->excludes, "/exclude", CSYNC_FTW_TYPE_DIR);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "/exclude", CSYNC_FTW_TYPE_DIR);
     assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
 
-    rc = csync_excluded_traversal(csync->excludes, "/foo/exclude", CSYNC_FTW_TYPE_DIR);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "/foo/exclude", CSYNC_FTW_TYPE_DIR);
     assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
 
     /* check for a file called exclude. Must still work */
-    rc = csync_excluded_traversal(csync->excludes, "/exclude", CSYNC_FTW_TYPE_FILE);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "/exclude", CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
 
-    rc = csync_excluded_traversal(csync->excludes, "/foo/exclude", CSYNC_FTW_TYPE_FILE);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "/foo/exclude", CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
 
     /* Add an exclude for directories only: excl/ */
     _csync_exclude_add( &(csync->excludes), "excl/" );
-    rc = csync_excluded_traversal(csync->excludes, "/excl", CSYNC_FTW_TYPE_DIR);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "/excl", CSYNC_FTW_TYPE_DIR);
     assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
 
-    rc = csync_excluded_traversal(csync->excludes, "meep/excl", CSYNC_FTW_TYPE_DIR);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "meep/excl", CSYNC_FTW_TYPE_DIR);
     assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
 
-    rc = csync_excluded_traversal(csync->excludes, "meep/excl/file", CSYNC_FTW_TYPE_FILE);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "meep/excl/file", CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, CSYNC_NOT_EXCLUDED); // because leading dirs aren't checked!
 
-    rc = csync_excluded_traversal(csync->excludes, "/excl", CSYNC_FTW_TYPE_FILE);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "/excl", CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
 
     _csync_exclude_add(&csync->excludes, "/excludepath/withsubdir");
 
-    rc = csync_excluded_traversal(csync->excludes, "/excludepath/withsubdir", CSYNC_FTW_TYPE_DIR);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "/excludepath/withsubdir", CSYNC_FTW_TYPE_DIR);
     assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
 
-    rc = csync_excluded_traversal(csync->excludes, "/excludepath/withsubdir", CSYNC_FTW_TYPE_FILE);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "/excludepath/withsubdir", CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
 
-    rc = csync_excluded_traversal(csync->excludes, "/excludepath/withsubdir2", CSYNC_FTW_TYPE_DIR);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "/excludepath/withsubdir2", CSYNC_FTW_TYPE_DIR);
     assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
 
-    rc = csync_excluded_traversal(csync->excludes, "/excludepath/withsubdir/foo", CSYNC_FTW_TYPE_DIR);
+    rc = csync_excluded_traversal(csync_exclude_compile(csync), "/excludepath/withsubdir/foo", CSYNC_FTW_TYPE_DIR);
     assert_int_equal(rc, CSYNC_NOT_EXCLUDED); // because leading dirs aren't checked!
 }
 
@@ -263,6 +263,71 @@ static void check_csync_pathes(void **state)
     assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
 }
 
+static void check_csync_exclude_matcher(void **state)
+{
+    c_strlist_t *excludes = NULL;
+    csync_exclude_matcher_t *matcher;
+    int rc;
+
+    (void) state;
+
+    _csync_exclude_add(&excludes, "]*.bak");
+    _csync_exclude_add(&excludes, "notes.bak");
+    _csync_exclude_add(&excludes, "cache*");
+    _csync_exclude_add(&excludes, "build/");
+    _csync_exclude_add(&excludes, "a?c");
+    _csync_exclude_add(&excludes, "]abc");
+    matcher = csync_exclude_matcher_new(excludes);
+
+    /* the earliest matching pattern decides the type */
+    rc = csync_excluded_no_ctx(matcher, "dir/notes.bak", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_AND_REMOVE);
+    rc = csync_excluded_no_ctx(matcher, "dir/abc", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_traversal(matcher, "cache12/x", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    rc = csync_excluded_no_ctx(matcher, "cache12/x", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_no_ctx(matcher, "ca", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+
+    /* dirs only patterns */
+    rc = csync_excluded_no_ctx(matcher, "src/build", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    rc = csync_excluded_no_ctx(matcher, "src/build", CSYNC_FTW_TYPE_DIR);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_no_ctx(matcher, "src/build/main.o", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+
+    /* the matcher keeps its own copy of the patterns */
+    c_strlist_clear(excludes);
+    rc = csync_excluded_no_ctx(matcher, "x/abc", CSYNC_FTW_TYPE_DIR);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+
+    csync_exclude_matcher_free(matcher);
+    c_strlist_destroy(excludes);
+
+    /* no patterns at all */
+    matcher = csync_exclude_matcher_new(NULL);
+    rc = csync_excluded_no_ctx(matcher, "abc", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    rc = csync_excluded_no_ctx(matcher, "a_conflict-1", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_SILENTLY_EXCLUDED);
+    csync_exclude_matcher_free(matcher);
+
+    /* the conflict files of the user, with and without a matcher */
+    setenv("CSYNC_CONFLICT_FILE_USERNAME", "alice", 1);
+    matcher = csync_exclude_matcher_new(NULL);
+    rc = csync_excluded_no_ctx(matcher, "dir/a_conflict_alice-1", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_SILENTLY_EXCLUDED);
+    csync_exclude_matcher_free(matcher);
+    rc = csync_excluded_no_ctx(NULL, "dir/a_conflict_alice-1", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_SILENTLY_EXCLUDED);
+    rc = csync_excluded_no_ctx(NULL, "dir/a_conflict_bob-1", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    unsetenv("CSYNC_CONFLICT_FILE_USERNAME");
+}
+
 static void check_csync_is_windows_reserved_word() {
     assert_true(csync_is_windows_reserved_word("CON"));
     assert_true(csync_is_windows_reserved_word("con"));
@@ -312,8 +377,8 @@ static void check_csync_excluded_performance(void **state)
         gettimeofday(&before, 0);
 
         for (int i = 0; i < N; ++i) {
-            totalRc += csync_excluded_traversal(csync->excludes, "/this/is/quite/a/long/path/with/many/components", CSYNC_FTW_TYPE_DIR);
-            totalRc += csync_excluded_traversal(csync->excludes, "/1/2/3/4/5/6/7/8/9/10/11/12/13/14/15/16/17/18/19/20/21/22/23/24/25/26/27/29", CSYNC_FTW_TYPE_FILE);
+            totalRc += csync_excluded_traversal(csync_exclude_compile(csync), "/this/is/quite/a/long/path/with/many/components", CSYNC_FTW_TYPE_DIR);
+            totalRc += csync_excluded_traversal(csync_exclude_compile(csync), "/1/2/3/4/5/6/7/8/9/10/11/12/13/14/15/16/17/18/19/20/21/22/23/24/25/26/27/29", CSYNC_FTW_TYPE_FILE);
         }
         assert_int_equal(totalRc, CSYNC_NOT_EXCLUDED); // mainly to avoid optimization
 
@@ -334,6 +399,7 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_excluded, setup_init, teardown),
         unit_test_setup_teardown(check_csync_excluded_traversal, setup_init, teardown),
         unit_test_setup_teardown(check_csync_pathes, setup_init, teardown),
+        unit_test(check_csync_exclude_matcher),
         unit_test_setup_teardown(check_csync_is_windows_reserved_word, setup_init, teardown),
         unit_test_setup_teardown(check_csync_excluded_performance, setup_init, teardown),
     };
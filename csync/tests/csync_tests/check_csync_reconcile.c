@@ -0,0 +1,202 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016 by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "torture.h"
+
+#include "csync_private.h"
+#include "csync_reconcile.h"
+#include "csync_rename.h"
+#include "csync_util.h"
+#include "std/c_jhash.h"
+
+#define SUBTREES 40
+
+static void add_file(CSYNC *csync, c_hashtable_t *tree, const char *path,
+                     int type, enum csync_instructions_e instruction, time_t modtime)
+{
+    size_t len = strlen(path);
+    csync_file_stat_t *st = csync_file_stat_new(csync, len);
+    int rc;
+
+    assert_non_null(st);
+    memcpy(st->path, path, len + 1);
+    st->pathlen = len;
+    st->phash = c_jhash64((uint8_t *) path, len, 0);
+    st->type = type;
+    st->instruction = instruction;
+    st->modtime = modtime;
+
+    rc = c_hashtable_insert(tree, st->phash, st);
+    assert_int_equal(rc, 0);
+}
+
+/* The same trees for every context: each subtree has unchanged, changed,
+ * new, removed and conflicting files, an ignored directory on one side and
+ * a folder that was renamed on the server into the next subtree. */
+static CSYNC *create_replicas(void)
+{
+    CSYNC *csync;
+    char path[64];
+    int i;
+    int rc;
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "dummy://foo/bar");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    for (i = 0; i < SUBTREES; i++) {
+        c_hashtable_t *local = csync->local.tree;
+        c_hashtable_t *remote = csync->remote.tree;
+
+        snprintf(path, sizeof(path), "dir%d", i);
+        add_file(csync, local, path, CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_NONE, 1);
+        add_file(csync, remote, path, CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_NONE, 1);
+
+        snprintf(path, sizeof(path), "dir%d/same", i);
+        add_file(csync, local, path, CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NONE, 1);
+        add_file(csync, remote, path, CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NONE, 1);
+
+        snprintf(path, sizeof(path), "dir%d/changed", i);
+        add_file(csync, local, path, CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_EVAL, 2);
+        add_file(csync, remote, path, CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NONE, 1);
+
+        snprintf(path, sizeof(path), "dir%d/new", i);
+        add_file(csync, remote, path, CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NEW, 1);
+
+        snprintf(path, sizeof(path), "dir%d/removed", i);
+        add_file(csync, local, path, CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NONE, 1);
+
+        snprintf(path, sizeof(path), "dir%d/conflict", i);
+        add_file(csync, local, path, CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NEW, 1);
+        add_file(csync, remote, path, CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NEW, 2);
+
+        snprintf(path, sizeof(path), "dir%d/ignored", i);
+        add_file(csync, remote, path, CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_IGNORE, 1);
+        snprintf(path, sizeof(path), "dir%d/ignored/sub/file", i);
+        add_file(csync, local, path, CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_EVAL, 1);
+
+        /* dir<i>/moved was renamed to dir<i+1>/arrived on the server */
+        snprintf(path, sizeof(path), "dir%d/moved/file", i);
+        add_file(csync, local, path, CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_EVAL, 2);
+        snprintf(path, sizeof(path), "dir%d/arrived/file", i + 1);
+        add_file(csync, remote, path, CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NONE, 1);
+        {
+            char from[64];
+            snprintf(from, sizeof(from), "dir%d/moved", i);
+            snprintf(path, sizeof(path), "dir%d/arrived", i + 1);
+            csync_rename_record(csync, from, path);
+        }
+    }
+
+    return csync;
+}
+
+/* Runs the jobs one after the other, starting with the last */
+static void reverse_parallel_for(void (*job)(void *data, int index), void *data, int count, void *userdata)
+{
+    int *calls = (int *) userdata;
+
+    while (count-- > 0) {
+        job(data, count);
+    }
+    (*calls)++;
+}
+
+static void reconcile(CSYNC *csync)
+{
+    int rc;
+
+    csync->current = LOCAL_REPLICA;
+    rc = csync_reconcile_updates(csync);
+    assert_int_equal(rc, 0);
+
+    csync->current = REMOTE_REPLICA;
+    rc = csync_reconcile_updates(csync);
+    assert_int_equal(rc, 0);
+}
+
+static void assert_same_instructions(c_hashtable_t *expected, c_hashtable_t *actual)
+{
+    size_t i;
+
+    assert_true(c_hashtable_size(expected) == c_hashtable_size(actual));
+    for (i = 0; i < expected->capacity; i++) {
+        csync_file_stat_t *e = expected->entries[i].data;
+        csync_file_stat_t *a;
+
+        if (e == NULL) {
+            continue;
+        }
+        a = c_hashtable_find(actual, e->phash);
+        assert_non_null(a);
+        assert_string_equal(csync_instruction_str(a->instruction), csync_instruction_str(e->instruction));
+    }
+}
+
+static void check_csync_reconcile_parallel(void **state)
+{
+    CSYNC *serial = create_replicas();
+    CSYNC *parallel = create_replicas();
+    csync_file_stat_t *st;
+    int calls = 0;
+    int rc;
+
+    (void) state; /* unused */
+
+    reconcile(serial);
+
+    parallel->callbacks.parallel_for_hook = reverse_parallel_for;
+    parallel->callbacks.parallel_for_userdata = &calls;
+    reconcile(parallel);
+    assert_int_equal(calls, 2);
+
+    assert_same_instructions(serial->local.tree, parallel->local.tree);
+    assert_same_instructions(serial->remote.tree, parallel->remote.tree);
+
+    st = c_hashtable_find(parallel->local.tree, c_jhash64((uint8_t *) "dir3/changed", 12, 0));
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_SYNC);
+    st = c_hashtable_find(parallel->local.tree, c_jhash64((uint8_t *) "dir3/removed", 12, 0));
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_REMOVE);
+    st = c_hashtable_find(parallel->local.tree, c_jhash64((uint8_t *) "dir3/ignored/sub/file", 21, 0));
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_IGNORE);
+    st = c_hashtable_find(parallel->remote.tree, c_jhash64((uint8_t *) "dir3/new", 8, 0));
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
+    /* found through the rename in the next subtree */
+    st = c_hashtable_find(parallel->local.tree, c_jhash64((uint8_t *) "dir3/moved/file", 15, 0));
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_SYNC);
+
+    rc = csync_destroy(serial);
+    assert_int_equal(rc, 0);
+    rc = csync_destroy(parallel);
+    assert_int_equal(rc, 0);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test(check_csync_reconcile_parallel),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,133 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016 by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "torture.h"
+
+#include "csync_private.h"
+#include "csync_rename.h"
+
+static void setup(void **state) {
+    CSYNC *csync;
+    int rc;
+
+    rc = csync_create(&csync, "/tmp/csync1", "/tmp/csync2");
+    assert_int_equal(rc, 0);
+
+    *state = csync;
+}
+
+static void teardown(void **state) {
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
+static void assert_adjusted(CSYNC *csync, const char *path, const char *expected)
+{
+    char *adjusted = csync_rename_adjust_path(csync, path);
+    assert_string_equal(adjusted, expected);
+    SAFE_FREE(adjusted);
+}
+
+static void assert_source(CSYNC *csync, const char *path, const char *expected)
+{
+    char *source = csync_rename_adjust_path_source(csync, path);
+    assert_string_equal(source, expected);
+    SAFE_FREE(source);
+}
+
+static void check_csync_rename_none(void **state)
+{
+    CSYNC *csync = *state;
+
+    assert_adjusted(csync, "A/B/file", "A/B/file");
+    assert_source(csync, "A/B/file", "A/B/file");
+
+    csync_rename_record(csync, "X", "Y");
+    assert_adjusted(csync, "A/B/file", "A/B/file");
+    assert_adjusted(csync, "XX/file", "XX/file");
+}
+
+static void check_csync_rename_adjust(void **state)
+{
+    CSYNC *csync = *state;
+
+    csync_rename_record(csync, "A/B", "A/C");
+    csync_rename_record(csync, "A/B/D/E", "F");
+
+    /* only the parents are adjusted, not the path itself */
+    assert_adjusted(csync, "A/B", "A/B");
+    assert_adjusted(csync, "A/B/file", "A/C/file");
+    assert_adjusted(csync, "A/B/D/file", "A/C/D/file");
+    assert_adjusted(csync, "A/BB/file", "A/BB/file");
+
+    /* the nearest renamed parent wins */
+    assert_adjusted(csync, "A/B/D/E/file", "F/file");
+    assert_adjusted(csync, "A/B/D/E/G/file", "F/G/file");
+
+    assert_source(csync, "A/C/file", "A/B/file");
+    assert_source(csync, "F/G/file", "A/B/D/E/G/file");
+    assert_source(csync, "A/B/file", "A/B/file");
+
+    /* a later record of the same folder replaces the earlier one */
+    csync_rename_record(csync, "A/B", "H");
+    assert_adjusted(csync, "A/B/file", "H/file");
+}
+
+static void check_csync_rename_merge(void **state)
+{
+    CSYNC *csync = *state;
+    CSYNC *other;
+    int rc;
+
+    rc = csync_create(&other, "/tmp/csync1", "/tmp/csync2");
+    assert_int_equal(rc, 0);
+
+    csync_rename_record(csync, "A", "B");
+    csync_rename_record(other, "A", "C");
+    csync_rename_record(other, "D/E", "F");
+
+    csync_rename_merge(csync, other);
+    assert_null(other->rename_info);
+
+    assert_adjusted(csync, "A/file", "B/file");
+    assert_adjusted(csync, "D/E/file", "F/file");
+    assert_source(csync, "F/file", "D/E/file");
+
+    rc = csync_destroy(other);
+    assert_int_equal(rc, 0);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_rename_none, setup, teardown),
+        unit_test_setup_teardown(check_csync_rename_adjust, setup, teardown),
+        unit_test_setup_teardown(check_csync_rename_merge, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
@@ -98,6 +98,52 @@ static void setup_db(void **state)
 
 }
 
+static void setup_snapshot_db(void **state)
+{
+    char *errmsg;
+    int rc = 0;
+    sqlite3 *db = NULL;
+
+    const char *sql = "CREATE TABLE IF NOT EXISTS metadata ("
+        "phash INTEGER(8),"
+        "pathlen INTEGER,"
+        "path VARCHAR(4096),"
+        "inode INTEGER,"
+        "uid INTEGER,"
+        "gid INTEGER,"
+        "mode INTEGER,"
+        "modtime INTEGER(8),"
+        "type INTEGER,"
+        "md5 VARCHAR(32),"
+        "fileid VARCHAR(128),"
+        "remotePerm VARCHAR(128),"
+        "filesize BIGINT,"
+        "ignoredChildrenRemote INT,"
+        "contentChecksum TEXT,"
+        "contentChecksumTypeId INTEGER,"
+        "PRIMARY KEY(phash)"
+        ");";
+
+    const char *sql2 = "INSERT INTO metadata VALUES"
+        "(1, 3, 'dir', 10, 0, 0, 0, 100, 2, 'etag1', 'id1', 'RDNVCK', 0, 1, NULL, 0),"
+        "(2, 5, 'dir/a', 11, 0, 0, 0, 200, 0, 'etag2', 'id2', 'RDNVW', 42, 0, 'abc', 1),"
+        "(3, 9, 'dir/sub/b', 12, 0, 0, 0, 300, 0, 'etag3', 'id3', 'RDNVW', 7, 0, NULL, 0),"
+        "(4, 4, 'dir!', 13, 0, 0, 0, 400, 0, 'etag4', 'id4', 'RDNVW', 1, 0, NULL, 0),"
+        "(5, 6, 'dir2/c', 14, 0, 0, 0, 500, 0, 'etag5', 'id5', 'RDNVW', 1, 0, NULL, 0);";
+
+    setup(state);
+    rc = sqlite3_open( TESTDB, &db);
+    assert_int_equal(rc, SQLITE_OK);
+
+    rc = sqlite3_exec( db, sql, NULL, NULL, &errmsg );
+    assert_int_equal(rc, SQLITE_OK);
+
+    rc = sqlite3_exec( db, sql2, NULL, NULL, &errmsg );
+    assert_int_equal(rc, SQLITE_OK);
+
+    sqlite3_close(db);
+}
+
 static void teardown(void **state) {
     CSYNC *csync = *state;
     int rc = 0;
@@ -157,11 +203,11 @@ static void check_csync_statedb_insert_metadata(void **state)
     assert_int_equal(rc, 0);
 
     for (i = 0; i < 100; i++) {
-        st = c_malloc(sizeof(csync_file_stat_t) + 30 );
+        st = csync_file_stat_new(csync, 30);
         snprintf(st->path, 29, "file_%d" , i );
         st->phash = i;
 
-        rc = c_rbtree_insert(csync->local.tree, (void *) st);
+        rc = c_hashtable_insert(csync->local.tree, st->phash, (void *) st);
         assert_int_equal(rc, 0);
     }
 
@@ -176,11 +222,11 @@ static void check_csync_statedb_write(void **state)
     int i, rc;
 
     for (i = 0; i < 100; i++) {
-        st = c_malloc(sizeof(csync_file_stat_t) + 30);
+        st = csync_file_stat_new(csync, 30);
         snprintf(st->path, 29, "file_%d" , i );
         st->phash = i;
 
-        rc = c_rbtree_insert(csync->local.tree, (void *) st);
+        rc = c_hashtable_insert(csync->local.tree, st->phash, (void *) st);
         assert_int_equal(rc, 0);
     }
 
@@ -210,6 +256,61 @@ static void check_csync_statedb_get_stat_by_inode_not_found(void **state)
     assert_null(tmp);
 }
 
+static void check_csync_statedb_snapshot(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *tmp;
+    int rc;
+
+    rc = csync_statedb_load_snapshot(csync);
+    assert_int_equal(rc, 0);
+    assert_non_null(csync->statedb.snapshot);
+
+    tmp = csync_statedb_get_stat_by_hash(csync, 2);
+    assert_non_null(tmp);
+    assert_string_equal(tmp->path, "dir/a");
+    assert_int_equal(tmp->pathlen, 5);
+    assert_int_equal(tmp->inode, 11);
+    assert_int_equal(tmp->modtime, 200);
+    assert_int_equal(tmp->size, 42);
+    assert_string_equal(tmp->etag, "etag2");
+    assert_string_equal(tmp->file_id, "id2");
+    assert_string_equal(tmp->remotePerm, "RDNVW");
+    assert_string_equal(tmp->checksum, "abc");
+    assert_int_equal(tmp->checksumTypeId, 1);
+    csync_file_stat_free(tmp);
+
+    tmp = csync_statedb_get_stat_by_inode(csync, 10);
+    assert_non_null(tmp);
+    assert_int_equal(tmp->phash, 1);
+    assert_int_equal(tmp->has_ignored_files, 1);
+    assert_null(tmp->checksum);
+    csync_file_stat_free(tmp);
+
+    tmp = csync_statedb_get_stat_by_file_id(csync, "id3");
+    assert_non_null(tmp);
+    assert_string_equal(tmp->path, "dir/sub/b");
+    csync_file_stat_free(tmp);
+
+    assert_null(csync_statedb_get_stat_by_hash(csync, 666));
+    assert_null(csync_statedb_get_stat_by_inode(csync, 666));
+    assert_null(csync_statedb_get_stat_by_file_id(csync, "id666"));
+
+    /* the snapshot finds the same entries below a path as the db query */
+    csync->current = REMOTE_REPLICA;
+    rc = csync_statedb_get_below_path(csync, "dir");
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hashtable_size(csync->remote.tree), 2);
+
+    csync_statedb_free_snapshot(csync);
+    assert_null(csync->statedb.snapshot);
+
+    csync->current = LOCAL_REPLICA;
+    rc = csync_statedb_get_below_path(csync, "dir");
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_hashtable_size(csync->local.tree), 2);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
@@ -219,6 +320,7 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_statedb_write, setup, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_hash_not_found, setup_db, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_inode_not_found, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_snapshot, setup_snapshot_db, teardown),
     };
 
     return run_tests(tests);
@@ -238,6 +238,175 @@ static int failing_fn(CSYNC *ctx,
   return -1;
 }
 
+/* A remote listing that breaks off after its first two entries */
+static int remote_readdir_count;
+
+static csync_vio_handle_t *failing_remote_opendir(const char *url, void *userdata)
+{
+  (void) url;
+  (void) userdata;
+
+  remote_readdir_count = 0;
+  return (csync_vio_handle_t *) &remote_readdir_count;
+}
+
+static csync_vio_file_stat_t *failing_remote_readdir(csync_vio_handle_t *dhandle, void *userdata)
+{
+  (void) dhandle;
+  (void) userdata;
+
+  switch (remote_readdir_count++) {
+  case 0:
+    return create_fstat("a.txt", 0, 1217597845);
+  case 1:
+    return create_fstat("b.txt", 0, 1217597845);
+  default:
+    errno = EIO;
+    return NULL;
+  }
+}
+
+static void failing_remote_closedir(csync_vio_handle_t *dhandle, void *userdata)
+{
+  (void) dhandle;
+  (void) userdata;
+}
+
+static int no_remove_visitor(void *obj, void *data)
+{
+  csync_file_stat_t *st = obj;
+  (void) data;
+
+  assert_int_not_equal(st->instruction, CSYNC_INSTRUCTION_REMOVE);
+  return 0;
+}
+
+/* Runs the jobs one after the other, starting with the last */
+static void reverse_parallel_for(void (*job)(void *data, int index), void *data, int count, void *userdata)
+{
+  int *calls = (int *) userdata;
+
+  while (count-- > 0) {
+    job(data, count);
+  }
+  (*calls)++;
+}
+
+/* More entries than a task of csync_ftw_parallel() lists in one round */
+#define WALK_DIRS 10
+#define WALK_SUBDIRS 4
+#define WALK_FILES 60
+
+static void statedb_insert_walked(sqlite3 *db, const char *path, int type)
+{
+  char file[256];
+  csync_vio_file_stat_t *fs = csync_vio_file_stat_new();
+  char *stmt;
+  int rc;
+
+  snprintf(file, sizeof(file), "/tmp/check_csync1/%s", path);
+  rc = csync_vio_local_stat(file, fs);
+  assert_int_equal(rc, 0);
+
+  stmt = sqlite3_mprintf("INSERT INTO metadata"
+                         "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, filesize) VALUES"
+                         "(%lld, %d, '%q', %lld, 0, 0, 0, %lld, %d, 'e', %lld);",
+                         (long long signed int) c_jhash64((uint8_t *) path, strlen(path), 0),
+                         (int) strlen(path), path, (long long signed int) fs->inode,
+                         (long long signed int) fs->mtime, type, (long long signed int) fs->size);
+  rc = sqlite3_exec(db, stmt, NULL, NULL, NULL);
+  sqlite3_free(stmt);
+  assert_int_equal(rc, SQLITE_OK);
+  csync_vio_file_stat_destroy(fs);
+}
+
+/* Creates dirN/subM/fileK in the local replica. The journal knows all
+ * directories, but only the files of the even dirN. */
+static void create_walk_tree(CSYNC *csync)
+{
+  char path[256];
+  sqlite3 *db;
+  int i, j, k;
+  int rc;
+
+  rc = sqlite3_open(csync->statedb.file, &db);
+  assert_int_equal(rc, SQLITE_OK);
+  rc = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+  assert_int_equal(rc, SQLITE_OK);
+
+  for (i = 0; i < WALK_DIRS; i++) {
+    snprintf(path, sizeof(path), "/tmp/check_csync1/dir%d", i);
+    assert_int_equal(mkdir(path, 0755), 0);
+    for (j = 0; j < WALK_SUBDIRS; j++) {
+      snprintf(path, sizeof(path), "/tmp/check_csync1/dir%d/sub%d", i, j);
+      assert_int_equal(mkdir(path, 0755), 0);
+      for (k = 0; k < WALK_FILES; k++) {
+        FILE *f;
+
+        snprintf(path, sizeof(path), "/tmp/check_csync1/dir%d/sub%d/file%d", i, j, k);
+        f = fopen(path, "w");
+        assert_non_null(f);
+        fclose(f);
+        if (i % 2 == 0) {
+          statedb_insert_walked(db, path + strlen("/tmp/check_csync1/"), CSYNC_FTW_TYPE_FILE);
+        }
+      }
+      snprintf(path, sizeof(path), "dir%d/sub%d", i, j);
+      statedb_insert_walked(db, path, CSYNC_FTW_TYPE_DIR);
+    }
+    snprintf(path, sizeof(path), "dir%d", i);
+    statedb_insert_walked(db, path, CSYNC_FTW_TYPE_DIR);
+  }
+  /* has_ignored_files goes up from here */
+  rc = system("touch /tmp/check_csync1/dir2/sub1/.hidden");
+  assert_int_equal(rc, 0);
+
+  rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+  assert_int_equal(rc, SQLITE_OK);
+  sqlite3_close(db);
+}
+
+typedef struct walked_s {
+  uint64_t phash;
+  int instruction;
+  int child_modified;
+  int should_update_metadata;
+  int has_ignored_files;
+} walked_t;
+
+typedef struct walk_result_s {
+  walked_t entries[WALK_DIRS * WALK_SUBDIRS * (WALK_FILES + 2) + 1];
+  int count;
+} walk_result_t;
+
+static int walk_result_visitor(void *obj, void *data)
+{
+  csync_file_stat_t *st = obj;
+  walk_result_t *result = data;
+  walked_t *walked;
+
+  assert_true(result->count < (int) (sizeof(result->entries) / sizeof(walked_t)));
+  walked = &result->entries[result->count++];
+  walked->phash = st->phash;
+  walked->instruction = st->instruction;
+  walked->child_modified = st->child_modified;
+  walked->should_update_metadata = st->should_update_metadata;
+  walked->has_ignored_files = st->has_ignored_files;
+  return 0;
+}
+
+/* Takes what the walk found out of the local tree */
+static void take_walk_result(CSYNC *csync, walk_result_t *result)
+{
+  int rc;
+
+  result->count = 0;
+  c_hashtable_walk(csync->local.tree, result, walk_result_visitor);
+  c_hashtable_free(csync->local.tree);
+  rc = c_hashtable_create(&csync->local.tree);
+  assert_int_equal(rc, 0);
+}
+
 /* detect a new file */
 static void check_csync_detect_update(void **state)
 {
@@ -256,7 +425,7 @@ static void check_csync_detect_update(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hashtable_find(csync->local.tree, c_jhash64((uint8_t *) "file.txt", 8, 0));
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* create a statedb */
@@ -285,7 +454,7 @@ static void check_csync_detect_update_db_none(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hashtable_find(csync->local.tree, c_jhash64((uint8_t *) "file.txt", 8, 0));
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
 
@@ -312,7 +481,7 @@ static void check_csync_detect_update_db_eval(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hashtable_find(csync->local.tree, c_jhash64((uint8_t *) "file.txt", 8, 0));
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* create a statedb */
@@ -343,7 +512,7 @@ static void check_csync_detect_update_db_rename(void **state)
     /* the instruction should be set to rename */
     /*
      * temporarily broken.
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hashtable_find(csync->local.tree, c_jhash64((uint8_t *) "wurst.txt", 9, 0));
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_RENAME);
 
     st->instruction = CSYNC_INSTRUCTION_UPDATED;
@@ -371,7 +540,7 @@ static void check_csync_detect_update_db_new(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hashtable_find(csync->local.tree, c_jhash64((uint8_t *) "file.txt", 8, 0));
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
 
@@ -432,6 +601,95 @@ static void check_csync_ftw_failing_fn(void **state)
     assert_int_equal(rc, -1);
 }
 
+static void check_csync_ftw_parallel(void **state)
+{
+  CSYNC *csync = *state;
+  walk_result_t *sequential = c_malloc(sizeof(walk_result_t));
+  walk_result_t *parallel = c_malloc(sizeof(walk_result_t));
+  int calls = 0;
+  int i;
+  int rc;
+
+  create_walk_tree(csync);
+  rc = csync_statedb_load_snapshot(csync);
+  assert_int_equal(rc, 0);
+  csync->current = LOCAL_REPLICA;
+  csync->replica = csync->local.type;
+
+  rc = csync_ftw(csync, "/tmp/check_csync1", csync_walker, MAX_DEPTH);
+  assert_int_equal(rc, 0);
+  take_walk_result(csync, sequential);
+  assert_int_equal(sequential->count, WALK_DIRS * WALK_SUBDIRS * (WALK_FILES + 1) + WALK_DIRS + 1);
+
+  csync->callbacks.parallel_for_hook = reverse_parallel_for;
+  csync->callbacks.parallel_for_userdata = &calls;
+  rc = csync_ftw_parallel(csync, "/tmp/check_csync1", MAX_DEPTH);
+  assert_int_equal(rc, 0);
+  assert_int_equal(csync->status_code, CSYNC_STATUS_OK);
+  /* the first task handed directories back */
+  assert_true(calls > 1);
+  take_walk_result(csync, parallel);
+
+  /* the same entries, with the same flags from their directories */
+  assert_int_equal(parallel->count, sequential->count);
+  for (i = 0; i < sequential->count; i++) {
+    assert_int_equal(parallel->entries[i].phash, sequential->entries[i].phash);
+    assert_int_equal(parallel->entries[i].instruction, sequential->entries[i].instruction);
+    assert_int_equal(parallel->entries[i].child_modified, sequential->entries[i].child_modified);
+    assert_int_equal(parallel->entries[i].should_update_metadata, sequential->entries[i].should_update_metadata);
+    assert_int_equal(parallel->entries[i].has_ignored_files, sequential->entries[i].has_ignored_files);
+  }
+
+  SAFE_FREE(sequential);
+  SAFE_FREE(parallel);
+}
+
+static void check_csync_update_remote_readdir_error(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    csync->callbacks.remote_opendir_hook = failing_remote_opendir;
+    csync->callbacks.remote_readdir_hook = failing_remote_readdir;
+    csync->callbacks.remote_closedir_hook = failing_remote_closedir;
+
+    rc = csync_update_remote(csync);
+    assert_int_equal(rc, -1);
+    assert_int_equal(csync->status_code, CSYNC_STATUS_READDIR_ERROR);
+    assert_int_equal(remote_readdir_count, 3);
+
+    /* the entries before the error are known, nothing is taken as deleted */
+    assert_non_null(c_hashtable_find(csync->remote.tree, c_jhash64((uint8_t *) "a.txt", 5, 0)));
+    assert_non_null(c_hashtable_find(csync->remote.tree, c_jhash64((uint8_t *) "b.txt", 5, 0)));
+    c_hashtable_walk(csync->remote.tree, NULL, no_remove_visitor);
+    c_hashtable_walk(csync->local.tree, NULL, no_remove_visitor);
+
+    /* so the sync does not go on to the reconcile */
+    rc = csync_update_finish(csync, rc);
+    assert_int_equal(rc, -1);
+    assert_false(csync->status & CSYNC_STATUS_UPDATE);
+}
+
+static void check_csync_local_dir_has_ignored_files(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync1/dir/sub && touch /tmp/check_csync1/dir/sub/file.txt");
+    assert_int_equal(rc, 0);
+    assert_false(csync_local_dir_has_ignored_files(csync, "dir"));
+
+    rc = system("touch /tmp/check_csync1/dir/sub/.hidden");
+    assert_int_equal(rc, 0);
+    assert_true(csync_local_dir_has_ignored_files(csync, "dir"));
+
+    csync->ignore_hidden_files = false;
+    assert_false(csync_local_dir_has_ignored_files(csync, "dir"));
+
+    /* nothing to protect in a directory that is gone */
+    assert_false(csync_local_dir_has_ignored_files(csync, "missing"));
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
@@ -445,6 +703,11 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_ftw, setup_ftw, teardown_rm),
         unit_test_setup_teardown(check_csync_ftw_empty_uri, setup_ftw, teardown_rm),
         unit_test_setup_teardown(check_csync_ftw_failing_fn, setup_ftw, teardown_rm),
+
+        unit_test_setup_teardown(check_csync_ftw_parallel, setup, teardown_rm),
+
+        unit_test_setup_teardown(check_csync_update_remote_readdir_error, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_local_dir_has_ignored_files, setup, teardown_rm),
     };
 
     return run_tests(tests);
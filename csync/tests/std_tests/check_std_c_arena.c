@@ -0,0 +1,163 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016 by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "torture.h"
+
+#include "std/c_arena.h"
+
+struct test_s {
+  int64_t answer;
+  char name[13];
+};
+
+static void setup(void **state) {
+    c_arena_t *arena = NULL;
+    int rc;
+
+    rc = c_arena_create(&arena);
+    assert_int_equal(rc, 0);
+
+    *state = arena;
+}
+
+static void teardown(void **state) {
+    c_arena_free(*state);
+
+    *state = NULL;
+}
+
+static void check_c_arena_create_null(void **state)
+{
+  int rc;
+
+  (void) state; /* unused */
+
+  rc = c_arena_create(NULL);
+  assert_int_equal(rc, -1);
+  assert_int_equal(errno, EINVAL);
+
+  assert_null(c_arena_alloc(NULL, 42));
+  c_arena_free(NULL);
+}
+
+static void check_c_arena_alloc(void **state)
+{
+  c_arena_t *arena = *state;
+  struct test_s *p = NULL;
+  struct test_s *q = NULL;
+  int i;
+
+  assert_null(c_arena_alloc(arena, 0));
+
+  /* spans many blocks, every allocation is zeroed, aligned and distinct */
+  for (i = 0; i < 10000; i++) {
+    p = c_arena_alloc(arena, sizeof(struct test_s) + i % 7);
+    assert_non_null(p);
+    assert_int_equal(((uintptr_t) p) % 8, 0);
+    assert_true(p->answer == 0);
+    assert_int_equal(p->name[0], '\0');
+    assert_true(p != q);
+    p->answer = 42;
+    strcpy(p->name, "hello world!");
+    q = p;
+  }
+  assert_true(c_arena_size(arena) >= 10000 * sizeof(struct test_s));
+}
+
+static void check_c_arena_alloc_big(void **state)
+{
+  c_arena_t *arena = *state;
+  char *small;
+  char *big;
+
+  small = c_arena_alloc(arena, 16);
+  assert_non_null(small);
+
+  /* bigger than a block */
+  big = c_arena_alloc(arena, 1024 * 1024);
+  assert_non_null(big);
+  memset(big, 'x', 1024 * 1024);
+
+  /* the current block is still used for small allocations */
+  assert_true(c_arena_alloc(arena, 16) == small + 16);
+}
+
+static void check_c_arena_strdup(void **state)
+{
+  c_arena_t *arena = *state;
+  const char *str = "test";
+  char *tdup = NULL;
+  char *edup = NULL;
+
+  tdup = c_arena_strdup(arena, str);
+  assert_string_equal(tdup, str);
+  assert_true(tdup != str);
+
+  edup = c_arena_strdup(arena, "");
+  assert_string_equal(edup, "");
+
+  assert_null(c_arena_strdup(arena, NULL));
+  assert_string_equal(tdup, str);
+}
+
+static void check_c_arena_merge(void **state)
+{
+  c_arena_t *arena = *state;
+  c_arena_t *other = NULL;
+  char *small;
+  char *str;
+  size_t used;
+  int rc;
+
+  rc = c_arena_create(&other);
+  assert_int_equal(rc, 0);
+
+  small = c_arena_alloc(arena, 16);
+  assert_non_null(small);
+  str = c_arena_strdup(other, "from the other arena");
+  assert_non_null(c_arena_alloc(other, 64 * 1024)); /* a big block as well */
+  used = c_arena_size(arena) + c_arena_size(other);
+
+  c_arena_merge(arena, other);
+  assert_true(c_arena_size(arena) == used);
+  assert_string_equal(str, "from the other arena");
+
+  /* the current block is still the one that gets filled */
+  assert_true(c_arena_alloc(arena, 16) == small + 16);
+
+  c_arena_merge(arena, NULL);
+  assert_true(c_arena_size(arena) == used + 16);
+}
+
+int torture_run_tests(void)
+{
+  const UnitTest tests[] = {
+      unit_test(check_c_arena_create_null),
+      unit_test_setup_teardown(check_c_arena_alloc, setup, teardown),
+      unit_test_setup_teardown(check_c_arena_alloc_big, setup, teardown),
+      unit_test_setup_teardown(check_c_arena_strdup, setup, teardown),
+      unit_test_setup_teardown(check_c_arena_merge, setup, teardown),
+  };
+
+  return run_tests(tests);
+}
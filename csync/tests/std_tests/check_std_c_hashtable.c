@@ -0,0 +1,369 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016 by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "torture.h"
+
+#include "std/c_alloc.h"
+#include "std/c_hashtable.h"
+#include "std/c_jhash.h"
+#include "std/c_rbtree.h"
+
+typedef struct test_s {
+    uint64_t key;
+    int number;
+} test_t;
+
+typedef struct walk_s {
+    uint64_t last;
+    size_t count;
+    int ordered;
+} walk_t;
+
+static uint64_t path_key(int i) {
+    char path[64];
+    int len = snprintf(path, sizeof(path), "dir_%d/sub/file_%d.txt", i % 97, i);
+
+    return c_jhash64((uint8_t *) path, len, 0);
+}
+
+static int walk_visitor(void *obj, void *data) {
+    test_t *t = (test_t *) obj;
+    walk_t *w = (walk_t *) data;
+
+    if (w->count > 0 && t->key <= w->last) {
+        w->ordered = 0;
+    }
+    w->last = t->key;
+    w->count++;
+
+    return 0;
+}
+
+static int fail_visitor(void *obj, void *data) {
+    (void) obj;
+    (void) data;
+
+    return -1;
+}
+
+static void destructor(void *data) {
+    test_t *freedata = (test_t *) data;
+    SAFE_FREE(freedata);
+}
+
+static void setup(void **state) {
+    c_hashtable_t *table = NULL;
+    int rc;
+
+    rc = c_hashtable_create(&table);
+    assert_int_equal(rc, 0);
+
+    *state = table;
+}
+
+static void teardown(void **state) {
+    c_hashtable_t *table = *state;
+
+    c_hashtable_destroy(table, destructor);
+
+    *state = NULL;
+}
+
+static void check_c_hashtable_create_null(void **state)
+{
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = c_hashtable_create(NULL);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EINVAL);
+
+    c_hashtable_free(NULL);
+    c_hashtable_destroy(NULL, destructor);
+    assert_true(c_hashtable_size((c_hashtable_t *) NULL) == 0);
+    assert_null(c_hashtable_find(NULL, 42));
+}
+
+static void check_c_hashtable_insert_find(void **state)
+{
+    c_hashtable_t *table = *state;
+    test_t *testdata;
+    int i, rc;
+
+    /* enough entries to grow the table a few times */
+    for (i = 0; i < 1000; i++) {
+        testdata = c_malloc(sizeof(test_t));
+        testdata->key = path_key(i);
+        testdata->number = i;
+
+        rc = c_hashtable_insert(table, testdata->key, testdata);
+        assert_int_equal(rc, 0);
+    }
+    assert_true(c_hashtable_size(table) == 1000);
+
+    for (i = 0; i < 1000; i++) {
+        testdata = c_hashtable_find(table, path_key(i));
+        assert_non_null(testdata);
+        assert_int_equal(testdata->number, i);
+    }
+    assert_null(c_hashtable_find(table, path_key(1000)));
+
+    /* zero is a valid key */
+    testdata = c_malloc(sizeof(test_t));
+    rc = c_hashtable_insert(table, 0, testdata);
+    assert_int_equal(rc, 0);
+    assert_true(c_hashtable_find(table, 0) == testdata);
+}
+
+static void check_c_hashtable_insert_duplicate(void **state)
+{
+    c_hashtable_t *table = *state;
+    test_t *testdata;
+    test_t *dup;
+    int rc;
+
+    testdata = c_malloc(sizeof(test_t));
+    testdata->key = 42;
+    rc = c_hashtable_insert(table, testdata->key, testdata);
+    assert_int_equal(rc, 0);
+
+    /* the first entry stays, like with c_rbtree_insert() */
+    dup = c_malloc(sizeof(test_t));
+    dup->key = 42;
+    rc = c_hashtable_insert(table, dup->key, dup);
+    assert_int_equal(rc, 1);
+    assert_true(c_hashtable_find(table, 42) == testdata);
+    assert_true(c_hashtable_size(table) == 1);
+    SAFE_FREE(dup);
+
+    rc = c_hashtable_insert(table, 43, NULL);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EINVAL);
+}
+
+static void check_c_hashtable_walk(void **state)
+{
+    c_hashtable_t *table = *state;
+    test_t *testdata;
+    walk_t walk;
+    int i, rc;
+
+    for (i = 0; i < 500; i++) {
+        testdata = c_malloc(sizeof(test_t));
+        testdata->key = path_key(i);
+        rc = c_hashtable_insert(table, testdata->key, testdata);
+        assert_int_equal(rc, 0);
+    }
+
+    memset(&walk, 0, sizeof(walk));
+    walk.ordered = 1;
+    rc = c_hashtable_walk(table, &walk, walk_visitor);
+    assert_int_equal(rc, 0);
+    assert_true(walk.count == 500);
+    assert_true(walk.ordered);
+
+    /* inserting after a walk invalidates the cached order */
+    for (i = 500; i < 600; i++) {
+        testdata = c_malloc(sizeof(test_t));
+        testdata->key = path_key(i);
+        rc = c_hashtable_insert(table, testdata->key, testdata);
+        assert_int_equal(rc, 0);
+    }
+
+    memset(&walk, 0, sizeof(walk));
+    walk.ordered = 1;
+    rc = c_hashtable_walk(table, &walk, walk_visitor);
+    assert_int_equal(rc, 0);
+    assert_true(walk.count == 600);
+    assert_true(walk.ordered);
+
+    rc = c_hashtable_walk(table, &walk, fail_visitor);
+    assert_int_equal(rc, -1);
+}
+
+static void check_c_hashtable_walk_null(void **state)
+{
+    c_hashtable_t *table = *state;
+    walk_t walk;
+    int rc;
+
+    rc = c_hashtable_walk(NULL, &walk, walk_visitor);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EINVAL);
+
+    rc = c_hashtable_walk(table, NULL, walk_visitor);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EINVAL);
+
+    rc = c_hashtable_walk(table, &walk, NULL);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EINVAL);
+}
+
+/* the comparators of the csync replica trees before they became hash tables */
+static int rbtree_key_cmp(const void *key, const void *data) {
+    uint64_t a = *(uint64_t *) key;
+    test_t *b = (test_t *) data;
+
+    if (a < b->key) {
+        return -1;
+    } else if (a > b->key) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static int rbtree_data_cmp(const void *key, const void *data) {
+    test_t *a = (test_t *) key;
+    test_t *b = (test_t *) data;
+
+    if (a->key < b->key) {
+        return -1;
+    } else if (a->key > b->key) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static double elapsed(struct timeval *before) {
+    struct timeval after;
+
+    gettimeofday(&after, 0);
+    return (after.tv_sec - before->tv_sec)
+            + (after.tv_usec - before->tv_usec) / 1.0e6;
+}
+
+/* The timings are only printed if CSYNC_BENCHMARK is set */
+static void report(const char *format, ...) {
+    va_list args;
+
+    if (getenv("CSYNC_BENCHMARK") == NULL) {
+        return;
+    }
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+static void rbtree_keep_data(void *data) {
+    (void) data; /* the items are freed with their array */
+}
+
+static void check_c_hashtable_performance(void **state)
+{
+    const int N = 200000;
+    test_t *items;
+    c_hashtable_t *table = NULL;
+    c_rbtree_t *tree = NULL;
+    struct timeval before;
+    walk_t walk;
+    size_t found = 0;
+    int i, rc;
+
+    (void) state; /* unused */
+
+    items = c_malloc(N * sizeof(test_t));
+    assert_non_null(items);
+    for (i = 0; i < N; i++) {
+        items[i].key = path_key(i);
+        items[i].number = i;
+    }
+
+    // Being able to use QElapsedTimer for measurement would be nice...
+    {
+        rc = c_rbtree_create(&tree, rbtree_key_cmp, rbtree_data_cmp);
+        assert_int_equal(rc, 0);
+
+        gettimeofday(&before, 0);
+        for (i = 0; i < N; i++) {
+            c_rbtree_insert(tree, &items[i]);
+        }
+        report("c_rbtree insert: %f ms for %d entries\n", elapsed(&before) * 1000, N);
+
+        gettimeofday(&before, 0);
+        for (i = 0; i < N; i++) {
+            found += c_rbtree_find(tree, &items[N - 1 - i].key) != NULL;
+        }
+        report("c_rbtree find: %f ms for %d lookups\n", elapsed(&before) * 1000, N);
+
+        memset(&walk, 0, sizeof(walk));
+        walk.ordered = 1;
+        gettimeofday(&before, 0);
+        rc = c_rbtree_walk(tree, &walk, walk_visitor);
+        report("c_rbtree walk: %f ms\n", elapsed(&before) * 1000);
+        assert_int_equal(rc, 0);
+        assert_true(walk.ordered);
+
+        c_rbtree_destroy(tree, rbtree_keep_data);
+    }
+
+    {
+        rc = c_hashtable_create(&table);
+        assert_int_equal(rc, 0);
+
+        gettimeofday(&before, 0);
+        for (i = 0; i < N; i++) {
+            c_hashtable_insert(table, items[i].key, &items[i]);
+        }
+        report("c_hashtable insert: %f ms for %d entries\n", elapsed(&before) * 1000, N);
+
+        gettimeofday(&before, 0);
+        for (i = 0; i < N; i++) {
+            found += c_hashtable_find(table, items[N - 1 - i].key) != NULL;
+        }
+        report("c_hashtable find: %f ms for %d lookups\n", elapsed(&before) * 1000, N);
+
+        memset(&walk, 0, sizeof(walk));
+        walk.ordered = 1;
+        gettimeofday(&before, 0);
+        rc = c_hashtable_walk(table, &walk, walk_visitor);
+        report("c_hashtable walk: %f ms\n", elapsed(&before) * 1000);
+        assert_int_equal(rc, 0);
+        assert_true(walk.ordered);
+
+        c_hashtable_free(table);
+    }
+
+    assert_true(found == 2 * (size_t) N); // mainly to avoid optimization
+
+    SAFE_FREE(items);
+}
+
+int torture_run_tests(void)
+{
+  const UnitTest tests[] = {
+      unit_test(check_c_hashtable_create_null),
+      unit_test_setup_teardown(check_c_hashtable_insert_find, setup, teardown),
+      unit_test_setup_teardown(check_c_hashtable_insert_duplicate, setup, teardown),
+      unit_test_setup_teardown(check_c_hashtable_walk, setup, teardown),
+      unit_test_setup_teardown(check_c_hashtable_walk_null, setup, teardown),
+      unit_test(check_c_hashtable_performance),
+  };
+
+  return run_tests(tests);
+}
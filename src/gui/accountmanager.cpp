@@ -30,6 +30,7 @@ static const char httpUserC[] = "http_user";
 static const char caCertsKeyC[] = "CaCertificates";
 static const char accountsC[] = "Accounts";
 static const char versionC[] = "version";
+static const char uploadChunkSizeC[] = "uploadChunkSize";
 }
 
 
@@ -150,6 +151,9 @@ void AccountManager::wantsAccountSavedSlot(AccountPtr a)
 void AccountManager::save(const AccountPtr& acc, QSettings& settings, bool saveCredentials)
 {
     settings.setValue(QLatin1String(urlC), acc->_url.toString());
+    if (acc->_uploadChunkSize) {
+        settings.setValue(QLatin1String(uploadChunkSizeC), acc->_uploadChunkSize);
+    }
     if (acc->_credentials) {
         if (saveCredentials) {
             // Only persist the credentials if the parameter is set, on migration from 1.8.x
@@ -195,6 +199,7 @@ AccountPtr AccountManager::load(QSettings& settings)
     auto acc = createAccount();
 
     acc->setUrl(settings.value(QLatin1String(urlC)).toUrl());
+    acc->setUploadChunkSize(settings.value(QLatin1String(uploadChunkSizeC)).toULongLong());
 
     // We want to only restore settings for that auth type and the user value
     acc->_settingsMap.insert(QLatin1String(userC), settings.value(userC));
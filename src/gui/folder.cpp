@@ -68,6 +68,9 @@ Folder::Folder(const FolderDefinition& definition,
       , _forceSyncOnPollTimeout(false)
       , _consecutiveFailingSyncs(0)
       , _consecutiveFollowUpSyncs(0)
+      , _localChangesTracked(false)
+      , _fullLocalDiscoveryNeeded(true)
+      , _fullLocalDiscoveryInSync(false)
       , _journal(definition.localPath)
       , _csync_ctx(0)
 {
@@ -222,9 +225,51 @@ bool Folder::ignoreHiddenFiles()
 
 void Folder::setIgnoreHiddenFiles(bool ignore)
 {
+    if (ignore != _definition.ignoreHiddenFiles) {
+        // Hidden files that were ignored so far are not in the journal
+        _fullLocalDiscoveryNeeded = true;
+    }
     _definition.ignoreHiddenFiles = ignore;
 }
 
+void Folder::setLocalChangesTracked(bool tracked)
+{
+    if (tracked && !_localChangesTracked) {
+        // Nothing was recorded so far
+        _fullLocalDiscoveryNeeded = true;
+    }
+    _localChangesTracked = tracked;
+}
+
+void Folder::slotNextSyncFullLocalDiscovery()
+{
+    _fullLocalDiscoveryNeeded = true;
+}
+
+void Folder::slotWatcherUnreliable()
+{
+    qDebug() << "The folder watcher of" << alias() << "misses changes, always doing a full local discovery";
+    _localChangesTracked = false;
+}
+
+void Folder::addLocalDiscoveryPath(const QString &relativePath)
+{
+    QString path = relativePath;
+    if (path.endsWith(QLatin1Char('/'))) {
+        path.chop(1);
+    }
+    if (path.isEmpty()) {
+        // The root directory is always read
+        return;
+    }
+    // The path itself in case it is a directory, and the directory containing it
+    _localDiscoveryPaths.insert(path);
+    int slash = path.lastIndexOf(QLatin1Char('/'));
+    if (slash > 0) {
+        _localDiscoveryPaths.insert(path.left(slash));
+    }
+}
+
 QString Folder::cleanPath()
 {
     QString cleanedPath = QDir::cleanPath(_definition.localPath);
@@ -592,6 +637,14 @@ int Folder::slotWipeErrorBlacklist()
 
 void Folder::slotWatchedPathChanged(const QString& path)
 {
+    // Remember the change for the local discovery, even if it is our own:
+    // the journal only knows what the sync itself expected to happen.
+    if (path.startsWith(this->path())) {
+        addLocalDiscoveryPath(path.mid(this->path().length()));
+    } else {
+        _fullLocalDiscoveryNeeded = true;
+    }
+
     // When no sync is running or it's in the prepare phase, we can
     // always schedule a new sync.
     if (! _engine || _syncResult.status() == SyncResult::SyncPrepare) {
@@ -882,6 +935,22 @@ void Folder::startSync(const QStringList &pathList)
 
     _engine.reset(new SyncEngine( _accountState->account(), _csync_ctx, path(), remoteUrl().path(), remotePath(), &_journal));
 
+    // Unless a full local discovery is due, only the directories the folder
+    // watcher reported are read from disk.
+    const qint64 fullLocalDiscoveryInterval = ConfigFile().fullLocalDiscoveryInterval();
+    _fullLocalDiscoveryInSync = !_localChangesTracked || _fullLocalDiscoveryNeeded
+            || fullLocalDiscoveryInterval < 0
+            || !_timeSinceLastFullLocalDiscovery.isValid()
+            || _timeSinceLastFullLocalDiscovery.elapsed() > fullLocalDiscoveryInterval;
+    if (_fullLocalDiscoveryInSync) {
+        _localDiscoveryPathsInSync.clear();
+    } else {
+        _localDiscoveryPathsInSync = _localDiscoveryPaths;
+        _engine->setLocalDiscoveryOptions(SyncEngine::DatabaseAndFilesystem, _localDiscoveryPathsInSync.toList());
+    }
+    _localDiscoveryPaths.clear();
+    _fullLocalDiscoveryNeeded = false;
+
     qRegisterMetaType<SyncFileItemVector>("SyncFileItemVector");
     qRegisterMetaType<SyncFileItem::Direction>("SyncFileItem::Direction");
 
@@ -1015,12 +1084,23 @@ void Folder::slotSyncFinished(bool success)
             || _syncResult.status() == SyncResult::Problem)
     {
         _consecutiveFailingSyncs = 0;
+        if (_fullLocalDiscoveryInSync) {
+            _timeSinceLastFullLocalDiscovery.start();
+        }
     }
     else
     {
         _consecutiveFailingSyncs++;
         qDebug() << "the last" << _consecutiveFailingSyncs << "syncs failed";
+
+        // The local changes this sync looked at might not be synced yet
+        if (_fullLocalDiscoveryInSync) {
+            _fullLocalDiscoveryNeeded = true;
+        }
+        _localDiscoveryPaths.unite(_localDiscoveryPathsInSync);
     }
+    _localDiscoveryPathsInSync.clear();
+    _fullLocalDiscoveryInSync = false;
 
     if (_syncResult.status() == SyncResult::Success && success) {
         // Clear the white list as all the folders that should be on that list are sync-ed
@@ -1094,6 +1174,18 @@ void Folder::slotItemCompleted(const SyncFileItem &item, const PropagatorJob& jo
         _stateLastSyncItemsWithError.insert(item._file);
     }
 
+    // The journal does not have the local state of items that did not sync,
+    // so the next local discovery needs to look at them again.
+    if (item._status == SyncFileItem::SoftError
+            || item._status == SyncFileItem::NormalError
+            || item._status == SyncFileItem::FatalError
+            || item._hasBlacklistEntry) {
+        addLocalDiscoveryPath(item._file);
+        if (!item._renameTarget.isEmpty()) {
+            addLocalDiscoveryPath(item._renameTarget);
+        }
+    }
+
     if (Progress::isWarningKind(item._status)) {
         // Count all error conditions.
         _syncResult.setWarnCount(_syncResult.warnCount()+1);
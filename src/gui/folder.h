@@ -197,6 +197,12 @@ public:
      /// Removes the folder from the account's settings.
      void removeFromSettings() const;
 
+     /**
+      * Whether the folder watcher reports every local change. Only then the
+      * local discovery is restricted to the directories it reported.
+      */
+     void setLocalChangesTracked(bool tracked);
+
      /**
       * Returns whether a file inside this folder should be excluded.
       */
@@ -247,6 +253,18 @@ public slots:
        */
       void slotWatchedPathChanged(const QString& path);
 
+      /**
+       * The next sync reads the whole local folder from disk instead of only
+       * the directories that were reported as changed.
+       */
+      void slotNextSyncFullLocalDiscovery();
+
+      /**
+       * Triggered by the folder watcher when it can no longer report all
+       * local changes.
+       */
+      void slotWatcherUnreliable();
+
 private slots:
     void slotSyncStarted();
     void slotSyncError(const QString& );
@@ -282,6 +300,9 @@ private:
     void createGuiLog(const QString& filename, SyncFileStatus status, int count,
                        const QString& renameTarget = QString::null );
 
+    /// Remember that the directory containing relativePath must be read in the next local discovery
+    void addLocalDiscoveryPath(const QString &relativePath);
+
     AccountState* _accountState;
     FolderDefinition _definition;
 
@@ -307,6 +328,19 @@ private:
     /// Reset when no follow-up is requested.
     int           _consecutiveFollowUpSyncs;
 
+    /// Whether the folder watcher can be trusted to report every local change.
+    bool          _localChangesTracked;
+
+    /// The next sync does a full local discovery.
+    bool          _fullLocalDiscoveryNeeded;
+    QElapsedTimer _timeSinceLastFullLocalDiscovery;
+
+    /// Local directories (relative, no trailing slash) that changed since the current sync started.
+    QSet<QString> _localDiscoveryPaths;
+    /// The changed directories the current sync is looking at, empty for a full local discovery.
+    QSet<QString> _localDiscoveryPathsInSync;
+    bool          _fullLocalDiscoveryInSync;
+
     // For the SocketAPI folder states
     QSet<QString>   _stateLastSyncItemsWithErrorNew; // gets moved to _stateLastSyncItemsWithError at end of sync
     QSet<QString>   _stateLastSyncItemsWithError;
@@ -148,6 +148,11 @@ void FolderMan::registerFolderMonitor( Folder *folder )
 
         // This is at the moment only for the behaviour of the SocketApi.
         connect(fw, SIGNAL(pathChanged(QString)), folder, SLOT(watcherSlot(QString)));
+
+        // The changed paths limit the local discovery as long as the watcher sees everything.
+        connect(fw, SIGNAL(lostChanges()), folder, SLOT(slotNextSyncFullLocalDiscovery()));
+        connect(fw, SIGNAL(becameUnreliable()), folder, SLOT(slotWatcherUnreliable()));
+        folder->setLocalChangesTracked(fw->isReliable());
     }
 
     // register the folder with the socket API
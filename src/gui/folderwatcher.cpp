@@ -39,7 +39,13 @@ namespace OCC {
 
 FolderWatcher::FolderWatcher(const QString &root, Folder* folder)
     : QObject(folder),
-      _folder(folder)
+      _folder(folder),
+#if defined(Q_OS_UNIX) && !defined(Q_OS_MAC)
+      _isReliable(true)
+#else
+      // The other backends don't tell exactly which paths changed
+      _isReliable(false)
+#endif
 {
     _d.reset(new FolderWatcherPrivate(this, root));
 
@@ -79,8 +85,10 @@ void FolderWatcher::changeDetected( const QStringList& paths )
     //   - why do we skip the file altogether instead of e.g. reducing the upload frequency?
 
     // Check if the same path was reported within the last second.
+    // A reliable watcher is the only record of the change for the partial
+    // local discovery (see Folder::addLocalDiscoveryPath), so it reports all.
     QSet<QString> pathsSet = paths.toSet();
-    if( pathsSet == _lastPaths && _timer.elapsed() < 1000 ) {
+    if( !_isReliable && pathsSet == _lastPaths && _timer.elapsed() < 1000 ) {
         // the same path was reported within the last second. Skip.
         return;
     }
@@ -68,6 +68,12 @@ public:
     /* Check if the path is ignored. */
     bool pathIsIgnored( const QString& path );
 
+    /**
+     * Whether every change below the root is reported through pathChanged().
+     * Only then the local discovery can be limited to the reported paths.
+     */
+    bool isReliable() const { return _isReliable; }
+
 signals:
     /** Emitted when one of the watched directories or one
      *  of the contained files is changed. */
@@ -76,6 +82,14 @@ signals:
     /** Emitted if an error occurs */
     void error(const QString& error);
 
+    /** Emitted when some changes could not be reported, e.g. because the
+     *  event queue overflowed. The next sync must look at the whole folder. */
+    void lostChanges();
+
+    /** Emitted when the watcher can no longer report all changes,
+     *  e.g. because a directory could not be watched. */
+    void becameUnreliable();
+
 protected slots:
     // called from the implementations to indicate a change in path
     void changeDetected( const QString& path);
@@ -89,6 +103,7 @@ private:
     QTime _timer;
     QSet<QString> _lastPaths;
     Folder* _folder;
+    bool _isReliable;
 
     friend class FolderWatcherPrivate;
 };
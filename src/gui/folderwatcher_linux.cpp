@@ -37,6 +37,7 @@ FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString& path
         connect(_socket.data(), SIGNAL(activated(int)), SLOT(slotReceivedNotification(int)));
     } else {
         qDebug() << Q_FUNC_INFO << "notify_init() failed: " << strerror(errno);
+        setUnreliable();
     }
 
     QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Q_ARG(QString, path));
@@ -83,7 +84,20 @@ void FolderWatcherPrivate::inotifyRegisterPath(const QString& path)
                                    IN_DONT_FOLLOW );
         if( wd > -1 ) {
             _watches.insert(wd, path);
-         }
+        } else {
+            // Changes in this directory will go unnoticed, usually because
+            // max_user_watches was reached.
+            qDebug() << Q_FUNC_INFO << "inotify_add_watch failed for" << path << strerror(errno);
+            setUnreliable();
+        }
+    }
+}
+
+void FolderWatcherPrivate::setUnreliable()
+{
+    if (_parent->_isReliable) {
+        _parent->_isReliable = false;
+        emit _parent->becameUnreliable();
     }
 }
 
@@ -156,7 +170,7 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
     // reset counter
     i = 0;
     // while there are enough events in the buffer
-    while(i + sizeof(struct inotify_event) < static_cast<unsigned int>(len)) {
+    while(i + sizeof(struct inotify_event) <= static_cast<unsigned int>(len)) {
         // cast an inotify_event
         event = (struct inotify_event*)&buffer[i];
         if (event == NULL) {
@@ -165,6 +179,11 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
             continue;
         }
 
+        if (event->mask & IN_Q_OVERFLOW) {
+            qDebug() << Q_FUNC_INFO << "inotify event queue overflow, changes were lost";
+            emit _parent->lostChanges();
+        }
+
         // Fire event for the path that was changed.
         if (event->len > 0 && event->wd > -1) {
             QByteArray fileName(event->name);
@@ -175,6 +194,12 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
             } else {
                 const QString p = _watches[event->wd] + '/' + fileName;
                 //qDebug() << "found a change in " << p;
+                if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && (event->mask & IN_ISDIR)
+                        && !_parent->pathIsIgnored(p)) {
+                    // Watch new directories right away, or changes done in them
+                    // before the next sync would go unnoticed.
+                    slotAddFolderRecursive(p);
+                }
                 _parent->changeDetected(p);
             }
         }
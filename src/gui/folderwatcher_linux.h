@@ -47,6 +47,7 @@ protected slots:
 protected:
     bool findFoldersBelow( const QDir& dir, QStringList& fullList );
     void inotifyRegisterPath(const QString& path);
+    void setUnreliable();
 
 private:
     FolderWatcher *_parent;
@@ -124,8 +124,10 @@ void IgnoreListEditor::slotUpdateLocalIgnoreList()
     // We need to force a remote discovery after a change of the ignore list.
     // Otherwise we would not download the files/directories that are no longer
     // ignored (because the remote etag did not change)   (issue #3172)
+    // Likewise, local files that were ignored so far are not in the journal.
     foreach (Folder* folder, folderMan->map()) {
         folder->journalDb()->forceRemoteDiscoveryNextSync();
+        folder->slotNextSyncFullLocalDiscovery();
         folderMan->slotScheduleSync(folder);
     }
 
@@ -58,6 +58,7 @@ public:
     quint64 duration();
 
     qint64 timeoutMsec() { return _timer.interval(); }
+    bool timedOut() const { return _timedout; }
 
 public slots:
     void setTimeout(qint64 msec);
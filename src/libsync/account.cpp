@@ -43,6 +43,7 @@ Account::Account(QObject *parent)
     , _treatSslErrorsAsFailure(false)
     , _davPath( Theme::instance()->webDavPath() )
     , _wasMigrated(false)
+    , _uploadChunkSize(0)
 {
     qRegisterMetaType<AccountPtr>("AccountPtr");
 }
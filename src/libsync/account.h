@@ -169,6 +169,12 @@ public:
     /// Called by network jobs on credential errors.
     void handleInvalidCredentials();
 
+    /** The chunk size the chunked uploads of this account settled on, 0 if none
+     *  was measured yet. It is saved with the account so the next sync can
+     *  start with it. */
+    quint64 uploadChunkSize() const { return _uploadChunkSize; }
+    void setUploadChunkSize(quint64 size) { _uploadChunkSize = size; }
+
 signals:
     void propagatorNetworkActivity();
     void invalidCredentials();
@@ -207,6 +213,7 @@ private:
     QString _pemPrivateKey;  
     QString _davPath; // defaults to value from theme, might be overwritten in brandings
     bool _wasMigrated;
+    quint64 _uploadChunkSize;
     friend class AccountManager;
 };
 
@@ -65,6 +65,11 @@ bool Capabilities::shareResharing() const
     return _capabilities["files_sharing"].toMap()["resharing"].toBool();
 }
 
+bool Capabilities::deltaUpload() const
+{
+    return _capabilities["dav"].toMap()["delta_upload"].toBool();
+}
+
 QList<QByteArray> Capabilities::supportedChecksumTypesAdvertised() const
 {
     return QList<QByteArray>();
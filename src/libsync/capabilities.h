@@ -40,6 +40,9 @@ public:
     int  sharePublicLinkExpireDateDays() const;
     bool shareResharing() const;
 
+    /// Whether the server assembles a file from the changed chunks and the previous version
+    bool deltaUpload() const;
+
     /// Returns the checksum types the server explicitly advertises
     QList<QByteArray> supportedChecksumTypesAdvertised() const;
 
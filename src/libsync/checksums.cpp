@@ -19,9 +19,31 @@
 #include "account.h"
 
 #include <qtconcurrentrun.h>
+#include <QThreadPool>
 
 namespace OCC {
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+/*
+ * Checksums are computed in their own pool, so hashing big files neither
+ * competes with other users of the global pool nor gets starved by them.
+ * The reading is I/O bound, a couple of threads are enough.
+ */
+static QThreadPool* checksumThreadPool()
+{
+    static QThreadPool* pool = 0;
+    if (!pool) {
+        pool = new QThreadPool;
+        int threads = qgetenv("OWNCLOUD_CHECKSUM_THREADS").toUInt();
+        if (!threads) {
+            threads = qBound(2, QThread::idealThreadCount() / 2, 4);
+        }
+        pool->setMaxThreadCount(threads);
+    }
+    return pool;
+}
+#endif
+
 QByteArray makeChecksumHeader(const QByteArray& checksumType, const QByteArray& checksum)
 {
     QByteArray header = checksumType;
@@ -81,7 +103,11 @@ void ComputeChecksum::start(const QString& filePath)
     connect( &_watcher, SIGNAL(finished()),
              this, SLOT(slotCalculationDone()),
              Qt::UniqueConnection );
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    _watcher.setFuture(QtConcurrent::run(checksumThreadPool(), ComputeChecksum::computeNow, filePath, checksumType()));
+#else
     _watcher.setFuture(QtConcurrent::run(ComputeChecksum::computeNow, filePath, checksumType()));
+#endif
 }
 
 QByteArray ComputeChecksum::computeNow(const QString& filePath, const QByteArray& checksumType)
@@ -90,6 +116,8 @@ QByteArray ComputeChecksum::computeNow(const QString& filePath, const QByteArray
         return FileSystem::calcMd5(filePath);
     } else if( checksumType == checkSumSHA1C ) {
         return FileSystem::calcSha1(filePath);
+    } else if( checksumType == checkSumCRC32CC ) {
+        return FileSystem::calcCrc32c(filePath);
     }
 #ifdef ZLIB_FOUND
     else if( checksumType == checkSumAdlerC) {
@@ -114,6 +142,29 @@ void ComputeChecksum::slotCalculationDone()
 }
 
 
+ComputeBlockHashes::ComputeBlockHashes(QObject* parent)
+    : QObject(parent)
+{
+}
+
+void ComputeBlockHashes::start(const QString& filePath, qint64 blockSize)
+{
+    connect( &_watcher, SIGNAL(finished()),
+             this, SLOT(slotCalculationDone()),
+             Qt::UniqueConnection );
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    _watcher.setFuture(QtConcurrent::run(checksumThreadPool(), FileSystem::calcBlockHashes, filePath, blockSize));
+#else
+    _watcher.setFuture(QtConcurrent::run(FileSystem::calcBlockHashes, filePath, blockSize));
+#endif
+}
+
+void ComputeBlockHashes::slotCalculationDone()
+{
+    emit done(_watcher.future().result());
+}
+
+
 ValidateChecksumHeader::ValidateChecksumHeader(QObject *parent)
     : QObject(parent)
 {
@@ -79,6 +79,33 @@ private:
     QFutureWatcher<QByteArray> _watcher;
 };
 
+/**
+ * Computes the block signature of a file, see FileSystem::calcBlockHashes().
+ * \ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ComputeBlockHashes : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ComputeBlockHashes(QObject* parent = 0);
+
+    /**
+     * Computes the hashes of the blocks of the given file in a different thread.
+     *
+     * done() is emitted when the calculation finishes.
+     */
+    void start(const QString& filePath, qint64 blockSize);
+
+signals:
+    void done(const QByteArray& hashes);
+
+private slots:
+    void slotCalculationDone();
+
+private:
+    QFutureWatcher<QByteArray> _watcher;
+};
+
 /**
  * Checks whether a file's checksum matches the expected value.
  * @ingroup libsync
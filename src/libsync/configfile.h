@@ -66,6 +66,11 @@ public:
     /* Force sync interval, in milliseconds */
     quint64 forceSyncInterval(const QString &connection = QString()) const;
 
+    /* Interval after which the local discovery walks the whole tree again even though
+     * the folder watcher reported every change, in milliseconds.
+     * A negative value disables the partial local discovery. */
+    qint64 fullLocalDiscoveryInterval() const;
+
     bool monoIcons() const;
     void setMonoIcons(bool);
 
@@ -107,6 +112,16 @@ public:
 
     int timeout() const;
 
+    // Chunk size of chunked uploads when no better value was measured yet,
+    // and the bounds the measured value is kept in. All in bytes.
+    quint64 chunkSize() const;
+    quint64 minChunkSize() const;
+    quint64 maxChunkSize() const;
+
+    // The duration a chunk upload should take, in milliseconds. The chunk
+    // size is adapted to get close to it. 0 keeps the chunk size fixed.
+    int targetChunkUploadDuration() const;
+
     // send a checksum as a header along with the transmission or not.
     // possible values:
     // empty: no checksum calculated or expected.
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "crc32c.h"
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define OC_CRC32C_SSE42 1
+#include <cpuid.h>
+#include <nmmintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define OC_CRC32C_SSE42 1
+#include <intrin.h>
+#include <nmmintrin.h>
+#endif
+
+namespace OCC {
+
+/*
+ * Portable implementation: slicing-by-8 over eight 256 entry tables of the
+ * reflected Castagnoli polynomial.
+ */
+namespace {
+
+struct Crc32cTables {
+    uint32_t t[8][256];
+
+    Crc32cTables() {
+        const uint32_t poly = 0x82f63b78;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+            }
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int s = 1; s < 8; ++s) {
+                t[s][i] = (t[s-1][i] >> 8) ^ t[0][t[s-1][i] & 0xff];
+            }
+        }
+    }
+};
+
+const Crc32cTables &tables()
+{
+    static const Crc32cTables tables;
+    return tables;
+}
+
+uint32_t crc32cSoftware(uint32_t crc, const unsigned char *p, size_t len)
+{
+    const Crc32cTables &tbl = tables();
+    while (len && (reinterpret_cast<uintptr_t>(p) & 7)) {
+        crc = tbl.t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        --len;
+    }
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        // the tables are for little endian input
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= crc;
+        crc = tbl.t[7][lo & 0xff] ^ tbl.t[6][(lo >> 8) & 0xff]
+            ^ tbl.t[5][(lo >> 16) & 0xff] ^ tbl.t[4][lo >> 24]
+            ^ tbl.t[3][hi & 0xff] ^ tbl.t[2][(hi >> 8) & 0xff]
+            ^ tbl.t[1][(hi >> 16) & 0xff] ^ tbl.t[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = tbl.t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef OC_CRC32C_SSE42
+
+/*
+ * The crc32 instruction of SSE 4.2 computes exactly CRC32C. It is compiled
+ * for that target only and selected at runtime, so the binary still runs on
+ * CPUs without it.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("sse4.2")))
+#endif
+uint32_t crc32cSse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len && (reinterpret_cast<uintptr_t>(p) & 7)) {
+        crc = _mm_crc32_u8(crc, *p++);
+        --len;
+    }
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = uint32_t(crc64);
+#endif
+    while (len >= 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+bool cpuHasSse42()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (ecx & bit_SSE4_2) != 0;
+#endif
+}
+
+#endif // OC_CRC32C_SSE42
+
+typedef uint32_t (*Crc32cFunction)(uint32_t, const unsigned char *, size_t);
+
+Crc32cFunction selectImplementation()
+{
+#ifdef OC_CRC32C_SSE42
+    if (cpuHasSse42()) {
+        return crc32cSse42;
+    }
+#endif
+    return crc32cSoftware;
+}
+
+Crc32cFunction implementation()
+{
+    static const Crc32cFunction impl = selectImplementation();
+    return impl;
+}
+
+} // anonymous namespace
+
+uint32_t crc32c(uint32_t crc, const char *data, size_t len)
+{
+    return ~implementation()(~crc, reinterpret_cast<const unsigned char *>(data), len);
+}
+
+bool crc32cIsAccelerated()
+{
+    return implementation() != crc32cSoftware;
+}
+
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace OCC {
+
+/**
+ * Updates the CRC32C (Castagnoli) checksum \a crc with \a len bytes of \a data.
+ *
+ * Start with a crc of 0. The computation uses the SSE 4.2 crc32 instruction
+ * if the CPU has it, and a table driven implementation otherwise.
+ * @ingroup libsync
+ */
+uint32_t crc32c(uint32_t crc, const char *data, size_t len);
+
+/** Whether crc32c() uses a hardware accelerated implementation */
+bool crc32cIsAccelerated();
+
+}
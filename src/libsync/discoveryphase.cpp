@@ -18,7 +18,10 @@
 
 #include <QUrl>
 #include "account.h"
+#include "syncjournaldb.h"
+#include "syncjournalfilerecord.h"
 #include <QFileInfo>
+#include <qtconcurrentrun.h>
 
 namespace OCC {
 
@@ -111,6 +114,26 @@ int DiscoveryJob::checkSelectiveSyncNewFolderCallback(void *data, const char *pa
     return static_cast<DiscoveryJob*>(data)->checkSelectiveSyncNewFolder(QString::fromUtf8(path));
 }
 
+bool DiscoveryJob::isLocalDirectoryChanged(const QString &path) const
+{
+    Q_ASSERT(std::is_sorted(_localDiscoveryPaths.begin(), _localDiscoveryPaths.end()));
+
+    if (std::binary_search(_localDiscoveryPaths.begin(), _localDiscoveryPaths.end(), path)) {
+        return true;
+    }
+
+    // Something below the directory changed: the entries starting with "path/"
+    // are right after it in the lexical order.
+    QString pathSlash = path + QLatin1Char('/');
+    auto it = std::lower_bound(_localDiscoveryPaths.begin(), _localDiscoveryPaths.end(), pathSlash);
+    return it != _localDiscoveryPaths.end() && it->startsWith(pathSlash);
+}
+
+int DiscoveryJob::isLocalDirectoryChangedCallback(void *data, const char *path)
+{
+    return static_cast<DiscoveryJob*>(data)->isLocalDirectoryChanged(QString::fromUtf8(path));
+}
+
 
 void DiscoveryJob::update_job_update_callback (bool local,
                                     const char *dirUrl,
@@ -119,6 +142,7 @@ void DiscoveryJob::update_job_update_callback (bool local,
     DiscoveryJob *updateJob = static_cast<DiscoveryJob*>(userdata);
     if (updateJob) {
         // Don't wanna overload the UI
+        QMutexLocker locker(&updateJob->_lastUpdateProgressCallbackMutex);
         if (!updateJob->_lastUpdateProgressCallbackCall.isValid()) {
             updateJob->_lastUpdateProgressCallbackCall.restart(); // first call
         } else if (updateJob->_lastUpdateProgressCallbackCall.elapsed() < 200) {
@@ -126,6 +150,7 @@ void DiscoveryJob::update_job_update_callback (bool local,
         } else {
             updateJob->_lastUpdateProgressCallbackCall.restart();
         }
+        locker.unlock();
 
         QByteArray pPath(dirUrl);
         int indx = pPath.lastIndexOf('/');
@@ -209,8 +234,9 @@ int get_errno_from_http_errcode( int err, const QString & reason ) {
 
 
 
-DiscoverySingleDirectoryJob::DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent)
-    : QObject(parent), _subPath(path), _account(account), _ignoredFirst(false)
+DiscoverySingleDirectoryJob::DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path,
+                                                         const DiscoveryDirectoryResultPtr &result, QObject *parent)
+    : QObject(parent), _result(result), _subPath(path), _account(account), _ignoredFirst(false)
 {
 }
 
@@ -223,8 +249,8 @@ void DiscoverySingleDirectoryJob::start()
                         << "http://owncloud.org/ns:downloadURL" << "http://owncloud.org/ns:dDC"
                         << "http://owncloud.org/ns:permissions");
 
-    QObject::connect(lsColJob, SIGNAL(directoryListingIterated(QString,QMap<QString,QString>)),
-                     this, SLOT(directoryListingIteratedSlot(QString,QMap<QString,QString>)));
+    QObject::connect(lsColJob, SIGNAL(directoryListingEntry(QString,LsColEntry)),
+                     this, SLOT(directoryListingEntrySlot(QString,LsColEntry)));
     QObject::connect(lsColJob, SIGNAL(finishedWithError(QNetworkReply*)), this, SLOT(lsJobFinishedWithErrorSlot(QNetworkReply*)));
     QObject::connect(lsColJob, SIGNAL(finishedWithoutError()), this, SLOT(lsJobFinishedWithoutErrorSlot()));
     lsColJob->start();
@@ -239,66 +265,68 @@ void DiscoverySingleDirectoryJob::abort()
     }
 }
 
-static csync_vio_file_stat_t* propertyMapToFileStat(const QMap<QString,QString> &map)
+static csync_vio_file_stat_t* entryToFileStat(const LsColEntry &entry)
 {
     csync_vio_file_stat_t* file_stat = csync_vio_file_stat_new();
 
-    for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
-        //qDebug() << it.key() << it.value();
-        QString property = it.key();
-        QString value = it.value();
-        if (property == "resourcetype") {
-            if (value.contains("collection")) {
-                file_stat->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-            } else {
-                file_stat->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-            }
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-        } else if  (property == "getlastmodified") {
-            file_stat->mtime = oc_httpdate_parse(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
-        } else if (property == "getcontentlength") {
-            file_stat->size = value.toLongLong();
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
-        } else if (property == "getetag") {
-            file_stat->etag = csync_normalize_etag(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
-        } else if (property == "id") {
-            csync_vio_file_stat_set_file_id(file_stat, value.toUtf8());
-        } else if (property == "downloadURL") {
-            file_stat->directDownloadUrl = strdup(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADURL;
-        } else if (property == "dDC") {
-            file_stat->directDownloadCookies = strdup(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADCOOKIES;
-        } else if (property == "permissions") {
-            auto v = value.toUtf8();
-            if (value.isEmpty()) {
-                // special meaning for our code: server returned permissions but are empty
-                // meaning only reading is allowed for this resource
-                file_stat->remotePerm[0] = ' ';
-                // see _csync_detect_update()
-                file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
-            } else if (v.length() < int(sizeof(file_stat->remotePerm))) {
-                strcpy(file_stat->remotePerm, v.constData());
-                file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
-            } else {
-                qWarning() << "permissions too large" << v;
-            }
+    if (entry.fields & LsColEntry::ResourceType) {
+        if (entry.isCollection) {
+            file_stat->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+        } else {
+            file_stat->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+        }
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+    }
+    if (entry.fields & LsColEntry::LastModified) {
+        file_stat->mtime = oc_httpdate_parse(entry.lastModified.constData());
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+    }
+    if (entry.fields & LsColEntry::ContentLength) {
+        file_stat->size = entry.size;
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+    }
+    if (entry.fields & LsColEntry::ETag) {
+        file_stat->etag = csync_normalize_etag(entry.etag.constData());
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
+    }
+    if (entry.fields & LsColEntry::FileId) {
+        csync_vio_file_stat_set_file_id(file_stat, entry.fileId.constData());
+    }
+    if (entry.fields & LsColEntry::DownloadUrl) {
+        file_stat->directDownloadUrl = strdup(entry.directDownloadUrl.constData());
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADURL;
+    }
+    if (entry.fields & LsColEntry::DownloadCookies) {
+        file_stat->directDownloadCookies = strdup(entry.directDownloadCookies.constData());
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADCOOKIES;
+    }
+    if (entry.fields & LsColEntry::Permissions) {
+        const QByteArray &v = entry.permissions;
+        if (v.isEmpty()) {
+            // special meaning for our code: server returned permissions but are empty
+            // meaning only reading is allowed for this resource
+            file_stat->remotePerm[0] = ' ';
+            // see _csync_detect_update()
+            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
+        } else if (v.length() < int(sizeof(file_stat->remotePerm))) {
+            strcpy(file_stat->remotePerm, v.constData());
+            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
+        } else {
+            qWarning() << "permissions too large" << v;
         }
     }
 
     return file_stat;
 }
 
-void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, const QMap<QString,QString> &map)
+void DiscoverySingleDirectoryJob::directoryListingEntrySlot(QString file, const LsColEntry &entry)
 {
-    //qDebug() << Q_FUNC_INFO << _subPath << file << map.count() << map.keys() << _account->davPath() << _lsColJob->reply()->request().url().path();
+    //qDebug() << Q_FUNC_INFO << _subPath << file << _account->davPath() << _lsColJob->reply()->request().url().path();
     if (!_ignoredFirst) {
         // First result is the directory itself. Maybe should have a better check for that? FIXME
         _ignoredFirst = true;
-        if (map.contains("permissions")) {
-            emit firstDirectoryPermissions(map.value("permissions"));
+        if (entry.fields & LsColEntry::Permissions) {
+            emit firstDirectoryPermissions(QString::fromUtf8(entry.permissions));
         }
 
     } else {
@@ -314,7 +342,7 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
         }
 
 
-        FileStatPointer file_stat(propertyMapToFileStat(map));
+        csync_vio_file_stat_t *file_stat = entryToFileStat(entry);
         file_stat->name = strdup(file.toUtf8());
         if (!file_stat->etag || strlen(file_stat->etag) == 0) {
             qDebug() << "WARNING: etag of" << file_stat->name << "is" << file_stat->etag << " This must not happen.";
@@ -328,16 +356,20 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
         if( fileRef.startsWith(QChar('.')) ) {
             file_stat->flags = CSYNC_VIO_FILE_FLAGS_HIDDEN;
         }
-        //qDebug() << "!!!!" << file_stat << file_stat->name << file_stat->file_id << map.count();
-        _results.append(file_stat);
+        if (file_stat->type == CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+            _subdirectories.append(FileStatPointer(csync_vio_file_stat_copy(file_stat)));
+        }
+        // The sync thread may take it right away
+        _result->append(file_stat);
     }
 
     //This works in concerto with the RequestEtagJob and the Folder object to check if the remote folder changed.
-    if (map.contains("getetag")) {
-       _etagConcatenation += map.value("getetag");
+    if (entry.fields & LsColEntry::ETag) {
+       const QString etag = QString::fromUtf8(entry.etag);
+       _etagConcatenation += etag;
 
        if (_firstEtag.isEmpty()) {
-           _firstEtag = map.value("getetag"); // for directory itself
+           _firstEtag = etag; // for directory itself
        }
     }
 }
@@ -345,7 +377,7 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
 void DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot()
 {
     if (!_ignoredFirst) {
-        // This is a sanity check, if we haven't _ignoredFirst then it means we never received any directoryListingIteratedSlot
+        // This is a sanity check, if we haven't _ignoredFirst then it means we never received any directoryListingEntrySlot
         // which means somehow the server XML was bogus
         emit finishedWithError(ERRNO_WRONG_CONTENT, QLatin1String("Server error: PROPFIND reply is not XML formatted!"));
         deleteLater();
@@ -353,7 +385,7 @@ void DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot()
     }
     emit etag(_firstEtag);
     emit etagConcatenation(_etagConcatenation);
-    emit finishedWithResult(_results);
+    emit finishedWithResult(_subdirectories);
     deleteLater();
 }
 
@@ -380,13 +412,193 @@ void DiscoverySingleDirectoryJob::lsJobFinishedWithErrorSlot(QNetworkReply *r)
     deleteLater();
 }
 
+DiscoveryRemoteChangesJob::DiscoveryRemoteChangesJob(const AccountPtr &account, const QString &path, CSYNC *ctx,
+                                                     const QByteArray &oldToken, QObject *parent)
+    : QObject(parent), _account(account), _path(path), _csync_ctx(ctx), _oldToken(oldToken), _changeCount(0)
+{
+    // remove trailing slash, like for the listings
+    while (_path.endsWith('/')) {
+        _path.chop(1);
+    }
+}
+
+void DiscoveryRemoteChangesJob::start()
+{
+    // The root is not part of the changes, but its etag and permissions are needed anyway
+    PropfindJob *job = new PropfindJob(_account, _path, this);
+    job->setProperties(QList<QByteArray>() << "getetag" << "sync-token"
+                       << "http://owncloud.org/ns:permissions");
+    QObject::connect(job, SIGNAL(result(QVariantMap)), this, SLOT(rootPropfindResultSlot(QVariantMap)));
+    QObject::connect(job, SIGNAL(finishedWithError()), this, SLOT(rootPropfindFinishedWithErrorSlot()));
+    job->start();
+    _job = job;
+}
+
+void DiscoveryRemoteChangesJob::abort()
+{
+    if (_job && _job->reply()) {
+        _job->reply()->abort();
+    }
+}
+
+void DiscoveryRemoteChangesJob::rootPropfindResultSlot(const QVariantMap &result)
+{
+    const QString etag = result.value(QLatin1String("getetag")).toString();
+    if (!etag.isEmpty()) {
+        emit rootEtag(etag);
+    }
+    if (result.contains(QLatin1String("permissions"))) {
+        _rootPermissions = result.value(QLatin1String("permissions")).toString();
+    }
+    _currentToken = result.value(QLatin1String("sync-token")).toString().toUtf8();
+
+    if (_oldToken.isEmpty() || _currentToken.isEmpty()) {
+        // Nothing to ask the changes since, or a server that does not know about them
+        finish(_currentToken);
+        return;
+    }
+    if (csync_remote_changes_init(_csync_ctx) < 0) {
+        finish(_currentToken);
+        return;
+    }
+    if (_currentToken == _oldToken) {
+        // Nothing changed, not even the root needs to be listed
+        finishWithChanges(_currentToken);
+        return;
+    }
+
+    startSyncCollection(_oldToken);
+}
+
+void DiscoveryRemoteChangesJob::startSyncCollection(const QByteArray &token)
+{
+    _askedToken = token;
+    SyncCollectionJob *job = new SyncCollectionJob(_account, _path, token, this);
+    job->setProperties(QList<QByteArray>() << "resourcetype" << "getlastmodified"
+                       << "getcontentlength" << "getetag" << "http://owncloud.org/ns:id"
+                       << "http://owncloud.org/ns:downloadURL" << "http://owncloud.org/ns:dDC"
+                       << "http://owncloud.org/ns:permissions");
+    QObject::connect(job, SIGNAL(directoryListingEntry(QString,LsColEntry)),
+                     this, SLOT(directoryListingEntrySlot(QString,LsColEntry)));
+    QObject::connect(job, SIGNAL(directoryListingRemoved(QString)),
+                     this, SLOT(directoryListingRemovedSlot(QString)));
+    QObject::connect(job, SIGNAL(finishedWithError(QNetworkReply*)),
+                     this, SLOT(syncCollectionFinishedWithErrorSlot(QNetworkReply*)));
+    QObject::connect(job, SIGNAL(finishedWithoutError()), this, SLOT(syncCollectionFinishedWithoutErrorSlot()));
+    job->start();
+    _job = job;
+}
+
+void DiscoveryRemoteChangesJob::rootPropfindFinishedWithErrorSlot()
+{
+    // The listing of the root will report the error
+    finish(QByteArray());
+}
+
+QString DiscoveryRemoteChangesJob::relativePath(QString file) const
+{
+    // Remove <webDAV-Url>/folder/ from <webDAV-Url>/folder/sub/file.txt
+    file.remove(0, _job->reply()->request().url().path().length());
+    while (file.endsWith('/')) {
+        file.chop(1);
+    }
+    while (file.startsWith('/')) {
+        file.remove(0, 1);
+    }
+    return file;
+}
+
+void DiscoveryRemoteChangesJob::directoryListingEntrySlot(const QString &name, const LsColEntry &entry)
+{
+    const QString file = relativePath(name);
+    csync_vio_file_stat_t *file_stat = entryToFileStat(entry);
+    if (file.section(QLatin1Char('/'), -1).startsWith(QLatin1Char('.'))) {
+        file_stat->flags = CSYNC_VIO_FILE_FLAGS_HIDDEN;
+    }
+    // csync names it after the path, and takes ownership of it
+    csync_remote_changes_add(_csync_ctx, file.toUtf8().constData(), file_stat);
+    ++_changeCount;
+}
+
+void DiscoveryRemoteChangesJob::directoryListingRemovedSlot(const QString &name)
+{
+    csync_remote_changes_add(_csync_ctx, relativePath(name).toUtf8().constData(), 0);
+    ++_changeCount;
+}
+
+void DiscoveryRemoteChangesJob::syncCollectionFinishedWithoutErrorSlot()
+{
+    SyncCollectionJob *job = qobject_cast<SyncCollectionJob *>(_job.data());
+    QByteArray newToken = job ? job->newSyncToken() : QByteArray();
+    if (newToken.isEmpty()) {
+        qDebug() << "The sync-collection reply has no sync token, listing all changed directories";
+        csync_remote_changes_destroy(_csync_ctx);
+        finish(_currentToken);
+        return;
+    }
+    if (job->truncated()) {
+        // The rest are the changes since the new token, the later reports win
+        if (newToken == _askedToken) {
+            qDebug() << "The server truncates the changes without progress, listing all changed directories";
+            csync_remote_changes_destroy(_csync_ctx);
+            finish(_currentToken);
+            return;
+        }
+        qDebug() << "The sync-collection reply was truncated, asking for the changes since" << newToken;
+        startSyncCollection(newToken);
+        return;
+    }
+
+    finishWithChanges(newToken);
+}
+
+void DiscoveryRemoteChangesJob::syncCollectionFinishedWithErrorSlot(QNetworkReply *r)
+{
+    // Most likely the server forgot about the old token (403 or 409 with
+    // <d:valid-sync-token/>), anything else is reported by the listings.
+    qDebug() << Q_FUNC_INFO << r->errorString()
+             << r->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    csync_remote_changes_destroy(_csync_ctx);
+    finish(_currentToken);
+}
+
+void DiscoveryRemoteChangesJob::finishWithChanges(const QByteArray &newToken)
+{
+    qDebug() << _changeCount << "remote changes since" << _oldToken;
+    // The root is not listed, so its permissions have to come from here
+    if (!_csync_ctx->remote.root_perms && !_rootPermissions.isNull()) {
+        _csync_ctx->remote.root_perms = strdup(_rootPermissions.toUtf8());
+    }
+    finish(newToken);
+}
+
+void DiscoveryRemoteChangesJob::finish(const QByteArray &newToken)
+{
+    emit finished(newToken);
+    deleteLater();
+}
+
+int DiscoveryMainThread::maximumParallelListings()
+{
+    static int max = qgetenv("OWNCLOUD_MAX_PARALLEL_DISCOVERY").toUInt();
+    if (!max) {
+        max = 4; //default
+    }
+    return max;
+}
+
 void DiscoveryMainThread::setupHooks(DiscoveryJob *discoveryJob, const QString &pathPrefix)
 {
     _discoveryJob = discoveryJob;
     _pathPrefix = pathPrefix;
 
-    connect(discoveryJob, SIGNAL(doOpendirSignal(QString,DiscoveryDirectoryResult*)),
-            this, SLOT(doOpendirSlot(QString,DiscoveryDirectoryResult*)),
+    // Used to not prefetch directories csync is not going to open.
+    // (The DiscoveryJob has its own copy that lives in the other thread)
+    _selectiveSyncBlackList = discoveryJob->_selectiveSyncBlackList;
+    _selectiveSyncBlackList.sort();
+
+    connect(discoveryJob, SIGNAL(doOpendirSignal(QString,DiscoveryDirectoryResultPtr*)),
+            this, SLOT(doOpendirSlot(QString,DiscoveryDirectoryResultPtr*)),
             Qt::QueuedConnection);
     connect(discoveryJob, SIGNAL(doGetSizeSignal(QString,qint64*)),
             this, SLOT(doGetSizeSlot(QString,qint64*)),
@@ -394,7 +606,31 @@ void DiscoveryMainThread::setupHooks(DiscoveryJob *discoveryJob, const QString &
 }
 
 // Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
-void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResultPtr *r)
+{
+    // emit _discoveryJob->folderDiscovered(false, subPath);
+    _discoveryJob->update_job_update_callback (false, subPath.toUtf8(), _discoveryJob);
+
+    _openedPaths.insert(subPath);
+    _prefetchQueue.removeAll(subPath);
+
+    auto prefetched = _prefetchedResults.find(subPath);
+    if (prefetched != _prefetchedResults.end()) {
+        // The listing was prefetched, what arrived of it so far can be used right away
+        qDebug() << Q_FUNC_INFO << "Using prefetched listing for" << subPath;
+        *r = *prefetched;
+        _prefetchedResults.erase(prefetched);
+    } else {
+        // Not prefetched: request it now, regardless of the number of running listings
+        *r = startSingleDirectoryJob(subPath);
+    }
+
+    // The sync thread waits for the entries on the result itself
+    QMutexLocker locker(&_discoveryJob->_vioMutex);
+    _discoveryJob->_vioWaitCondition.wakeAll();
+}
+
+DiscoveryDirectoryResultPtr DiscoveryMainThread::startSingleDirectoryJob(const QString &subPath)
 {
     QString fullPath = _pathPrefix;
     if (!_pathPrefix.endsWith('/')) {
@@ -406,61 +642,112 @@ void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirecto
         fullPath.chop(1);
     }
 
-    // emit _discoveryJob->folderDiscovered(false, subPath);
-    _discoveryJob->update_job_update_callback (false, subPath.toUtf8(), _discoveryJob);
-
-    // Result gets written in there
-    _currentDiscoveryDirectoryResult = r;
-    _currentDiscoveryDirectoryResult->path = fullPath;
+    DiscoveryDirectoryResultPtr result(new DiscoveryDirectoryResult);
+    result->path = subPath;
 
     // Schedule the DiscoverySingleDirectoryJob
-    _singleDirJob = new DiscoverySingleDirectoryJob(_account, fullPath, this);
-    QObject::connect(_singleDirJob, SIGNAL(finishedWithResult(const QList<FileStatPointer> &)),
+    auto singleDirJob = new DiscoverySingleDirectoryJob(_account, fullPath, result, this);
+    QObject::connect(singleDirJob, SIGNAL(finishedWithResult(const QList<FileStatPointer> &)),
                      this, SLOT(singleDirectoryJobResultSlot(const QList<FileStatPointer> &)));
-    QObject::connect(_singleDirJob, SIGNAL(finishedWithError(int,QString)),
+    QObject::connect(singleDirJob, SIGNAL(finishedWithError(int,QString)),
                      this, SLOT(singleDirectoryJobFinishedWithErrorSlot(int,QString)));
-    QObject::connect(_singleDirJob, SIGNAL(firstDirectoryPermissions(QString)),
-                     this, SLOT(singleDirectoryJobFirstDirectoryPermissionsSlot(QString)));
-    QObject::connect(_singleDirJob, SIGNAL(etagConcatenation(QString)),
+    if (subPath.isEmpty()) {
+        // Only the root folder's permissions are of interest, and the sync thread is
+        // blocked waiting for it (the root is never prefetched)
+        QObject::connect(singleDirJob, SIGNAL(firstDirectoryPermissions(QString)),
+                         this, SLOT(singleDirectoryJobFirstDirectoryPermissionsSlot(QString)));
+    }
+    QObject::connect(singleDirJob, SIGNAL(etagConcatenation(QString)),
                      this, SIGNAL(etagConcatenation(QString)));
-    QObject::connect(_singleDirJob, SIGNAL(etag(QString)),
+    QObject::connect(singleDirJob, SIGNAL(etag(QString)),
                      this, SIGNAL(etag(QString)));
-    _singleDirJob->start();
+    _runningJobs.insert(singleDirJob, result);
+    singleDirJob->start();
+    return result;
 }
 
+void DiscoveryMainThread::startPrefetchJobs()
+{
+    while (_runningJobs.count() < maximumParallelListings() && !_prefetchQueue.isEmpty()) {
+        const QString subPath = _prefetchQueue.takeFirst();
+        if (_openedPaths.contains(subPath) || _prefetchedResults.contains(subPath)) {
+            continue;
+        }
+        _prefetchedResults.insert(subPath, startSingleDirectoryJob(subPath));
+    }
+}
 
-void DiscoveryMainThread::singleDirectoryJobResultSlot(const QList<FileStatPointer> & result)
+/* Guess which of the sub directories csync_ftw will open, and put them in front of the
+ * prefetch queue. csync reads a directory from the database instead of doing a PROPFIND
+ * when its etag, file id and permissions are the same as in the journal (see
+ * _csync_detect_update), so these are not fetched. A wrong guess only costs a request. */
+void DiscoveryMainThread::queueChildDirectories(const QString &subPath, const QList<FileStatPointer> &subdirectories)
 {
-    if (!_currentDiscoveryDirectoryResult) {
-        return; // possibly aborted
+    if (maximumParallelListings() <= 1 || !_journal) {
+        return;
     }
-    qDebug() << Q_FUNC_INFO << "Have" << result.count() << "results for " << _currentDiscoveryDirectoryResult->path;
 
+    QLinkedList<QString> children;
+    foreach (const FileStatPointer &file_stat, subdirectories) {
+        if (!file_stat->name) {
+            continue;
+        }
+        const QString childPath = subPath.isEmpty() ? QString::fromUtf8(file_stat->name)
+            : subPath + QLatin1Char('/') + QString::fromUtf8(file_stat->name);
+
+        if (_openedPaths.contains(childPath)) {
+            // Opened while the listing of this directory was still arriving
+            continue;
+        }
+        if (!_selectiveSyncBlackList.isEmpty() && findPathInList(_selectiveSyncBlackList, childPath)) {
+            continue;
+        }
 
-    _currentDiscoveryDirectoryResult->list = result;
-    _currentDiscoveryDirectoryResult->code = 0;
-    _currentDiscoveryDirectoryResult->listIndex = 0;
-     _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
+        SyncJournalFileRecord record = _journal->getFileRecord(childPath);
+        if (record.isValid()
+                && record._etag == QByteArray(file_stat->etag)
+                && record._fileId == QByteArray(file_stat->file_id)
+                && record._remotePerm == QByteArray(file_stat->remotePerm)) {
+            // Will be read from the database
+            continue;
+        }
+        children.append(childPath);
+    }
 
-    _discoveryJob->_vioMutex.lock();
-    _discoveryJob->_vioWaitCondition.wakeAll();
-    _discoveryJob->_vioMutex.unlock();
+    // csync walks depth first: the children of this directory are needed before the
+    // directories that were queued earlier.
+    while (!children.isEmpty()) {
+        _prefetchQueue.prepend(children.takeLast());
+    }
 }
 
-void DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg)
+void DiscoveryMainThread::singleDirectoryJobResultSlot(const QList<FileStatPointer> &subdirectories)
 {
-    if (!_currentDiscoveryDirectoryResult) {
+    auto job = static_cast<DiscoverySingleDirectoryJob *>(sender());
+    if (!_runningJobs.contains(job)) {
         return; // possibly aborted
     }
-    qDebug() << Q_FUNC_INFO << csyncErrnoCode << msg;
+    DiscoveryDirectoryResultPtr result = _runningJobs.take(job);
+    qDebug() << Q_FUNC_INFO << "Finished the listing of" << result->path;
 
-     _currentDiscoveryDirectoryResult->code = csyncErrnoCode;
-     _currentDiscoveryDirectoryResult->msg = msg;
-     _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
+    result->finish(0, QString());
+    queueChildDirectories(result->path, subdirectories);
+    startPrefetchJobs();
+}
 
-    _discoveryJob->_vioMutex.lock();
-    _discoveryJob->_vioWaitCondition.wakeAll();
-    _discoveryJob->_vioMutex.unlock();
+void DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg)
+{
+    auto job = static_cast<DiscoverySingleDirectoryJob *>(sender());
+    if (!_runningJobs.contains(job)) {
+        return; // possibly aborted
+    }
+    DiscoveryDirectoryResultPtr result = _runningJobs.take(job);
+    qDebug() << Q_FUNC_INFO << result->path << csyncErrnoCode << msg;
+
+    // Errors are kept and reported only if csync actually opens that directory,
+    // or when it reads past the entries that arrived before the error.
+    result->finish(csyncErrnoCode, msg);
+    startPrefetchJobs();
 }
 
 void DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot(const QString &p)
@@ -528,20 +815,18 @@ void DiscoveryMainThread::slotGetSizeResult(const QVariantMap &map)
 
 // called from SyncEngine
 void DiscoveryMainThread::abort() {
-    if (_singleDirJob) {
-        _singleDirJob->disconnect(SIGNAL(finishedWithError(int,QString)), this);
-        _singleDirJob->disconnect(SIGNAL(firstDirectoryPermissions(QString)), this);
-        _singleDirJob->disconnect(SIGNAL(finishedWithResult(const QList<FileStatPointer> &)), this);
-        _singleDirJob->abort();
-    }
-    if (_currentDiscoveryDirectoryResult) {
-        if (_discoveryJob->_vioMutex.tryLock()) {
-            _currentDiscoveryDirectoryResult->msg = tr("Aborted by the user"); // Actually also created somewhere else by sync engine
-            _currentDiscoveryDirectoryResult->code = EIO;
-            _currentDiscoveryDirectoryResult = 0;
-            _discoveryJob->_vioWaitCondition.wakeAll();
-            _discoveryJob->_vioMutex.unlock();
-        }
+    auto runningJobs = _runningJobs;
+    _runningJobs.clear();
+    _prefetchQueue.clear();
+    _prefetchedResults.clear();
+    for (auto it = runningJobs.constBegin(); it != runningJobs.constEnd(); ++it) {
+        DiscoverySingleDirectoryJob *singleDirJob = it.key();
+        singleDirJob->disconnect(SIGNAL(finishedWithError(int,QString)), this);
+        singleDirJob->disconnect(SIGNAL(firstDirectoryPermissions(QString)), this);
+        singleDirJob->disconnect(SIGNAL(finishedWithResult(const QList<FileStatPointer> &)), this);
+        singleDirJob->abort();
+        // Wakes the sync thread if it waits for this listing
+        it.value()->finish(EIO, tr("Aborted by the user")); // Actually also created somewhere else by sync engine
     }
     if (_currentGetSizeResult) {
         _currentGetSizeResult = 0;
@@ -550,6 +835,36 @@ void DiscoveryMainThread::abort() {
     }
 }
 
+DiscoveryDirectoryResult::~DiscoveryDirectoryResult()
+{
+    for (int i = listIndex; i < list.size(); ++i) {
+        csync_vio_file_stat_destroy(list.at(i));
+    }
+}
+
+void DiscoveryDirectoryResult::append(csync_vio_file_stat_t *file_stat)
+{
+    QMutexLocker locker(&mutex);
+    if (complete) {
+        csync_vio_file_stat_destroy(file_stat); // aborted
+        return;
+    }
+    list.append(file_stat);
+    changed.wakeAll();
+}
+
+void DiscoveryDirectoryResult::finish(int c, const QString &m)
+{
+    QMutexLocker locker(&mutex);
+    if (complete) {
+        return;
+    }
+    code = c;
+    msg = m;
+    complete = true;
+    changed.wakeAll();
+}
+
 csync_vio_handle_t* DiscoveryJob::remote_vio_opendir_hook (const char *url,
                                     void *userdata)
 {
@@ -557,19 +872,29 @@ csync_vio_handle_t* DiscoveryJob::remote_vio_opendir_hook (const char *url,
     if (discoveryJob) {
         qDebug() << discoveryJob << url << "Calling into main thread...";
 
-        QScopedPointer<DiscoveryDirectoryResult> directoryResult(new DiscoveryDirectoryResult());
-        directoryResult->code = EIO;
+        QScopedPointer<DiscoveryDirectoryResultPtr> handle(new DiscoveryDirectoryResultPtr);
 
         discoveryJob->_vioMutex.lock();
         const QString qurl = QString::fromUtf8(url);
-        emit discoveryJob->doOpendirSignal(qurl, directoryResult.data());
+        emit discoveryJob->doOpendirSignal(qurl, handle.data());
         discoveryJob->_vioWaitCondition.wait(&discoveryJob->_vioMutex, ULONG_MAX); // FIXME timeout?
         discoveryJob->_vioMutex.unlock();
 
         qDebug() << discoveryJob << url << "...Returned from main thread";
 
-        // Upon awakening from the _vioWaitCondition, iterator should be a valid iterator.
-        if (directoryResult->code != 0) {
+        DiscoveryDirectoryResultPtr directoryResult = *handle;
+        if (!directoryResult) {
+            // Woken up without a result, the main thread was aborted
+            errno = EIO;
+            return NULL;
+        }
+
+        // Wait for the first entry, errors are only known once the listing finished
+        QMutexLocker locker(&directoryResult->mutex);
+        while (directoryResult->list.isEmpty() && !directoryResult->complete) {
+            directoryResult->changed.wait(&directoryResult->mutex);
+        }
+        if (directoryResult->complete && directoryResult->code != 0) {
             qDebug() << directoryResult->code << "when opening" << url << "msg=" << directoryResult->msg;
             errno = directoryResult->code;
             // save the error string to the context
@@ -577,7 +902,7 @@ csync_vio_handle_t* DiscoveryJob::remote_vio_opendir_hook (const char *url,
             return NULL;
         }
 
-        return directoryResult.take();
+        return handle.take();
     }
     return NULL;
 }
@@ -588,12 +913,29 @@ csync_vio_file_stat_t* DiscoveryJob::remote_vio_readdir_hook (csync_vio_handle_t
 {
     DiscoveryJob *discoveryJob = static_cast<DiscoveryJob*>(userdata);
     if (discoveryJob) {
-        DiscoveryDirectoryResult *directoryResult = static_cast<DiscoveryDirectoryResult*>(dhandle);
+        DiscoveryDirectoryResult *directoryResult = static_cast<DiscoveryDirectoryResultPtr*>(dhandle)->data();
+        QMutexLocker locker(&directoryResult->mutex);
+        // The listing may still be arriving
+        while (directoryResult->listIndex == directoryResult->list.size() && !directoryResult->complete) {
+            directoryResult->changed.wait(&directoryResult->mutex);
+        }
         if (directoryResult->listIndex < directoryResult->list.size()) {
-            csync_vio_file_stat_t *file_stat = directoryResult->list.at(directoryResult->listIndex++).data();
-            // Make a copy, csync_update will delete the copy
-            return csync_vio_file_stat_copy(file_stat);
+            // csync_update will delete it, no need to keep what csync already read
+            csync_vio_file_stat_t *file_stat = directoryResult->list.at(directoryResult->listIndex);
+            directoryResult->list[directoryResult->listIndex++] = 0;
+            return file_stat;
         }
+        int code = directoryResult->code;
+        if (code != 0) {
+            // The listing failed after some of its entries arrived
+            qDebug() << code << "when reading" << directoryResult->path << "msg=" << directoryResult->msg;
+            discoveryJob->_csync_ctx->error_string = qstrdup( directoryResult->msg.toUtf8().constData() );
+        }
+        locker.unlock();
+        // Waiting, logging and allocating may have clobbered errno, csync_ftw only
+        // takes the end as complete if it is 0
+        errno = code;
+        return NULL;
     }
     return NULL;
 }
@@ -602,20 +944,34 @@ void DiscoveryJob::remote_vio_closedir_hook (csync_vio_handle_t *dhandle,  void
 {
     DiscoveryJob *discoveryJob = static_cast<DiscoveryJob*>(userdata);
     if (discoveryJob) {
-        DiscoveryDirectoryResult *directoryResult = static_cast<DiscoveryDirectoryResult*> (dhandle);
-        QString path = directoryResult->path;
+        DiscoveryDirectoryResultPtr *handle = static_cast<DiscoveryDirectoryResultPtr*> (dhandle);
+        QString path = (*handle)->path;
         qDebug() << Q_FUNC_INFO << discoveryJob << path;
-        delete directoryResult; // just deletes the struct and the iterator, the data itself is owned by the SyncEngine/DiscoveryMainThread
+        delete handle; // the result itself is deleted once the main thread is done with it as well
     }
 }
 
+int DiscoveryJob::updateLocal(DiscoveryJob *discoveryJob)
+{
+    // csync logs through thread local settings
+    csync_set_log_callback(discoveryJob->_log_callback);
+    csync_set_log_level(discoveryJob->_log_level);
+    csync_set_log_userdata(discoveryJob->_log_userdata);
+
+    return csync_update_local(discoveryJob->_csync_ctx);
+}
+
 void DiscoveryJob::start() {
     _selectiveSyncBlackList.sort();
     _selectiveSyncWhiteList.sort();
+    _localDiscoveryPaths.sort();
     _csync_ctx->callbacks.update_callback_userdata = this;
     _csync_ctx->callbacks.update_callback = update_job_update_callback;
     _csync_ctx->callbacks.checkSelectiveSyncBlackListHook = isInSelectiveSyncBlackListCallback;
     _csync_ctx->callbacks.checkSelectiveSyncNewFolderHook = checkSelectiveSyncNewFolderCallback;
+    if (_partialLocalDiscovery) {
+        _csync_ctx->callbacks.checkLocalDirectoryChangedHook = isLocalDirectoryChangedCallback;
+    }
 
     _csync_ctx->callbacks.remote_opendir_hook = remote_vio_opendir_hook;
     _csync_ctx->callbacks.remote_readdir_hook = remote_vio_readdir_hook;
@@ -626,10 +982,26 @@ void DiscoveryJob::start() {
     csync_set_log_level(_log_level);
     csync_set_log_userdata(_log_userdata);
     _lastUpdateProgressCallbackCall.invalidate();
-    int ret = csync_update(_csync_ctx);
+
+    // The local update waits for the disk and the remote one for the server,
+    // so both replicas are walked at the same time when csync allows it.
+    int ret = csync_update_start(_csync_ctx);
+    if (ret >= 0 && csync_update_walks_in_parallel(_csync_ctx)) {
+        QFuture<int> localResult = QtConcurrent::run(updateLocal, this);
+        ret = csync_update_remote(_csync_ctx);
+        const int localRet = localResult.result();
+        ret = csync_update_finish(_csync_ctx, ret < 0 ? ret : localRet);
+    } else if (ret >= 0) {
+        ret = csync_update_local(_csync_ctx);
+        if (ret >= 0) {
+            ret = csync_update_remote(_csync_ctx);
+        }
+        ret = csync_update_finish(_csync_ctx, ret);
+    }
 
     _csync_ctx->callbacks.checkSelectiveSyncNewFolderHook = 0;
     _csync_ctx->callbacks.checkSelectiveSyncBlackListHook = 0;
+    _csync_ctx->callbacks.checkLocalDirectoryChangedHook = 0;
     _csync_ctx->callbacks.update_callback = 0;
     _csync_ctx->callbacks.update_callback_userdata = 0;
 
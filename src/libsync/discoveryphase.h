@@ -23,10 +23,14 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <QLinkedList>
+#include <QHash>
+#include <QSet>
+#include <QSharedPointer>
 
 namespace OCC {
 
 class Account;
+class SyncJournalDb;
 
 /**
  * The Discovery Phase was once called "update" phase in csync terms.
@@ -61,14 +65,33 @@ private:
     csync_vio_file_stat_t *_stat;
 };
 
+/**
+ * @brief The listing of one remote directory, shared by the main thread that fills it
+ * and the sync thread that reads it.
+ *
+ * The sync thread can read the entries while the listing is still running, see
+ * DiscoveryJob::remote_vio_readdir_hook. All members are protected by the mutex.
+ *
+ * @ingroup libsync
+ */
 struct DiscoveryDirectoryResult {
     QString path;
     QString msg;
     int code;
-    QList<FileStatPointer> list;
+    QList<csync_vio_file_stat_t *> list; // the entries before listIndex were taken by the sync thread
     int listIndex;
-    DiscoveryDirectoryResult() : code(EIO), listIndex(0) { }
+    bool complete;
+    QMutex mutex;
+    QWaitCondition changed;
+
+    DiscoveryDirectoryResult() : code(EIO), listIndex(0), complete(false) { }
+    ~DiscoveryDirectoryResult();
+
+    // Called from the main thread
+    void append(csync_vio_file_stat_t *file_stat);
+    void finish(int code, const QString &msg);
 };
+typedef QSharedPointer<DiscoveryDirectoryResult> DiscoveryDirectoryResultPtr;
 
 /**
  * @brief The DiscoverySingleDirectoryJob class
@@ -80,7 +103,8 @@ struct DiscoveryDirectoryResult {
 class DiscoverySingleDirectoryJob : public QObject {
     Q_OBJECT
 public:
-    explicit DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent = 0);
+    explicit DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path,
+                                         const DiscoveryDirectoryResultPtr &result, QObject *parent = 0);
     void start();
     void abort();
     // This is not actually a network job, it is just a job
@@ -88,14 +112,17 @@ signals:
     void firstDirectoryPermissions(const QString &);
     void etagConcatenation(const QString &);
     void etag(const QString &);
-    void finishedWithResult(const QList<FileStatPointer> &);
+    // The entries went to the DiscoveryDirectoryResult as they arrived, only the
+    // sub directories are passed here
+    void finishedWithResult(const QList<FileStatPointer> &subdirectories);
     void finishedWithError(int csyncErrnoCode, const QString &msg);
 private slots:
-    void directoryListingIteratedSlot(QString, const QMap<QString,QString>&);
+    void directoryListingEntrySlot(QString, const LsColEntry&);
     void lsJobFinishedWithoutErrorSlot();
     void lsJobFinishedWithErrorSlot(QNetworkReply*);
 private:
-    QList<FileStatPointer> _results;
+    DiscoveryDirectoryResultPtr _result;
+    QList<FileStatPointer> _subdirectories;
     QString _subPath;
     QString _etagConcatenation;
     QString _firstEtag;
@@ -104,28 +131,100 @@ private:
     QPointer<LsColJob> _lsColJob;
 };
 
+/**
+ * @brief Records the remote changes since the last sync in the csync context
+ *
+ * Run in the main thread before the DiscoveryJob starts. It reads the etag, the
+ * permissions and the current sync token of the root, then asks for the changes
+ * since oldToken with a SyncCollectionJob and passes them to
+ * csync_remote_changes_add(). The remote update then only lists the directories
+ * with changes below them, and takes the rest from the database.
+ *
+ * A reply the server truncated is followed by a report for the changes since
+ * the token it returned, until one is complete.
+ *
+ * If there is no old token, or the server cannot tell the changes since it, no
+ * changes are recorded and the remote update lists every changed directory as usual.
+ * finished() is emitted with the token to store once the sync succeeded, which is
+ * empty if the server does not support sync tokens.
+ *
+ * @ingroup libsync
+ */
+class DiscoveryRemoteChangesJob : public QObject {
+    Q_OBJECT
+public:
+    explicit DiscoveryRemoteChangesJob(const AccountPtr &account, const QString &path, CSYNC *ctx,
+                                       const QByteArray &oldToken, QObject *parent = 0);
+    void start();
+    void abort();
+signals:
+    void rootEtag(const QString &);
+    void finished(const QByteArray &newToken);
+private slots:
+    void rootPropfindResultSlot(const QVariantMap &);
+    void rootPropfindFinishedWithErrorSlot();
+    void directoryListingEntrySlot(const QString &, const LsColEntry &);
+    void directoryListingRemovedSlot(const QString &);
+    void syncCollectionFinishedWithoutErrorSlot();
+    void syncCollectionFinishedWithErrorSlot(QNetworkReply *);
+private:
+    void startSyncCollection(const QByteArray &token);
+    QString relativePath(QString file) const;
+    void finishWithChanges(const QByteArray &newToken);
+    void finish(const QByteArray &newToken);
+
+    AccountPtr _account;
+    QString _path;
+    CSYNC *_csync_ctx;
+    QByteArray _oldToken;
+    QByteArray _askedToken; // of the running SyncCollectionJob
+    QByteArray _currentToken; // from the PROPFIND of the root
+    QString _rootPermissions;
+    int _changeCount;
+    QPointer<AbstractNetworkJob> _job;
+};
+
 // Lives in main thread. Deleted by the SyncEngine
 class DiscoveryJob;
 class DiscoveryMainThread : public QObject {
     Q_OBJECT
 
     QPointer<DiscoveryJob> _discoveryJob;
-    QPointer<DiscoverySingleDirectoryJob> _singleDirJob;
     QString _pathPrefix; // remote path
     AccountPtr _account;
-    DiscoveryDirectoryResult *_currentDiscoveryDirectoryResult;
+    SyncJournalDb *_journal;
+    QStringList _selectiveSyncBlackList; // sorted
     qint64 *_currentGetSizeResult;
 
+    // The directory listings that are currently running, and their results.
+    QHash<DiscoverySingleDirectoryJob *, DiscoveryDirectoryResultPtr> _runningJobs;
+    // Directories that are likely to be opened by csync soon, in the order they should be fetched.
+    QLinkedList<QString> _prefetchQueue;
+    // Prefetched listings, running or finished, that the DiscoveryJob did not open yet.
+    QHash<QString, DiscoveryDirectoryResultPtr> _prefetchedResults;
+    // Directories the DiscoveryJob opened. It can open one before the listing of its parent
+    // finished, so they must not be prefetched after that.
+    QSet<QString> _openedPaths;
+
+    DiscoveryDirectoryResultPtr startSingleDirectoryJob(const QString &subPath);
+    void startPrefetchJobs();
+    void queueChildDirectories(const QString &subPath, const QList<FileStatPointer> &subdirectories);
+
 public:
-    DiscoveryMainThread(AccountPtr account) : QObject(), _account(account),
-        _currentDiscoveryDirectoryResult(0), _currentGetSizeResult(0)
+    DiscoveryMainThread(AccountPtr account, SyncJournalDb *journal = 0) : QObject(), _account(account),
+        _journal(journal), _currentGetSizeResult(0)
     { }
     void abort();
 
+    /**
+     * The maximum number of PROPFIND requests that may be in flight at the same time.
+     * Setting OWNCLOUD_MAX_PARALLEL_DISCOVERY to 1 disables the prefetching of sub directories.
+     */
+    static int maximumParallelListings();
 
 public slots:
     // From DiscoveryJob:
-    void doOpendirSlot(const QString &url, DiscoveryDirectoryResult* );
+    void doOpendirSlot(const QString &url, DiscoveryDirectoryResultPtr* );
     void doGetSizeSlot(const QString &path ,qint64 *result);
 
     // From Job:
@@ -157,6 +256,7 @@ class DiscoveryJob : public QObject {
     int                 _log_level;
     void*               _log_userdata;
     QElapsedTimer       _lastUpdateProgressCallbackCall;
+    QMutex              _lastUpdateProgressCallbackMutex; // the local and the remote update report at the same time
 
     /**
      * return true if the given path should be ignored,
@@ -167,11 +267,21 @@ class DiscoveryJob : public QObject {
     bool checkSelectiveSyncNewFolder(const QString &path);
     static int checkSelectiveSyncNewFolderCallback(void*, const char*);
 
+    /**
+     * return true if the local directory must be read from the file system,
+     * false if its contents can be taken from the journal
+     */
+    bool isLocalDirectoryChanged(const QString &path) const;
+    static int isLocalDirectoryChangedCallback(void *, const char *);
+
     // Just for progress
     static void update_job_update_callback (bool local,
                                             const char *dirname,
                                             void *userdata);
 
+    // Runs the local update detection on a thread of its own
+    static int updateLocal(DiscoveryJob *discoveryJob);
+
     // For using QNAM to get the directory listings
     static csync_vio_handle_t* remote_vio_opendir_hook (const char *url,
                                         void *userdata);
@@ -185,7 +295,7 @@ class DiscoveryJob : public QObject {
 
 public:
     explicit DiscoveryJob(CSYNC *ctx, QObject* parent = 0)
-            : QObject(parent), _csync_ctx(ctx), _newBigFolderSizeLimit(-1) {
+            : QObject(parent), _csync_ctx(ctx), _newBigFolderSizeLimit(-1), _partialLocalDiscovery(false) {
         // We need to forward the log property as csync uses thread local
         // and updates run in another thread
         _log_callback = csync_get_log_callback();
@@ -196,13 +306,16 @@ public:
     QStringList _selectiveSyncBlackList;
     QStringList _selectiveSyncWhiteList;
     qint64 _newBigFolderSizeLimit;
+    /// Only read the directories in _localDiscoveryPaths (and their parents) from the file system
+    bool _partialLocalDiscovery;
+    QStringList _localDiscoveryPaths;
     Q_INVOKABLE void start();
 signals:
     void finished(int result);
     void folderDiscovered(bool local, QString folderUrl);
 
     // After the discovery job has been woken up again (_vioWaitCondition)
-    void doOpendirSignal(QString url, DiscoveryDirectoryResult*);
+    void doOpendirSignal(QString url, DiscoveryDirectoryResultPtr*);
     void doGetSizeSignal(const QString &path, qint64 *result);
 
     // A new folder was discovered and was not synced because of the confirmation feature
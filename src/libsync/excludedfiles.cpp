@@ -26,13 +26,13 @@ extern "C" {
 using namespace OCC;
 
 ExcludedFiles::ExcludedFiles()
-    : _excludes(NULL)
+    : _matcher(NULL)
 {
 }
 
 ExcludedFiles::~ExcludedFiles()
 {
-    c_strlist_destroy(_excludes);
+    csync_exclude_matcher_free(_matcher);
 }
 
 ExcludedFiles& ExcludedFiles::instance()
@@ -50,12 +50,14 @@ void ExcludedFiles::addExcludeFilePath(const QString& path)
 void ExcludedFiles::reloadExcludes()
 {
     QWriteLocker locker(&_mutex);
-    c_strlist_destroy(_excludes);
-    _excludes = NULL;
+    csync_exclude_matcher_free(_matcher);
 
+    c_strlist_t* excludes = NULL;
     foreach (const QString& file, _excludeFiles) {
-        csync_exclude_load(file.toUtf8(), &_excludes);
+        csync_exclude_load(file.toUtf8(), &excludes);
     }
+    _matcher = csync_exclude_matcher_new(excludes);
+    c_strlist_destroy(excludes);
 }
 
 CSYNC_EXCLUDE_TYPE ExcludedFiles::isExcluded(
@@ -76,5 +78,5 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::isExcluded(
         type = CSYNC_FTW_TYPE_DIR;
     }
     QReadLocker lock(&_mutex);
-    return csync_excluded_no_ctx(_excludes, relativePath.toUtf8(), type);
+    return csync_excluded_no_ctx(_matcher, relativePath.toUtf8(), type);
 }
@@ -66,7 +66,8 @@ private:
     ExcludedFiles();
     ~ExcludedFiles();
 
-    c_strlist_t* _excludes;
+    /// Compiled from the patterns of all _excludeFiles in reloadExcludes()
+    csync_exclude_matcher_t* _matcher;
     QStringList _excludeFiles;
     mutable QReadWriteLock _mutex;
 };
@@ -14,11 +14,13 @@
 #include "filesystem.h"
 
 #include "utility.h"
+#include "crc32c.h"
 #include <QFile>
 #include <QFileInfo>
 #include <QCoreApplication>
 #include <QDebug>
 #include <QCryptographicHash>
+#include <QThreadStorage>
 
 #ifdef ZLIB_FOUND
 #include <zlib.h>
@@ -35,6 +37,10 @@
 
 #endif
 
+#if defined(Q_OS_UNIX) && !defined(Q_OS_MAC)
+#include <fcntl.h>
+#endif
+
 // We use some internals of csync:
 extern "C" int c_utimes(const char *, const struct timeval *);
 extern "C" void csync_win32_set_file_hidden( const char *file, bool h );
@@ -489,23 +495,47 @@ QString FileSystem::fileSystemForPath(const QString & path)
 }
 #endif
 
-#define BUFSIZE 1024*1024*10
+#define BUFSIZE 1024*1024
+
+/*
+ * The buffer the checksums are computed in. Every thread keeps its own,
+ * so checksumming many files does not allocate a new buffer per file.
+ */
+static QByteArray& checksumBuffer()
+{
+    static QThreadStorage<QByteArray*> buffers;
+    if (!buffers.hasLocalData()) {
+        buffers.setLocalData(new QByteArray(BUFSIZE, 0));
+    }
+    return *buffers.localData();
+}
+
+/*
+ * Opens the file for a single sequential pass. The kernel is told so, to
+ * read ahead more aggressively while we are hashing.
+ */
+static bool openForChecksum(QFile& file)
+{
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        return false;
+    }
+#if defined(Q_OS_UNIX) && !defined(Q_OS_MAC) && defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(file.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return true;
+}
 
 static QByteArray readToCrypto( const QString& filename, QCryptographicHash::Algorithm algo )
 {
-    const qint64 bufSize = BUFSIZE;
-    QByteArray buf(bufSize,0);
+    QByteArray& buf = checksumBuffer();
     QByteArray arr;
     QCryptographicHash crypto( algo );
 
     QFile file(filename);
-    if (file.open(QIODevice::ReadOnly)) {
+    if (openForChecksum(file)) {
         qint64 size;
-        while (!file.atEnd()) {
-            size = file.read( buf.data(), bufSize );
-            if( size > 0 ) {
-                crypto.addData(buf.data(), size);
-            }
+        while ((size = file.read( buf.data(), buf.size() )) > 0) {
+            crypto.addData(buf.data(), size);
         }
         arr = crypto.result().toHex();
     }
@@ -522,20 +552,63 @@ QByteArray FileSystem::calcSha1( const QString& filename )
     return readToCrypto( filename, QCryptographicHash::Sha1 );
 }
 
+QByteArray FileSystem::calcCrc32c( const QString& filename )
+{
+    uint32_t crc = 0;
+    QByteArray& buf = checksumBuffer();
+
+    QFile file(filename);
+    if (openForChecksum(file)) {
+        qint64 size;
+        while ((size = file.read(buf.data(), buf.size())) > 0) {
+            crc = crc32c(crc, buf.constData(), size);
+        }
+    }
+
+    return QByteArray::number( crc, 16 );
+}
+
+QByteArray FileSystem::calcBlockHashes( const QString& filename, qint64 blockSize )
+{
+    QByteArray& buf = checksumBuffer();
+    QByteArray hashes("");
+    QCryptographicHash crypto( QCryptographicHash::Md5 );
+
+    QFile file(filename);
+    if (blockSize <= 0 || !openForChecksum(file)) {
+        return QByteArray();
+    }
+    qint64 inBlock = 0;
+    qint64 size;
+    while ((size = file.read( buf.data(), qMin(qint64(buf.size()), blockSize - inBlock) )) > 0) {
+        crypto.addData(buf.data(), size);
+        inBlock += size;
+        if (inBlock == blockSize) {
+            hashes.append(crypto.result());
+            crypto.reset();
+            inBlock = 0;
+        }
+    }
+    if (size < 0) {
+        return QByteArray();
+    }
+    if (inBlock > 0) {
+        hashes.append(crypto.result());
+    }
+    return hashes;
+}
+
 #ifdef ZLIB_FOUND
 QByteArray FileSystem::calcAdler32( const QString& filename )
 {
     unsigned int adler = adler32(0L, Z_NULL, 0);
-    const qint64 bufSize = BUFSIZE;
-    QByteArray buf(bufSize, 0);
+    QByteArray& buf = checksumBuffer();
 
     QFile file(filename);
-    if (file.open(QIODevice::ReadOnly)) {
+    if (openForChecksum(file)) {
         qint64 size;
-        while (!file.atEnd()) {
-            size = file.read(buf.data(), bufSize);
-            if( size > 0 )
-                adler = adler32(adler, (const Bytef*) buf.data(), size);
+        while ((size = file.read(buf.data(), buf.size())) > 0) {
+            adler = adler32(adler, (const Bytef*) buf.data(), size);
         }
     }
 
@@ -165,6 +165,15 @@ QString fileSystemForPath(const QString & path);
 
 QByteArray OWNCLOUDSYNC_EXPORT calcMd5( const QString& fileName );
 QByteArray OWNCLOUDSYNC_EXPORT calcSha1( const QString& fileName );
+QByteArray OWNCLOUDSYNC_EXPORT calcCrc32c( const QString& fileName );
+
+/**
+ * Returns the raw MD5 digests of the consecutive blocks of \a blockSize bytes
+ * of the file, concatenated. The last block may be shorter.
+ *
+ * Returns a null QByteArray if the file could not be read.
+ */
+QByteArray OWNCLOUDSYNC_EXPORT calcBlockHashes( const QString& fileName, qint64 blockSize );
 #ifdef ZLIB_FOUND
 QByteArray OWNCLOUDSYNC_EXPORT calcAdler32( const QString& fileName );
 #endif
@@ -126,141 +126,296 @@ bool MkColJob::finished()
 }
 
 /*********************************************************************************************/
-// supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
-static QString readContentsAsString(QXmlStreamReader &reader) {
-    QString result;
-    int level = 0;
-    do {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        if (type == QXmlStreamReader::StartElement) {
-            level++;
-            result += "<" + reader.name().toString() + ">";
-        } else if (type == QXmlStreamReader::Characters) {
-            result += reader.text();
-        } else if (type == QXmlStreamReader::EndElement) {
-            level--;
-            if (level < 0) {
-                break;
-            }
-            result += "</" + reader.name().toString() + ">";
-        }
 
-    } while (!reader.atEnd());
-    return result;
+LsColXMLParser::LsColXMLParser()
+    : _sizes(0)
+    , _failed(false)
+    , _emitMaps(false)
+    , _currentPropsHaveHttp200(false)
+    , _currentResponseRemoved(false)
+    , _currentResponseInsufficientStorage(false)
+    , _insideResponse(false)
+    , _insidePropstat(false)
+    , _insideProp(false)
+    , _insideMultiStatus(false)
+    , _capture(NoCapture)
+    , _captureDepth(0)
+    , _truncated(false)
+{
+
 }
 
+bool LsColXMLParser::parse( const QByteArray& xml, QHash<QString, qint64> *sizes, const QString& expectedPath)
+{
+    start(sizes, expectedPath);
+    return addData(xml) && finish();
+}
+
+void LsColXMLParser::start(QHash<QString, qint64> *sizes, const QString& expectedPath)
+{
+    _reader.clear();
+    _reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
+    _sizes = sizes;
+    _expectedPath = expectedPath;
+    _failed = false;
+    // Building the property maps is wasted work if nobody wants them
+    _emitMaps = receivers(SIGNAL(directoryListingIterated(QString,QMap<QString,QString>))) > 0;
+
+    _folders.clear();
+    _currentHref.clear();
+    _currentTmpEntry = LsColEntry();
+    _currentHttp200Entry = LsColEntry();
+    _currentTmpProperties.clear();
+    _currentHttp200Properties.clear();
+    _currentPropsHaveHttp200 = false;
+    _currentResponseRemoved = false;
+    _currentResponseInsufficientStorage = false;
+    _insideResponse = false;
+    _insidePropstat = false;
+    _insideProp = false;
+    _insideMultiStatus = false;
+    _capture = NoCapture;
+    _syncToken.clear();
+    _truncated = false;
+}
+
+bool LsColXMLParser::addData(const QByteArray &data)
+{
+    if (_failed) {
+        return false;
+    }
+    _reader.addData(data);
+    if (!parseAvailable()) {
+        _failed = true;
+        return false;
+    }
+    return true;
+}
 
-LsColXMLParser::LsColXMLParser()
+bool LsColXMLParser::finish()
 {
+    if (_failed) {
+        return false;
+    }
+    _failed = true; // whatever happens, nothing can come after this
 
+    if (_reader.hasError()) {
+        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
+        qDebug() << "ERROR" << _reader.errorString() << "at line" << _reader.lineNumber();
+        return false;
+    } else if (!_insideMultiStatus) {
+        qDebug() << "ERROR no WebDAV response?";
+        return false;
+    } else {
+        emit directoryListingSubfolders(_folders);
+        emit finishedWithoutError();
+    }
+    return true;
 }
 
-bool LsColXMLParser::parse( const QByteArray& xml, QHash<QString, qint64> *sizes, const QString& expectedPath)
+/* Process the tokens of the data added so far. The elements are handled token by token,
+ * a property whose end has not arrived yet is collected until it does. */
+bool LsColXMLParser::parseAvailable()
 {
-    // Parse DAV response
-    QXmlStreamReader reader(xml);
-    reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
-
-    QStringList folders;
-    QString currentHref;
-    QMap<QString, QString> currentTmpProperties;
-    QMap<QString, QString> currentHttp200Properties;
-    bool currentPropsHaveHttp200 = false;
-    bool insidePropstat = false;
-    bool insideProp = false;
-    bool insideMultiStatus = false;
-
-    while (!reader.atEnd()) {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        QString name = reader.name().toString();
+    while (!_reader.atEnd()) {
+        QXmlStreamReader::TokenType type = _reader.readNext();
+
+        if (_capture != NoCapture) {
+            // supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
+            if (type == QXmlStreamReader::StartElement) {
+                _captureDepth++;
+                _captureContents += "<" + _reader.name().toString() + ">";
+            } else if (type == QXmlStreamReader::Characters) {
+                _captureContents += _reader.text();
+                _captureText += _reader.text();
+            } else if (type == QXmlStreamReader::EndElement) {
+                if (_captureDepth == 0) {
+                    if (!endCapture()) {
+                        return false;
+                    }
+                } else {
+                    _captureDepth--;
+                    _captureContents += "</" + _reader.name().toString() + ">";
+                }
+            }
+            continue;
+        }
+
+        QStringRef name = _reader.name();
         // Start elements with DAV:
-        if (type == QXmlStreamReader::StartElement && reader.namespaceUri() == QLatin1String("DAV:")) {
+        if (type == QXmlStreamReader::StartElement && _reader.namespaceUri() == QLatin1String("DAV:")) {
             if (name == QLatin1String("href")) {
-                // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
-                // but the result will have URL encoding..
-                QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(reader.readElementText().toUtf8()));
-                if (!hrefString.startsWith(expectedPath)) {
-                    qDebug() << "Invalid href" << hrefString << "expected starting with" << expectedPath;
-                    return false;
-                }
-                currentHref = hrefString;
+                _capture = HrefCapture;
+                continue;
             } else if (name == QLatin1String("response")) {
+                _insideResponse = true;
             } else if (name == QLatin1String("propstat")) {
-                insidePropstat = true;
-            } else if (name == QLatin1String("status") && insidePropstat) {
-                QString httpStatus = reader.readElementText();
-                if (httpStatus.startsWith("HTTP/1.1 200")) {
-                    currentPropsHaveHttp200 = true;
-                } else {
-                    currentPropsHaveHttp200 = false;
-                }
+                _insidePropstat = true;
+            } else if (name == QLatin1String("status") && _insidePropstat) {
+                _capture = StatusCapture;
+                continue;
+            } else if (name == QLatin1String("status") && _insideResponse) {
+                _capture = ResponseStatusCapture;
+                continue;
+            } else if (name == QLatin1String("sync-token") && _insideMultiStatus && !_insideResponse) {
+                _capture = SyncTokenCapture;
+                continue;
             } else if (name == QLatin1String("prop")) {
-                insideProp = true;
+                _insideProp = true;
                 continue;
             } else if (name == QLatin1String("multistatus")) {
-                insideMultiStatus = true;
+                _insideMultiStatus = true;
                 continue;
             }
         }
 
-        if (type == QXmlStreamReader::StartElement && insidePropstat && insideProp) {
+        if (type == QXmlStreamReader::StartElement && _insidePropstat && _insideProp) {
             // All those elements are properties
-            QString propertyContent = readContentsAsString(reader);
-            if (name == QLatin1String("resourcetype") && propertyContent.contains("collection")) {
-                folders.append(currentHref);
-            } else if (name == QLatin1String("quota-used-bytes")) {
-                bool ok = false;
-                auto s = propertyContent.toLongLong(&ok);
-                if (ok && sizes) {
-                    sizes->insert(currentHref, s);
-                }
-            }
-            currentTmpProperties.insert(reader.name().toString(), propertyContent);
+            _capture = PropertyCapture;
+            _captureName = name.toString();
+            continue;
         }
 
         // End elements with DAV:
         if (type == QXmlStreamReader::EndElement) {
-            if (reader.namespaceUri() == QLatin1String("DAV:")) {
-                if (reader.name() == "response") {
-                    if (currentHref.endsWith('/')) {
-                        currentHref.chop(1);
+            if (_reader.namespaceUri() == QLatin1String("DAV:")) {
+                if (name == QLatin1String("response")) {
+                    if (_currentHref.endsWith('/')) {
+                        _currentHref.chop(1);
+                    }
+                    if (_currentResponseInsufficientStorage && isExpectedPath(_currentHref)) {
+                        // Not a removal: the server did not report all the changes
+                        _truncated = true;
+                    } else if (_currentResponseRemoved) {
+                        emit directoryListingRemoved(_currentHref);
+                    } else {
+                        if (_emitMaps) {
+                            emit directoryListingIterated(_currentHref, _currentHttp200Properties);
+                        }
+                        emit directoryListingEntry(_currentHref, _currentHttp200Entry);
                     }
-                    emit directoryListingIterated(currentHref, currentHttp200Properties);
-                    currentHref.clear();
-                    currentHttp200Properties.clear();
-                } else if (reader.name() == "propstat") {
-                    insidePropstat = false;
-                    if (currentPropsHaveHttp200) {
-                        currentHttp200Properties = QMap<QString,QString>(currentTmpProperties);
+                    _insideResponse = false;
+                    _currentResponseRemoved = false;
+                    _currentResponseInsufficientStorage = false;
+                    _currentHref.clear();
+                    _currentHttp200Properties.clear();
+                    _currentHttp200Entry = LsColEntry();
+                } else if (name == QLatin1String("propstat")) {
+                    _insidePropstat = false;
+                    if (_currentPropsHaveHttp200) {
+                        _currentHttp200Properties = _currentTmpProperties;
+                        _currentHttp200Entry = _currentTmpEntry;
                     }
-                    currentTmpProperties.clear();
-                    currentPropsHaveHttp200 = false;
-                } else if (reader.name() == "prop") {
-                    insideProp = false;
+                    _currentTmpProperties.clear();
+                    _currentTmpEntry = LsColEntry();
+                    _currentPropsHaveHttp200 = false;
+                } else if (name == QLatin1String("prop")) {
+                    _insideProp = false;
                 }
             }
         }
     }
 
-    if (reader.hasError()) {
-        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
-        qDebug() << "ERROR" << reader.errorString() << xml;
-        return false;
-    } else if (!insideMultiStatus) {
-        qDebug() << "ERROR no WebDAV response?" << xml;
-        return false;
-    } else {
-        emit directoryListingSubfolders(folders);
-        emit finishedWithoutError();
+    // Running out of data in the middle of the document only means the rest has not arrived yet
+    return !_reader.hasError() || _reader.error() == QXmlStreamReader::PrematureEndOfDocumentError;
+}
+
+bool LsColXMLParser::isExpectedPath(const QString &href) const
+{
+    QString expected = _expectedPath;
+    while (expected.endsWith('/')) {
+        expected.chop(1);
     }
+    return href == expected;
+}
+
+bool LsColXMLParser::endCapture()
+{
+    if (_capture == HrefCapture) {
+        // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
+        // but the result will have URL encoding..
+        QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(_captureText.toUtf8()));
+        if (!hrefString.startsWith(_expectedPath)) {
+            qDebug() << "Invalid href" << hrefString << "expected starting with" << _expectedPath;
+            return false;
+        }
+        _currentHref = hrefString;
+    } else if (_capture == StatusCapture) {
+        _currentPropsHaveHttp200 = _captureText.startsWith("HTTP/1.1 200");
+    } else if (_capture == ResponseStatusCapture) {
+        // Like "HTTP/1.1 404 Not Found" for a member that is gone
+        _currentResponseRemoved = !_captureText.startsWith("HTTP/1.1 2");
+        _currentResponseInsufficientStorage = _captureText.startsWith("HTTP/1.1 507");
+    } else if (_capture == SyncTokenCapture) {
+        _syncToken = _captureText.trimmed().toUtf8();
+    } else if (_capture == PropertyCapture) {
+        addProperty();
+    }
+
+    _capture = NoCapture;
+    _captureDepth = 0;
+    _captureName.clear();
+    _captureContents.clear();
+    _captureText.clear();
     return true;
+}
 
+void LsColXMLParser::addProperty()
+{
+    const QString &name = _captureName;
+    if (name == QLatin1String("resourcetype") && _captureContents.contains("collection")) {
+        _folders.append(_currentHref);
+    } else if (name == QLatin1String("quota-used-bytes")) {
+        bool ok = false;
+        auto s = _captureContents.toLongLong(&ok);
+        if (ok && _sizes) {
+            _sizes->insert(_currentHref, s);
+        }
+    }
+    if (_emitMaps) {
+        _currentTmpProperties.insert(name, _captureContents);
+    }
+
+    LsColEntry &entry = _currentTmpEntry;
+    if (name == QLatin1String("resourcetype")) {
+        entry.isCollection = _captureContents.contains("collection");
+        entry.fields |= LsColEntry::ResourceType;
+    } else if (name == QLatin1String("getlastmodified")) {
+        entry.lastModified = _captureText.toUtf8();
+        entry.fields |= LsColEntry::LastModified;
+    } else if (name == QLatin1String("getcontentlength")) {
+        entry.size = _captureText.toLongLong();
+        entry.fields |= LsColEntry::ContentLength;
+    } else if (name == QLatin1String("getetag")) {
+        entry.etag = _captureText.toUtf8();
+        entry.fields |= LsColEntry::ETag;
+    } else if (name == QLatin1String("id")) {
+        entry.fileId = _captureText.toUtf8();
+        entry.fields |= LsColEntry::FileId;
+    } else if (name == QLatin1String("permissions")) {
+        entry.permissions = _captureText.toUtf8();
+        entry.fields |= LsColEntry::Permissions;
+    } else if (name == QLatin1String("downloadURL")) {
+        entry.directDownloadUrl = _captureText.toUtf8();
+        entry.fields |= LsColEntry::DownloadUrl;
+    } else if (name == QLatin1String("dDC")) {
+        entry.directDownloadCookies = _captureText.toUtf8();
+        entry.fields |= LsColEntry::DownloadCookies;
+    } else if (name == QLatin1String("checksums")) {
+        entry.checksums = _captureText.toUtf8();
+        entry.fields |= LsColEntry::Checksums;
+    } else if (name == QLatin1String("sync-token")) {
+        entry.syncToken = _captureText.trimmed().toUtf8();
+        entry.fields |= LsColEntry::SyncToken;
+    }
 }
 
 /*********************************************************************************************/
 
 LsColJob::LsColJob(AccountPtr account, const QString &path, QObject *parent)
     : AbstractNetworkJob(account, path, parent)
+    , _parsing(false)
+    , _parseFailed(false)
 {
 }
 
@@ -274,15 +429,10 @@ QList<QByteArray> LsColJob::properties() const
     return _properties;
 }
 
-void LsColJob::start()
+QByteArray LsColJob::propertiesXml() const
 {
-    QList<QByteArray> properties = _properties;
-
-    if (properties.isEmpty()) {
-        qWarning() << "Propfind with no properties!";
-    }
     QByteArray propStr;
-    foreach (const QByteArray &prop, properties) {
+    foreach (const QByteArray &prop, _properties) {
         if (prop.contains(':')) {
             int colIdx = prop.lastIndexOf(":");
             auto ns = prop.left(colIdx);
@@ -295,61 +445,134 @@ void LsColJob::start()
             propStr += "    <d:" + prop + " />\n";
         }
     }
+    return propStr;
+}
+
+void LsColJob::start()
+{
+    if (_properties.isEmpty()) {
+        qWarning() << "Propfind with no properties!";
+    }
 
     QNetworkRequest req;
     req.setRawHeader("Depth", "1");
     QByteArray xml("<?xml version=\"1.0\" ?>\n"
                    "<d:propfind xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">\n"
                    "  <d:prop>\n"
-                   + propStr +
+                   + propertiesXml() +
                    "  </d:prop>\n"
                    "</d:propfind>\n");
+    sendRequest("PROPFIND", req, xml);
+}
+
+void LsColJob::sendRequest(const QByteArray &verb, QNetworkRequest req, const QByteArray &body)
+{
     QBuffer *buf = new QBuffer(this);
-    buf->setData(xml);
+    buf->setData(body);
     buf->open(QIODevice::ReadOnly);
-    QNetworkReply *reply = davRequest("PROPFIND", path(), req, buf);
+    QNetworkReply *reply = davRequest(verb, path(), req, buf);
     buf->setParent(reply);
     setReply(reply);
     setupConnections(reply);
+    connect(reply, SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
     AbstractNetworkJob::start();
 }
 
-// TODO: Instead of doing all in this slot, we should iteratively parse in readyRead(). This
-// would allow us to be more asynchronous in processing while data is coming from the network,
-// not all in one big blob at the end.
-bool LsColJob::finished()
+// The reply is parsed while it arrives, so the entries can be used before the whole
+// listing is there and the reply is never held in memory all at once.
+void LsColJob::slotReadyRead()
+{
+    if (!_parsing && !startParsing()) {
+        return; // not a listing, finished() reports the error
+    }
+    QByteArray data = reply()->readAll();
+    if (!_parseFailed && !_parser.addData(data)) {
+        _parseFailed = true;
+    }
+}
+
+bool LsColJob::startParsing()
 {
     QString contentType = reply()->header(QNetworkRequest::ContentTypeHeader).toString();
     int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-    if (httpCode == 207 && contentType.contains("application/xml; charset=utf-8")) {
-        LsColXMLParser parser;
-        connect( &parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
-                 this, SIGNAL(directoryListingSubfolders(const QStringList&)) );
-        connect( &parser, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)),
+    if (httpCode != 207 || !contentType.contains("application/xml; charset=utf-8")) {
+        return false;
+    }
+
+    connect( &_parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
+             this, SIGNAL(directoryListingSubfolders(const QStringList&)) );
+    if (receivers(SIGNAL(directoryListingIterated(QString,QMap<QString,QString>))) > 0) {
+        connect( &_parser, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)),
                  this, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)) );
-        connect( &parser, SIGNAL(finishedWithError(QNetworkReply *)),
-                 this, SIGNAL(finishedWithError(QNetworkReply *)) );
-        connect( &parser, SIGNAL(finishedWithoutError()),
-                 this, SIGNAL(finishedWithoutError()) );
-
-        QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/webdav/folder"
-        if( !parser.parse( reply()->readAll(), &_sizes, expectedPath ) ) {
-            // XML parse error
-            emit finishedWithError(reply());
+    }
+    connect( &_parser, SIGNAL(directoryListingEntry(const QString&, const LsColEntry&)),
+             this, SIGNAL(directoryListingEntry(const QString&, const LsColEntry&)) );
+    connect( &_parser, SIGNAL(directoryListingRemoved(const QString&)),
+             this, SIGNAL(directoryListingRemoved(const QString&)) );
+    connect( &_parser, SIGNAL(finishedWithError(QNetworkReply *)),
+             this, SIGNAL(finishedWithError(QNetworkReply *)) );
+    connect( &_parser, SIGNAL(finishedWithoutError()),
+             this, SIGNAL(finishedWithoutError()) );
+
+    QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/webdav/folder"
+    _parser.start(&_sizes, expectedPath);
+    _parsing = true;
+    return true;
+}
+
+bool LsColJob::finished()
+{
+    // After a redirect there was no readyRead for this reply
+    if (!_parsing) {
+        startParsing();
+    }
+
+    if (_parsing && reply()->error() == QNetworkReply::NoError) {
+        QByteArray rest = reply()->readAll();
+        if (!_parseFailed && _parser.addData(rest) && _parser.finish()) {
+            return true;
         }
-    } else if (httpCode == 207) {
-        // wrong content type
-        emit finishedWithError(reply());
-    } else {
-        // wrong HTTP code or any other network error
-        emit finishedWithError(reply());
+        // XML parse error
     }
+    // wrong HTTP code, wrong content type, XML parse error or any other network error
+    emit finishedWithError(reply());
 
     return true;
 }
 
 /*********************************************************************************************/
 
+SyncCollectionJob::SyncCollectionJob(AccountPtr account, const QString &path,
+                                     const QByteArray &syncToken, QObject *parent)
+    : LsColJob(account, path, parent)
+    , _syncToken(syncToken)
+{
+}
+
+void SyncCollectionJob::start()
+{
+    if (properties().isEmpty()) {
+        qWarning() << "Sync collection report with no properties!";
+    }
+
+    QByteArray token = _syncToken;
+    token.replace('&', "&amp;").replace('<', "&lt;").replace('>', "&gt;");
+
+    QNetworkRequest req;
+    req.setRawHeader("Depth", "0"); // the sync-level says how deep the report goes
+    QByteArray xml("<?xml version=\"1.0\" ?>\n"
+                   "<d:sync-collection xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">\n"
+                   "  <d:sync-token>" + token + "</d:sync-token>\n"
+                   "  <d:sync-level>infinite</d:sync-level>\n"
+                   "  <d:prop>\n"
+                   + propertiesXml() +
+                   "  </d:prop>\n"
+                   "</d:sync-collection>\n");
+    sendRequest("REPORT", req, xml);
+}
+
+/*********************************************************************************************/
+
 namespace {
 const char statusphpC[] = "status.php";
 const char owncloudDirC[] = "owncloud/";
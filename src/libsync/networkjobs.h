@@ -18,6 +18,8 @@
 
 #include "abstractnetworkjob.h"
 
+#include <QXmlStreamReader>
+
 class QUrl;
 
 namespace OCC {
@@ -39,6 +41,42 @@ private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
 };
 
+/**
+ * @brief The properties of one resource of a PROPFIND reply that the sync uses
+ *
+ * Only the properties the server returned with status 200 are set, see fields.
+ *
+ * @ingroup libsync
+ */
+struct OWNCLOUDSYNC_EXPORT LsColEntry {
+    enum Field {
+        ResourceType = 0x1,
+        LastModified = 0x2,
+        ContentLength = 0x4,
+        ETag = 0x8,
+        FileId = 0x10,
+        Permissions = 0x20,
+        DownloadUrl = 0x40,
+        DownloadCookies = 0x80,
+        Checksums = 0x100,
+        SyncToken = 0x200
+    };
+
+    LsColEntry() : fields(0), isCollection(false), size(0) {}
+
+    int fields;
+    bool isCollection;
+    qint64 size;
+    QByteArray lastModified; // an HTTP date
+    QByteArray etag;
+    QByteArray fileId;
+    QByteArray permissions;
+    QByteArray directDownloadUrl;
+    QByteArray directDownloadCookies;
+    QByteArray checksums;
+    QByteArray syncToken; // of a collection, see SyncCollectionJob
+};
+
 /**
  * @brief The LsColJob class
  * @ingroup libsync
@@ -50,12 +88,68 @@ public:
 
     bool parse(const QByteArray &xml, QHash<QString, qint64> *sizes, const QString& expectedPath);
 
+    /**
+     * Parse a reply while it arrives: start(), then addData() with every piece
+     * of it, then finish(). Entries are emitted as soon as they are complete.
+     *
+     * addData() and finish() return false once the reply is invalid, the
+     * entries emitted before must then be discarded.
+     */
+    void start(QHash<QString, qint64> *sizes, const QString& expectedPath);
+    bool addData(const QByteArray &data);
+    bool finish();
+
+    /// The DAV:sync-token of a sync-collection REPORT reply, once it was parsed
+    QByteArray syncToken() const { return _syncToken; }
+    /// The collection itself had a 507 status: the reply only has part of the changes
+    bool truncated() const { return _truncated; }
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString,QString> &properties);
+    void directoryListingEntry(const QString &name, const LsColEntry &entry);
+    // A response with a status of its own that is not 2xx, a removed member in a REPORT reply
+    void directoryListingRemoved(const QString &name);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
 
+private:
+    enum Capture { NoCapture, HrefCapture, StatusCapture, ResponseStatusCapture, SyncTokenCapture, PropertyCapture };
+
+    bool parseAvailable();
+    bool endCapture();
+    void addProperty();
+    bool isExpectedPath(const QString &href) const;
+
+    QXmlStreamReader _reader;
+    QHash<QString, qint64> *_sizes;
+    QString _expectedPath;
+    bool _failed;
+    bool _emitMaps; // directoryListingIterated is connected
+
+    QStringList _folders;
+    QString _currentHref;
+    LsColEntry _currentTmpEntry;
+    LsColEntry _currentHttp200Entry;
+    QMap<QString, QString> _currentTmpProperties;
+    QMap<QString, QString> _currentHttp200Properties;
+    bool _currentPropsHaveHttp200;
+    bool _currentResponseRemoved;
+    bool _currentResponseInsufficientStorage;
+    bool _insideResponse;
+    bool _insidePropstat;
+    bool _insideProp;
+    bool _insideMultiStatus;
+
+    // The element whose contents are collected
+    Capture _capture;
+    int _captureDepth;
+    QString _captureName;
+    QString _captureContents; // with the tags of child elements, like "<collection></collection>"
+    QString _captureText;
+
+    QByteArray _syncToken;
+    bool _truncated;
 };
 
 class OWNCLOUDSYNC_EXPORT LsColJob : public AbstractNetworkJob {
@@ -79,14 +173,59 @@ public:
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString,QString> &properties);
+    void directoryListingEntry(const QString &name, const LsColEntry &entry);
+    void directoryListingRemoved(const QString &name);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
 
 private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
+    void slotReadyRead();
+
+protected:
+    // The <d:prop> children for properties()
+    QByteArray propertiesXml() const;
+    void sendRequest(const QByteArray &verb, QNetworkRequest req, const QByteArray &body);
+
+    LsColXMLParser _parser;
 
 private:
+    bool startParsing();
+
     QList<QByteArray> _properties;
+    bool _parsing;
+    bool _parseFailed;
+};
+
+/**
+ * @brief Asks for the changes below a collection since a sync token (RFC 6578)
+ *
+ * Sends a sync-collection REPORT with sync-level infinite for properties().
+ * The changed resources are emitted with directoryListingEntry, the removed
+ * ones with directoryListingRemoved. Unlike with a PROPFIND, the collection
+ * itself is not part of the reply.
+ *
+ * The server answers 403 or 409 if it does not know the token anymore, the
+ * job then finishes with an error like for any other problem. If it left out
+ * some of the changes, truncated() is set and the rest are the changes since
+ * newSyncToken().
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT SyncCollectionJob : public LsColJob {
+    Q_OBJECT
+public:
+    explicit SyncCollectionJob(AccountPtr account, const QString &path,
+                               const QByteArray &syncToken, QObject *parent = 0);
+    void start() Q_DECL_OVERRIDE;
+
+    /// The token to ask with the next time, valid after finishedWithoutError
+    QByteArray newSyncToken() const { return _parser.syncToken(); }
+    /// The server limited the number of changes, see RFC 6578 section 3.6
+    bool truncated() const { return _parser.truncated(); }
+
+private:
+    QByteArray _syncToken;
 };
 
 /**
@@ -22,6 +22,7 @@
 #include "propagateremotemove.h"
 #include "propagateremotemkdir.h"
 #include "propagatorjobs.h"
+#include "syncfileitemtree.h"
 #include "configfile.h"
 #include "utility.h"
 #include "account.h"
@@ -32,7 +33,6 @@
 #include <winbase.h>
 #endif
 
-#include <QStack>
 #include <QFileInfo>
 #include <QDir>
 #include <QTimer>
@@ -74,19 +74,142 @@ OwncloudPropagator::~OwncloudPropagator()
 /* The maximum number of active jobs in parallel  */
 int OwncloudPropagator::maximumActiveJob()
 {
+    // A fixed value from the environment disables the adaptation
     static int max = qgetenv("OWNCLOUD_MAX_PARALLEL").toUInt();
+    int smallJobs = max ? max : int(_parallelism);
+
+    // Large transfers are limited by maximumActiveLargeJobs() and must
+    // not starve the small jobs.
+    return smallJobs + _activeLargeJobs;
+}
+
+int OwncloudPropagator::maximumActiveLargeJobs()
+{
+    static int max = qgetenv("OWNCLOUD_MAX_PARALLEL_LARGE").toUInt();
     if (!max) {
-        max = 3; //default
+        max = 2; //default
     }
 
     if (_downloadLimit.fetchAndAddAcquire(0) != 0 || _uploadLimit.fetchAndAddAcquire(0) != 0) {
-        // disable parallelism when there is a network limit.
+        // The bandwidth is limited anyway, more transfers only make each one slower
         return 1;
     }
 
     return max;
 }
 
+bool OwncloudPropagator::isLargeTransfer(const SyncFileItem &item) const
+{
+    if (item._isDirectory) {
+        return false;
+    }
+    if (item._instruction != CSYNC_INSTRUCTION_NEW
+            && item._instruction != CSYNC_INSTRUCTION_SYNC
+            && item._instruction != CSYNC_INSTRUCTION_CONFLICT) {
+        return false;
+    }
+    // Files that would be chunked when uploaded
+    return item._size >= _chunkSize;
+}
+
+void OwncloudPropagator::adaptParallelism(const SyncFileItem &item, SyncFileItem::Status status)
+{
+    // More parallel requests than QNAM connections only queue up in QNAM, the
+    // latency signal stops the growth long before that matters.
+    static const double hardMaximum = 16;
+
+    if (item._httpErrorCode >= 500) {
+        backOff(QString("HTTP %1 for %2").arg(item._httpErrorCode).arg(item._file));
+        return;
+    }
+
+    // The duration of large transfers depends on their size rather than on the latency
+    if (status != SyncFileItem::Success || item._requestDuration == 0 || isLargeTransfer(item)) {
+        return;
+    }
+
+    double latency = item._requestDuration;
+    _latency = _latency ? 0.8 * _latency + 0.2 * latency : latency;
+    if (!_baseLatency || _latency < _baseLatency) {
+        _baseLatency = _latency;
+    }
+
+    // Grow by one job per round trip as long as the requests are not slowed
+    // down; once they take much longer than the best we have seen, requests
+    // queue up in the server or the network and we shrink again.
+    if (_latency > 2 * _baseLatency) {
+        _parallelism = qMax(1., _parallelism - 1 / _parallelism);
+    } else {
+        _parallelism = qMin(hardMaximum, _parallelism + 1 / _parallelism);
+    }
+}
+
+void OwncloudPropagator::requestTimedOut()
+{
+    backOff(QLatin1String("Request timeout"));
+}
+
+void OwncloudPropagator::backOff(const QString &reason)
+{
+    // The server is struggling: halve the limit. All requests that were
+    // in flight at that time probably fail the same way, so back off at
+    // most once per request duration.
+    if (!_lastBackoff.isValid() || _lastBackoff.elapsed() > qMax(_latency, 1000.)) {
+        _parallelism = qMax(1., _parallelism / 2);
+        _lastBackoff.start();
+        qDebug() << reason << "- reducing parallelism to" << int(_parallelism);
+    }
+}
+
+int OwncloudPropagator::maximumParallelChunks()
+{
+    static int max = qgetenv("OWNCLOUD_MAX_PARALLEL_CHUNKS").toUInt();
+    if (!max) {
+        max = 4; //default
+    }
+
+    if (_downloadLimit.fetchAndAddAcquire(0) != 0 || _uploadLimit.fetchAndAddAcquire(0) != 0) {
+        // the bandwidth manager measures one device at a time
+        return 1;
+    }
+
+    return max;
+}
+
+void OwncloudPropagator::adaptChunkSize(quint64 size, qint64 msecs)
+{
+    if (_targetChunkUploadDuration <= 0 || size == 0) {
+        return;
+    }
+    msecs = qMax(msecs, qint64(1));
+
+    // The size the chunk should have had to take the target duration. The
+    // measurement fluctuates a lot with the available bandwidth and the other
+    // uploads running, so only move half way towards it.
+    quint64 predictedSize = size * _targetChunkUploadDuration / msecs;
+    quint64 newSize = qBound(_minChunkSize, (_chunkSize + predictedSize) / 2, _maxChunkSize);
+    if (newSize != _chunkSize) {
+        qDebug() << "Chunk of" << size << "bytes took" << msecs << "ms, chunk size is now" << newSize;
+        _chunkSize = newSize;
+        _account->setUploadChunkSize(_chunkSize);
+    }
+}
+
+void OwncloudPropagator::chunkUploadFailed(quint64 size)
+{
+    if (_targetChunkUploadDuration <= 0 || size == 0) {
+        return;
+    }
+
+    // Less is lost and sent again when the next one breaks off too
+    quint64 newSize = qBound(_minChunkSize, qMin(_chunkSize, size) / 2, _maxChunkSize);
+    if (newSize != _chunkSize) {
+        qDebug() << "Chunk of" << size << "bytes failed, chunk size is now" << newSize;
+        _chunkSize = newSize;
+        _account->setUploadChunkSize(_chunkSize);
+    }
+}
+
 /** Updates, creates or removes a blacklist entry for the given item.
  *
  * Returns whether the file is in the blacklist now.
@@ -107,6 +230,9 @@ static bool blacklistCheck(SyncJournalDb* journal, const SyncFileItem& item)
 
 void PropagateItemJob::done(SyncFileItem::Status status, const QString &errorString)
 {
+    if (_state == Running) {
+        _propagator->_runningItemJobs--;
+    }
     _state = Finished;
     if (_item->_isRestoration) {
         if( status == SyncFileItem::Success || status == SyncFileItem::Conflict) {
@@ -158,10 +284,31 @@ void PropagateItemJob::done(SyncFileItem::Status status, const QString &errorStr
 
     _item->_status = status;
 
+    if (_countedAsLargeTransfer) {
+        _countedAsLargeTransfer = false;
+        _propagator->_activeLargeJobs--;
+    }
+    _propagator->adaptParallelism(*_item, status);
+
     emit itemCompleted(*_item, *this);
     emit finished(status);
 }
 
+bool PropagateItemJob::scheduleNextJob()
+{
+    if (_state != NotYetStarted) {
+        return false;
+    }
+    _state = Running;
+    _propagator->_runningItemJobs++;
+    if (_propagator->isLargeTransfer(*_item)) {
+        _countedAsLargeTransfer = true;
+        _propagator->_activeLargeJobs++;
+    }
+    QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
+    return true;
+}
+
 /**
  * For delete or remove, check that we are not removing from a shared directory.
  * If we are, try to restore the file
@@ -283,26 +430,47 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
     if( !checksumType.isEmpty() ) {
         if( checksumType == checkSumAdlerC ||
                 checksumType == checkSumMD5C    ||
-                checksumType == checkSumSHA1C ) {
+                checksumType == checkSumSHA1C   ||
+                checksumType == checkSumCRC32CC ) {
             qDebug() << "Client sends transmission checksum type" << checksumType;
         } else {
             qWarning() << "Unknown transmission checksum type from config" << checksumType;
         }
     }
 
+    /* Start with the chunk size the previous syncs of this account settled on */
+    static uint envChunkSize = qgetenv("OWNCLOUD_CHUNK_SIZE").toUInt();
+    _minChunkSize = cfg.minChunkSize();
+    _maxChunkSize = qMax(_minChunkSize, cfg.maxChunkSize());
+    if (envChunkSize) {
+        // a chunk size from the environment is used as is
+        _chunkSize = envChunkSize;
+        _targetChunkUploadDuration = 0;
+    } else {
+        _chunkSize = _account->uploadChunkSize() ? _account->uploadChunkSize() : cfg.chunkSize();
+        _targetChunkUploadDuration = cfg.targetChunkUploadDuration();
+        if (_targetChunkUploadDuration > 0) {
+            _chunkSize = qBound(_minChunkSize, _chunkSize, _maxChunkSize);
+        }
+    }
+    qDebug() << "Starting with chunk size" << _chunkSize;
+
     /* This builds all the jobs needed for the propagation.
      * Each directory is a PropagateDirectory job, which contains the files in it.
      * In order to do that we loop over the items. (which are sorted by destination)
-     * When we enter a directory, we can create the directory job and push it on the stack. */
+     * The job of an item goes into the job of the closest parent directory item
+     * that got one, or into the root job. */
 
     _rootJob.reset(new PropagateDirectory(this));
-    QStack<QPair<QString /* directory name */, PropagateDirectory* /* job */> > directories;
-    directories.push(qMakePair(QString(), _rootJob.data()));
+    const SyncFileItemTree tree(items);
+    QVector<PropagateDirectory*> directoryJobs(items.size()); // by item index, 0 if there is none
     QVector<PropagatorJob*> directoriesToRemove;
-    QString removedDirectory;
-    foreach(const SyncFileItemPtr &item, items) {
+    int removedDirectoryEnd = 0; // subtree end of the last removed directory
+
+    for (int i = 0; i < items.size(); ++i) {
+        const SyncFileItemPtr &item = items.at(i);
 
-        if (!removedDirectory.isEmpty() && item->_file.startsWith(removedDirectory)) {
+        if (i < removedDirectoryEnd) {
             // this is an item in a directory which is going to be removed.
             PropagateDirectory *delDirJob = dynamic_cast<PropagateDirectory*>(directoriesToRemove.last());
 
@@ -330,9 +498,11 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
                        << item->_file << item->_instruction;
         }
 
-        while (!item->destination().startsWith(directories.top().first)) {
-            directories.pop();
+        int parent = tree.parent(i);
+        while (parent >= 0 && !directoryJobs.at(parent)) {
+            parent = tree.parent(parent);
         }
+        PropagateDirectory *parentJob = parent >= 0 ? directoryJobs.at(parent) : _rootJob.data();
 
         if (item->_isDirectory) {
             PropagateDirectory *dir = new PropagateDirectory(this, item);
@@ -341,22 +511,24 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
                 // We do the removal of directories at the end, because there might be moves from
                 // these directories that will happen later.
                 directoriesToRemove.append(dir);
-                removedDirectory = item->_file + "/";
+                removedDirectoryEnd = tree.subtreeEnd(i);
 
                 // We should not update the etag of parent directories of the removed directory
                 // since it would be done before the actual remove (issue #1845)
                 // NOTE: Currently this means that we don't update those etag at all in this sync,
                 //       but it should not be a problem, they will be updated in the next sync.
-                for (int i = 0; i < directories.size(); ++i) {
-                    directories[i].second->_item->_should_update_metadata = false;
+                _rootJob->_item->_should_update_metadata = false;
+                for (int p = parent; p >= 0; p = tree.parent(p)) {
+                    if (directoryJobs.at(p)) {
+                        directoryJobs.at(p)->_item->_should_update_metadata = false;
+                    }
                 }
             } else {
-                PropagateDirectory* currentDirJob = directories.top().second;
-                currentDirJob->append(dir);
+                parentJob->append(dir);
             }
-            directories.push(qMakePair(item->destination() + "/" , dir));
+            directoryJobs[i] = dir;
         } else if (PropagateItemJob* current = createJob(item)) {
-            directories.top().second->append(current);
+            parentJob->append(current);
         }
     }
 
@@ -464,9 +636,12 @@ QString OwncloudPropagator::getFilePath(const QString& tmp_file_name) const
 
 void OwncloudPropagator::scheduleNextJob()
 {
-    if (this->_activeJobs < maximumActiveJob()) {
-        if (_rootJob->scheduleNextJob()) {
-            QTimer::singleShot(100, this, SLOT(scheduleNextJob()));
+    // Called whenever a job finished or became ready. Fill all the free slots
+    // at once: jobs that complete synchronously, like most local jobs, free
+    // their slot right away and let the loop continue.
+    while (_runningItemJobs < maximumActiveJob()) {
+        if (!_rootJob->scheduleNextJob()) {
+            break;
         }
     }
 }
@@ -572,6 +747,15 @@ bool PropagateDirectory::scheduleNextJob()
             return false;
         }
 
+        if (_subJobs.at(i)->_state == NotYetStarted
+                && _propagator->_activeLargeJobs >= _propagator->maximumActiveLargeJobs()) {
+            // All slots for large transfers are taken; start the smaller items that come after it
+            auto itemJob = qobject_cast<PropagateItemJob*>(_subJobs.at(i));
+            if (itemJob && _propagator->isLargeTransfer(*itemJob->_item)) {
+                continue;
+            }
+        }
+
         if (possiblyRunNextJob(_subJobs.at(i))) {
             return true;
         }
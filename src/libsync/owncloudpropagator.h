@@ -147,19 +147,13 @@ protected slots:
 
 private:
     QScopedPointer<PropagateItemJob> _restoreJob;
+    bool _countedAsLargeTransfer; // whether the job is counted in OwncloudPropagator::_activeLargeJobs
 
 public:
     PropagateItemJob(OwncloudPropagator* propagator, const SyncFileItemPtr &item)
-        : PropagatorJob(propagator), _item(item) {}
+        : PropagatorJob(propagator), _countedAsLargeTransfer(false), _item(item) {}
 
-    bool scheduleNextJob() Q_DECL_OVERRIDE {
-        if (_state != NotYetStarted) {
-            return false;
-        }
-        _state = Running;
-        QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
-        return true;
-    }
+    bool scheduleNextJob() Q_DECL_OVERRIDE;
 
     SyncFileItemPtr  _item;
 
@@ -274,8 +268,16 @@ public:
             , _journal(progressDb)
             , _finishedEmited(false)
             , _bandwidthManager(this)
-            , _activeJobs(0)
+            , _runningItemJobs(0)
+            , _activeLargeJobs(0)
             , _anotherSyncNeeded(false)
+            , _chunkSize(0)
+            , _minChunkSize(0)
+            , _maxChunkSize(0)
+            , _targetChunkUploadDuration(0)
+            , _parallelism(3)
+            , _latency(0)
+            , _baseLatency(0)
             , _account(account)
     { }
 
@@ -289,15 +291,49 @@ public:
 
     QAtomicInt _abortRequested; // boolean set by the main thread to abort.
 
-    /* The number of currently active jobs */
-    int _activeJobs;
+    /* The number of item jobs that were started and did not finish yet, including
+     * the ones that are not waiting for the network, e.g. an upload computing its
+     * checksum. Scheduling is limited by it. */
+    int _runningItemJobs;
+
+    /* The number of transfers of large files that were started and did not finish yet */
+    int _activeLargeJobs;
 
     /** We detected that another sync is required after this one */
     bool _anotherSyncNeeded;
 
-    /* The maximum number of active jobs in parallel  */
+    /* The maximum number of active jobs in parallel.
+     * The limit for small jobs adapts to the server latency and errors, the
+     * running transfers of large files come on top of it. */
     int maximumActiveJob();
 
+    /* The maximum number of transfers of large files in parallel */
+    int maximumActiveLargeJobs();
+
+    /* Whether the item is a file transfer large enough to count against maximumActiveLargeJobs() */
+    bool isLargeTransfer(const SyncFileItem &item) const;
+
+    /* Adapts the number of small jobs in parallel to the outcome of a finished item */
+    void adaptParallelism(const SyncFileItem &item, SyncFileItem::Status status);
+
+    /* Backs off like after a 5xx reply, for a request that got no answer in time */
+    void requestTimedOut();
+
+    /* The maximum number of chunks or segments of a single file that are transferred in parallel.
+     * A transfer counts as one running job no matter how many of its parts are in transit. */
+    int maximumParallelChunks();
+
+    /* The chunk size to use for a chunked upload that starts now */
+    quint64 chunkSize() const { return _chunkSize; }
+
+    /* Adapts the chunk size to the time \a msecs that the upload of a chunk of \a size bytes took.
+     * The new value is remembered in the account for the next sync. */
+    void adaptChunkSize(quint64 size, qint64 msecs);
+
+    /* Halves the chunk size after the upload of a chunk of \a size bytes broke off
+     * without an answer from the server, e.g. by a timeout on a flaky link. */
+    void chunkUploadFailed(quint64 size);
+
     bool isInSharedDirectory(const QString& file);
     bool localFileNameClash(const QString& relfile);
     QString getFilePath(const QString& tmp_file_name) const;
@@ -356,6 +392,19 @@ signals:
     void finished();
 
 private:
+    void backOff(const QString &reason);
+
+    // Chunk size of new chunked uploads and the bounds for adapting it, see ConfigFile
+    quint64 _chunkSize;
+    quint64 _minChunkSize;
+    quint64 _maxChunkSize;
+    int _targetChunkUploadDuration;
+
+    // State of the concurrency controller for small jobs, see adaptParallelism()
+    double _parallelism; // current limit, fractional to allow additive increase
+    double _latency; // smoothed request duration in ms
+    double _baseLatency; // lowest smoothed request duration seen in this sync
+    QElapsedTimer _lastBackoff;
 
     AccountPtr _account;
 
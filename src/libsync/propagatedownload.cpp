@@ -15,6 +15,7 @@
 #include "config.h"
 #include "owncloudpropagator_p.h"
 #include "propagatedownload.h"
+#include "propagateupload.h"
 #include "networkjobs.h"
 #include "account.h"
 #include "syncjournaldb.h"
@@ -57,6 +58,35 @@ QString OWNCLOUDSYNC_EXPORT createDownloadTmpFileName(const QString &previous) {
     }
 }
 
+// Splits a file of the given size into count segments of about the same size
+QVector<SyncJournalDb::DownloadSegment> OWNCLOUDSYNC_EXPORT createDownloadSegments(quint64 size, int count)
+{
+    QVector<SyncJournalDb::DownloadSegment> segments;
+    if (count < 1) {
+        return segments;
+    }
+    const quint64 segmentSize = (size + count - 1) / count;
+    for (quint64 start = 0; start < size; start += segmentSize) {
+        SyncJournalDb::DownloadSegment segment;
+        segment._start = start;
+        segment._end = qMin(start + segmentSize, size);
+        segments.append(segment);
+    }
+    return segments;
+}
+
+/**
+ * Smaller files are downloaded in one piece, the extra requests would not pay off.
+ */
+static qint64 segmentedDownloadMinSize()
+{
+    static qint64 minSize = qgetenv("OWNCLOUD_SEGMENTED_DOWNLOAD_MIN_SIZE").toUInt();
+    if (!minSize) {
+        minSize = 20 * 1024 * 1024; // default to 20 MiB
+    }
+    return minSize;
+}
+
 // DOES NOT take ownership of the device.
 GETFileJob::GETFileJob(AccountPtr account, const QString& path, QFile *device,
                     const QMap<QByteArray, QByteArray> &headers, const QByteArray &expectedEtagForResume,
@@ -66,6 +96,7 @@ GETFileJob::GETFileJob(AccountPtr account, const QString& path, QFile *device,
 , _resumeStart(resumeStart) , _errorStatus(SyncFileItem::NoStatus)
 , _bandwidthLimited(false), _bandwidthChoked(false), _bandwidthQuota(0), _bandwidthManager(0)
 , _hasEmittedFinishedSignal(false), _lastModified()
+, _rangeEnd(0), _rangeIgnored(false)
 {
 }
 
@@ -78,13 +109,17 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl& url, QFile *device,
 , _resumeStart(resumeStart), _errorStatus(SyncFileItem::NoStatus), _directDownloadUrl(url)
 , _bandwidthLimited(false), _bandwidthChoked(false), _bandwidthQuota(0), _bandwidthManager(0)
 , _hasEmittedFinishedSignal(false), _lastModified()
+, _rangeEnd(0), _rangeIgnored(false)
 {
 }
 
 
 void GETFileJob::start() {
-    if (_resumeStart > 0) {
+    if (_resumeStart > 0 || _rangeEnd > 0) {
         _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) +'-';
+        if (_rangeEnd > 0) {
+            _headers["Range"] += QByteArray::number(_rangeEnd - 1);
+        }
         _headers["Accept-Ranges"] = "bytes";
         qDebug() << "Retry with range " << _headers["Range"];
     }
@@ -162,12 +197,31 @@ void GETFileJob::slotMetaDataChanged()
 
     quint64 start = 0;
     QByteArray ranges = reply()->rawHeader("Content-Range");
+    if (ranges.isEmpty() && _rangeEnd > 0) {
+        // The whole file is coming, it can't be written into the segment
+        qDebug() << Q_FUNC_INFO << "No content-range for a segment, the server ignored the range";
+        _rangeIgnored = true;
+        _errorString = tr("Server does not support range requests");
+        _errorStatus = SyncFileItem::SoftError;
+        reply()->abort();
+        return;
+    }
+    quint64 end = 0;
     if (!ranges.isEmpty()) {
-        QRegExp rx("bytes (\\d+)-");
+        QRegExp rx("bytes (\\d+)-(\\d+)?");
         if (rx.indexIn(ranges) >= 0) {
             start = rx.cap(1).toULongLong();
+            end = rx.cap(2).toULongLong();
         }
     }
+    if (_rangeEnd > 0 && end != _rangeEnd - 1) {
+        // More would overwrite the next segment, less would leave a hole
+        qDebug() << Q_FUNC_INFO << "Wrong content-range: " << ranges << " while expecting end was" << _rangeEnd - 1;
+        _errorString = tr("Server returned wrong content-range");
+        _errorStatus = SyncFileItem::NormalError;
+        reply()->abort();
+        return;
+    }
     if (start != _resumeStart) {
         qDebug() << Q_FUNC_INFO <<  "Wrong content-range: "<< ranges << " while expecting start was" << _resumeStart;
         if (ranges.isEmpty()) {
@@ -258,6 +312,15 @@ void GETFileJob::slotReadyRead()
             return;
         }
 
+        if (_rangeEnd > 0 && currentDownloadPosition() + r > qint64(_rangeEnd)) {
+            // Never write past the segment, the next one is there
+            qDebug() << "The server sent more than the requested range" << _rangeEnd << currentDownloadPosition() << r;
+            _errorString = tr("Server sent more data than requested");
+            _errorStatus = SyncFileItem::NormalError;
+            reply()->abort();
+            return;
+        }
+
         if (_device->isOpen()) {
             qint64 w = _device->write(buffer.constData(), r);
             if (w != r) {
@@ -287,6 +350,7 @@ void GETFileJob::slotReadyRead()
 void GETFileJob::slotTimeout()
 {
     qDebug() << "Timeout" << reply()->request().url();
+    _timedout = true;
     _errorString =  tr("Connection Timeout");
     _errorStatus = SyncFileItem::FatalError;
     reply()->abort();
@@ -308,7 +372,7 @@ void PropagateDownloadFileQNAM::start()
     if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
         return;
 
-    qDebug() << Q_FUNC_INFO << _item->_file << _propagator->_activeJobs;
+    qDebug() << Q_FUNC_INFO << _item->_file << _propagator->_runningItemJobs;
 
     // do a klaas' case clash check.
     if( _propagator->localFileNameClash(_item->_file) ) {
@@ -321,6 +385,7 @@ void PropagateDownloadFileQNAM::start()
 
     QString tmpFileName;
     QByteArray expectedEtagForResume;
+    QVector<SyncJournalDb::DownloadSegment> segments;
     const SyncJournalDb::DownloadInfo progressInfo = _propagator->_journal->getDownloadInfo(_item->_file);
     if (progressInfo._valid) {
         // if the etag has changed meanwhile, remove the already downloaded part.
@@ -330,12 +395,23 @@ void PropagateDownloadFileQNAM::start()
         } else {
             tmpFileName = progressInfo._tmpfile;
             expectedEtagForResume = progressInfo._etag;
+            segments = progressInfo._segments;
         }
 
     }
 
     if (tmpFileName.isEmpty()) {
         tmpFileName = createDownloadTmpFileName(_item->_file);
+        if (_item->_directDownloadUrl.isEmpty()
+                && qint64(_item->_size) >= segmentedDownloadMinSize()
+                && _propagator->maximumParallelChunks() > 1) {
+            segments = createDownloadSegments(_item->_size, _propagator->maximumParallelChunks());
+        }
+    }
+
+    if (!segments.isEmpty()) {
+        startSegmentedDownload(tmpFileName, segments);
+        return;
     }
 
     _tmpFile.setFileName(_propagator->getFilePath(tmpFileName));
@@ -356,18 +432,7 @@ void PropagateDownloadFileQNAM::start()
         }
     }
 
-    // If there's not enough space to fully download this file, stop.
-    const auto diskSpaceResult = _propagator->diskSpaceCheck();
-    if (diskSpaceResult == OwncloudPropagator::DiskSpaceFailure) {
-        _item->_errorMayBeBlacklisted = true;
-        done(SyncFileItem::NormalError,
-             tr("The download would reduce free disk space below %1").arg(
-                 Utility::octetsToString(freeSpaceLimit())));
-        return;
-    } else if (diskSpaceResult == OwncloudPropagator::DiskSpaceCritical) {
-        done(SyncFileItem::FatalError,
-             tr("Free space on disk is less than %1").arg(
-                 Utility::octetsToString(criticalFreeSpaceLimit())));
+    if (!checkDiskSpace()) {
         return;
     }
 
@@ -403,10 +468,247 @@ void PropagateDownloadFileQNAM::start()
     _job->setBandwidthManager(&_propagator->_bandwidthManager);
     connect(_job, SIGNAL(finishedSignal()), this, SLOT(slotGetFinished()));
     connect(_job, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(slotDownloadProgress(qint64,qint64)));
-    _propagator->_activeJobs ++;
     _job->start();
 }
 
+bool PropagateDownloadFileQNAM::checkDiskSpace()
+{
+    // If there's not enough space to fully download this file, stop.
+    const auto diskSpaceResult = _propagator->diskSpaceCheck();
+    if (diskSpaceResult == OwncloudPropagator::DiskSpaceFailure) {
+        _item->_errorMayBeBlacklisted = true;
+        done(SyncFileItem::NormalError,
+             tr("The download would reduce free disk space below %1").arg(
+                 Utility::octetsToString(freeSpaceLimit())));
+        return false;
+    } else if (diskSpaceResult == OwncloudPropagator::DiskSpaceCritical) {
+        done(SyncFileItem::FatalError,
+             tr("Free space on disk is less than %1").arg(
+                 Utility::octetsToString(criticalFreeSpaceLimit())));
+        return false;
+    }
+    return true;
+}
+
+void PropagateDownloadFileQNAM::startSegmentedDownload(const QString& tmpFileName,
+                                                       const QVector<SyncJournalDb::DownloadSegment>& segments)
+{
+    _tmpFile.setFileName(_propagator->getFilePath(tmpFileName));
+
+    // A temporary file of the wrong size does not contain what the journal
+    // says, e.g. because it was removed after a checksum failure
+    const bool tmpFileValid = _tmpFile.size() == qint64(_item->_size);
+    _segments.clear();
+    _resumeStart = 0;
+    foreach (const auto &range, segments) {
+        Segment segment;
+        segment._range = range;
+        if (!tmpFileValid) {
+            segment._range._done = 0;
+        }
+        _resumeStart += segment._range._done;
+        _segments.append(segment);
+    }
+
+    if (!checkDiskSpace()) {
+        return;
+    }
+
+    // Preallocate the file, every segment writes at its own offset
+    if (!_tmpFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        done(SyncFileItem::NormalError, _tmpFile.errorString());
+        return;
+    }
+    FileSystem::setFileHidden(_tmpFile.fileName(), true);
+    if (!tmpFileValid && !_tmpFile.resize(_item->_size)) {
+        done(SyncFileItem::NormalError, _tmpFile.errorString());
+        return;
+    }
+    _tmpFile.close();
+
+    {
+        SyncJournalDb::DownloadInfo pi;
+        pi._etag = _item->_etag;
+        pi._tmpfile = tmpFileName;
+        pi._valid = true;
+        foreach (const auto &segment, _segments) {
+            pi._segments.append(segment._range);
+        }
+        _propagator->_journal->setDownloadInfo(_item->_file, pi);
+        _propagator->_journal->commit("download file start");
+    }
+
+    if (_resumeStart == _item->_size) {
+        qDebug() << "File is already complete, no need to download";
+        downloadFinished();
+        return;
+    }
+
+    for (int i = 0; i < _segments.count(); ++i) {
+        Segment &segment = _segments[i];
+        const quint64 position = segment._range._start + segment._range._done;
+        if (position >= segment._range._end) {
+            continue;
+        }
+        segment._file.reset(new QFile(_tmpFile.fileName()));
+        if (!segment._file->open(QIODevice::ReadWrite | QIODevice::Unbuffered)
+                || !segment._file->seek(position)) {
+            done(SyncFileItem::NormalError, segment._file->errorString());
+            return;
+        }
+    }
+
+    for (int i = 0; i < _segments.count(); ++i) {
+        Segment &segment = _segments[i];
+        if (!segment._file) {
+            continue;
+        }
+        const quint64 position = segment._range._start + segment._range._done;
+        // All segments have to be of the version the journal entry was made for
+        segment._job = new GETFileJob(_propagator->account(),
+                                      _propagator->_remoteFolder + _item->_file,
+                                      segment._file.data(), QMap<QByteArray, QByteArray>(),
+                                      _item->_etag, position);
+        segment._job->setRangeEnd(segment._range._end);
+        segment._job->setBandwidthManager(&_propagator->_bandwidthManager);
+        connect(segment._job, SIGNAL(finishedSignal()), this, SLOT(slotSegmentFinished()));
+        connect(segment._job, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(slotSegmentProgress(qint64,qint64)));
+    }
+
+    qDebug() << Q_FUNC_INFO << _item->_file << "in" << _segments.count() << "segments";
+    foreach (const auto &segment, _segments) {
+        if (segment._job) {
+            _runningSegments++;
+            segment._job->start();
+        }
+    }
+}
+
+void PropagateDownloadFileQNAM::saveSegments()
+{
+    SyncJournalDb::DownloadInfo pi = _propagator->_journal->getDownloadInfo(_item->_file);
+    if (!pi._valid) {
+        return;
+    }
+    pi._segments.clear();
+    foreach (const auto &segment, _segments) {
+        pi._segments.append(segment._range);
+    }
+    _propagator->_journal->setDownloadInfo(_item->_file, pi);
+}
+
+void PropagateDownloadFileQNAM::slotSegmentProgress(qint64 received, qint64)
+{
+    _downloadProgress = 0;
+    for (int i = 0; i < _segments.count(); ++i) {
+        if (_segments[i]._job == sender()) {
+            _segments[i]._received = received;
+        }
+        _downloadProgress += _segments[i]._received;
+    }
+    emit progress(*_item, _resumeStart + _downloadProgress);
+}
+
+void PropagateDownloadFileQNAM::slotSegmentFinished()
+{
+    GETFileJob *job = qobject_cast<GETFileJob *>(sender());
+    Q_ASSERT(job);
+
+    qDebug() << Q_FUNC_INFO << job->reply()->request().url() << "FINISHED WITH STATUS"
+             << job->reply()->error()
+             << (job->reply()->error() == QNetworkReply::NoError ? QLatin1String("") : job->reply()->errorString())
+             << job->reply()->rawHeader("Content-Range");
+
+    for (int i = 0; i < _segments.count(); ++i) {
+        Segment &segment = _segments[i];
+        if (segment._job != job) {
+            continue;
+        }
+        segment._range._done = job->currentDownloadPosition() - segment._range._start;
+        segment._file->close();
+        segment._job = 0;
+    }
+    _runningSegments--;
+
+    QNetworkReply::NetworkError err = job->reply()->error();
+    if (err != QNetworkReply::NoError) {
+        if (job->timedOut()) {
+            _propagator->requestTimedOut();
+        }
+        if (_segmentsStatus == SyncFileItem::NoStatus) {
+            // The first failure decides, the other segments are stopped
+            _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+            _segmentsRangeIgnored = job->rangeIgnored();
+            _segmentsErrorString = job->errorString();
+            _segmentsStatus = job->errorStatus();
+            if (_item->_httpErrorCode == 404) {
+                _segmentsErrorString = tr("File was deleted from server");
+                _segmentsStatus = SyncFileItem::SoftError;
+            } else if (_segmentsStatus == SyncFileItem::NoStatus) {
+                _segmentsStatus = classifyError(err, _item->_httpErrorCode,
+                                                &_propagator->_anotherSyncNeeded);
+            }
+            // Queued: aborting a reply finishes its job right away
+            QMetaObject::invokeMethod(this, "abortSegments", Qt::QueuedConnection);
+        }
+    } else {
+        _segmentsEtag = job->etag();
+        _segmentsChecksumHeader = job->reply()->rawHeader(checkSumHeaderC);
+        if (job->lastModified()) {
+            _segmentsLastModified = job->lastModified();
+        }
+        _item->_responseTimeStamp = job->responseTimestamp();
+    }
+
+    if (_runningSegments > 0) {
+        return;
+    }
+
+    if (_segmentsRangeIgnored) {
+        // Download the file in one piece instead, now and when resuming
+        qDebug() << Q_FUNC_INFO << "Segmented download not possible, downloading" << _item->_file << "in one piece";
+        _tmpFile.remove();
+        _segments.clear();
+        _segmentsRangeIgnored = false;
+        _segmentsStatus = SyncFileItem::NoStatus;
+        _item->_httpErrorCode = 0;
+        saveSegments();
+        start();
+        return;
+    }
+    if (_item->_httpErrorCode == 404) {
+        _tmpFile.remove();
+        _propagator->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+    } else {
+        // Keep what arrived for the next attempt
+        saveSegments();
+    }
+    if (_segmentsStatus != SyncFileItem::NoStatus) {
+        done(_segmentsStatus, _segmentsErrorString);
+        return;
+    }
+
+    foreach (const auto &segment, _segments) {
+        if (segment._range._start + segment._range._done != segment._range._end) {
+            _propagator->_anotherSyncNeeded = true;
+            done(SyncFileItem::SoftError, tr("The file could not be downloaded completely."));
+            return;
+        }
+    }
+
+    if (!_segmentsEtag.isEmpty()) {
+        _item->_etag = parseEtag(_segmentsEtag);
+    }
+    if (_segmentsLastModified) {
+        // It is possible that the file was modified on the server since we did the discovery phase
+        // so make sure we have the up-to-date time
+        _item->_modtime = _segmentsLastModified;
+    }
+    _item->_requestDuration = job->duration();
+
+    validateChecksumHeader(_segmentsChecksumHeader);
+}
+
 qint64 PropagateDownloadFileQNAM::committedDiskSpace() const
 {
     if (_state == Running) {
@@ -418,8 +720,6 @@ qint64 PropagateDownloadFileQNAM::committedDiskSpace() const
 const char owncloudCustomSoftErrorStringC[] = "owncloud-custom-soft-error-string";
 void PropagateDownloadFileQNAM::slotGetFinished()
 {
-    _propagator->_activeJobs--;
-
     GETFileJob *job = qobject_cast<GETFileJob *>(sender());
     Q_ASSERT(job);
 
@@ -433,6 +733,9 @@ void PropagateDownloadFileQNAM::slotGetFinished()
     QNetworkReply::NetworkError err = job->reply()->error();
     if (err != QNetworkReply::NoError) {
         _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (job->timedOut()) {
+            _propagator->requestTimedOut();
+        }
 
         // If we sent a 'Range' header and get 416 back, we want to retry
         // without the header.
@@ -529,6 +832,11 @@ void PropagateDownloadFileQNAM::slotGetFinished()
         return;
     }
 
+    validateChecksumHeader(job->reply()->rawHeader(checkSumHeaderC));
+}
+
+void PropagateDownloadFileQNAM::validateChecksumHeader(const QByteArray& header)
+{
     // Do checksum validation for the download. If there is no checksum header, the validator
     // will also emit the validated() signal to continue the flow in slot downloadFinished()
     // as this is (still) also correct.
@@ -537,7 +845,7 @@ void PropagateDownloadFileQNAM::slotGetFinished()
             SLOT(downloadFinished()));
     connect(validator, SIGNAL(validationFailed(QString)),
             SLOT(slotChecksumFail(QString)));
-    auto checksumHeader = job->reply()->rawHeader(checkSumHeaderC);
+    auto checksumHeader = header;
     if (!downloadChecksumEnabled()) {
         checksumHeader.clear();
     }
@@ -620,6 +928,16 @@ static void handleRecallFile(const QString &fn)
 
 void PropagateDownloadFileQNAM::downloadFinished()
 {
+    if (!_blockHashesComputed && qint64(_tmpFile.size()) >= deltaMinFileSize()
+            && _propagator->account()->capabilities().deltaUpload()) {
+        // Without the signature of the version on the server the next upload
+        // of this file could not be a delta.
+        auto computeHashes = new ComputeBlockHashes(this);
+        connect(computeHashes, SIGNAL(done(QByteArray)), SLOT(slotBlockHashesComputed(QByteArray)));
+        computeHashes->start(_tmpFile.fileName(), deltaBlockSize());
+        return;
+    }
+
     QString fn = _propagator->getFilePath(_item->_file);
 
     // In case of file name clash, report an error
@@ -704,6 +1022,15 @@ void PropagateDownloadFileQNAM::downloadFinished()
 
     _propagator->_journal->setFileRecord(SyncJournalFileRecord(*_item, fn));
     _propagator->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+    if (!_blockHashes.isNull()) {
+        SyncJournalDb::BlockSignature signature;
+        signature._etag = _item->_etag;
+        signature._blockSize = deltaBlockSize();
+        signature._fileSize = _item->_size;
+        signature._hashes = _blockHashes;
+        signature._valid = true;
+        _propagator->_journal->setBlockSignature(_item->_file, signature);
+    }
     _propagator->_journal->commit("download file start2");
     done(isConflict ? SyncFileItem::Conflict : SyncFileItem::Success);
 
@@ -713,6 +1040,16 @@ void PropagateDownloadFileQNAM::downloadFinished()
     }
 }
 
+void PropagateDownloadFileQNAM::slotBlockHashesComputed(const QByteArray& hashes)
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0) || _state == Finished) {
+        return;
+    }
+    _blockHashes = hashes;
+    _blockHashesComputed = true;
+    downloadFinished();
+}
+
 void PropagateDownloadFileQNAM::slotDownloadProgress(qint64 received, qint64)
 {
     if (!_job) return;
@@ -725,6 +1062,17 @@ void PropagateDownloadFileQNAM::abort()
 {
     if (_job &&  _job->reply())
         _job->reply()->abort();
+    abortSegments();
+}
+
+void PropagateDownloadFileQNAM::abortSegments()
+{
+    // Not the download in one piece that may have replaced them meanwhile
+    foreach (const auto &segment, _segments) {
+        if (segment._job && segment._job->reply()) {
+            segment._job->reply()->abort();
+        }
+    }
 }
 
 
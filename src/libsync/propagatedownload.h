@@ -18,6 +18,7 @@
 
 #include <QBuffer>
 #include <QFile>
+#include <QSharedPointer>
 
 namespace OCC {
 
@@ -41,6 +42,8 @@ class GETFileJob : public AbstractNetworkJob {
     QPointer<BandwidthManager> _bandwidthManager;
     bool _hasEmittedFinishedSignal;
     time_t _lastModified;
+    quint64 _rangeEnd;
+    bool _rangeIgnored;
 public:
 
     // DOES NOT take ownership of the device.
@@ -78,6 +81,10 @@ public:
     void setBandwidthManager(BandwidthManager *bwm);
     void setChoked(bool c);
     void setBandwidthLimited(bool b);
+    /** Only download the bytes before \a end, for a segment of the file */
+    void setRangeEnd(quint64 end) { _rangeEnd = end; }
+    /** The server sent the whole file instead of the requested segment */
+    bool rangeIgnored() const { return _rangeIgnored; }
     void giveBandwidthQuota(qint64 q);
     qint64 currentDownloadPosition();
 
@@ -104,13 +111,24 @@ private slots:
 
 /**
  * @brief The PropagateDownloadFileQNAM class
+ *
+ * Big files are downloaded in segments: byte ranges that are fetched in
+ * parallel, each into its part of the preallocated temporary file. How much
+ * of every segment arrived is kept in the journal to resume all of them.
+ *
+ * If the server supports delta uploads, the block signature of a big file is
+ * stored with its record, so the first upload of a local change can already
+ * be a delta.
+ *
  * @ingroup libsync
  */
 class PropagateDownloadFileQNAM : public PropagateItemJob {
     Q_OBJECT
 public:
     PropagateDownloadFileQNAM(OwncloudPropagator* propagator,const SyncFileItemPtr& item)
-        : PropagateItemJob(propagator, item), _resumeStart(0), _downloadProgress(0) {}
+        : PropagateItemJob(propagator, item), _resumeStart(0), _downloadProgress(0),
+          _runningSegments(0), _segmentsLastModified(0), _segmentsStatus(SyncFileItem::NoStatus),
+          _segmentsRangeIgnored(false), _blockHashesComputed(false) {}
     void start() Q_DECL_OVERRIDE;
     qint64 committedDiskSpace() const Q_DECL_OVERRIDE;
 
@@ -120,12 +138,41 @@ private slots:
     void downloadFinished();
     void slotDownloadProgress(qint64,qint64);
     void slotChecksumFail( const QString& errMsg );
+    void slotSegmentFinished();
+    void slotSegmentProgress(qint64,qint64);
+    void abortSegments();
+    void slotBlockHashesComputed(const QByteArray& hashes);
 
 private:
+    bool checkDiskSpace();
+    void startSegmentedDownload(const QString& tmpFileName, const QVector<SyncJournalDb::DownloadSegment>& segments);
+    void saveSegments();
+    void validateChecksumHeader(const QByteArray& checksumHeader);
+
     quint64 _resumeStart;
     qint64 _downloadProgress;
     QPointer<GETFileJob> _job;
     QFile _tmpFile;
+
+    struct Segment {
+        Segment() : _received(0) {}
+        SyncJournalDb::DownloadSegment _range;
+        QSharedPointer<QFile> _file; // the temporary file, positioned at the segment
+        QPointer<GETFileJob> _job;
+        qint64 _received; // by the running job
+    };
+    QVector<Segment> _segments;
+    int _runningSegments;
+    // Collected from the segments as they finish
+    QByteArray _segmentsEtag;
+    QByteArray _segmentsChecksumHeader;
+    time_t _segmentsLastModified;
+    SyncFileItem::Status _segmentsStatus;
+    QString _segmentsErrorString;
+    bool _segmentsRangeIgnored;
+
+    QByteArray _blockHashes; /// signature of the downloaded file, for the next delta upload
+    bool _blockHashesComputed;
 };
 
 }
@@ -32,7 +32,6 @@ public:
     bool finished() Q_DECL_OVERRIDE;
 
     QString errorString();
-    bool timedOut() { return _timedout; }
 
 signals:
     void finishedSignal();
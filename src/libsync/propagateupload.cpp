@@ -40,6 +40,38 @@ const char owncloudShouldSoftCancelPropertyName[] = "owncloud-should-soft-cancel
 
 namespace OCC {
 
+qint64 deltaBlockSize()
+{
+    static qint64 blockSize = qgetenv("OWNCLOUD_DELTA_BLOCK_SIZE").toUInt();
+    if (!blockSize) {
+        blockSize = 1024 * 1024; // default to 1 MiB
+    }
+    return blockSize;
+}
+
+qint64 deltaMinFileSize()
+{
+    static qint64 minSize = qgetenv("OWNCLOUD_DELTA_MIN_SIZE").toUInt();
+    if (!minSize) {
+        minSize = 10 * 1024 * 1024; // default to 10 MiB
+    }
+    return minSize;
+}
+
+QVector<int> deltaUploadChunks(const QByteArray& baseHashes, const QByteArray& hashes)
+{
+    QVector<int> chunks;
+    const int hashSize = 16; // MD5
+    const int count = hashes.size() / hashSize;
+    for (int i = 0; i < count; ++i) {
+        if ((i + 1) * hashSize > baseHashes.size()
+                || memcmp(hashes.constData() + i * hashSize, baseHashes.constData() + i * hashSize, hashSize) != 0) {
+            chunks.append(i);
+        }
+    }
+    return chunks;
+}
+
 /**
  * We do not want to upload files that are currently being modified.
  * To avoid that, we don't upload files that have a modification time
@@ -59,17 +91,6 @@ static bool fileIsStillChanging(const SyncFileItem & item)
             && msSinceMod > -10000;
 }
 
-static qint64 chunkSize() {
-    static uint chunkSize;
-    if (!chunkSize) {
-        chunkSize = qgetenv("OWNCLOUD_CHUNK_SIZE").toUInt();
-        if (chunkSize == 0) {
-            chunkSize = 5*1024*1024; // default to 5 MiB
-        }
-    }
-    return chunkSize;
-}
-
 PUTFileJob::~PUTFileJob()
 {
     // Make sure that we destroy the QNetworkReply before our _device of which it keeps an internal pointer.
@@ -82,7 +103,8 @@ void PUTFileJob::start() {
         req.setRawHeader(it.key(), it.value());
     }
 
-    setReply(davRequest("PUT", path(), req, _device.data()));
+    _requestTimer.start();
+    setReply(davRequest(_verb, path(), req, _device.data()));
     setupConnections(reply());
 
     if( reply()->error() != QNetworkReply::NoError ) {
@@ -108,6 +130,7 @@ void PUTFileJob::start() {
 
 void PUTFileJob::slotTimeout() {
     qDebug() << "Timeout" << reply()->request().url();
+    _timedout = true;
     _errorString =  tr("Connection Timeout");
     reply()->abort();
 }
@@ -262,13 +285,43 @@ void PropagateUploadFileQNAM::slotComputeTransmissionChecksum(const QByteArray&
     } else {
         computeChecksum->setChecksumType(QByteArray());
     }
+    const QString filePath = _propagator->getFilePath(_item->_file);
+
+    if (!computeChecksum->checksumType().isEmpty()
+            && quint64(FileSystem::getSize(filePath)) > _propagator->chunkSize()) {
+        // Only the last chunk carries the transmission checksum. Upload the
+        // other chunks while it is being computed instead of hashing the
+        // whole file before the first byte is sent.
+        _transmissionChecksumPending = true;
+        connect(computeChecksum, SIGNAL(done(QByteArray,QByteArray)),
+                SLOT(slotTransmissionChecksumComputed(QByteArray,QByteArray)));
+        computeChecksum->start(filePath);
+        slotStartUpload(computeChecksum->checksumType(), QByteArray());
+        return;
+    }
 
     connect(computeChecksum, SIGNAL(done(QByteArray,QByteArray)),
             SLOT(slotStartUpload(QByteArray,QByteArray)));
-    const QString filePath = _propagator->getFilePath(_item->_file);
     computeChecksum->start(filePath);
 }
 
+void PropagateUploadFileQNAM::slotTransmissionChecksumComputed(const QByteArray& transmissionChecksumType, const QByteArray& transmissionChecksum)
+{
+    _transmissionChecksumPending = false;
+    if (_state == Finished || _finished) {
+        return;
+    }
+    _stopWatch.addLapTime(QLatin1String("TransmissionChecksum"));
+
+    _transmissionChecksumType = transmissionChecksumType;
+    _transmissionChecksum = transmissionChecksum;
+
+    // The last chunk or the delta manifest may be waiting for the checksum
+    if (_deltaUpload || _currentChunk < _chunkCount) {
+        startNextChunk();
+    }
+}
+
 void PropagateUploadFileQNAM::slotStartUpload(const QByteArray& transmissionChecksumType, const QByteArray& transmissionChecksum)
 {
     _transmissionChecksum = transmissionChecksum;
@@ -280,7 +333,9 @@ void PropagateUploadFileQNAM::slotStartUpload(const QByteArray& transmissionChec
         done(SyncFileItem::SoftError, tr("File Removed"));
         return;
     }
-    _stopWatch.addLapTime(QLatin1String("TransmissionChecksum"));
+    if (!_transmissionChecksumPending) {
+        _stopWatch.addLapTime(QLatin1String("TransmissionChecksum"));
+    }
 
     time_t prevModtime = _item->_modtime; // the _item value was set in PropagateUploadFileQNAM::start()
     // but a potential checksum calculation could have taken some time during which the file could
@@ -305,7 +360,29 @@ void PropagateUploadFileQNAM::slotStartUpload(const QByteArray& transmissionChec
         return;
     }
 
-    _chunkCount = std::ceil(fileSize/double(chunkSize()));
+    if (!_deltaFallback
+            && (_item->_instruction == CSYNC_INSTRUCTION_SYNC || _item->_instruction == CSYNC_INSTRUCTION_NEW)
+            && qint64(fileSize) >= deltaMinFileSize()
+            && _propagator->account()->capabilities().deltaUpload()) {
+        // The block signature is needed to find the changed blocks, and is
+        // stored after the upload so the next upload can be a delta too.
+        // A new file has no base to compare with, but gets its signature.
+        auto computeHashes = new ComputeBlockHashes(this);
+        connect(computeHashes, SIGNAL(done(QByteArray)), SLOT(slotBlockHashesComputed(QByteArray)));
+        computeHashes->start(fullFilePath, deltaBlockSize());
+        return;
+    }
+
+    startFullUpload();
+}
+
+void PropagateUploadFileQNAM::startFullUpload()
+{
+    quint64 fileSize = _item->_size;
+
+    // The chunk size is fixed for the whole transfer, the server expects
+    // all chunks but the last one to have the same size.
+    _chunkSize = _propagator->chunkSize();
     _startChunk = 0;
     _transferId = qrand() ^ _item->_modtime ^ (_item->_size << 16);
 
@@ -314,8 +391,16 @@ void PropagateUploadFileQNAM::slotStartUpload(const QByteArray& transmissionChec
     if (progressInfo._valid && Utility::qDateTimeToTime_t(progressInfo._modtime) == _item->_modtime ) {
         _startChunk = progressInfo._chunk;
         _transferId = progressInfo._transferid;
+        if (progressInfo._chunkSize) {
+            // Keep the chunk layout of the transfer we resume
+            _chunkSize = progressInfo._chunkSize;
+        }
         qDebug() << Q_FUNC_INFO << _item->_file << ": Resuming from chunk " << _startChunk;
     }
+    _chunkCount = std::ceil(fileSize/double(_chunkSize));
+    if (_startChunk >= _chunkCount) {
+        _startChunk = 0;
+    }
 
     _currentChunk = 0;
     _duration.start();
@@ -324,8 +409,56 @@ void PropagateUploadFileQNAM::slotStartUpload(const QByteArray& transmissionChec
     this->startNextChunk();
 }
 
+void PropagateUploadFileQNAM::slotBlockHashesComputed(const QByteArray& hashes)
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0) || _state == Finished) {
+        return;
+    }
+    _stopWatch.addLapTime(QLatin1String("BlockHashes"));
+
+    if (!FileSystem::verifyFileUnchanged(_propagator->getFilePath(_item->_file), _item->_size, _item->_modtime)) {
+        _propagator->_anotherSyncNeeded = true;
+        done(SyncFileItem::SoftError, tr("Local file changed during sync."));
+        return;
+    }
+
+    _blockHashes = hashes;
+    _blockSize = deltaBlockSize();
+
+    const SyncJournalDb::BlockSignature base = _propagator->_journal->getBlockSignature(_item->_file);
+    const SyncJournalDb::UploadInfo progressInfo = _propagator->_journal->getUploadInfo(_item->_file);
+    if (hashes.isNull() || !base._valid
+            || base._etag != _item->_etag || base._blockSize != _blockSize
+            || (progressInfo._valid && Utility::qDateTimeToTime_t(progressInfo._modtime) == _item->_modtime)) {
+        // No signature of the version on the server, or a full upload to resume
+        startFullUpload();
+        return;
+    }
+
+    _deltaChunks = deltaUploadChunks(base._hashes, hashes);
+    if (qint64(_deltaChunks.count()) * _blockSize > qint64(_item->_size) / 2) {
+        // Not worth the extra request
+        startFullUpload();
+        return;
+    }
+
+    _deltaUpload = true;
+    _chunkSize = _blockSize;
+    _chunkCount = qMax(1, int(std::ceil(_item->_size / double(_chunkSize))));
+    _startChunk = 0;
+    _currentChunk = 0;
+    _transferId = qrand() ^ _item->_modtime ^ (_item->_size << 16);
+    qDebug() << Q_FUNC_INFO << _item->_file << ": Delta upload of" << _deltaChunks.count()
+             << "of" << _chunkCount << "blocks";
+    _duration.start();
+
+    emit progress(*_item, 0);
+    startNextChunk();
+}
+
 UploadDevice::UploadDevice(BandwidthManager *bwm)
-    : _read(0),
+    : _start(0), _size(0), _read(0),
+      _fileSize(0), _fileModtime(0),
       _bandwidthManager(bwm),
       _bandwidthQuota(0),
       _readWithProgress(0),
@@ -343,27 +476,34 @@ UploadDevice::~UploadDevice() {
 
 bool UploadDevice::prepareAndOpen(const QString& fileName, qint64 start, qint64 size)
 {
-    _data.clear();
     _read = 0;
+    _start = start;
+    _size = 0;
 
-    QFile file(fileName);
+    _file.setFileName(fileName);
     QString openError;
-    if (!FileSystem::openAndSeekFileSharedRead(&file, &openError, start)) {
+    if (!FileSystem::openAndSeekFileSharedRead(&_file, &openError, start)) {
         setErrorString(openError);
         return false;
     }
 
-    size = qBound(0ll, size, FileSystem::getSize(fileName) - start);
-    _data.resize(size);
-    auto read = file.read(_data.data(), size);
-    if (read != size) {
-        setErrorString(file.errorString());
-        return false;
-    }
+    _fileSize = FileSystem::getSize(fileName);
+    _fileModtime = FileSystem::getModTime(fileName);
+    _size = qBound(0ll, size, _fileSize - start);
 
     return QIODevice::open(QIODevice::ReadOnly);
 }
 
+bool UploadDevice::verifyFileUnchanged()
+{
+    if (FileSystem::getSize(_file.fileName()) != _fileSize
+            || FileSystem::getModTime(_file.fileName()) != _fileModtime) {
+        setErrorString(tr("Local file changed during sync."));
+        return false;
+    }
+    return true;
+}
+
 
 qint64 UploadDevice::writeData(const char* , qint64 ) {
     Q_ASSERT(!"write to read only device");
@@ -372,14 +512,14 @@ qint64 UploadDevice::writeData(const char* , qint64 ) {
 
 qint64 UploadDevice::readData(char* data, qint64 maxlen) {
     //qDebug() << Q_FUNC_INFO << maxlen << _read << _size << _bandwidthQuota;
-    if (_data.size() - _read <= 0) {
+    if (_size - _read <= 0) {
         // at end
         if (_bandwidthManager) {
             _bandwidthManager->unregisterUploadDevice(this);
         }
         return -1;
     }
-    maxlen = qMin(maxlen, _data.size() - _read);
+    maxlen = qMin(maxlen, _size - _read);
     if (maxlen == 0) {
         return 0;
     }
@@ -394,9 +534,30 @@ qint64 UploadDevice::readData(char* data, qint64 maxlen) {
         }
         _bandwidthQuota -= maxlen;
     }
-    std::memcpy(data, _data.data()+_read, maxlen);
-    _read += maxlen;
-    return maxlen;
+
+    // The data is read straight from the file into QNAM's buffer. After a
+    // seek() (e.g. a retransmit after a connection reset) the file position
+    // has to be moved first.
+    if (_file.pos() != _start + _read && !_file.seek(_start + _read)) {
+        setErrorString(_file.errorString());
+        return -1;
+    }
+    qint64 read = _file.read(data, maxlen);
+    if (read != maxlen) {
+        // The file was truncated or became unreadable while we were uploading it
+        if (verifyFileUnchanged()) {
+            setErrorString(_file.errorString());
+        }
+        return -1;
+    }
+    _read += read;
+
+    // Since the chunk is no longer read in one go, make sure the data we
+    // handed out was not modified while the chunk was being sent.
+    if (_read == _size && !verifyFileUnchanged()) {
+        return -1;
+    }
+    return read;
 }
 
 void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
@@ -409,19 +570,19 @@ void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
 }
 
 bool UploadDevice::atEnd() const {
-    return _read >= _data.size();
+    return _read >= _size;
 }
 
 qint64 UploadDevice::size() const{
 //    qDebug() << this << Q_FUNC_INFO << _size;
-    return _data.size();
+    return _size;
 }
 
 qint64 UploadDevice::bytesAvailable() const
 {
 //    qDebug() << this << Q_FUNC_INFO << _size << _read << QIODevice::bytesAvailable()
 //             <<   _size - _read + QIODevice::bytesAvailable();
-    return _data.size() - _read + QIODevice::bytesAvailable();
+    return _size - _read + QIODevice::bytesAvailable();
 }
 
 // random access, we can seek
@@ -433,7 +594,7 @@ bool UploadDevice::seek ( qint64 pos ) {
     if (! QIODevice::seek(pos)) {
         return false;
     }
-    if (pos < 0 || pos > _data.size()) {
+    if (pos < 0 || pos > _size) {
         return false;
     }
     _read = pos;
@@ -459,24 +620,12 @@ void UploadDevice::setChoked(bool b) {
     }
 }
 
-void PropagateUploadFileQNAM::startNextChunk()
+QMap<QByteArray, QByteArray> PropagateUploadFileQNAM::uploadHeaders()
 {
-    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
-        return;
-
-    if (! _jobs.isEmpty() &&  _currentChunk + _startChunk >= _chunkCount - 1) {
-        // Don't do parallel upload of chunk if this might be the last chunk because the server cannot handle that
-        // https://github.com/owncloud/core/issues/11106
-        // We return now and when the _jobs are finished we will proceed with the last chunk
-        // NOTE: Some other parts of the code such as slotUploadProgress also assume that the last chunk
-        // is sent last.
-        return;
-    }
-    quint64 fileSize = _item->_size;
     QMap<QByteArray, QByteArray> headers;
-    headers["OC-Total-Length"] = QByteArray::number(fileSize);
+    headers["OC-Total-Length"] = QByteArray::number(quint64(_item->_size));
     headers["OC-Async"] = "1";
-    headers["OC-Chunk-Size"]= QByteArray::number(quint64(chunkSize()));
+    headers["OC-Chunk-Size"]= QByteArray::number(quint64(_chunkSize));
     headers["Content-Type"] = "application/octet-stream";
     headers["X-OC-Mtime"] = QByteArray::number(qint64(_item->_modtime));
 
@@ -499,6 +648,55 @@ void PropagateUploadFileQNAM::startNextChunk()
         headers["If-Match"] = '"' + _item->_etag + '"';
     }
 
+    return headers;
+}
+
+PUTFileJob* PropagateUploadFileQNAM::startPutJob(const QString& path, QIODevice* device,
+                                                 const QMap<QByteArray, QByteArray>& headers, int chunk,
+                                                 const QByteArray& verb)
+{
+    // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
+    PUTFileJob* job = new PUTFileJob(_propagator->account(), _propagator->_remoteFolder + path, device, headers, chunk);
+    job->setVerb(verb);
+    _jobs.append(job);
+    connect(job, SIGNAL(finishedSignal()), this, SLOT(slotPutFinished()));
+    connect(job, SIGNAL(uploadProgress(qint64,qint64)), this, SLOT(slotUploadProgress(qint64,qint64)));
+    if (qobject_cast<UploadDevice*>(device)) {
+        connect(job, SIGNAL(uploadProgress(qint64,qint64)), device, SLOT(slotJobUploadProgress(qint64,qint64)));
+    }
+    connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(slotJobDestroyed(QObject*)));
+    job->start();
+    return job;
+}
+
+void PropagateUploadFileQNAM::startNextChunk()
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    if (_deltaUpload) {
+        startNextDeltaChunk();
+        return;
+    }
+
+    if (! _jobs.isEmpty() &&  _currentChunk + _startChunk >= _chunkCount - 1) {
+        // Don't do parallel upload of chunk if this might be the last chunk because the server cannot handle that
+        // https://github.com/owncloud/core/issues/11106
+        // We return now and when the _jobs are finished we will proceed with the last chunk
+        // NOTE: Some other parts of the code such as slotUploadProgress also assume that the last chunk
+        // is sent last.
+        return;
+    }
+
+    if (_transmissionChecksumPending
+            && (_chunkCount <= 1 || (_currentChunk + _startChunk) % _chunkCount == _chunkCount - 1)) {
+        // The final chunk carries the checksum header: slotTransmissionChecksumComputed()
+        // sends it once the checksum is known
+        return;
+    }
+
+    quint64 fileSize = _item->_size;
+    QMap<QByteArray, QByteArray> headers = uploadHeaders();
     QString path = _item->_file;
 
     UploadDevice *device = new UploadDevice(&_propagator->_bandwidthManager);
@@ -508,18 +706,18 @@ void PropagateUploadFileQNAM::startNextChunk()
     if (_chunkCount > 1) {
         int sendingChunk = (_currentChunk + _startChunk) % _chunkCount;
         // XOR with chunk size to make sure everything goes well if chunk size changes between runs
-        uint transid = _transferId ^ chunkSize();
+        uint transid = _transferId ^ uint(_chunkSize);
         qDebug() << "Upload chunk" << sendingChunk << "of" << _chunkCount << "transferid(remote)=" << transid;
         path +=  QString("-chunking-%1-%2-%3").arg(transid).arg(_chunkCount).arg(sendingChunk);
 
         headers["OC-Chunked"] = "1";
 
-        chunkStart = chunkSize() * quint64(sendingChunk);
-        currentChunkSize = chunkSize();
+        chunkStart = _chunkSize * quint64(sendingChunk);
+        currentChunkSize = _chunkSize;
         if (sendingChunk == _chunkCount - 1) { // last chunk
-            currentChunkSize = (fileSize % chunkSize());
+            currentChunkSize = (fileSize % _chunkSize);
             if( currentChunkSize == 0 ) { // if the last chunk pretends to be 0, its actually the full chunk size.
-                currentChunkSize = chunkSize();
+                currentChunkSize = _chunkSize;
             }
             isFinalChunk = true;
         }
@@ -541,45 +739,101 @@ void PropagateUploadFileQNAM::startNextChunk()
         return;
     }
 
-    // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
-    PUTFileJob* job = new PUTFileJob(_propagator->account(), _propagator->_remoteFolder + path, device, headers, _currentChunk);
-    _jobs.append(job);
-    connect(job, SIGNAL(finishedSignal()), this, SLOT(slotPutFinished()));
-    connect(job, SIGNAL(uploadProgress(qint64,qint64)), this, SLOT(slotUploadProgress(qint64,qint64)));
-    connect(job, SIGNAL(uploadProgress(qint64,qint64)), device, SLOT(slotJobUploadProgress(qint64,qint64)));
-    connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(slotJobDestroyed(QObject*)));
-    job->start();
-    _propagator->_activeJobs++;
+    startPutJob(path, device, headers, _currentChunk);
     _currentChunk++;
 
-    bool parallelChunkUpload = true;
+    int parallelChunks = _propagator->maximumParallelChunks();
     QByteArray env = qgetenv("OWNCLOUD_PARALLEL_CHUNK");
     if (!env.isEmpty()) {
-        parallelChunkUpload = env != "false" && env != "0";
+        if (env == "false" || env == "0") {
+            parallelChunks = 1;
+        }
     } else {
         int versionNum = _propagator->account()->serverVersionInt();
         if (versionNum < 0x080003) {
             // Disable parallel chunk upload severs older than 8.0.3 to avoid too many
             // internal sever errors (#2743, #2938)
-            parallelChunkUpload = false;
+            parallelChunks = 1;
         }
     }
 
     if (_currentChunk + _startChunk >= _chunkCount - 1) {
         // Don't do parallel upload of chunk if this might be the last chunk because the server cannot handle that
         // https://github.com/owncloud/core/issues/11106
-        parallelChunkUpload = false;
+        parallelChunks = 1;
     }
 
-    if (parallelChunkUpload && (_propagator->_activeJobs < _propagator->maximumActiveJob())
-            && _currentChunk < _chunkCount ) {
+    // Fill up this file's parallel chunk slots. slotPutFinished() refills them
+    // as chunks complete. The resume point stored in the journal is always the
+    // lowest chunk still in transit, so out of order completion is safe.
+    if (_jobs.count() < parallelChunks && _currentChunk < _chunkCount) {
         startNextChunk();
-    }
-    if (!parallelChunkUpload || _chunkCount - _currentChunk <= 0) {
+    } else {
+        // The chunks in transit only occupy one slot, other items may be started
         emit ready();
     }
 }
 
+void PropagateUploadFileQNAM::startNextDeltaChunk()
+{
+    if (_currentChunk > _deltaChunks.count()) {
+        // The manifest was sent already
+        return;
+    }
+
+    // Unlike for a regular chunked upload, the server assembles the file only
+    // once it gets the manifest. So all the changed chunks may be in transit
+    // at the same time.
+    uint transid = _transferId ^ uint(_chunkSize);
+    const QString filePath = _propagator->getFilePath(_item->_file);
+    while (_currentChunk < _deltaChunks.count() && _jobs.count() < _propagator->maximumParallelChunks()) {
+        int sendingChunk = _deltaChunks.at(_currentChunk);
+        qDebug() << "Upload delta chunk" << sendingChunk << "of" << _chunkCount << "transferid(remote)=" << transid;
+        QString path = _item->_file + QString("-chunking-%1-%2-%3").arg(transid).arg(_chunkCount).arg(sendingChunk);
+        QMap<QByteArray, QByteArray> headers = uploadHeaders();
+        headers["OC-Chunked"] = "1";
+
+        UploadDevice *device = new UploadDevice(&_propagator->_bandwidthManager);
+        if (! device->prepareAndOpen(filePath, _chunkSize * quint64(sendingChunk), _chunkSize)) {
+            qDebug() << "ERR: Could not prepare upload device: " << device->errorString();
+            abortWithError( SyncFileItem::SoftError, device->errorString() );
+            delete device;
+            return;
+        }
+        startPutJob(path, device, headers, _currentChunk);
+        _currentChunk++;
+    }
+
+    if (_currentChunk == _deltaChunks.count() && _jobs.isEmpty() && !_transmissionChecksumPending) {
+        // All changed chunks are on the server. The manifest lists them, the
+        // server takes all other chunks from the version If-Match refers to.
+        QMap<QByteArray, QByteArray> headers = uploadHeaders();
+        headers["OC-Chunked"] = "1";
+        headers["OC-Delta-Transfer-Id"] = QByteArray::number(transid);
+        headers["OC-Chunk-Count"] = QByteArray::number(_chunkCount);
+        headers["Content-Type"] = "application/x-oc-delta-manifest";
+        if (!_transmissionChecksumType.isEmpty()) {
+            headers[checkSumHeaderC] = makeChecksumHeader(
+                    _transmissionChecksumType, _transmissionChecksum);
+        }
+
+        QByteArray manifest;
+        foreach (int chunk, _deltaChunks) {
+            manifest += QByteArray::number(chunk) + '\n';
+        }
+        QBuffer *buffer = new QBuffer;
+        buffer->setData(manifest);
+        buffer->open(QIODevice::ReadOnly);
+
+        qDebug() << "Upload delta manifest" << _deltaChunks.count() << "of" << _chunkCount << "transferid(remote)=" << transid;
+        startPutJob(_item->_file, buffer, headers, -1, "PATCH");
+        _currentChunk++;
+    }
+
+    // The chunks in transit only occupy one slot, other items may be started
+    emit ready();
+}
+
 void PropagateUploadFileQNAM::slotPutFinished()
 {
     PUTFileJob *job = qobject_cast<PUTFileJob *>(sender());
@@ -592,8 +846,6 @@ void PropagateUploadFileQNAM::slotPutFinished()
              << job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute)
              << job->reply()->attribute(QNetworkRequest::HttpReasonPhraseAttribute);
 
-    _propagator->_activeJobs--;
-
     if (_finished) {
         // We have sent the finished signal already. We don't need to handle any remaining jobs
         return;
@@ -614,11 +866,37 @@ void PropagateUploadFileQNAM::slotPutFinished()
 
     if (err != QNetworkReply::NoError) {
         _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (job->timedOut()) {
+            _propagator->requestTimedOut();
+        }
+        if (_deltaUpload && job->_chunk < 0
+                && (_item->_httpErrorCode == 400 || _item->_httpErrorCode == 405
+                    || _item->_httpErrorCode == 415 || _item->_httpErrorCode == 501)) {
+            // The server does not know how to assemble the file: send all of it
+            qDebug() << "Delta upload refused, uploading" << _item->_file << "in full";
+            _item->_httpErrorCode = 0;
+            _deltaUpload = false;
+            _deltaFallback = true;
+            startFullUpload();
+            return;
+        }
         if(checkForProblemsWithShared(_item->_httpErrorCode,
             tr("The file was edited locally but is part of a read only share. "
                "It is restored and your edit is in the conflict file."))) {
             return;
         }
+        if (_item->_httpErrorCode == 0
+                && !FileSystem::verifyFileUnchanged(_propagator->getFilePath(_item->_file), _item->_size, _item->_modtime)) {
+            // The upload device fails the request if the file changes while it is being streamed
+            _propagator->_anotherSyncNeeded = true;
+            abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
+            return;
+        }
+        if (_item->_httpErrorCode == 0 && job->_chunk >= 0 && _chunkCount > 1
+                && !_propagator->_abortRequested.fetchAndAddRelaxed(0)) {
+            // The connection broke off or timed out, smaller chunks lose less
+            _propagator->chunkUploadFailed(_chunkSize);
+        }
         QByteArray replyContent = job->reply()->readAll();
         qDebug() << replyContent; // display the XML error in the debug
         QString errorString = errorMessage(job->errorString(), replyContent);
@@ -687,6 +965,17 @@ void PropagateUploadFileQNAM::slotPutFinished()
         }
     }
 
+    if (!finished && _deltaUpload) {
+        if (job->_chunk < 0) {
+            _finished = true;
+            done(SyncFileItem::NormalError, tr("The server did not acknowledge the delta upload. (No e-tag was present)"));
+            return;
+        }
+        // No upload info: a delta upload is cheap to restart from scratch
+        startNextChunk();
+        return;
+    }
+
     if (!finished) {
         // Proceed to next chunk.
         if (_currentChunk >= _chunkCount) {
@@ -699,6 +988,11 @@ void PropagateUploadFileQNAM::slotPutFinished()
             return;
         }
 
+        // Only full chunks tell something about the chunk size that suits the connection
+        if ((job->_chunk + _startChunk) % _chunkCount != _chunkCount - 1) {
+            _propagator->adaptChunkSize(_chunkSize, job->msSinceStart());
+        }
+
         // Deletes an existing blacklist entry on successful chunk upload
         if (_item->_hasBlacklistEntry) {
             _propagator->_journal->wipeErrorBlacklistEntry(_item->_file);
@@ -714,6 +1008,7 @@ void PropagateUploadFileQNAM::slotPutFinished()
         }
         pi._chunk = (currentChunk + _startChunk + 1) % _chunkCount ; // next chunk to start with
         pi._transferid = _transferId;
+        pi._chunkSize = _chunkSize;
         pi._modtime =  Utility::qDateTimeFromTime_t(_item->_modtime);
         _propagator->_journal->setUploadInfo(_item->_file, pi);
         _propagator->_journal->commit("Upload info");
@@ -766,6 +1061,16 @@ void PropagateUploadFileQNAM::finalize(const SyncFileItem &copy)
     _propagator->_journal->setFileRecord(SyncJournalFileRecord(*_item, _propagator->getFilePath(_item->_file)));
     // Remove from the progress database:
     _propagator->_journal->setUploadInfo(_item->_file, SyncJournalDb::UploadInfo());
+    if (!_blockHashes.isNull()) {
+        // Describes the version that is on the server now
+        SyncJournalDb::BlockSignature signature;
+        signature._etag = _item->_etag;
+        signature._blockSize = _blockSize;
+        signature._fileSize = _item->_size;
+        signature._hashes = _blockHashes;
+        signature._valid = true;
+        _propagator->_journal->setBlockSignature(_item->_file, signature);
+    }
     _propagator->_journal->commit("upload file start");
 
     _finished = true;
@@ -790,11 +1095,11 @@ void PropagateUploadFileQNAM::slotUploadProgress(qint64 sent, qint64 total)
     // not including this one.
     // FIXME: this assumes all chunks have the same size, which is true only if the last chunk
     // has not been finished (which should not happen because the last chunk is sent sequentially)
-    quint64 amount = progressChunk * chunkSize();
+    quint64 amount = progressChunk * _chunkSize;
 
     sender()->setProperty("byteWritten", sent);
     if (_jobs.count() > 1) {
-        amount -= (_jobs.count() -1) * chunkSize();
+        amount -= (_jobs.count() -1) * _chunkSize;
         foreach (QObject *j, _jobs) {
             amount += j->property("byteWritten").toULongLong();
         }
@@ -816,7 +1121,6 @@ void PropagateUploadFileQNAM::startPollJob(const QString& path)
     info._modtime = _item->_modtime;
     _propagator->_journal->setPollInfo(info);
     _propagator->_journal->commit("add poll info");
-    _propagator->_activeJobs++;
     job->start();
 }
 
@@ -825,8 +1129,6 @@ void PropagateUploadFileQNAM::slotPollFinished()
     PollJob *job = qobject_cast<PollJob *>(sender());
     Q_ASSERT(job);
 
-    _propagator->_activeJobs--;
-
     if (job->_item->_status != SyncFileItem::Success) {
         _finished = true;
         done(job->_item->_status, job->_item->_errorString);
@@ -34,7 +34,10 @@ public:
     UploadDevice(BandwidthManager *bwm);
     ~UploadDevice();
 
-    /** Reads the data from the file and opens the device */
+    /**
+     * Opens the file and the device. The data is not read here but streamed
+     * from the file while QNAM consumes it.
+     */
     bool prepareAndOpen(const QString& fileName, qint64 start, qint64 size);
 
     qint64 writeData(const char* , qint64 ) Q_DECL_OVERRIDE;
@@ -62,10 +65,20 @@ signals:
 
 private:
 
-    // The file data
-    QByteArray _data;
-    // Position in the data
+    /** Returns false and sets the error string if the file changed since prepareAndOpen() */
+    bool verifyFileUnchanged();
+
+    // The file the chunk is read from
+    QFile _file;
+    // Offset of the chunk in the file
+    qint64 _start;
+    // Size of the chunk
+    qint64 _size;
+    // Position in the chunk
     qint64 _read;
+    // Size and mtime of the file when it was opened, to detect changes during the upload
+    qint64 _fileSize;
+    time_t _fileModtime;
 
     // Bandwidth manager related
     QPointer<BandwidthManager> _bandwidthManager;
@@ -89,16 +102,21 @@ private:
     QScopedPointer<QIODevice> _device;
     QMap<QByteArray, QByteArray> _headers;
     QString _errorString;
+    QElapsedTimer _requestTimer;
+    QByteArray _verb;
 
 public:
     // Takes ownership of the device
     explicit PUTFileJob(AccountPtr account, const QString& path, QIODevice *device,
                         const QMap<QByteArray, QByteArray> &headers, int chunk, QObject* parent = 0)
-        : AbstractNetworkJob(account, path, parent), _device(device), _headers(headers), _chunk(chunk) {}
+        : AbstractNetworkJob(account, path, parent), _device(device), _headers(headers), _verb("PUT"), _chunk(chunk) {}
     ~PUTFileJob();
 
     int _chunk;
 
+    /** The request method, PUT by default */
+    void setVerb(const QByteArray& verb) { _verb = verb; }
+
     virtual void start() Q_DECL_OVERRIDE;
 
     virtual bool finished() Q_DECL_OVERRIDE {
@@ -112,6 +130,9 @@ public:
 
     virtual void slotTimeout() Q_DECL_OVERRIDE;
 
+    /** Milliseconds since the request was sent */
+    qint64 msSinceStart() const { return _requestTimer.elapsed(); }
+
 
 signals:
     void finishedSignal();
@@ -154,8 +175,38 @@ signals:
     void finishedSignal();
 };
 
+/**
+ * Returns the indexes of the blocks whose hash in \a hashes differs from the
+ * one in \a baseHashes, see FileSystem::calcBlockHashes().
+ */
+QVector<int> OWNCLOUDSYNC_EXPORT deltaUploadChunks(const QByteArray& baseHashes, const QByteArray& hashes);
+
+/**
+ * Size of the blocks of the signatures used for delta uploads.
+ * It is also the chunk size of a delta upload.
+ */
+qint64 deltaBlockSize();
+
+/**
+ * Smaller files are always uploaded in full, the signature would cost
+ * more than it saves.
+ */
+qint64 deltaMinFileSize();
+
 /**
  * @brief The PropagateUploadFileQNAM class
+ *
+ * Big modified files can be uploaded as a delta if the server advertises the
+ * dav.delta_upload capability and the journal has the block signature of the
+ * version on the server: only the chunks with changed blocks are sent, with the
+ * usual chunk naming. A PATCH of the file, whose body lists these chunks, then
+ * makes the server assemble the new version, taking all other chunks from the
+ * version If-Match refers to. If the server refuses the PATCH the file is sent
+ * in full.
+ *
+ * The signature is stored after every upload of a big file, new or modified,
+ * and after its download (see PropagateDownloadFileQNAM).
+ *
  * @ingroup libsync
  */
 class PropagateUploadFileQNAM : public PropagateItemJob {
@@ -175,6 +226,7 @@ private:
      */
     int _currentChunk;
     int _chunkCount; /// Total number of chunks for this file
+    quint64 _chunkSize; /// Size of all chunks but the last one
     int _transferId; /// transfer id (part of the url)
     QElapsedTimer _duration;
     QVector<PUTFileJob*> _jobs; /// network jobs that are currently in transit
@@ -185,10 +237,20 @@ private:
 
     QByteArray _transmissionChecksum;
     QByteArray _transmissionChecksumType;
+    bool _transmissionChecksumPending; // the upload started before the transmission checksum was computed
+
+    // Delta upload: only the chunks that differ from the version on the server are sent,
+    // followed by a manifest from which the server assembles the file.
+    QByteArray _blockHashes; /// signature of the uploaded file, stored in the journal once it is on the server
+    qint64 _blockSize;
+    QVector<int> _deltaChunks; /// the changed chunks
+    bool _deltaUpload;
+    bool _deltaFallback; /// the server refused the manifest, the file is sent in full
 
 public:
     PropagateUploadFileQNAM(OwncloudPropagator* propagator,const SyncFileItemPtr& item)
-        : PropagateItemJob(propagator, item), _startChunk(0), _currentChunk(0), _chunkCount(0), _transferId(0), _finished(false) {}
+        : PropagateItemJob(propagator, item), _startChunk(0), _currentChunk(0), _chunkCount(0), _chunkSize(0), _transferId(0), _finished(false), _transmissionChecksumPending(false),
+          _blockSize(0), _deltaUpload(false), _deltaFallback(false) {}
     void start() Q_DECL_OVERRIDE;
 private slots:
     void slotPutFinished();
@@ -200,8 +262,15 @@ private slots:
     void slotJobDestroyed(QObject *job);
     void slotStartUpload(const QByteArray& transmissionChecksumType, const QByteArray& transmissionChecksum);
     void slotComputeTransmissionChecksum(const QByteArray& contentChecksumType, const QByteArray& contentChecksum);
+    void slotTransmissionChecksumComputed(const QByteArray& transmissionChecksumType, const QByteArray& transmissionChecksum);
+    void slotBlockHashesComputed(const QByteArray& hashes);
 
 private:
+    void startFullUpload();
+    void startNextDeltaChunk();
+    QMap<QByteArray, QByteArray> uploadHeaders();
+    PUTFileJob* startPutJob(const QString& path, QIODevice* device, const QMap<QByteArray, QByteArray>& headers,
+                            int chunk, const QByteArray& verb = "PUT");
     void startPollJob(const QString& path);
     void abortWithError(SyncFileItem::Status status, const QString &error);
 };
@@ -21,6 +21,7 @@
 #include "discoveryphase.h"
 #include "creds/abstractcredentials.h"
 #include "syncfilestatus.h"
+#include "syncfileitemtree.h"
 #include "csync_private.h"
 #include "filesystem.h"
 
@@ -46,7 +47,9 @@
 #include <QSslCertificate>
 #include <QProcess>
 #include <QElapsedTimer>
+#include <QFuture>
 #include <qtextcodec.h>
+#include <qtconcurrentrun.h>
 
 extern "C" const char *csync_instruction_str(enum csync_instructions_e instr);
 
@@ -71,6 +74,7 @@ SyncEngine::SyncEngine(AccountPtr account, CSYNC *ctx, const QString& localPath,
   , _uploadLimit(0)
   , _downloadLimit(0)
   , _newBigFolderSizeLimit(-1)
+  , _localDiscoveryStyle(FilesystemOnly)
   , _checksum_hook(journal)
   , _anotherSyncNeeded(false)
 {
@@ -297,6 +301,69 @@ int SyncEngine::treewalkRemote( TREE_WALK_FILE* file, void *data )
     return static_cast<SyncEngine*>(data)->treewalkFile( file, true );
 }
 
+QByteArray SyncEngine::intern(const char *str)
+{
+    // Look up without copying, only values seen for the first time are copied
+    auto it = _internedByteArrays.constFind(QByteArray::fromRawData(str, qstrlen(str)));
+    if (it != _internedByteArrays.constEnd()) {
+        return *it;
+    }
+    QByteArray value(str);
+    _internedByteArrays.insert(value);
+    return value;
+}
+
+QByteArray SyncEngine::intern(const QByteArray &value)
+{
+    auto it = _internedByteArrays.constFind(value);
+    if (it != _internedByteArrays.constEnd()) {
+        return *it;
+    }
+    _internedByteArrays.insert(value);
+    return value;
+}
+
+namespace {
+struct CSyncLogSettings {
+    csync_log_callback callback;
+    int level;
+    void *userdata;
+};
+}
+
+static void runCSyncJob(void (*job)(void *, int), void *data, int index, CSyncLogSettings log)
+{
+    // csync logs through thread local settings
+    csync_set_log_callback(log.callback);
+    csync_set_log_level(log.level);
+    csync_set_log_userdata(log.userdata);
+
+    job(data, index);
+}
+
+// csync_parallel_for_hook running the jobs on the global thread pool
+static void csyncParallelFor(void (*job)(void *, int), void *data, int count, void *)
+{
+    CSyncLogSettings log = { csync_get_log_callback(), csync_get_log_level(), csync_get_log_userdata() };
+    QVector<QFuture<void> > futures;
+    futures.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        futures.append(QtConcurrent::run(runCSyncJob, job, data, i, log));
+    }
+    foreach (QFuture<void> future, futures) {
+        future.waitForFinished();
+    }
+}
+
+// Returns str as a QByteArray, sharing the data of candidate if it holds the same bytes.
+static QByteArray shareIfEqual(const QByteArray &candidate, const char *str)
+{
+    if (str && !candidate.isNull() && candidate == str) {
+        return candidate;
+    }
+    return QByteArray(str);
+}
+
 int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
 {
     if( ! file ) return -1;
@@ -345,8 +412,9 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
         }
     }
 
+    // The local and the remote walk mostly report the same ids, keep the first copy
     if (file->file_id && file->file_id[0]) {
-        item->_fileId = file->file_id;
+        item->_fileId = shareIfEqual(item->_fileId, file->file_id);
     }
     if (file->directDownloadUrl) {
         item->_directDownloadUrl = QString::fromUtf8( file->directDownloadUrl );
@@ -355,7 +423,7 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
         item->_directDownloadCookies = QString::fromUtf8( file->directDownloadCookies );
     }
     if (file->remotePerm && file->remotePerm[0]) {
-        item->_remotePerm = QByteArray(file->remotePerm);
+        item->_remotePerm = intern(file->remotePerm);
     }
 
     item->_should_update_metadata = item->_should_update_metadata || file->should_update_metadata;
@@ -378,7 +446,7 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
     // Sometimes the discovery computes checksums for local files
     if (!remote && file->checksum && file->checksumTypeId) {
         item->_contentChecksum = QByteArray(file->checksum);
-        item->_contentChecksumType = _journal->getChecksumType(file->checksumTypeId);
+        item->_contentChecksumType = intern(_journal->getChecksumType(file->checksumTypeId));
     }
 
     // record the seen files to be able to clean the journal later
@@ -389,7 +457,7 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
     }
 
     if (remote && file->remotePerm && file->remotePerm[0]) {
-        _remotePerms[item->_file] = file->remotePerm;
+        _remotePerms[item->_file] = item->_remotePerm;
     }
 
     switch(file->error_status) {
@@ -447,7 +515,7 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
     item->_isDirectory = file->type == CSYNC_FTW_TYPE_DIR;
 
     if (file->etag && file->etag[0]) {
-        item->_etag = file->etag;
+        item->_etag = shareIfEqual(item->_etag, file->etag);
     }
     item->_size = file->size;
 
@@ -566,14 +634,15 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
 
     _needsUpdate = true;
 
-    item->log._etag          = file->etag;
-    item->log._fileId        = file->file_id;
+    // The logged ids are mostly the ones of the item, share their data
+    item->log._etag          = shareIfEqual(item->_etag, file->etag);
+    item->log._fileId        = shareIfEqual(item->_fileId, file->file_id);
     item->log._instruction   = file->instruction;
     item->log._modtime       = file->modtime;
     item->log._size          = file->size;
 
-    item->log._other_etag        = file->other.etag;
-    item->log._other_fileId      = file->other.file_id;
+    item->log._other_etag        = shareIfEqual(item->log._etag, file->other.etag);
+    item->log._other_fileId      = shareIfEqual(item->log._fileId, file->other.file_id);
     item->log._other_instruction = file->other.instruction;
     item->log._other_modtime     = file->other.modtime;
     item->log._other_size        = file->other.size;
@@ -662,6 +731,9 @@ void SyncEngine::startSync()
 
     _syncedItems.clear();
     _syncItemMap.clear();
+    _internedByteArrays.clear();
+    _unfinishedPaths.clear();
+    _unfinishedItems.clear();
     _needsUpdate = false;
 
     csync_resume(_csync_ctx);
@@ -695,21 +767,54 @@ void SyncEngine::startSync()
     // thereby speeding up the initial discovery significantly.
     _csync_ctx->db_is_empty = (fileRecordCount == 0);
 
-    auto selectiveSyncBlackList = _journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList);
-    bool usingSelectiveSync = (!selectiveSyncBlackList.isEmpty());
-    qDebug() << (usingSelectiveSync ? "====Using Selective Sync" : "====NOT Using Selective Sync");
-
     csync_set_userdata(_csync_ctx, this);
 
     // Set up checksumming hook
     _csync_ctx->callbacks.checksum_hook = &CSyncChecksumHook::hook;
     _csync_ctx->callbacks.checksum_userdata = &_checksum_hook;
 
+    // Reconcile independent subtrees on several threads
+    if (QThread::idealThreadCount() > 1) {
+        _csync_ctx->callbacks.parallel_for_hook = &csyncParallelFor;
+    }
+
     _stopWatch.start();
 
+    // Ask the server which files changed since the last sync, if it can tell
+    static int useSyncCollection = qgetenv("OWNCLOUD_SYNC_COLLECTION").toInt();
+    _newSyncToken.clear();
+    if (useSyncCollection && account()->rootEtagChangesNotOnlySubFolderEtags()) {
+        QByteArray oldToken = fileRecordCount > 0 ? _journal->syncToken() : QByteArray();
+        qDebug() << "====Asking for the remote changes since" << oldToken;
+        _remoteChangesJob = new DiscoveryRemoteChangesJob(account(), _remotePath, _csync_ctx, oldToken, this);
+        connect(_remoteChangesJob, SIGNAL(rootEtag(QString)), this, SLOT(slotRootEtagReceived(QString)));
+        connect(_remoteChangesJob, SIGNAL(finished(QByteArray)), this, SLOT(slotRemoteChangesFinished(QByteArray)));
+        _remoteChangesJob->start();
+        return;
+    }
+
+    startDiscovery();
+}
+
+void SyncEngine::slotRemoteChangesFinished(const QByteArray &newToken)
+{
+    _newSyncToken = newToken;
+    if (csync_abort_requested(_csync_ctx)) {
+        finalize(false);
+        return;
+    }
+    startDiscovery();
+}
+
+void SyncEngine::startDiscovery()
+{
+    auto selectiveSyncBlackList = _journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList);
+    bool usingSelectiveSync = (!selectiveSyncBlackList.isEmpty());
+    qDebug() << (usingSelectiveSync ? "====Using Selective Sync" : "====NOT Using Selective Sync");
+
     qDebug() << "#### Discovery start #################################################### >>";
 
-    _discoveryMainThread = new DiscoveryMainThread(account());
+    _discoveryMainThread = new DiscoveryMainThread(account(), _journal);
     _discoveryMainThread->setParent(this);
     connect(this, SIGNAL(finished(bool)), _discoveryMainThread, SLOT(deleteLater()));
     qDebug() << "=====Server" << account()->serverVersion()
@@ -725,6 +830,11 @@ void SyncEngine::startSync()
     discoveryJob->_selectiveSyncWhiteList =
         _journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncWhiteList);
     discoveryJob->_newBigFolderSizeLimit = _newBigFolderSizeLimit;
+    if (_localDiscoveryStyle == DatabaseAndFilesystem) {
+        qDebug() << "====Partial local discovery of" << _localDiscoveryPaths.size() << "paths";
+        discoveryJob->_partialLocalDiscovery = true;
+        discoveryJob->_localDiscoveryPaths = _localDiscoveryPaths;
+    }
     discoveryJob->moveToThread(&_thread);
     connect(discoveryJob, SIGNAL(finished(int)), this, SLOT(slotDiscoveryJobFinished(int)));
     connect(discoveryJob, SIGNAL(folderDiscovered(bool,QString)),
@@ -802,22 +912,41 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // Re-init the csync context to free memory
     csync_commit(_csync_ctx);
 
-    // The map was used for merging trees, convert it to a list:
-    _syncedItems = _syncItemMap.values().toVector();
-    _syncItemMap.clear(); // free memory
+    // The map was used for merging trees, convert it to a list sorted per
+    // destination. The sort keys are computed once per item, comparing the
+    // items directly would build them on every comparison.
+    {
+        typedef QPair<QString, SyncFileItemPtr> KeyedItem;
+        QVector<KeyedItem> keyedItems;
+        keyedItems.reserve(_syncItemMap.size());
+        for (auto it = _syncItemMap.constBegin(); it != _syncItemMap.constEnd(); ++it) {
+            const SyncFileItemPtr &item = it.value();
+            // Adjust the paths for the renames.
+            item->_file = adjustRenamedPath(item->_file);
+            keyedItems.append(KeyedItem(item->sortKey(), item));
+        }
+        _syncItemMap.clear(); // free memory
+        _internedByteArrays.clear(); // the items keep sharing the values
 
-    // Adjust the paths for the renames.
-    for (SyncFileItemVector::iterator it = _syncedItems.begin();
-            it != _syncedItems.end(); ++it) {
-        (*it)->_file = adjustRenamedPath((*it)->_file);
-    }
+        std::sort(keyedItems.begin(), keyedItems.end(),
+                  [](const KeyedItem &a, const KeyedItem &b) { return a.first < b.first; });
 
-    // Sort items per destination
-    std::sort(_syncedItems.begin(), _syncedItems.end());
+        _syncedItems.reserve(keyedItems.size());
+        foreach (const KeyedItem &keyedItem, keyedItems) {
+            _syncedItems.append(keyedItem.second);
+        }
+    }
 
     // make sure everything is allowed
     checkForPermission();
 
+    // Index the paths for estimateState
+    _unfinishedItems.reserve(_syncedItems.size());
+    foreach (const SyncFileItemPtr &item, _syncedItems) {
+        _unfinishedPaths[item->_file]++;
+        _unfinishedItems.insert(item.data(), item->_file);
+    }
+
     // To announce the beginning of the sync
     emit aboutToPropagate(_syncedItems);
     // it's important to do this before ProgressInfo::start(), to announce start of new sync
@@ -881,6 +1010,12 @@ void SyncEngine::slotCleanPollsJobAborted(const QString &error)
     finalize(false);
 }
 
+void SyncEngine::setLocalDiscoveryOptions(LocalDiscoveryStyle style, const QStringList &paths)
+{
+    _localDiscoveryStyle = style;
+    _localDiscoveryPaths = paths;
+}
+
 void SyncEngine::setNetworkLimits(int upload, int download)
 {
     _uploadLimit = upload;
@@ -913,6 +1048,7 @@ void SyncEngine::slotItemCompleted(const SyncFileItem &item, const PropagatorJob
     qDebug() << Q_FUNC_INFO << item._file << instruction_str << item._status << item._errorString;
 
     _progressInfo->setProgressComplete(item);
+    markItemFinished(item);
 
     if (item._status == SyncFileItem::FatalError) {
         emit csyncError(item._errorString);
@@ -931,6 +1067,20 @@ void SyncEngine::slotFinished()
         qDebug() << "Cleaning of synced ";
     }
 
+    // Only what went through is known to be in sync, the next sync must see the rest again.
+    // Without a new token, the old one is dropped as it does not cover this sync.
+    bool clean = !_anotherSyncNeeded && !csync_abort_requested(_csync_ctx);
+    foreach (const SyncFileItemPtr &item, _syncedItems) {
+        if (item->_instruction == CSYNC_INSTRUCTION_ERROR
+                || item->_status == SyncFileItem::FatalError
+                || item->_status == SyncFileItem::NormalError
+                || item->_status == SyncFileItem::SoftError) {
+            clean = false;
+            break;
+        }
+    }
+    _journal->setSyncToken(clean ? _newSyncToken : QByteArray());
+
     _journal->commit("All Finished.", false);
     emit treeWalkResult(_syncedItems);
     finalize(true); // FIXME: should it be true if there was errors?
@@ -983,7 +1133,12 @@ void SyncEngine::checkForPermission()
     auto selectiveSyncBlackList = _journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList);
     std::sort(selectiveSyncBlackList.begin(), selectiveSyncBlackList.end());
 
+    // The items below a directory are the range up to subtreeEnd() after it
+    const SyncFileItemTree tree(_syncedItems);
+
     for (SyncFileItemVector::iterator it = _syncedItems.begin(); it != _syncedItems.end(); ++it) {
+        const SyncFileItemVector::iterator subtreeEnd = _syncedItems.begin() + tree.subtreeEnd(it - _syncedItems.begin());
+
         if ((*it)->_direction != SyncFileItem::Up) {
             // Currently we only check server-side permissions
             continue;
@@ -998,7 +1153,7 @@ void SyncEngine::checkForPermission()
             (*it)->_errorString = tr("Ignored because of the \"choose what to sync\" blacklist");
 
             if ((*it)->_isDirectory) {
-                for (SyncFileItemVector::iterator it_next = it + 1; it_next != _syncedItems.end() && (*it_next)->_file.startsWith(path); ++it_next) {
+                for (SyncFileItemVector::iterator it_next = it + 1; it_next != subtreeEnd; ++it_next) {
                     it = it_next;
                     (*it)->_instruction = CSYNC_INSTRUCTION_IGNORE;
                     (*it)->_status = SyncFileItem::FileIgnored;
@@ -1022,7 +1177,7 @@ void SyncEngine::checkForPermission()
                     (*it)->_status = SyncFileItem::NormalError;
                     (*it)->_errorString = tr("Not allowed because you don't have permission to add subfolders to that folder");
 
-                    for (SyncFileItemVector::iterator it_next = it + 1; it_next != _syncedItems.end() && (*it_next)->_file.startsWith(path); ++it_next) {
+                    for (SyncFileItemVector::iterator it_next = it + 1; it_next != subtreeEnd; ++it_next) {
                         it = it_next;
                         (*it)->_instruction = CSYNC_INSTRUCTION_ERROR;
                         (*it)->_status = SyncFileItem::NormalError;
@@ -1074,8 +1229,7 @@ void SyncEngine::checkForPermission()
 
                     if ((*it)->_isDirectory) {
                         // restore all sub items
-                        for (SyncFileItemVector::iterator it_next = it + 1;
-                             it_next != _syncedItems.end() && (*it_next)->_file.startsWith(path); ++it_next) {
+                        for (SyncFileItemVector::iterator it_next = it + 1; it_next != subtreeEnd; ++it_next) {
                             it = it_next;
 
                             if ((*it)->_instruction != CSYNC_INSTRUCTION_REMOVE) {
@@ -1102,14 +1256,11 @@ void SyncEngine::checkForPermission()
                     // underneath, propagator sees that.
                     if( (*it)->_isDirectory ) {
                         // put a more descriptive message if a top level share dir really is removed.
-                        if( it == _syncedItems.begin() || !(path.startsWith((*(it-1))->_file)) ) {
+                        if( tree.parent(it - _syncedItems.begin()) < 0 ) {
                             (*it)->_errorString = tr("Local files and share folder removed.");
                         }
 
-                        for (SyncFileItemVector::iterator it_next = it + 1;
-                             it_next != _syncedItems.end() && (*it_next)->_file.startsWith(path); ++it_next) {
-                            it = it_next;
-                        }
+                        it = subtreeEnd - 1;
                     }
                 }
                 break;
@@ -1182,8 +1333,7 @@ void SyncEngine::checkForPermission()
 
 
                     if ((*it)->_isDirectory) {
-                        for (SyncFileItemVector::iterator it_next = it + 1;
-                             it_next != _syncedItems.end() && (*it_next)->destination().startsWith(path); ++it_next) {
+                        for (SyncFileItemVector::iterator it_next = it + 1; it_next != subtreeEnd; ++it_next) {
                             it = it_next;
                             (*it)->_instruction = CSYNC_INSTRUCTION_ERROR;
                             (*it)->_status = SyncFileItem::NormalError;
@@ -1212,23 +1362,33 @@ QByteArray SyncEngine::getPermissions(const QString& file) const
     return _remotePerms.value(file);
 }
 
+void SyncEngine::markItemFinished(const SyncFileItem &item)
+{
+    auto it = _unfinishedItems.find(&item);
+    if (it == _unfinishedItems.end()) {
+        return;
+    }
+    auto pathIt = _unfinishedPaths.find(it.value());
+    if (pathIt != _unfinishedPaths.end() && --pathIt.value() <= 0) {
+        _unfinishedPaths.erase(pathIt);
+    }
+    _unfinishedItems.erase(it);
+}
+
 bool SyncEngine::estimateState(QString fn, csync_ftw_type_e t, SyncFileStatus* s)
 {
-    Q_UNUSED(t);
     QString pat(fn);
     if( t == CSYNC_FTW_TYPE_DIR && ! fn.endsWith(QLatin1Char('/'))) {
         pat.append(QLatin1Char('/'));
     }
 
-    Q_FOREACH(const SyncFileItemPtr &item, _syncedItems) {
-        //qDebug() << Q_FUNC_INFO << fn << item._file << fn.startsWith(item._file) << item._file.startsWith(fn);
-
-        if (item->_file.startsWith(pat) ||
-                item->_file == fn /* the same directory or file */) {
-            qDebug() << Q_FUNC_INFO << "Setting" << fn << " to STATUS_EVAL";
-            s->set(SyncFileStatus::STATUS_EVAL);
-            return true;
-        }
+    // All the paths starting with pat directly follow it in the sorted map
+    auto it = _unfinishedPaths.lowerBound(pat);
+    if ((it != _unfinishedPaths.end() && it.key().startsWith(pat))
+            || _unfinishedPaths.contains(fn) /* the same directory or file */) {
+        qDebug() << Q_FUNC_INFO << "Setting" << fn << " to STATUS_EVAL";
+        s->set(SyncFileStatus::STATUS_EVAL);
+        return true;
     }
     return false;
 }
@@ -1255,8 +1415,13 @@ void SyncEngine::abort()
     if (_discoveryMainThread) {
         _discoveryMainThread->abort();
     }
-    // Sets a flag for the update phase
+    // Sets a flag for the update phase. Before aborting the remote changes job:
+    // aborting its reply finishes it right away, and slotRemoteChangesFinished()
+    // must not start the discovery then.
     csync_request_abort(_csync_ctx);
+    if (_remoteChangesJob) {
+        _remoteChangesJob->abort();
+    }
     // For the propagator
     if(_propagator) {
         _propagator->abort();
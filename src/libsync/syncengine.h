@@ -23,6 +23,7 @@
 #include <QString>
 #include <QSet>
 #include <QMap>
+#include <QHash>
 #include <QStringList>
 #include <QSharedPointer>
 
@@ -73,6 +74,21 @@ public:
      */
     void setNewBigFolderSizeLimit(qint64 limit) { _newBigFolderSizeLimit = limit; }
 
+    enum LocalDiscoveryStyle {
+        FilesystemOnly, //< read all local data from the filesystem
+        DatabaseAndFilesystem, //< read from the db, except for listed paths
+    };
+
+    /**
+     * Control how the local discovery of the next sync is done.
+     *
+     * With DatabaseAndFilesystem only the given directories (relative paths,
+     * without trailing slash) and their parents are read from the file system.
+     * The contents of every other directory are taken from the journal, so the
+     * caller must make sure the list covers all changes since the last sync.
+     */
+    void setLocalDiscoveryOptions(LocalDiscoveryStyle style, const QStringList &paths = QStringList());
+
     Utility::StopWatch &stopWatch() { return _stopWatch; }
 
     /* Return true if we detected that another sync is needed to complete the sync */
@@ -130,6 +146,7 @@ private slots:
     void slotItemCompleted(const SyncFileItem& item, const PropagatorJob & job);
     void slotFinished();
     void slotProgress(const SyncFileItem& item, quint64 curent);
+    void slotRemoteChangesFinished(const QByteArray &newToken);
     void slotDiscoveryJobFinished(int updateResult);
     void slotCleanPollsJobAborted(const QString &error);
 
@@ -154,6 +171,9 @@ private:
     // cleanup and emit the finished signal
     void finalize(bool success);
 
+    // The part of startSync() after the remote changes are known
+    void startDiscovery();
+
     static bool _syncRunning; //true when one sync is running somewhere (for debugging)
 
     // Must only be acessed during update and reconcile
@@ -163,6 +183,15 @@ private:
     // sorted and re-adjusted based on permissions.
     SyncFileItemVector _syncedItems;
 
+    // The paths of the items from _syncedItems that are not propagated yet, with the
+    // number of such items for each path. Sorted, so that estimateState finds all the
+    // items below a directory with a binary search.
+    QMap<QString, int> _unfinishedPaths;
+    // The path each unfinished item was entered with in _unfinishedPaths, since
+    // renames change the item's _file during propagation.
+    QHash<const SyncFileItem *, QString> _unfinishedItems;
+    void markItemFinished(const SyncFileItem &item);
+
     AccountPtr _account;
     CSYNC *_csync_ctx;
     bool _needsUpdate;
@@ -172,6 +201,8 @@ private:
     QString _remoteRootEtag;
     SyncJournalDb *_journal;
     QPointer<DiscoveryMainThread> _discoveryMainThread;
+    QPointer<DiscoveryRemoteChangesJob> _remoteChangesJob;
+    QByteArray _newSyncToken; // to store once the sync went through, see DiscoveryRemoteChangesJob
     QSharedPointer <OwncloudPropagator> _propagator;
     QString _lastDeleted; // if the last item was a path and it has been deleted
 
@@ -214,9 +245,18 @@ private:
     /* maximum size a folder can have without asking for confirmation: -1 means infinite */
     qint64 _newBigFolderSizeLimit;
 
+    LocalDiscoveryStyle _localDiscoveryStyle;
+    QStringList _localDiscoveryPaths;
+
     // hash containing the permissions on the remote directory
     QHash<QString, QByteArray> _remotePerms;
 
+    // Values that repeat across the items of the plan (permissions, checksum
+    // types), so that equal ones share their data. Only used during discovery.
+    QSet<QByteArray> _internedByteArrays;
+    QByteArray intern(const char *str);
+    QByteArray intern(const QByteArray &value);
+
     /// Hook for computing checksums from csync_update
     CSyncChecksumHook _checksum_hook;
 
@@ -34,6 +34,13 @@ namespace OCC {
 
 /**
  * @brief The SyncFileItem class
+ *
+ * The paths and ids are the implicitly shared Qt types that the GUI and the
+ * propagator use directly. Discovery makes equal values share their data,
+ * see SyncEngine::treewalkFile(). Paths are not split into shared parent
+ * prefixes and ids are not kept in fixed-size fields: that would change the
+ * type of these members for all of their users.
+ *
  * @ingroup libsync
  */
 class SyncFileItem {
@@ -107,6 +114,20 @@ public:
         return data1[prefixL] < data2[prefixL];
     }
 
+    /**
+     * A key that sorts like operator<: comparing the keys of two items with
+     * QString's operator< gives the same result as comparing the items.
+     * Sorting many items by precomputed keys avoids building the destination
+     * on every comparison.
+     */
+    QString sortKey() const {
+        // operator< puts the slash before any other character, so does the
+        // null character, which can not be part of a file name.
+        QString key = destination();
+        key.replace(QLatin1Char('/'), QChar(0));
+        return key;
+    }
+
     QString destination() const {
         if (!_renameTarget.isEmpty()) {
             return _renameTarget;
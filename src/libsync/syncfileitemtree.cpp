@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncfileitemtree.h"
+
+#include <QPair>
+
+#include <algorithm>
+
+namespace OCC {
+
+SyncFileItemTree::SyncFileItemTree(const SyncFileItemVector &items)
+    : _subtreeEnd(items.size())
+    , _parent(items.size())
+{
+    Q_ASSERT(std::is_sorted(items.begin(), items.end()));
+
+    // The directories containing the current item, innermost last
+    QVector<QPair<QString /* destination + '/' */, int /* index */> > directories;
+
+    for (int i = 0; i < items.size(); ++i) {
+        const SyncFileItem &item = *items.at(i);
+        const QString destination = item.destination();
+
+        while (!directories.isEmpty() && !destination.startsWith(directories.last().first)) {
+            _subtreeEnd[directories.last().second] = i;
+            directories.removeLast();
+        }
+
+        _parent[i] = directories.isEmpty() ? -1 : directories.last().second;
+        _subtreeEnd[i] = i + 1;
+        if (item._isDirectory) {
+            directories.append(qMakePair(destination + QLatin1Char('/'), i));
+        }
+    }
+
+    while (!directories.isEmpty()) {
+        _subtreeEnd[directories.last().second] = items.size();
+        directories.removeLast();
+    }
+}
+
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef SYNCFILEITEMTREE_H
+#define SYNCFILEITEMTREE_H
+
+#include <QVector>
+
+#include "owncloudlib.h"
+#include "syncfileitem.h"
+
+namespace OCC {
+
+/**
+ * @brief The directory hierarchy of a sorted SyncFileItemVector
+ * @ingroup libsync
+ *
+ * The items below a directory directly follow it in the sorted vector, so
+ * every subtree is a range of indexes. The tree stores the end of that range
+ * and the enclosing directory item for every item, which turns "everything
+ * below this directory" into a jump instead of a startsWith() scan.
+ *
+ * The hierarchy is computed from the destinations of the items. It stays
+ * valid as long as the vector and the destinations do not change.
+ */
+class OWNCLOUDSYNC_EXPORT SyncFileItemTree
+{
+public:
+    explicit SyncFileItemTree(const SyncFileItemVector &items);
+
+    /**
+     * One past the index of the last item below the item at index i.
+     * Equals i + 1 for files and empty directories.
+     */
+    int subtreeEnd(int i) const { return _subtreeEnd.at(i); }
+
+    /**
+     * The index of the closest directory item the item at index i is in,
+     * or -1 if none of its parent directories is part of the vector.
+     */
+    int parent(int i) const { return _parent.at(i); }
+
+private:
+    QVector<int> _subtreeEnd;
+    QVector<int> _parent;
+};
+
+}
+
+#endif // SYNCFILEITEMTREE_H
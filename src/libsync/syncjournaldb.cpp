@@ -223,6 +223,7 @@ bool SyncJournalDb::checkConnect()
                          "tmpfile VARCHAR(4096),"
                          "etag VARCHAR(32),"
                          "errorcount INTEGER,"
+                         "segments TEXT,"
                          "PRIMARY KEY(path)"
                          ");");
 
@@ -244,6 +245,20 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Create table uploadinfo", createQuery);
     }
 
+    // The block signatures of the remote versions of big files, for delta uploads
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS blocksignatures("
+                           "path VARCHAR(4096),"
+                           "etag VARCHAR(32),"
+                           "blocksize INTEGER(8),"
+                           "filesize INTEGER(8),"
+                           "hashes BLOB,"
+                           "PRIMARY KEY(path)"
+                           ");");
+
+    if (!createQuery.exec()) {
+        return sqlFail("Create table blocksignatures", createQuery);
+    }
+
     // create the blacklist table.
     createQuery.prepare("CREATE TABLE IF NOT EXISTS blacklist ("
                         "path VARCHAR(4096),"
@@ -276,6 +291,14 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Create table selectivesync", createQuery);
     }
 
+    // create the synctoken table.
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS synctoken("
+                        "token TEXT"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table synctoken", createQuery);
+    }
+
     // create the checksumtype table.
     createQuery.prepare("CREATE TABLE IF NOT EXISTS checksumtype("
                                "id INTEGER PRIMARY KEY,"
@@ -378,13 +401,13 @@ bool SyncJournalDb::checkConnect()
             " WHERE phash == ?1;");
 
     _getDownloadInfoQuery.reset(new SqlQuery(_db) );
-    _getDownloadInfoQuery->prepare( "SELECT tmpfile, etag, errorcount FROM "
+    _getDownloadInfoQuery->prepare( "SELECT tmpfile, etag, errorcount, segments FROM "
                                     "downloadinfo WHERE path=?1" );
 
     _setDownloadInfoQuery.reset(new SqlQuery(_db) );
     _setDownloadInfoQuery->prepare( "INSERT OR REPLACE INTO downloadinfo "
-                                    "(path, tmpfile, etag, errorcount) "
-                                    "VALUES ( ?1 , ?2, ?3, ?4 )" );
+                                    "(path, tmpfile, etag, errorcount, segments) "
+                                    "VALUES ( ?1 , ?2, ?3, ?4, ?5 )" );
 
     _deleteDownloadInfoQuery.reset(new SqlQuery(_db) );
     _deleteDownloadInfoQuery->prepare( "DELETE FROM downloadinfo WHERE path=?1" );
@@ -401,6 +424,18 @@ bool SyncJournalDb::checkConnect()
     _deleteUploadInfoQuery.reset(new SqlQuery(_db));
     _deleteUploadInfoQuery->prepare("DELETE FROM uploadinfo WHERE path=?1" );
 
+    _getBlockSignatureQuery.reset(new SqlQuery(_db));
+    _getBlockSignatureQuery->prepare( "SELECT etag, blocksize, filesize, hashes FROM "
+                                      "blocksignatures WHERE path=?1" );
+
+    _setBlockSignatureQuery.reset(new SqlQuery(_db));
+    _setBlockSignatureQuery->prepare( "INSERT OR REPLACE INTO blocksignatures "
+                                      "(path, etag, blocksize, filesize, hashes) "
+                                      "VALUES ( ?1 , ?2, ?3 , ?4 , ?5 )");
+
+    _deleteBlockSignatureQuery.reset(new SqlQuery(_db));
+    _deleteBlockSignatureQuery->prepare("DELETE FROM blocksignatures WHERE path=?1" );
+
 
     _deleteFileRecordPhash.reset(new SqlQuery(_db));
     _deleteFileRecordPhash->prepare("DELETE FROM metadata WHERE phash=?1");
@@ -463,6 +498,9 @@ void SyncJournalDb::close()
     _getUploadInfoQuery.reset(0);
     _setUploadInfoQuery.reset(0);
     _deleteUploadInfoQuery.reset(0);
+    _getBlockSignatureQuery.reset(0);
+    _setBlockSignatureQuery.reset(0);
+    _deleteBlockSignatureQuery.reset(0);
     _deleteFileRecordPhash.reset(0);
     _deleteFileRecordRecursively.reset(0);
     _getErrorBlacklistQuery.reset(0);
@@ -483,6 +521,8 @@ bool SyncJournalDb::updateDatabaseStructure()
         return false;
     if (!updateErrorBlacklistTableStructure())
         return false;
+    if (!updateDownloadInfoTableStructure())
+        return false;
     return true;
 }
 
@@ -615,6 +655,28 @@ bool SyncJournalDb::updateErrorBlacklistTableStructure()
     return re;
 }
 
+bool SyncJournalDb::updateDownloadInfoTableStructure()
+{
+    QStringList columns = tableColumns("downloadinfo");
+    bool re = true;
+
+    if( !checkConnect() ) {
+        return false;
+    }
+
+    if( columns.indexOf(QLatin1String("segments")) == -1 ) {
+        SqlQuery query(_db);
+        query.prepare("ALTER TABLE downloadinfo ADD COLUMN segments TEXT;");
+        if( !query.exec() ) {
+            sqlFail("updateDownloadInfoTableStructure: add segments column", query);
+            re = false;
+        }
+        commitInternal("update database structure: add segments col");
+    }
+
+    return re;
+}
+
 QStringList SyncJournalDb::tableColumns( const QString& table )
 {
     QStringList columns;
@@ -853,6 +915,13 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString>& filepathsToKeep,
         }
     }
 
+    // Block signatures are only useful as long as the file is in the journal
+    SqlQuery delSignaturesQuery(_db);
+    delSignaturesQuery.prepare("DELETE FROM blocksignatures WHERE path NOT IN (SELECT path FROM metadata)");
+    if( !delSignaturesQuery.exec() ) {
+        qDebug() << "Error removing superfluous block signatures: " << delSignaturesQuery.lastQuery() << ", Error:" << delSignaturesQuery.error();
+    }
+
     // Incorporate results back into main DB
     walCheckpoint();
 
@@ -939,12 +1008,41 @@ bool SyncJournalDb::setFileRecordMetadata(const SyncJournalFileRecord& record)
     return setFileRecord(existing);
 }
 
+// Segments are stored as "start-end-done" triples separated by commas
+static QString segmentsToString(const QVector<SyncJournalDb::DownloadSegment> &segments)
+{
+    QStringList list;
+    foreach (const auto &segment, segments) {
+        list.append(QString("%1-%2-%3").arg(segment._start).arg(segment._end).arg(segment._done));
+    }
+    return list.join(QLatin1Char(','));
+}
+
+static QVector<SyncJournalDb::DownloadSegment> segmentsFromString(const QString &str)
+{
+    QVector<SyncJournalDb::DownloadSegment> segments;
+    foreach (const QString &entry, str.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        const QStringList values = entry.split(QLatin1Char('-'));
+        if (values.count() != 3) {
+            qDebug() << "Invalid download segment" << entry;
+            return QVector<SyncJournalDb::DownloadSegment>();
+        }
+        SyncJournalDb::DownloadSegment segment;
+        segment._start = values.at(0).toULongLong();
+        segment._end = values.at(1).toULongLong();
+        segment._done = values.at(2).toULongLong();
+        segments.append(segment);
+    }
+    return segments;
+}
+
 static void toDownloadInfo(SqlQuery &query, SyncJournalDb::DownloadInfo * res)
 {
     bool ok = true;
     res->_tmpfile    = query.stringValue(0);
     res->_etag       = query.baValue(1);
     res->_errorCount = query.intValue(2);
+    res->_segments   = segmentsFromString(query.stringValue(3));
     res->_valid      = ok;
 }
 
@@ -1010,6 +1108,7 @@ void SyncJournalDb::setDownloadInfo(const QString& file, const SyncJournalDb::Do
         _setDownloadInfoQuery->bindValue(2, i._tmpfile);
         _setDownloadInfoQuery->bindValue(3, i._etag );
         _setDownloadInfoQuery->bindValue(4, i._errorCount );
+        _setDownloadInfoQuery->bindValue(5, segmentsToString(i._segments) );
 
         if( !_setDownloadInfoQuery->exec() ) {
             qWarning() << "Exec error of SQL statement: " << _setDownloadInfoQuery->lastQuery() <<  " :"   << _setDownloadInfoQuery->error();
@@ -1043,7 +1142,7 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
 
     SqlQuery query(_db);
     // The selected values *must* match the ones expected by toDownloadInfo().
-    query.prepare("SELECT tmpfile, etag, errorcount, path FROM downloadinfo");
+    query.prepare("SELECT tmpfile, etag, errorcount, segments, path FROM downloadinfo");
 
     if (!query.exec()) {
         QString err = query.error();
@@ -1055,7 +1154,7 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
     QVector<SyncJournalDb::DownloadInfo> deleted_entries;
 
     while (query.next()) {
-        const QString file = query.stringValue(3); // path
+        const QString file = query.stringValue(4); // path
         if (!keep.contains(file)) {
             superfluousPaths.append(file);
             DownloadInfo info;
@@ -1110,7 +1209,7 @@ SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString& file)
             res._chunk      = _getUploadInfoQuery->intValue(0);
             res._transferid = _getUploadInfoQuery->intValue(1);
             res._errorCount = _getUploadInfoQuery->intValue(2);
-            res._size       = _getUploadInfoQuery->int64Value(3);
+            res._chunkSize  = _getUploadInfoQuery->int64Value(3);
             res._modtime    = Utility::qDateTimeFromTime_t(_getUploadInfoQuery->int64Value(4));
             res._valid      = ok;
         }
@@ -1133,7 +1232,7 @@ void SyncJournalDb::setUploadInfo(const QString& file, const SyncJournalDb::Uplo
         _setUploadInfoQuery->bindValue(2, i._chunk);
         _setUploadInfoQuery->bindValue(3, i._transferid );
         _setUploadInfoQuery->bindValue(4, i._errorCount );
-        _setUploadInfoQuery->bindValue(5, i._size );
+        _setUploadInfoQuery->bindValue(5, i._chunkSize );
         _setUploadInfoQuery->bindValue(6, Utility::qDateTimeToTime_t(i._modtime) );
 
         if( !_setUploadInfoQuery->exec() ) {
@@ -1185,6 +1284,72 @@ bool SyncJournalDb::deleteStaleUploadInfos(const QSet<QString> &keep)
     return deleteBatch(*_deleteUploadInfoQuery, superfluousPaths, "uploadinfo");
 }
 
+SyncJournalDb::BlockSignature SyncJournalDb::getBlockSignature(const QString& file)
+{
+    QMutexLocker locker(&_mutex);
+
+    BlockSignature res;
+
+    if( checkConnect() ) {
+
+        _getBlockSignatureQuery->reset();
+        _getBlockSignatureQuery->bindValue(1, file);
+
+        if (!_getBlockSignatureQuery->exec()) {
+            QString err = _getBlockSignatureQuery->error();
+            qDebug() << "Database error for file " << file << " : " << _getBlockSignatureQuery->lastQuery() << ", Error:" << err;
+            return res;
+        }
+
+        if( _getBlockSignatureQuery->next() ) {
+            res._etag      = _getBlockSignatureQuery->baValue(0);
+            res._blockSize = _getBlockSignatureQuery->int64Value(1);
+            res._fileSize  = _getBlockSignatureQuery->int64Value(2);
+            res._hashes    = QByteArray::fromBase64(_getBlockSignatureQuery->baValue(3));
+            res._valid     = res._blockSize > 0;
+        }
+        _getBlockSignatureQuery->reset();
+    }
+    return res;
+}
+
+void SyncJournalDb::setBlockSignature(const QString& file, const SyncJournalDb::BlockSignature& i)
+{
+    QMutexLocker locker(&_mutex);
+
+    if( !checkConnect() ) {
+        return;
+    }
+
+    if (i._valid) {
+        _setBlockSignatureQuery->reset();
+        _setBlockSignatureQuery->bindValue(1, file);
+        _setBlockSignatureQuery->bindValue(2, i._etag);
+        _setBlockSignatureQuery->bindValue(3, i._blockSize);
+        _setBlockSignatureQuery->bindValue(4, i._fileSize);
+        // Stored as text: SqlQuery binds byte arrays as strings
+        _setBlockSignatureQuery->bindValue(5, QString::fromLatin1(i._hashes.toBase64()));
+
+        if( !_setBlockSignatureQuery->exec() ) {
+            qWarning() << "Exec error of SQL statement: " << _setBlockSignatureQuery->lastQuery() <<  " :"   << _setBlockSignatureQuery->error();
+            return;
+        }
+
+        qDebug() <<  _setBlockSignatureQuery->lastQuery() << file << i._etag << i._blockSize << i._fileSize;
+        _setBlockSignatureQuery->reset();
+    } else {
+        _deleteBlockSignatureQuery->reset();
+        _deleteBlockSignatureQuery->bindValue(1, file);
+
+        if( !_deleteBlockSignatureQuery->exec() ) {
+            qWarning() << "Exec error of SQL statement: " << _deleteBlockSignatureQuery->lastQuery() <<  " : " << _deleteBlockSignatureQuery->error();
+            return;
+        }
+        qDebug() <<  _deleteBlockSignatureQuery->lastQuery() << file;
+        _deleteBlockSignatureQuery->reset();
+    }
+}
+
 SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry( const QString& file )
 {
     QMutexLocker locker(&_mutex);
@@ -1435,6 +1600,54 @@ void SyncJournalDb::setSelectiveSyncList(SyncJournalDb::SelectiveSyncListType ty
     }
 }
 
+QByteArray SyncJournalDb::syncToken()
+{
+    QMutexLocker locker(&_mutex);
+    if( !checkConnect() ) {
+        return QByteArray();
+    }
+
+    if (!_avoidReadFromDbOnNextSyncFilter.isEmpty()) {
+        return QByteArray();
+    }
+    SqlQuery invalidQuery("SELECT 1 FROM metadata WHERE type == 2 AND md5 == '_invalid_' LIMIT 1;", _db); // CSYNC_FTW_TYPE_DIR == 2
+    if (!invalidQuery.exec() || invalidQuery.next()) {
+        qDebug() << Q_FUNC_INFO << "Some directories must be discovered again, not using the sync token";
+        return QByteArray();
+    }
+
+    SqlQuery query("SELECT token FROM synctoken;", _db);
+    if (!query.exec()) {
+        qWarning() << "SQL query failed: "<< query.error();
+        return QByteArray();
+    }
+    if (!query.next()) {
+        return QByteArray();
+    }
+    return query.baValue(0);
+}
+
+void SyncJournalDb::setSyncToken(const QByteArray &token)
+{
+    QMutexLocker locker(&_mutex);
+    if( !checkConnect() ) {
+        return;
+    }
+
+    SqlQuery delQuery("DELETE FROM synctoken;", _db);
+    if( !delQuery.exec() ) {
+        qWarning() << "SQL error when deleting the sync token" << delQuery.error();
+    }
+    if (token.isEmpty()) {
+        return;
+    }
+    SqlQuery insQuery("INSERT INTO synctoken VALUES (?1);", _db);
+    insQuery.bindValue(1, QString::fromUtf8(token));
+    if( !insQuery.exec() ) {
+        qWarning() << "SQL error when inserting the sync token" << token << insQuery.error();
+    }
+}
+
 void SyncJournalDb::avoidRenamesOnNextSync(const QString& path)
 {
     QMutexLocker locker(&_mutex);
@@ -1606,12 +1819,21 @@ bool SyncJournalDb::isConnected()
     return checkConnect();
 }
 
+bool operator==(const SyncJournalDb::DownloadSegment & lhs,
+                const SyncJournalDb::DownloadSegment & rhs)
+{
+    return     lhs._start == rhs._start
+            && lhs._end == rhs._end
+            && lhs._done == rhs._done;
+}
+
 bool operator==(const SyncJournalDb::DownloadInfo & lhs,
                 const SyncJournalDb::DownloadInfo & rhs)
 {
     return     lhs._errorCount == rhs._errorCount
             && lhs._etag == rhs._etag
             && lhs._tmpfile == rhs._tmpfile
+            && lhs._segments == rhs._segments
             && lhs._valid == rhs._valid;
 
 }
@@ -1623,7 +1845,7 @@ bool operator==(const SyncJournalDb::UploadInfo & lhs,
             && lhs._chunk == rhs._chunk
             && lhs._modtime == rhs._modtime
             && lhs._valid == rhs._valid
-            && lhs._size == rhs._size
+            && lhs._chunkSize == rhs._chunkSize
             && lhs._transferid == rhs._transferid;
 }
 
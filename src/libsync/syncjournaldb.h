@@ -60,23 +60,45 @@ public:
     int wipeErrorBlacklist();
     int errorBlackListEntryCount();
 
+    /// A byte range of a file that is downloaded in several parts at once
+    struct DownloadSegment {
+        DownloadSegment() : _start(0), _end(0), _done(0) {}
+        quint64 _start;
+        quint64 _end; // exclusive
+        quint64 _done; // bytes from _start on that are in the temporary file
+    };
     struct DownloadInfo {
         DownloadInfo() : _errorCount(0), _valid(false) {}
         QString _tmpfile;
         QByteArray _etag;
         int _errorCount;
+        QVector<DownloadSegment> _segments; // empty for a download in one piece
         bool _valid;
     };
     struct UploadInfo {
-        UploadInfo() : _chunk(0), _transferid(0), _size(0), _errorCount(0), _valid(false) {}
+        UploadInfo() : _chunk(0), _transferid(0), _chunkSize(0), _errorCount(0), _valid(false) {}
         int _chunk;
         int _transferid;
-        quint64 _size; //currently unused
+        quint64 _chunkSize; // chunk size of the transfer (stored in the size column), 0 if unknown
         QDateTime _modtime;
         int _errorCount;
         bool _valid;
     };
 
+    /**
+     * The hashes of the fixed size blocks of the remote version \a _etag of a
+     * file. Comparing them to the local file tells which blocks a delta
+     * upload has to send.
+     */
+    struct BlockSignature {
+        BlockSignature() : _blockSize(0), _fileSize(0), _valid(false) {}
+        QByteArray _etag;
+        qint64 _blockSize;
+        qint64 _fileSize;
+        QByteArray _hashes; // concatenated MD5 digests, see FileSystem::calcBlockHashes()
+        bool _valid;
+    };
+
     struct PollInfo {
         QString _file;
         QString _url;
@@ -92,6 +114,10 @@ public:
     void setUploadInfo(const QString &file, const UploadInfo &i);
     bool deleteStaleUploadInfos(const QSet<QString>& keep);
 
+    BlockSignature getBlockSignature(const QString &file);
+    /// Stores the signature, or deletes it if it is not valid
+    void setBlockSignature(const QString &file, const BlockSignature &i);
+
     SyncJournalErrorBlacklistRecord errorBlacklistEntry( const QString& );
     bool deleteStaleErrorBlacklistEntries(const QSet<QString>& keep);
 
@@ -130,6 +156,16 @@ public:
      */
     void forceRemoteDiscoveryNextSync();
 
+    /**
+     * The sync token of the remote folder after the last successful sync, to ask
+     * the server for the changes since then.
+     *
+     * Empty if there is none, or if some directories must be discovered again
+     * (see avoidReadFromDbOnNextSync), which the changes would not tell.
+     */
+    QByteArray syncToken();
+    void setSyncToken(const QByteArray &token);
+
     bool postSyncCleanup(const QSet<QString>& filepathsToKeep,
                          const QSet<QString>& prefixesToKeep);
 
@@ -155,6 +191,7 @@ private:
     bool updateDatabaseStructure();
     bool updateMetadataTableStructure();
     bool updateErrorBlacklistTableStructure();
+    bool updateDownloadInfoTableStructure();
     bool sqlFail(const QString& log, const SqlQuery &query );
     void commitInternal(const QString &context, bool startTrans = true);
     void startTransaction();
@@ -185,6 +222,9 @@ private:
     QScopedPointer<SqlQuery> _getUploadInfoQuery;
     QScopedPointer<SqlQuery> _setUploadInfoQuery;
     QScopedPointer<SqlQuery> _deleteUploadInfoQuery;
+    QScopedPointer<SqlQuery> _getBlockSignatureQuery;
+    QScopedPointer<SqlQuery> _setBlockSignatureQuery;
+    QScopedPointer<SqlQuery> _deleteBlockSignatureQuery;
     QScopedPointer<SqlQuery> _deleteFileRecordPhash;
     QScopedPointer<SqlQuery> _deleteFileRecordRecursively;
     QScopedPointer<SqlQuery> _getErrorBlacklistQuery;
@@ -201,6 +241,9 @@ private:
     QList<QString> _avoidReadFromDbOnNextSyncFilter;
 };
 
+bool OWNCLOUDSYNC_EXPORT
+operator==(const SyncJournalDb::DownloadSegment & lhs,
+           const SyncJournalDb::DownloadSegment & rhs);
 bool OWNCLOUDSYNC_EXPORT
 operator==(const SyncJournalDb::DownloadInfo & lhs,
            const SyncJournalDb::DownloadInfo & rhs);
@@ -13,51 +13,395 @@
 
 #include "httpserver.h"
 
+#include <QCryptographicHash>
+#include <QLocale>
+#include <QRegExp>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QUrl>
+#include <QDebug>
+
+static const char davPrefix[] = "/remote.php/webdav";
+static const char tokenPrefix[] = "http://owncloud.org/ns/sync/";
+
+static QByteArray xmlEscape(const QString &s)
+{
+    QString r = s;
+    r.replace('&', "&amp;").replace('<', "&lt;").replace('>', "&gt;").replace('"', "&quot;");
+    return r.toUtf8();
+}
+
+static QByteArray httpDate(const QDateTime &dt)
+{
+    return QLocale::c().toString(dt.toUTC(), QLatin1String("ddd, dd MMM yyyy hh:mm:ss 'GMT'")).toLatin1();
+}
+
+static QString parentPath(const QString &path)
+{
+    int slash = path.lastIndexOf('/');
+    return slash < 0 ? QString("") : path.left(slash);
+}
+
+static bool isBelow(const QString &path, const QString &dir)
+{
+    return dir.isEmpty() ? !path.isEmpty() : path.startsWith(dir + QLatin1Char('/'));
+}
+
 HttpServer::HttpServer(quint16 port, QObject* parent)
-    : QTcpServer(parent)
+    : QTcpServer(parent), _changeId(0), _nextFileId(1), _invalidTokenCode(403)
+{
+    touch(QString(""), true);
+    connect(this, SIGNAL(newConnection()), this, SLOT(acceptClient()));
+    if (!listen(QHostAddress::Any, port)) {
+        qWarning() << "Cannot listen on port" << port << errorString();
+    }
+}
+
+void HttpServer::addPath(const QString &p, const QByteArray &content)
+{
+    QString path = p;
+    bool isDirectory = path.endsWith('/');
+    while (path.endsWith('/')) {
+        path.chop(1);
+    }
+    while (path.startsWith('/')) {
+        path.remove(0, 1);
+    }
+    // the parents first
+    QString parent = parentPath(path);
+    if (!_items.contains(parent)) {
+        addPath(parent + QLatin1Char('/'));
+    }
+    touch(path, isDirectory);
+    if (!isDirectory) {
+        _items[path].content = content;
+    }
+}
+
+void HttpServer::removePath(const QString &path)
+{
+    if (path.isEmpty() || !_items.contains(path)) {
+        return;
+    }
+    ++_changeId;
+    _items.remove(path);
+    _removed.insert(path, _changeId);
+    QMap<QString, Item>::iterator it = _items.lowerBound(path + QLatin1Char('/'));
+    while (it != _items.end() && isBelow(it.key(), path)) {
+        _removed.insert(it.key(), _changeId);
+        it = _items.erase(it);
+    }
+    // the parents changed
+    QString parent = parentPath(path);
+    while (true) {
+        Item &item = _items[parent];
+        item.changeId = _changeId;
+        item.etag = QByteArray::number(_changeId, 16) + QCryptographicHash::hash(parent.toUtf8(), QCryptographicHash::Md5).toHex().left(8);
+        if (parent.isEmpty()) {
+            break;
+        }
+        parent = parentPath(parent);
+    }
+}
+
+void HttpServer::setErrorCode(const QString &path, int code)
+{
+    if (code) {
+        _errorCodes.insert(path, code);
+    } else {
+        _errorCodes.remove(path);
+    }
+}
+
+void HttpServer::touch(const QString &path, bool isDirectory)
+{
+    ++_changeId;
+    QString p = path;
+    while (true) {
+        Item &item = _items[p];
+        if (item.fileId.isEmpty()) {
+            item.fileId = QByteArray::number(_nextFileId++).rightJustified(8, '0') + "ocmock";
+            item.isDirectory = (p != path) || isDirectory;
+            _removed.remove(p);
+        }
+        item.changeId = _changeId;
+        item.etag = QByteArray::number(_changeId, 16) + QCryptographicHash::hash(p.toUtf8(), QCryptographicHash::Md5).toHex().left(8);
+        item.modified = QDateTime::currentDateTime();
+        if (p.isEmpty()) {
+            break;
+        }
+        p = parentPath(p);
+    }
+}
+
+QMap<QString, HttpServer::Item>::const_iterator HttpServer::firstBelow(const QString &dir) const
+{
+    // "a b" sorts between "a" and "a/x"
+    return dir.isEmpty() ? _items.upperBound(dir) : _items.lowerBound(dir + QLatin1Char('/'));
+}
+
+QByteArray HttpServer::syncToken() const
+{
+    return tokenPrefix + QByteArray::number(_changeId);
+}
+
+QByteArray HttpServer::href(const QString &path) const
+{
+    QByteArray h = davPrefix;
+    foreach (const QString &segment, path.split('/', QString::SkipEmptyParts)) {
+        h += '/' + QUrl::toPercentEncoding(segment);
+    }
+    if (_items.value(path).isDirectory) {
+        h += '/';
+    }
+    return h;
+}
+
+QByteArray HttpServer::propertiesXml(const Item &item) const
+{
+    QByteArray xml = "<d:getetag>\"" + item.etag + "\"</d:getetag>"
+            "<d:getlastmodified>" + httpDate(item.modified) + "</d:getlastmodified>"
+            "<oc:id>" + item.fileId + "</oc:id>";
+    if (item.isDirectory) {
+        xml += "<d:resourcetype><d:collection/></d:resourcetype>"
+               "<oc:permissions>RDNVCK</oc:permissions>"
+               "<d:sync-token>" + syncToken() + "</d:sync-token>";
+    } else {
+        xml += "<d:resourcetype/>"
+               "<oc:permissions>RDNVW</oc:permissions>"
+               "<d:getcontentlength>" + QByteArray::number(item.content.size()) + "</d:getcontentlength>";
+    }
+    return xml;
+}
+
+static QByteArray response(const QByteArray &href, const QByteArray &properties)
 {
-    listen(QHostAddress::Any, port);
+    return "<d:response><d:href>" + href + "</d:href>"
+           "<d:propstat><d:prop>" + properties + "</d:prop>"
+           "<d:status>HTTP/1.1 200 OK</d:status></d:propstat></d:response>";
+}
+
+static const char multistatusStart[] = "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+        "<d:multistatus xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">";
+
+void HttpServer::acceptClient()
+{
+    while (QTcpSocket *socket = nextPendingConnection()) {
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readClient()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(discardClient()));
+    }
 }
 
 void HttpServer::readClient()
 {
-    QTcpSocket* socket = (QTcpSocket*)sender();
-    if (socket->canReadLine()) {
-        QStringList tokens = QString(socket->readLine()).split(QRegExp("[ \r\n][ \r\n]*"));
-        if (tokens[0] == "GET") {
-            QTextStream os(socket);
-            os.setAutoDetectUnicode(true);
-            os << "HTTP/1.0 200 Ok\r\n"
-                "Content-Type: text/html; charset=\"utf-8\"\r\n"
-                "\r\n"
-                "<h1>Nothing to see here</h1>\n"
-                << QDateTime::currentDateTime().toString() << "\n";
-            socket->close();
+    QTcpSocket* socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket) {
+        return;
+    }
+    QByteArray &buffer = _buffers[socket];
+    buffer += socket->readAll();
 
-            QtServiceBase::instance()->logMessage("Wrote to client");
+    // Several requests can come on the same connection
+    while (true) {
+        int headerEnd = buffer.indexOf("\r\n\r\n");
+        if (headerEnd < 0) {
+            return;
+        }
+        QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+        QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+        if (requestLine.size() < 2) {
+            socket->close();
+            return;
+        }
+        Request request;
+        request.verb = requestLine.at(0);
+        foreach (const QByteArray &line, lines) {
+            int colon = line.indexOf(':');
+            if (colon > 0) {
+                request.headers.insert(line.left(colon).trimmed().toLower(), line.mid(colon + 1).trimmed());
+            }
+        }
+        int length = request.headers.value("content-length").toInt();
+        if (buffer.size() < headerEnd + 4 + length) {
+            return; // the body did not arrive yet
+        }
+        request.body = buffer.mid(headerEnd + 4, length);
+        buffer.remove(0, headerEnd + 4 + length);
 
-            if (socket->state() == QTcpSocket::UnconnectedState) {
-                delete socket;
-                QtServiceBase::instance()->logMessage("Connection closed");
+        QByteArray rawPath = requestLine.at(1);
+        if (rawPath.contains('?')) {
+            rawPath.truncate(rawPath.indexOf('?'));
+        }
+        QString path = QUrl::fromPercentEncoding(rawPath);
+        if (path.startsWith(QLatin1String(davPrefix))) {
+            path.remove(0, sizeof(davPrefix) - 1);
+            while (path.endsWith('/')) {
+                path.chop(1);
             }
+            while (path.startsWith('/')) {
+                path.remove(0, 1);
+            }
+            request.path = path;
+        } else {
+            request.path = QString();
+            request.headers.insert(":raw-path", rawPath);
         }
+        handleRequest(socket, request);
     }
 }
+
 void HttpServer::discardClient()
 {
-    QTcpSocket* socket = (QTcpSocket*)sender();
+    QTcpSocket* socket = qobject_cast<QTcpSocket *>(sender());
+    _buffers.remove(socket);
     socket->deleteLater();
+}
+
+void HttpServer::handleRequest(QTcpSocket *socket, const Request &request)
+{
+    qDebug() << request.verb << request.path << request.headers.value("depth");
+    _requestCounts[request.verb]++;
+
+    if (request.path.isNull()) {
+        if (request.verb == "GET" && request.headers.value(":raw-path").endsWith("/status.php")) {
+            reply(socket, 200, "OK", "{\"installed\":true,\"maintenance\":false,\"version\":\"9.0.0.19\","
+                  "\"versionstring\":\"9.0.0\",\"edition\":\"\"}", "application/json");
+        } else {
+            reply(socket, 404, "Not Found");
+        }
+        return;
+    }
 
-    QtServiceBase::instance()->logMessage("Connection closed");
+    int errorCode = _errorCodes.value(request.path);
+    if (errorCode && request.verb != "PROPFIND" && request.verb != "REPORT") {
+        reply(socket, errorCode, "Error");
+        return;
+    }
+
+    if (request.verb == "PROPFIND") {
+        propfind(socket, request);
+    } else if (request.verb == "REPORT") {
+        report(socket, request);
+    } else if (request.verb == "GET") {
+        if (!_items.contains(request.path) || _items.value(request.path).isDirectory) {
+            reply(socket, 404, "Not Found");
+        } else {
+            const Item &item = _items[request.path];
+            QMap<QByteArray, QByteArray> headers;
+            headers["ETag"] = '"' + item.etag + '"';
+            headers["OC-FileId"] = item.fileId;
+            headers["Last-Modified"] = httpDate(item.modified);
+            reply(socket, 200, "OK", item.content, "application/octet-stream", headers);
+        }
+    } else if (request.verb == "PUT" || request.verb == "MKCOL") {
+        if (!_items.value(parentPath(request.path)).isDirectory) {
+            reply(socket, 409, "Conflict");
+            return;
+        }
+        addPath(request.path + (request.verb == "MKCOL" ? "/" : ""), request.body);
+        reply(socket, 201, "Created");
+    } else if (request.verb == "DELETE") {
+        if (request.path.isEmpty() || !_items.contains(request.path)) {
+            reply(socket, 404, "Not Found");
+            return;
+        }
+        removePath(request.path);
+        reply(socket, 204, "No Content");
+    } else {
+        reply(socket, 405, "Method Not Allowed");
+    }
 }
 
+void HttpServer::propfind(QTcpSocket *socket, const Request &request)
+{
+    if (!_items.contains(request.path)) {
+        reply(socket, 404, "Not Found");
+        return;
+    }
+    QByteArray depth = request.headers.value("depth", "1");
+    if (depth != "0" && depth != "1") {
+        reply(socket, 403, "Forbidden", "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+              "<d:error xmlns:d=\"DAV:\"><d:propfind-finite-depth/></d:error>");
+        return;
+    }
+
+    const Item &item = _items[request.path];
+    QByteArray xml = multistatusStart;
+    xml += response(href(request.path), propertiesXml(item));
+    if (depth == "1" && item.isDirectory) {
+        QMap<QString, Item>::const_iterator it = firstBelow(request.path);
+        for (; it != _items.constEnd() && isBelow(it.key(), request.path); ++it) {
+            if (parentPath(it.key()) == request.path) {
+                xml += response(href(it.key()), propertiesXml(it.value()));
+            }
+        }
+    }
+    xml += "</d:multistatus>";
+    reply(socket, 207, "Multi-Status", xml);
+}
 
-void HttpServer::incomingConnection(int socket)
+void HttpServer::report(QTcpSocket *socket, const Request &request)
 {
-    if (disabled)
+    if (!_items.value(request.path).isDirectory || !request.body.contains("sync-collection")) {
+        reply(socket, 403, "Forbidden", "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+              "<d:error xmlns:d=\"DAV:\"><d:supported-report/></d:error>");
         return;
-    QTcpSocket* s = new QTcpSocket(this);
-    connect(s, SIGNAL(readyRead()), this, SLOT(readClient()));
-    connect(s, SIGNAL(disconnected()), this, SLOT(discardClient()));
-    s->setSocketDescriptor(socket);
+    }
+
+    // An empty token asks for everything
+    QRegExp tokenExp(QLatin1String("<[^>]*sync-token[^>]*>([^<]*)<"));
+    QString token;
+    if (tokenExp.indexIn(QString::fromUtf8(request.body)) >= 0) {
+        token = tokenExp.cap(1).trimmed();
+    }
+    qint64 since = 0;
+    if (!token.isEmpty()) {
+        bool ok = token.startsWith(QLatin1String(tokenPrefix));
+        since = ok ? token.mid(sizeof(tokenPrefix) - 1).toLongLong(&ok) : 0;
+        if (!ok || since > _changeId) {
+            reply(socket, _invalidTokenCode, "Invalid Sync Token", "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+                  "<d:error xmlns:d=\"DAV:\"><d:valid-sync-token/></d:error>");
+            return;
+        }
+    }
+
+    QByteArray xml = multistatusStart;
+    QMap<QString, Item>::const_iterator it = firstBelow(request.path);
+    for (; it != _items.constEnd() && isBelow(it.key(), request.path); ++it) {
+        if (it.value().changeId > since) {
+            xml += response(href(it.key()), propertiesXml(it.value()));
+        }
+    }
+    if (since > 0) {
+        for (QMap<QString, qint64>::const_iterator rit = _removed.constBegin(); rit != _removed.constEnd(); ++rit) {
+            if (rit.value() > since && isBelow(rit.key(), request.path)) {
+                QByteArray removedHref = davPrefix;
+                foreach (const QString &segment, rit.key().split('/', QString::SkipEmptyParts)) {
+                    removedHref += '/' + QUrl::toPercentEncoding(segment);
+                }
+                xml += "<d:response><d:href>" + removedHref + "</d:href>"
+                       "<d:status>HTTP/1.1 404 Not Found</d:status></d:response>";
+            }
+        }
+    }
+    xml += "<d:sync-token>" + xmlEscape(QString::fromUtf8(syncToken())) + "</d:sync-token>"
+           "</d:multistatus>";
+    reply(socket, 207, "Multi-Status", xml);
+}
+
+void HttpServer::reply(QTcpSocket *socket, int code, const QByteArray &reason,
+                       const QByteArray &body, const QByteArray &contentType,
+                       const QMap<QByteArray, QByteArray> &headers)
+{
+    QByteArray header = "HTTP/1.1 " + QByteArray::number(code) + ' ' + reason + "\r\n"
+            "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    if (!body.isEmpty()) {
+        header += "Content-Type: " + contentType + "\r\n";
+    }
+    for (QMap<QByteArray, QByteArray>::const_iterator it = headers.constBegin(); it != headers.constEnd(); ++it) {
+        header += it.key() + ": " + it.value() + "\r\n";
+    }
+    header += "\r\n";
+    header += body;
+    socket->write(header);
 }
@@ -11,16 +11,92 @@
  * for more details.
  */
 
+#pragma once
+
 #include <QTcpServer>
+#include <QDateTime>
+#include <QHash>
+#include <QMap>
+
+class QTcpSocket;
 
+/**
+ * @brief A WebDAV server stand-in for testing the discovery offline
+ *
+ * Serves an in-memory tree below /remote.php/webdav:
+ *  - PROPFIND with Depth 0 or 1, always with all the properties the client asks for,
+ *    and the DAV:sync-token of the collections
+ *  - REPORT with a DAV:sync-collection body (RFC 6578), sync-level infinite
+ *  - GET, PUT, MKCOL and DELETE to look at and change the tree
+ *  - GET /status.php
+ *
+ * Every change gets a new change id, which is the sync token. Like on a real
+ * server, the etags of the parents change along.
+ *
+ * It runs in the event loop of its thread, so tests can sync against it in-process.
+ */
 class HttpServer : public QTcpServer
- {
-     Q_OBJECT
- public:
-    HttpServer(qint16 port, QObject* parent = 0);
-    void incomingConnection(int socket);
-
- private slots:
-     void readClient();
-     void discardClient();
- };
+{
+    Q_OBJECT
+public:
+    explicit HttpServer(quint16 port, QObject* parent = 0);
+
+    // Adds a file (or a directory if the path ends with a slash), and its parents
+    void addPath(const QString &path, const QByteArray &content = QByteArray());
+    void removePath(const QString &path);
+
+    // The token a sync-collection REPORT returns now
+    QByteArray syncToken() const;
+    // Number of requests with the verb so far
+    int requestCount(const QByteArray &verb) const { return _requestCounts.value(verb); }
+    // Answer GET, PUT, MKCOL and DELETE of the path with the code, 0 to stop
+    void setErrorCode(const QString &path, int code);
+    // The code for a sync token the server does not know, 403 by default
+    void setInvalidTokenCode(int code) { _invalidTokenCode = code; }
+
+private slots:
+    void acceptClient();
+    void readClient();
+    void discardClient();
+
+private:
+    struct Item {
+        Item() : isDirectory(false), changeId(0) {}
+        bool isDirectory;
+        QByteArray content;
+        QByteArray etag;
+        QByteArray fileId;
+        QDateTime modified;
+        qint64 changeId; // of the last change at or below it
+    };
+
+    struct Request {
+        QByteArray verb;
+        QString path; // relative to the webdav root, without slashes around, or null if outside of it
+        QHash<QByteArray, QByteArray> headers; // with lower case names
+        QByteArray body;
+    };
+
+    void handleRequest(QTcpSocket *socket, const Request &request);
+    void propfind(QTcpSocket *socket, const Request &request);
+    void report(QTcpSocket *socket, const Request &request);
+
+    void touch(const QString &path, bool isDirectory);
+    QByteArray href(const QString &path) const;
+    QByteArray propertiesXml(const Item &item) const;
+    QMap<QString, Item>::const_iterator firstBelow(const QString &dir) const;
+
+    static void reply(QTcpSocket *socket, int code, const QByteArray &reason,
+                      const QByteArray &body = QByteArray(),
+                      const QByteArray &contentType = "application/xml; charset=utf-8",
+                      const QMap<QByteArray, QByteArray> &headers = QMap<QByteArray, QByteArray>());
+
+    QMap<QString, Item> _items; // sorted, so the paths below a directory come right after it
+    QMap<QString, qint64> _removed; // change id of the removal
+    qint64 _changeId;
+    qint64 _nextFileId;
+    QHash<QTcpSocket *, QByteArray> _buffers;
+    QHash<QByteArray, int> _requestCounts;
+    QHash<QString, int> _errorCodes;
+    int _invalidTokenCode;
+};
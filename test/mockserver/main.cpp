@@ -12,12 +12,35 @@
  */
 
 #include <QCoreApplication>
+#include <QStringList>
+#include <iostream>
 
 #include "httpserver.h"
 
+/*
+ * Usage: mockserver [port] [number of files]
+ *
+ * Serves http://localhost:<port>/remote.php/webdav with the given number of
+ * files, ten per directory and three directory levels deep. Use PUT, MKCOL and
+ * DELETE (with curl for instance) to change the tree between two syncs.
+ */
 int main(int argc, char* argv[])
 {
-  QCoreApplication app(argc, argv);
-  HttpServer server;
-  return app.exec();
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+
+    quint16 port = args.size() > 1 ? args.at(1).toUShort() : 8080;
+    int fileCount = args.size() > 2 ? args.at(2).toInt() : 100;
+
+    HttpServer server(port);
+    for (int i = 0; i < fileCount; ++i) {
+        QString path = QString("d%1/d%2/d%3/f%4.txt").arg(i / 1000).arg(i / 100 % 10).arg(i / 10 % 10).arg(i);
+        server.addPath(path, QByteArray("content of ") + path.toUtf8());
+    }
+    if (!server.isListening()) {
+        return 1;
+    }
+    std::cout << "Serving " << fileCount << " files on http://localhost:" << server.serverPort()
+              << "/remote.php/webdav" << std::endl;
+    return app.exec();
 }
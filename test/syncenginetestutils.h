@@ -0,0 +1,195 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_SYNCENGINETESTUTILS_H
+#define MIRALL_SYNCENGINETESTUTILS_H
+
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTimerEvent>
+#include <functional>
+
+#include "creds/abstractcredentials.h"
+
+/**
+ * Credentials that are always valid. The account gets the given
+ * QNetworkAccessManager, and deletes it.
+ */
+class FakeCredentials : public OCC::AbstractCredentials
+{
+public:
+    explicit FakeCredentials(QNetworkAccessManager *qnam) : _qnam(qnam) { }
+
+    bool changed(OCC::AbstractCredentials *) const Q_DECL_OVERRIDE { return false; }
+    QString authType() const Q_DECL_OVERRIDE { return QLatin1String("test"); }
+    QString user() const Q_DECL_OVERRIDE { return QLatin1String("admin"); }
+    QNetworkAccessManager *getQNAM() const Q_DECL_OVERRIDE { return _qnam; }
+    bool ready() const Q_DECL_OVERRIDE { return true; }
+    void fetchFromKeychain() Q_DECL_OVERRIDE { }
+    void askFromUser() Q_DECL_OVERRIDE { }
+    bool stillValid(QNetworkReply *) Q_DECL_OVERRIDE { return true; }
+    void persist() Q_DECL_OVERRIDE { }
+    void invalidateToken() Q_DECL_OVERRIDE { }
+
+private:
+    QNetworkAccessManager *_qnam;
+};
+
+/// The answer of a FakeQNAM to a request
+struct FakeResponse
+{
+    explicit FakeResponse(int code = 200) : code(code) { }
+
+    int code;
+    QMap<QByteArray, QByteArray> headers;
+    QByteArray body;
+};
+
+/**
+ * A reply that arrives in one piece once the event loop runs, like a real
+ * one would. Codes of 400 and above are errors.
+ */
+class FakeReply : public QNetworkReply
+{
+public:
+    FakeReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request,
+              const FakeResponse &response, QObject *parent)
+        : QNetworkReply(parent), _body(response.body)
+    {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, response.code);
+        setAttribute(QNetworkRequest::HttpReasonPhraseAttribute, QByteArray("Fake"));
+        for (QMap<QByteArray, QByteArray>::const_iterator it = response.headers.constBegin();
+             it != response.headers.constEnd(); ++it) {
+            setRawHeader(it.key(), it.value());
+        }
+        setHeader(QNetworkRequest::ContentLengthHeader, _body.size());
+        if (response.code >= 400) {
+            setError(errorForCode(response.code), QString("HTTP error %1").arg(response.code));
+        }
+        _timerId = startTimer(0);
+    }
+
+    void abort() Q_DECL_OVERRIDE
+    {
+        if (isFinished()) {
+            return;
+        }
+        if (_timerId) {
+            killTimer(_timerId);
+            _timerId = 0;
+        }
+        _body.clear();
+        setError(OperationCanceledError, QLatin1String("Operation canceled"));
+        setFinished(true);
+        emit error(OperationCanceledError);
+        emit finished();
+    }
+
+    qint64 bytesAvailable() const Q_DECL_OVERRIDE
+    {
+        return _body.size() + QIODevice::bytesAvailable();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) Q_DECL_OVERRIDE
+    {
+        qint64 len = qMin(maxlen, qint64(_body.size()));
+        memcpy(data, _body.constData(), len);
+        _body.remove(0, len);
+        return len;
+    }
+
+    void timerEvent(QTimerEvent *) Q_DECL_OVERRIDE
+    {
+        killTimer(_timerId);
+        _timerId = 0;
+        emit metaDataChanged();
+        if (isFinished()) {
+            // aborted by a receiver
+            return;
+        }
+        if (!_body.isEmpty()) {
+            emit readyRead();
+            if (isFinished()) {
+                return;
+            }
+        }
+        setFinished(true);
+        if (error() != NoError) {
+            emit error(error());
+        }
+        emit finished();
+    }
+
+private:
+    static NetworkError errorForCode(int code)
+    {
+        switch (code) {
+        case 400: return ProtocolInvalidOperationError;
+        case 401: return AuthenticationRequiredError;
+        case 403: return ContentAccessDenied;
+        case 404: return ContentNotFoundError;
+        case 405: return ContentOperationNotPermittedError;
+        default: return code < 500 ? UnknownContentError : ProtocolFailure;
+        }
+    }
+
+    QByteArray _body;
+    int _timerId;
+};
+
+/**
+ * A QNetworkAccessManager that does not go to the network. Every request is
+ * recorded, and answered with what the handler returns for it.
+ */
+class FakeQNAM : public QNetworkAccessManager
+{
+public:
+    struct Request {
+        QByteArray verb;
+        QNetworkRequest request;
+        QByteArray body;
+    };
+    typedef std::function<FakeResponse (const Request &)> Handler;
+
+    explicit FakeQNAM(const Handler &handler) : _handler(handler) { }
+
+    /// All the requests so far, in the order they were sent
+    QList<Request> requests() const { return _requests; }
+
+protected:
+    QNetworkReply *createRequest(Operation op, const QNetworkRequest &request,
+                                 QIODevice *outgoingData) Q_DECL_OVERRIDE
+    {
+        Request r;
+        switch (op) {
+        case HeadOperation: r.verb = "HEAD"; break;
+        case GetOperation: r.verb = "GET"; break;
+        case PutOperation: r.verb = "PUT"; break;
+        case PostOperation: r.verb = "POST"; break;
+        case DeleteOperation: r.verb = "DELETE"; break;
+        default: r.verb = request.attribute(QNetworkRequest::CustomVerbAttribute).toByteArray(); break;
+        }
+        r.request = request;
+        if (outgoingData) {
+            r.body = outgoingData->readAll();
+        }
+        _requests.append(r);
+        return new FakeReply(op, request, _handler(r), this);
+    }
+
+private:
+    Handler _handler;
+    QList<Request> _requests;
+};
+
+#endif
@@ -16,6 +16,7 @@
 #include "utility.h"
 #include "filesystem.h"
 #include "propagatorjobs.h"
+#include "crc32c.h"
 
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
 // poor man QTRY_VERIFY when Qt5 is not available.
@@ -120,6 +121,45 @@ using namespace OCC;
         delete vali;
     }
 
+    void testUploadChecksummingCrc32c() {
+
+        ComputeChecksum *vali = new ComputeChecksum(this);
+        _expectedType = OCC::checkSumCRC32CC;
+        vali->setChecksumType(_expectedType);
+        connect(vali, SIGNAL(done(QByteArray,QByteArray)), this, SLOT(slotUpValidated(QByteArray,QByteArray)));
+
+        _expected = FileSystem::calcCrc32c( _testfile );
+
+        vali->start(_testfile);
+
+        QEventLoop loop;
+        connect(vali, SIGNAL(done(QByteArray,QByteArray)), &loop, SLOT(quit()), Qt::QueuedConnection);
+        loop.exec();
+
+        delete vali;
+    }
+
+    void testCrc32c() {
+        // Check value of the CRC32C catalogue entry
+        QCOMPARE(OCC::crc32c(0, "123456789", 9), uint32_t(0xe3069283));
+
+        // Updating piecewise, from unaligned positions, gives the same result
+        QByteArray data(100000, 0);
+        for (int i = 0; i < data.size(); ++i) {
+            data[i] = char(qrand());
+        }
+        uint32_t whole = OCC::crc32c(0, data.constData() + 3, data.size() - 3);
+        uint32_t pieces = OCC::crc32c(0, data.constData() + 3, 1001);
+        pieces = OCC::crc32c(pieces, data.constData() + 1004, data.size() - 1004);
+        QCOMPARE(pieces, whole);
+
+        QFile file(_root + "/crcFile");
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("123456789");
+        file.close();
+        QCOMPARE(FileSystem::calcCrc32c(file.fileName()), QByteArray("e3069283"));
+    }
+
     void testDownloadChecksummingAdler() {
 
         QByteArray adler =  checkSumAdlerC;
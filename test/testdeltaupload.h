@@ -0,0 +1,255 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTDELTAUPLOAD_H
+#define MIRALL_TESTDELTAUPLOAD_H
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "syncenginetestutils.h"
+#include "account.h"
+#include "filesystem.h"
+#include "owncloudpropagator.h"
+#include "syncengine.h"
+#include "syncjournaldb.h"
+#include "syncjournalfilerecord.h"
+
+using namespace OCC;
+
+class TestDeltaUpload : public QObject
+{
+    Q_OBJECT
+
+    enum { BlockSize = 1024, BlockCount = 16, ChangedBlock = 3 };
+
+    static QByteArray fileContent(bool changed)
+    {
+        QByteArray data;
+        for (int i = 0; i < BlockCount; ++i) {
+            data += QByteArray(BlockSize, char('a' + i));
+        }
+        if (changed) {
+            data[ChangedBlock * BlockSize + 7] = 'X';
+        }
+        return data;
+    }
+
+    static bool writeFile(const QString &path, const QByteArray &data)
+    {
+        QFile f(path);
+        return f.open(QIODevice::WriteOnly) && f.write(data) == data.size();
+    }
+
+    static AccountPtr createAccount(FakeQNAM *qnam, bool deltaUpload)
+    {
+        AccountPtr account = Account::create();
+        account->setUrl(QUrl(QLatin1String("http://example.com/owncloud")));
+        account->setCredentials(new FakeCredentials(qnam));
+        QVariantMap dav;
+        dav["delta_upload"] = deltaUpload;
+        QVariantMap capabilities;
+        capabilities["dav"] = dav;
+        account->setCapabilities(capabilities);
+        return account;
+    }
+
+    // Propagates the item, and tells if the propagator finished in time
+    static bool propagate(const AccountPtr &account, const QString &localPath, SyncJournalDb *journal,
+                          const SyncFileItemPtr &item)
+    {
+        OwncloudPropagator propagator(account, localPath, QLatin1String("/owncloud/remote.php/webdav/"),
+                                      QLatin1String("/"), journal);
+        QSignalSpy finished(&propagator, SIGNAL(finished()));
+        propagator.start(SyncFileItemVector() << item);
+        return finished.wait(10000);
+    }
+
+private slots:
+    void initTestCase()
+    {
+        // Read once, by the first upload
+        qputenv("OWNCLOUD_DELTA_BLOCK_SIZE", QByteArray::number(BlockSize));
+        qputenv("OWNCLOUD_DELTA_MIN_SIZE", QByteArray::number(4 * BlockSize));
+        SyncEngine::minimumFileAgeForUpload = 0;
+    }
+
+    void testDeltaUpload_data()
+    {
+        QTest::addColumn<int>("patchCode");
+        QTest::newRow("assembled") << 201;
+        // The server cannot assemble the file from the manifest
+        QTest::newRow("400") << 400;
+        QTest::newRow("405") << 405;
+        QTest::newRow("415") << 415;
+        QTest::newRow("501") << 501;
+    }
+
+    void testDeltaUpload()
+    {
+        QFETCH(int, patchCode);
+
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString localPath = dir.path() + QLatin1Char('/');
+        const QString filePath = localPath + QLatin1String("big.bin");
+        const QByteArray newData = fileContent(true);
+
+        // The journal has the signature of the version on the server
+        QVERIFY(writeFile(filePath, fileContent(false)));
+        SyncJournalDb journal(localPath);
+        SyncJournalDb::BlockSignature signature;
+        signature._etag = "e1";
+        signature._blockSize = BlockSize;
+        signature._fileSize = BlockCount * BlockSize;
+        signature._hashes = FileSystem::calcBlockHashes(filePath, BlockSize);
+        signature._valid = true;
+        journal.setBlockSignature(QLatin1String("big.bin"), signature);
+        QVERIFY(writeFile(filePath, newData));
+
+        FakeQNAM *qnam = new FakeQNAM([patchCode](const FakeQNAM::Request &request) {
+            FakeResponse response(201);
+            if (request.verb == "PATCH") {
+                response.code = patchCode;
+            }
+            if (response.code == 201 && !request.request.url().path().contains(QLatin1String("-chunking-"))) {
+                // The whole file is on the server now
+                response.headers["ETag"] = "\"e2\"";
+                response.headers["OC-FileId"] = "00000001ocfake";
+                response.headers["X-OC-MTime"] = "accepted";
+            }
+            return response;
+        });
+        AccountPtr account = createAccount(qnam, true);
+
+        SyncFileItemPtr item(new SyncFileItem);
+        item->_file = item->_originalFile = QLatin1String("big.bin");
+        item->_type = SyncFileItem::File;
+        item->_direction = SyncFileItem::Up;
+        item->_instruction = CSYNC_INSTRUCTION_SYNC;
+        item->_size = newData.size();
+        item->_modtime = FileSystem::getModTime(filePath);
+        item->_etag = "e1";
+        QVERIFY(propagate(account, localPath, &journal, item));
+
+        const QList<FakeQNAM::Request> requests = qnam->requests();
+        QCOMPARE(requests.size(), patchCode == 201 ? 2 : 3);
+
+        // Only the changed block is sent
+        QCOMPARE(requests.at(0).verb, QByteArray("PUT"));
+        QVERIFY(requests.at(0).request.url().path().contains(QLatin1String("/big.bin-chunking-")));
+        QVERIFY(requests.at(0).request.url().path().endsWith(QString("-%1").arg(ChangedBlock)));
+        QCOMPARE(requests.at(0).body, newData.mid(ChangedBlock * BlockSize, BlockSize));
+
+        // Then the manifest that lists it
+        const FakeQNAM::Request &patch = requests.at(1);
+        QCOMPARE(patch.verb, QByteArray("PATCH"));
+        QVERIFY(patch.request.url().path().endsWith(QLatin1String("/big.bin")));
+        QCOMPARE(patch.request.rawHeader("Content-Type"), QByteArray("application/x-oc-delta-manifest"));
+        QCOMPARE(patch.body, QByteArray::number(ChangedBlock) + '\n');
+
+        if (patchCode != 201) {
+            // A normal upload of the whole file
+            const FakeQNAM::Request &put = requests.at(2);
+            QCOMPARE(put.verb, QByteArray("PUT"));
+            QVERIFY(put.request.url().path().endsWith(QLatin1String("/big.bin")));
+            QCOMPARE(put.body, newData);
+        }
+
+        // Either way the new version is in the journal, with its signature
+        QCOMPARE(journal.getFileRecord(QLatin1String("big.bin"))._etag, QByteArray("e2"));
+        const SyncJournalDb::BlockSignature newSignature = journal.getBlockSignature(QLatin1String("big.bin"));
+        QVERIFY(newSignature._valid);
+        QCOMPARE(newSignature._etag, QByteArray("e2"));
+        QCOMPARE(newSignature._hashes, FileSystem::calcBlockHashes(filePath, BlockSize));
+    }
+
+    void testNewFileSignature()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString localPath = dir.path() + QLatin1Char('/');
+        const QString filePath = localPath + QLatin1String("big.bin");
+        QVERIFY(writeFile(filePath, fileContent(false)));
+        SyncJournalDb journal(localPath);
+
+        FakeQNAM *qnam = new FakeQNAM([](const FakeQNAM::Request &) {
+            FakeResponse response(201);
+            response.headers["ETag"] = "\"e1\"";
+            response.headers["OC-FileId"] = "00000001ocfake";
+            response.headers["X-OC-MTime"] = "accepted";
+            return response;
+        });
+
+        SyncFileItemPtr item(new SyncFileItem);
+        item->_file = item->_originalFile = QLatin1String("big.bin");
+        item->_type = SyncFileItem::File;
+        item->_direction = SyncFileItem::Up;
+        item->_instruction = CSYNC_INSTRUCTION_NEW;
+        item->_size = BlockCount * BlockSize;
+        item->_modtime = FileSystem::getModTime(filePath);
+        QVERIFY(propagate(createAccount(qnam, true), localPath, &journal, item));
+
+        // Sent in full, there is nothing to compare with yet
+        const QList<FakeQNAM::Request> requests = qnam->requests();
+        QCOMPARE(requests.size(), 1);
+        QCOMPARE(requests.at(0).verb, QByteArray("PUT"));
+        QCOMPARE(requests.at(0).body, fileContent(false));
+
+        // But the next change of the file can be a delta
+        const SyncJournalDb::BlockSignature signature = journal.getBlockSignature(QLatin1String("big.bin"));
+        QVERIFY(signature._valid);
+        QCOMPARE(signature._etag, QByteArray("e1"));
+        QCOMPARE(signature._blockSize, qint64(BlockSize));
+        QCOMPARE(signature._hashes, FileSystem::calcBlockHashes(filePath, BlockSize));
+    }
+
+    void testDownloadSignature_data()
+    {
+        QTest::addColumn<bool>("deltaUpload");
+        QTest::newRow("capability") << true;
+        QTest::newRow("no capability") << false;
+    }
+
+    void testDownloadSignature()
+    {
+        QFETCH(bool, deltaUpload);
+
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString localPath = dir.path() + QLatin1Char('/');
+        const QString filePath = localPath + QLatin1String("big.bin");
+        SyncJournalDb journal(localPath);
+
+        FakeQNAM *qnam = new FakeQNAM([](const FakeQNAM::Request &) {
+            FakeResponse response(200);
+            response.headers["ETag"] = "\"e1\"";
+            response.body = fileContent(false);
+            return response;
+        });
+
+        SyncFileItemPtr item(new SyncFileItem);
+        item->_file = item->_originalFile = QLatin1String("big.bin");
+        item->_type = SyncFileItem::File;
+        item->_direction = SyncFileItem::Down;
+        item->_instruction = CSYNC_INSTRUCTION_NEW;
+        item->_size = BlockCount * BlockSize;
+        item->_modtime = 1234567890;
+        item->_etag = "e1";
+        QVERIFY(propagate(createAccount(qnam, deltaUpload), localPath, &journal, item));
+        QCOMPARE(item->_status, SyncFileItem::Success);
+
+        const SyncJournalDb::BlockSignature signature = journal.getBlockSignature(QLatin1String("big.bin"));
+        QCOMPARE(signature._valid, deltaUpload);
+        if (deltaUpload) {
+            QCOMPARE(signature._etag, QByteArray("e1"));
+            QCOMPARE(signature._fileSize, qint64(BlockCount * BlockSize));
+            QCOMPARE(signature._hashes, FileSystem::calcBlockHashes(filePath, BlockSize));
+        }
+    }
+};
+
+#endif
@@ -88,6 +88,23 @@ private slots:
        QVERIFY(sSum == sum );
     }
 
+    void testBlockHashes()
+    {
+       QString file( _root+"/file_c.bin");
+       writeRandomFile(file, 5500);
+       QFile f(file);
+       QVERIFY(f.open(QIODevice::ReadOnly));
+       QByteArray data = f.readAll();
+       QVERIFY(data.size() > 5000);
+
+       QByteArray expected;
+       for (int pos = 0; pos < data.size(); pos += 1000) {
+           expected += QCryptographicHash::hash(data.mid(pos, 1000), QCryptographicHash::Md5);
+       }
+       QCOMPARE(calcBlockHashes(file, 1000), expected);
+       QVERIFY(calcBlockHashes(_root+"/does_not_exist", 1000).isNull());
+    }
+
 };
 
 #endif
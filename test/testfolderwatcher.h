@@ -165,6 +165,36 @@ private slots:
         checkNotifications();
     }
 
+    void testMoveBackWithinASecond() { // the partial local discovery depends on every event
+        if (!_watcher->isReliable()) {
+            return;
+        }
+        QString file1(_root+"/a1/b1/moveback");
+        QString file2(_root+"/a1/b2/moveback");
+        Utility::writeRandomFile(file1);
+        QVERIFY(QFile::rename(file1, file2));
+        processAndWait();
+
+        _requiredNotifications.insert(file1);
+        _requiredNotifications.insert(file2);
+        QVERIFY(QFile::rename(file2, file1));
+
+        checkNotifications();
+    }
+
+    void testCreateInNewDir() { // a new directory must be watched without a sync in between
+        QString dirName(_root+"/a2/new_dir2");
+        QString file(dirName+"/new_file");
+        QDir dir;
+        QVERIFY(dir.mkdir(dirName));
+        processAndWait();
+
+        _requiredNotifications.insert(file);
+        Utility::writeRandomFile(file);
+
+        checkNotifications();
+    }
+
     void cleanupTestCase() {
         if( _root.startsWith(QDir::tempPath() )) {
             system( QString("rm -rf %1").arg(_root).toLocal8Bit() );
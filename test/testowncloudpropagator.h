@@ -9,20 +9,60 @@
 
 #include <QtTest>
 #include <QDebug>
+#include <QTemporaryDir>
 
+#include "account.h"
+#include "configfile.h"
 #include "propagatedownload.h"
+#include "propagateupload.h"
 #include "owncloudpropagator_p.h"
+#include "syncjournaldb.h"
 
 using namespace OCC;
 namespace OCC {
 QString OWNCLOUDSYNC_EXPORT createDownloadTmpFileName(const QString &previous);
+QVector<SyncJournalDb::DownloadSegment> OWNCLOUDSYNC_EXPORT createDownloadSegments(quint64 size, int count);
 }
 
+// The defaults of ConfigFile, as the test config dir is empty
+static const quint64 MiB = 1024 * 1024;
+static const quint64 minChunkSize = 1 * MiB;
+static const quint64 maxChunkSize = 100 * MiB;
+static const qint64 targetChunkUploadDuration = 60 * 1000;
+
 class TestOwncloudPropagator : public QObject
 {
     Q_OBJECT
 
+    QTemporaryDir _dir;
+
+    // A propagator for an empty sync, with its controllers set up
+    OwncloudPropagator *startPropagator(const AccountPtr &account, SyncJournalDb *journal)
+    {
+        OwncloudPropagator *propagator = new OwncloudPropagator(account, _dir.path(),
+            QLatin1String("/remote.php/webdav/"), QLatin1String("/"), journal);
+        propagator->start(SyncFileItemVector());
+        return propagator;
+    }
+
+    // A small item that was propagated in requestDuration ms
+    static SyncFileItem smallItem(quint64 requestDuration)
+    {
+        SyncFileItem item;
+        item._file = QLatin1String("small.txt");
+        item._instruction = CSYNC_INSTRUCTION_NEW;
+        item._size = 100;
+        item._requestDuration = requestDuration;
+        return item;
+    }
+
 private slots:
+    void initTestCase()
+    {
+        QVERIFY(_dir.isValid());
+        ConfigFile::setConfDir(_dir.path());
+    }
+
     void testUpdateErrorFromSession()
     {
 //        OwncloudPropagator propagator( NULL, QLatin1String("test1"), QLatin1String("test2"), new ProgressDatabase);
@@ -66,6 +106,265 @@ private slots:
         }
     }
 
+    void testCreateDownloadSegments()
+    {
+        auto segments = createDownloadSegments(100, 4);
+        QCOMPARE(segments.count(), 4);
+        QCOMPARE(segments.first()._start, quint64(0));
+        QCOMPARE(segments.last()._end, quint64(100));
+
+        segments = createDownloadSegments(10, 4);
+        QCOMPARE(segments.count(), 4);
+        quint64 expectedStart = 0;
+        foreach (const auto &segment, segments) {
+            // contiguous, none empty, nothing done yet
+            QCOMPARE(segment._start, expectedStart);
+            QVERIFY(segment._end > segment._start);
+            QCOMPARE(segment._done, quint64(0));
+            expectedStart = segment._end;
+        }
+        QCOMPARE(expectedStart, quint64(10));
+
+        // fewer bytes than segments
+        QCOMPARE(createDownloadSegments(2, 4).count(), 2);
+        QVERIFY(createDownloadSegments(0, 4).isEmpty());
+    }
+
+    void testDeltaUploadChunks()
+    {
+        auto hash = [](char c) { return QByteArray(16, c); };
+        QByteArray base = hash('a') + hash('b') + hash('c') + hash('d');
+
+        // unchanged
+        QCOMPARE(deltaUploadChunks(base, base), QVector<int>());
+        // a block changed in the middle
+        QCOMPARE(deltaUploadChunks(base, hash('a') + hash('x') + hash('c') + hash('d')), QVector<int>() << 1);
+        // the file grew
+        QCOMPARE(deltaUploadChunks(base, base + hash('e') + hash('f')), QVector<int>() << 4 << 5);
+        // the file was truncated, the last block is shorter than before
+        QCOMPARE(deltaUploadChunks(base, hash('a') + hash('y')), QVector<int>() << 1);
+        // no signature of the old version
+        QCOMPARE(deltaUploadChunks(QByteArray(), hash('a') + hash('b')), QVector<int>() << 0 << 1);
+    }
+
+    void testChunkSizeAdaptsToTarget()
+    {
+        SyncJournalDb journal(_dir.path());
+        AccountPtr account = Account::create();
+        QScopedPointer<OwncloudPropagator> propagator(startPropagator(account, &journal));
+        QCOMPARE(propagator->chunkSize(), 5 * MiB);
+
+        // A fast link: 5 MiB in 10 s would be 30 MiB in the target time.
+        // The size moves half way towards it with every chunk.
+        const quint64 bytesPerSecond = MiB / 2;
+        const quint64 targetSize = bytesPerSecond * targetChunkUploadDuration / 1000;
+        quint64 previous = propagator->chunkSize();
+        for (int i = 0; i < 20; ++i) {
+            const quint64 size = propagator->chunkSize();
+            propagator->adaptChunkSize(size, size * 1000 / bytesPerSecond);
+            QVERIFY(propagator->chunkSize() >= previous);
+            previous = propagator->chunkSize();
+        }
+        QVERIFY(qAbs(qint64(targetSize) - qint64(propagator->chunkSize())) < qint64(MiB / 100));
+
+        // The link gets slower: the chunks shrink
+        propagator->adaptChunkSize(propagator->chunkSize(), 4 * targetChunkUploadDuration);
+        QVERIFY(propagator->chunkSize() < previous);
+    }
+
+    void testChunkSizeShrinksOnFailure()
+    {
+        SyncJournalDb journal(_dir.path());
+        AccountPtr account = Account::create();
+        QScopedPointer<OwncloudPropagator> propagator(startPropagator(account, &journal));
+
+        propagator->chunkUploadFailed(propagator->chunkSize());
+        QCOMPARE(propagator->chunkSize(), 5 * MiB / 2);
+        // A chunk that was started before the first failure halves the new size
+        propagator->chunkUploadFailed(5 * MiB);
+        QCOMPARE(propagator->chunkSize(), 5 * MiB / 4);
+        for (int i = 0; i < 10; ++i) {
+            propagator->chunkUploadFailed(propagator->chunkSize());
+        }
+        QCOMPARE(propagator->chunkSize(), minChunkSize);
+    }
+
+    void testChunkSizeBounds()
+    {
+        SyncJournalDb journal(_dir.path());
+        AccountPtr account = Account::create();
+        QScopedPointer<OwncloudPropagator> propagator(startPropagator(account, &journal));
+
+        for (int i = 0; i < 50; ++i) {
+            propagator->adaptChunkSize(propagator->chunkSize(), 1);
+            QVERIFY(propagator->chunkSize() <= maxChunkSize);
+        }
+        QCOMPARE(propagator->chunkSize(), maxChunkSize);
+
+        for (int i = 0; i < 50; ++i) {
+            propagator->adaptChunkSize(propagator->chunkSize(), 1000 * targetChunkUploadDuration);
+            QVERIFY(propagator->chunkSize() >= minChunkSize);
+        }
+        QCOMPARE(propagator->chunkSize(), minChunkSize);
+
+        // Nothing to learn from an empty chunk
+        propagator->adaptChunkSize(0, 1);
+        QCOMPARE(propagator->chunkSize(), minChunkSize);
+    }
+
+    void testChunkSizeStoredInAccount()
+    {
+        SyncJournalDb journal(_dir.path());
+        AccountPtr account = Account::create();
+        quint64 adapted = 0;
+        {
+            QScopedPointer<OwncloudPropagator> propagator(startPropagator(account, &journal));
+            propagator->adaptChunkSize(propagator->chunkSize(), targetChunkUploadDuration / 4);
+            adapted = propagator->chunkSize();
+            QVERIFY(adapted > 5 * MiB);
+            QCOMPARE(account->uploadChunkSize(), adapted);
+        }
+
+        // The next sync of the account starts where the last one ended
+        QScopedPointer<OwncloudPropagator> propagator(startPropagator(account, &journal));
+        QCOMPARE(propagator->chunkSize(), adapted);
+
+        // A stored value outside of the bounds is brought back in
+        account->setUploadChunkSize(1000 * MiB);
+        propagator.reset(startPropagator(account, &journal));
+        QCOMPARE(propagator->chunkSize(), maxChunkSize);
+    }
+
+    void testParallelismRampUp()
+    {
+        SyncJournalDb journal(_dir.path());
+        AccountPtr account = Account::create();
+        QScopedPointer<OwncloudPropagator> propagator(startPropagator(account, &journal));
+        QCOMPARE(propagator->maximumActiveJob(), 3);
+
+        // Fast answers with a stable latency: one more job per round trip
+        int previous = propagator->maximumActiveJob();
+        for (int i = 0; i < 500; ++i) {
+            propagator->adaptParallelism(smallItem(100), SyncFileItem::Success);
+            QVERIFY(propagator->maximumActiveJob() >= previous);
+            QVERIFY(propagator->maximumActiveJob() <= 16);
+            previous = propagator->maximumActiveJob();
+        }
+        QCOMPARE(propagator->maximumActiveJob(), 16);
+    }
+
+    void testParallelismBackOffOnLatency()
+    {
+        SyncJournalDb journal(_dir.path());
+        AccountPtr account = Account::create();
+        QScopedPointer<OwncloudPropagator> propagator(startPropagator(account, &journal));
+        for (int i = 0; i < 500; ++i) {
+            propagator->adaptParallelism(smallItem(100), SyncFileItem::Success);
+        }
+        QCOMPARE(propagator->maximumActiveJob(), 16);
+
+        // The requests queue up: shrink, but never stop
+        int previous = propagator->maximumActiveJob();
+        for (int i = 0; i < 500; ++i) {
+            propagator->adaptParallelism(smallItem(1000), SyncFileItem::Success);
+            QVERIFY(propagator->maximumActiveJob() <= previous);
+            previous = propagator->maximumActiveJob();
+        }
+        QCOMPARE(propagator->maximumActiveJob(), 1);
+
+        // Items that tell nothing about the latency are ignored
+        propagator->adaptParallelism(smallItem(0), SyncFileItem::Success);
+        propagator->adaptParallelism(smallItem(10), SyncFileItem::NormalError);
+        QCOMPARE(propagator->maximumActiveJob(), 1);
+    }
+
+    void testParallelismBackOffOn5xx()
+    {
+        SyncJournalDb journal(_dir.path());
+        AccountPtr account = Account::create();
+        QScopedPointer<OwncloudPropagator> propagator(startPropagator(account, &journal));
+        for (int i = 0; i < 500; ++i) {
+            propagator->adaptParallelism(smallItem(100), SyncFileItem::Success);
+        }
+        QCOMPARE(propagator->maximumActiveJob(), 16);
+
+        SyncFileItem failed = smallItem(100);
+        failed._httpErrorCode = 503;
+        propagator->adaptParallelism(failed, SyncFileItem::NormalError);
+        QCOMPARE(propagator->maximumActiveJob(), 8);
+
+        // The other requests that were in flight fail the same way
+        propagator->adaptParallelism(failed, SyncFileItem::NormalError);
+        propagator->requestTimedOut();
+        QCOMPARE(propagator->maximumActiveJob(), 8);
+    }
+
+    void testParallelismTimeout()
+    {
+        SyncJournalDb journal(_dir.path());
+        AccountPtr account = Account::create();
+        QScopedPointer<OwncloudPropagator> propagator(startPropagator(account, &journal));
+        QCOMPARE(propagator->maximumActiveJob(), 3);
+
+        propagator->requestTimedOut();
+        QCOMPARE(propagator->maximumActiveJob(), 1);
+    }
+
+    void testParallelismLargeJobs()
+    {
+        SyncJournalDb journal(_dir.path());
+        AccountPtr account = Account::create();
+        QScopedPointer<OwncloudPropagator> propagator(startPropagator(account, &journal));
+        QCOMPARE(propagator->maximumActiveLargeJobs(), 2);
+
+        SyncFileItem large = smallItem(100000);
+        large._size = 10 * MiB;
+        QVERIFY(propagator->isLargeTransfer(large));
+        QVERIFY(!propagator->isLargeTransfer(smallItem(100)));
+        SyncFileItem dir = large;
+        dir._isDirectory = true;
+        QVERIFY(!propagator->isLargeTransfer(dir));
+        SyncFileItem removed = large;
+        removed._instruction = CSYNC_INSTRUCTION_REMOVE;
+        QVERIFY(!propagator->isLargeTransfer(removed));
+
+        // The duration of a large transfer says nothing about the latency
+        propagator->adaptParallelism(smallItem(100), SyncFileItem::Success);
+        const int smallJobs = propagator->maximumActiveJob();
+        for (int i = 0; i < 10; ++i) {
+            propagator->adaptParallelism(large, SyncFileItem::Success);
+        }
+        QCOMPARE(propagator->maximumActiveJob(), smallJobs);
+
+        // Running large transfers do not take the slots of the small jobs
+        propagator->_activeLargeJobs = 2;
+        QCOMPARE(propagator->maximumActiveJob(), smallJobs + 2);
+        propagator->_activeLargeJobs = 0;
+    }
+
+    void testParallelismBandwidthLimit()
+    {
+        SyncJournalDb journal(_dir.path());
+        AccountPtr account = Account::create();
+        QScopedPointer<OwncloudPropagator> propagator(startPropagator(account, &journal));
+        QCOMPARE(propagator->maximumParallelChunks(), 4);
+
+        propagator->_uploadLimit.fetchAndStoreOrdered(100 * 1024);
+        QCOMPARE(propagator->maximumActiveLargeJobs(), 1);
+        QCOMPARE(propagator->maximumParallelChunks(), 1);
+
+        // The small jobs are not limited by the bandwidth
+        for (int i = 0; i < 500; ++i) {
+            propagator->adaptParallelism(smallItem(100), SyncFileItem::Success);
+        }
+        QCOMPARE(propagator->maximumActiveJob(), 16);
+
+        propagator->_uploadLimit.fetchAndStoreOrdered(0);
+        propagator->_downloadLimit.fetchAndStoreOrdered(-75);
+        QCOMPARE(propagator->maximumActiveLargeJobs(), 1);
+        QCOMPARE(propagator->maximumParallelChunks(), 1);
+    }
+
     void testParseEtag()
     {
         typedef QPair<const char*, const char*> Test;
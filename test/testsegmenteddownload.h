@@ -0,0 +1,235 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTSEGMENTEDDOWNLOAD_H
+#define MIRALL_TESTSEGMENTEDDOWNLOAD_H
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "syncenginetestutils.h"
+#include "account.h"
+#include "owncloudpropagator.h"
+#include "syncjournaldb.h"
+
+using namespace OCC;
+
+class TestSegmentedDownload : public QObject
+{
+    Q_OBJECT
+
+    // Four segments of SegmentSize bytes with the default of four parallel chunks
+    enum { SegmentSize = 1000, FileSize = 4 * SegmentSize };
+
+    // How the fake server answers a range request
+    enum RangeMode { HonorRange, IgnoreRange, WrongContentRange, TooMuchData };
+
+    static QByteArray fileContent()
+    {
+        QByteArray data;
+        for (int i = 0; i < FileSize; ++i) {
+            data += char('a' + (i * 7) % 26);
+        }
+        return data;
+    }
+
+    static QByteArray readFile(const QString &path)
+    {
+        QFile f(path);
+        return f.open(QIODevice::ReadOnly) ? f.readAll() : QByteArray();
+    }
+
+    static FakeResponse serve(const FakeQNAM::Request &request, RangeMode mode)
+    {
+        const QByteArray data = fileContent();
+        FakeResponse response(200);
+        response.headers["ETag"] = "\"e1\"";
+        response.body = data;
+
+        QRegExp rx("bytes=(\\d+)-(\\d+)?");
+        if (mode == IgnoreRange || rx.indexIn(request.request.rawHeader("Range")) < 0) {
+            return response;
+        }
+        const int start = rx.cap(1).toInt();
+        const int end = rx.cap(2).isEmpty() ? FileSize - 1 : rx.cap(2).toInt();
+        response.code = 206;
+        response.headers["Content-Range"] = "bytes " + QByteArray::number(start) + '-'
+                + QByteArray::number(end) + '/' + QByteArray::number(int(FileSize));
+        response.body = data.mid(start, end - start + 1);
+        if (mode == WrongContentRange) {
+            response.headers["Content-Range"] = "bytes " + QByteArray::number(start) + '-'
+                    + QByteArray::number(FileSize - 1) + '/' + QByteArray::number(int(FileSize));
+            response.body = data.mid(start);
+        } else if (mode == TooMuchData) {
+            response.body = data.mid(start);
+        }
+        return response;
+    }
+
+    // Downloads big.bin into localPath, and returns the status of the item
+    static SyncFileItem::Status download(const QString &localPath, SyncJournalDb *journal,
+                                         FakeQNAM *qnam)
+    {
+        AccountPtr account = Account::create();
+        account->setUrl(QUrl(QLatin1String("http://example.com/owncloud")));
+        account->setCredentials(new FakeCredentials(qnam));
+
+        SyncFileItemPtr item(new SyncFileItem);
+        item->_file = item->_originalFile = QLatin1String("big.bin");
+        item->_type = SyncFileItem::File;
+        item->_direction = SyncFileItem::Down;
+        item->_instruction = CSYNC_INSTRUCTION_NEW;
+        item->_size = FileSize;
+        item->_modtime = 1234567890;
+        item->_etag = "e1";
+
+        OwncloudPropagator propagator(account, localPath, QLatin1String("/owncloud/remote.php/webdav/"),
+                                      QLatin1String("/"), journal);
+        QSignalSpy finished(&propagator, SIGNAL(finished()));
+        propagator.start(SyncFileItemVector() << item);
+        if (!finished.wait(10000)) {
+            return SyncFileItem::NoStatus;
+        }
+        return item->_status;
+    }
+
+    // The ranges of the GET requests, in the order they were sent
+    static QList<QByteArray> ranges(FakeQNAM *qnam)
+    {
+        QList<QByteArray> result;
+        foreach (const FakeQNAM::Request &request, qnam->requests()) {
+            if (request.verb == "GET") {
+                result.append(request.request.rawHeader("Range"));
+            }
+        }
+        return result;
+    }
+
+private slots:
+    void initTestCase()
+    {
+        // Read once, by the first download
+        qputenv("OWNCLOUD_SEGMENTED_DOWNLOAD_MIN_SIZE", QByteArray::number(int(SegmentSize)));
+    }
+
+    void testSegmentedDownload()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString localPath = dir.path() + QLatin1Char('/');
+        SyncJournalDb journal(localPath);
+
+        FakeQNAM *qnam = new FakeQNAM([](const FakeQNAM::Request &request) {
+            return serve(request, HonorRange);
+        });
+        QCOMPARE(download(localPath, &journal, qnam), SyncFileItem::Success);
+
+        QList<QByteArray> sent = ranges(qnam);
+        qSort(sent);
+        QCOMPARE(sent, QList<QByteArray>() << "bytes=0-999" << "bytes=1000-1999"
+                                           << "bytes=2000-2999" << "bytes=3000-3999");
+        QCOMPARE(readFile(localPath + QLatin1String("big.bin")), fileContent());
+        QVERIFY(!journal.getDownloadInfo(QLatin1String("big.bin"))._valid);
+        QCOMPARE(journal.getFileRecord(QLatin1String("big.bin"))._etag, QByteArray("e1"));
+    }
+
+    void testResumeSegments()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString localPath = dir.path() + QLatin1Char('/');
+        SyncJournalDb journal(localPath);
+
+        // A previous attempt got part of the first and all of the third segment
+        const QByteArray data = fileContent();
+        QByteArray partial(FileSize, '\0');
+        partial.replace(0, 300, data.left(300));
+        partial.replace(2000, SegmentSize, data.mid(2000, SegmentSize));
+        {
+            QFile tmp(localPath + QLatin1String(".big.bin.~resume"));
+            QVERIFY(tmp.open(QIODevice::WriteOnly));
+            QCOMPARE(tmp.write(partial), qint64(FileSize));
+        }
+        SyncJournalDb::DownloadInfo info;
+        info._etag = "e1";
+        info._tmpfile = QLatin1String(".big.bin.~resume");
+        info._valid = true;
+        const quint64 done[] = { 300, 0, SegmentSize, 0 };
+        for (int i = 0; i < 4; ++i) {
+            SyncJournalDb::DownloadSegment segment;
+            segment._start = i * SegmentSize;
+            segment._end = (i + 1) * SegmentSize;
+            segment._done = done[i];
+            info._segments.append(segment);
+        }
+        journal.setDownloadInfo(QLatin1String("big.bin"), info);
+
+        FakeQNAM *qnam = new FakeQNAM([](const FakeQNAM::Request &request) {
+            return serve(request, HonorRange);
+        });
+        QCOMPARE(download(localPath, &journal, qnam), SyncFileItem::Success);
+
+        // Only the missing parts are asked for
+        QList<QByteArray> sent = ranges(qnam);
+        qSort(sent);
+        QCOMPARE(sent, QList<QByteArray>() << "bytes=1000-1999" << "bytes=300-999" << "bytes=3000-3999");
+        QCOMPARE(readFile(localPath + QLatin1String("big.bin")), data);
+        QVERIFY(!QFile::exists(localPath + QLatin1String(".big.bin.~resume")));
+    }
+
+    void testServerIgnoresRange()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString localPath = dir.path() + QLatin1Char('/');
+        SyncJournalDb journal(localPath);
+
+        FakeQNAM *qnam = new FakeQNAM([](const FakeQNAM::Request &request) {
+            return serve(request, IgnoreRange);
+        });
+        QCOMPARE(download(localPath, &journal, qnam), SyncFileItem::Success);
+
+        // The segments are given up for one download of the whole file
+        const QList<QByteArray> sent = ranges(qnam);
+        QVERIFY(sent.size() >= 2);
+        QVERIFY(!sent.first().isEmpty());
+        QVERIFY(sent.last().isEmpty());
+        QCOMPARE(readFile(localPath + QLatin1String("big.bin")), fileContent());
+    }
+
+    void testRangeOverrun_data()
+    {
+        QTest::addColumn<int>("mode");
+        QTest::newRow("content-range") << int(WrongContentRange);
+        QTest::newRow("body") << int(TooMuchData);
+    }
+
+    void testRangeOverrun()
+    {
+        QFETCH(int, mode);
+
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString localPath = dir.path() + QLatin1Char('/');
+        SyncJournalDb journal(localPath);
+
+        FakeQNAM *qnam = new FakeQNAM([mode](const FakeQNAM::Request &request) {
+            return serve(request, RangeMode(mode));
+        });
+        QCOMPARE(download(localPath, &journal, qnam), SyncFileItem::NormalError);
+        QVERIFY(!QFile::exists(localPath + QLatin1String("big.bin")));
+
+        // No segment got past its end
+        const SyncJournalDb::DownloadInfo info = journal.getDownloadInfo(QLatin1String("big.bin"));
+        QVERIFY(info._valid);
+        QCOMPARE(info._segments.size(), 4);
+        foreach (const SyncJournalDb::DownloadSegment &segment, info._segments) {
+            QVERIFY(segment._start + segment._done <= segment._end);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,154 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTSYNCCOLLECTION_H
+#define MIRALL_TESTSYNCCOLLECTION_H
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "syncenginetestutils.h"
+#include "mockserver/httpserver.h"
+#include "account.h"
+#include "csync.h"
+#include "syncengine.h"
+#include "syncjournaldb.h"
+
+using namespace OCC;
+
+class TestSyncCollection : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir *_dir;
+    HttpServer *_server;
+    AccountPtr _account;
+    SyncJournalDb *_journal;
+    CSYNC *_csync_ctx;
+
+    QString localPath() const { return _dir->path() + QLatin1Char('/'); }
+
+    bool localExists(const QString &path) const { return QFile::exists(localPath() + path); }
+
+    // Runs one sync to the end, and tells if it succeeded
+    bool sync()
+    {
+        SyncEngine engine(_account, _csync_ctx, localPath(), QLatin1String("/remote.php/webdav/"),
+                          QLatin1String("/"), _journal);
+        QSignalSpy finished(&engine, SIGNAL(finished(bool)));
+        QMetaObject::invokeMethod(&engine, "startSync", Qt::QueuedConnection);
+        if (!finished.wait(30000)) {
+            engine.abort();
+            return false;
+        }
+        return finished.first().first().toBool();
+    }
+
+private slots:
+    void initTestCase()
+    {
+        // Read once, by the first sync
+        qputenv("OWNCLOUD_SYNC_COLLECTION", "1");
+        SyncEngine::minimumFileAgeForUpload = 0;
+    }
+
+    void init()
+    {
+        _dir = new QTemporaryDir;
+        QVERIFY(_dir->isValid());
+
+        _server = new HttpServer(0, this);
+        QVERIFY(_server->isListening());
+        _server->addPath(QLatin1String("A/a1.txt"), "a1");
+        _server->addPath(QLatin1String("A/a2.txt"), "a2");
+        _server->addPath(QLatin1String("B/b1.txt"), "b1");
+
+        const QString host = QString("127.0.0.1:%1").arg(_server->serverPort());
+        _account = Account::create();
+        _account->setUrl(QUrl(QLatin1String("http://") + host));
+        _account->setCredentials(new FakeCredentials(new QNetworkAccessManager));
+        // Sync tokens are only asked for when the root etag covers everything
+        _account->setServerVersion(QLatin1String("9.0.0"));
+
+        _journal = new SyncJournalDb(localPath());
+
+        const QString remoteUrl = QLatin1String("owncloud://") + host + QLatin1String("/remote.php/webdav/");
+        QVERIFY(csync_create(&_csync_ctx, localPath().toUtf8().constData(), remoteUrl.toUtf8().constData()) >= 0);
+        QVERIFY(csync_init(_csync_ctx) >= 0);
+    }
+
+    void cleanup()
+    {
+        csync_destroy(_csync_ctx);
+        delete _journal;
+        _account.clear();
+        delete _server;
+        delete _dir;
+    }
+
+    void testTokenRoundTrip()
+    {
+        // Nothing to ask the changes since yet, but the token is stored
+        QVERIFY(sync());
+        QVERIFY(localExists(QLatin1String("A/a1.txt")));
+        QVERIFY(localExists(QLatin1String("B/b1.txt")));
+        QCOMPARE(_server->requestCount("REPORT"), 0);
+        QCOMPARE(_journal->syncToken(), _server->syncToken());
+
+        // The next sync only asks for what changed since
+        _server->addPath(QLatin1String("A/a3.txt"), "a3");
+        QVERIFY(sync());
+        QCOMPARE(_server->requestCount("REPORT"), 1);
+        QVERIFY(localExists(QLatin1String("A/a3.txt")));
+        QCOMPARE(_journal->syncToken(), _server->syncToken());
+    }
+
+    void testInvalidToken_data()
+    {
+        QTest::addColumn<int>("code");
+        QTest::newRow("403") << 403;
+        QTest::newRow("409") << 409;
+    }
+
+    void testInvalidToken()
+    {
+        QFETCH(int, code);
+        _server->setInvalidTokenCode(code);
+
+        QVERIFY(sync());
+        // A token the server does not know (any more)
+        _journal->setSyncToken("http://owncloud.org/ns/sync/999999");
+
+        // The full discovery still finds the change
+        _server->addPath(QLatin1String("B/b3.txt"), "b3");
+        QVERIFY(sync());
+        QCOMPARE(_server->requestCount("REPORT"), 1);
+        QVERIFY(localExists(QLatin1String("B/b3.txt")));
+        QCOMPARE(_journal->syncToken(), _server->syncToken());
+    }
+
+    void testUncleanSyncClearsToken()
+    {
+        QVERIFY(sync());
+        QVERIFY(!_journal->syncToken().isEmpty());
+
+        // The token does not cover a file that could not be downloaded
+        _server->addPath(QLatin1String("B/broken.txt"), "broken");
+        _server->setErrorCode(QLatin1String("B/broken.txt"), 500);
+        sync();
+        QVERIFY(!localExists(QLatin1String("B/broken.txt")));
+        QVERIFY(_journal->syncToken().isEmpty());
+
+        // So the next sync lists the changed directories again
+        _server->setErrorCode(QLatin1String("B/broken.txt"), 0);
+        _journal->wipeErrorBlacklist();
+        QVERIFY(sync());
+        QVERIFY(localExists(QLatin1String("B/broken.txt")));
+        QCOMPARE(_journal->syncToken(), _server->syncToken());
+    }
+};
+
+#endif
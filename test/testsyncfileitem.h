@@ -10,6 +10,7 @@
 #include <QtTest>
 
 #include "syncfileitem.h"
+#include "syncfileitemtree.h"
 
 using namespace OCC;
 
@@ -66,6 +67,61 @@ private slots:
         QVERIFY(!(b < b));
         QVERIFY(!(c < c));
     }
+
+    void testSortKey_data() {
+        testComparator_data();
+    }
+
+    void testSortKey() {
+        QFETCH( SyncFileItem , a );
+        QFETCH( SyncFileItem , b );
+        QFETCH( SyncFileItem , c );
+
+        QVERIFY(a.sortKey() < b.sortKey());
+        QVERIFY(b.sortKey() < c.sortKey());
+        QVERIFY(a.sortKey() < c.sortKey());
+
+        QVERIFY(!(b.sortKey() < a.sortKey()));
+        QVERIFY(!(c.sortKey() < b.sortKey()));
+        QVERIFY(!(a.sortKey() < a.sortKey()));
+    }
+
+    void testTree() {
+        SyncFileItemVector items;
+        auto add = [&](const QString &file, bool isDirectory) {
+            SyncFileItemPtr item(new SyncFileItem(createItem(file)));
+            item->_isDirectory = isDirectory;
+            items.append(item);
+        };
+        add("a", true);             // 0
+        add("a/b", true);           // 1
+        add("a/b/c.txt", false);    // 2
+        add("a/b/d", true);         // 3
+        add("a/e.txt", false);      // 4
+        add("a-b", true);           // 5
+        add("f/g.txt", false);      // 6, its parent is not in the plan
+        add("f/h", true);           // 7
+        add("f/h/i.txt", false);    // 8
+
+        SyncFileItemTree tree(items);
+
+        QCOMPARE(tree.subtreeEnd(0), 5);
+        QCOMPARE(tree.subtreeEnd(1), 4);
+        QCOMPARE(tree.subtreeEnd(2), 3);
+        QCOMPARE(tree.subtreeEnd(3), 4);
+        QCOMPARE(tree.subtreeEnd(5), 6);
+        QCOMPARE(tree.subtreeEnd(7), 9);
+
+        QCOMPARE(tree.parent(0), -1);
+        QCOMPARE(tree.parent(1), 0);
+        QCOMPARE(tree.parent(2), 1);
+        QCOMPARE(tree.parent(3), 1);
+        QCOMPARE(tree.parent(4), 0);
+        QCOMPARE(tree.parent(5), -1);
+        QCOMPARE(tree.parent(6), -1);
+        QCOMPARE(tree.parent(7), -1);
+        QCOMPARE(tree.parent(8), 7);
+    }
 };
 
 #endif
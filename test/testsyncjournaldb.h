@@ -148,6 +148,33 @@ private slots:
         QVERIFY(!wipedRecord._valid);
     }
 
+    void testDownloadInfoSegments()
+    {
+        typedef SyncJournalDb::DownloadInfo Info;
+        Info record;
+        record._etag = "ABCDEF";
+        record._valid = true;
+        record._tmpfile = "/tmp/foo-segmented";
+        for (quint64 i = 0; i < 4; ++i) {
+            SyncJournalDb::DownloadSegment segment;
+            segment._start = i * 5000000000ULL;
+            segment._end = (i + 1) * 5000000000ULL;
+            segment._done = i * 1000;
+            record._segments.append(segment);
+        }
+        _db.setDownloadInfo("foo-segmented", record);
+
+        Info storedRecord = _db.getDownloadInfo("foo-segmented");
+        QVERIFY(storedRecord == record);
+
+        // Without segments again
+        record._segments.clear();
+        _db.setDownloadInfo("foo-segmented", record);
+        storedRecord = _db.getDownloadInfo("foo-segmented");
+        QVERIFY(storedRecord == record);
+        QVERIFY(storedRecord._segments.isEmpty());
+    }
+
     void testUploadInfo()
     {
         typedef SyncJournalDb::UploadInfo Info;
@@ -157,7 +184,7 @@ private slots:
         record._errorCount = 5;
         record._chunk = 12;
         record._transferid = 812974891;
-        record._size = 12894789147;
+        record._chunkSize = 12894789147;
         record._modtime = dropMsecs(QDateTime::currentDateTime());
         record._valid = true;
         _db.setUploadInfo("foo", record);
@@ -170,6 +197,32 @@ private slots:
         QVERIFY(!wipedRecord._valid);
     }
 
+    void testBlockSignature()
+    {
+        typedef SyncJournalDb::BlockSignature Info;
+        Info record = _db.getBlockSignature("nonexistant");
+        QVERIFY(!record._valid);
+
+        record._etag = "ABCDEF";
+        record._blockSize = 1024 * 1024;
+        record._fileSize = 5 * 1024 * 1024 + 17;
+        // binary data, including zeros and invalid utf8
+        record._hashes = QByteArray("\0\xff\x80hash", 7).repeated(6 * 16 / 7 + 1).left(6 * 16);
+        record._valid = true;
+        _db.setBlockSignature("foo", record);
+
+        Info storedRecord = _db.getBlockSignature("foo");
+        QVERIFY(storedRecord._valid);
+        QCOMPARE(storedRecord._etag, record._etag);
+        QCOMPARE(storedRecord._blockSize, record._blockSize);
+        QCOMPARE(storedRecord._fileSize, record._fileSize);
+        QCOMPARE(storedRecord._hashes, record._hashes);
+
+        _db.setBlockSignature("foo", Info());
+        Info wipedRecord = _db.getBlockSignature("foo");
+        QVERIFY(!wipedRecord._valid);
+    }
+
 private:
     SyncJournalDb _db;
 };
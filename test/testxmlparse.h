@@ -21,6 +21,8 @@ private:
   bool _success;
   QStringList _subdirs;
   QStringList _items;
+  QList<LsColEntry> _entries;
+  QStringList _removed;
 
 public slots:
   void slotDirectoryListingSubFolders(const QStringList& list)
@@ -35,6 +37,17 @@ public slots:
     _items.append(item);
   }
 
+  void slotDirectoryListingEntry(const QString& item, const LsColEntry& entry)
+  {
+    _items.append(item);
+    _entries.append(entry);
+  }
+
+  void slotDirectoryListingRemoved(const QString& item)
+  {
+    _removed.append(item);
+  }
+
   void slotFinishedSuccessfully()
   {
       _success = true;
@@ -46,6 +59,8 @@ private slots:
       _success = false;
       _subdirs.clear();
       _items.clear();
+      _entries.clear();
+      _removed.clear();
     }
 
     void cleanup() {
@@ -442,6 +457,195 @@ private slots:
         QVERIFY(_subdirs.size() == 1);
     }
 
+    void testParserIncremental() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004213ocobzus5kn6s</oc:id>"
+              "<oc:permissions>RDNVCK</oc:permissions>"
+              "<d:getetag>\"5527beb0400b0\"</d:getetag>"
+              "<d:resourcetype>"
+              "<d:collection/>"
+              "</d:resourcetype>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/%C3%A4.pdf</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004215ocobzus5kn6s</oc:id>"
+              "<oc:permissions></oc:permissions>"
+              "<d:getetag>\"2fa2f0d9ed49ea0c3e409d49e652dea0\"</d:getetag>"
+              "<d:resourcetype/>"
+              "<d:getlastmodified>Fri, 06 Feb 2015 13:49:55 GMT</d:getlastmodified>"
+              "<d:getcontentlength>121780</d:getcontentlength>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:downloadURL/>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 404 Not Found</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+
+        connect( &parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
+                 this, SLOT(slotDirectoryListingSubFolders(const QStringList&)) );
+        connect( &parser, SIGNAL(directoryListingEntry(const QString&, const LsColEntry&)),
+                 this, SLOT(slotDirectoryListingEntry(const QString&, const LsColEntry&)) );
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+
+        // Feed it in small pieces, like a slow network would
+        QHash <QString, qint64> sizes;
+        const int firstResponseEnd = testXml.indexOf("</d:response>") + int(sizeof("</d:response>") - 1);
+        parser.start(&sizes, "/oc/remote.php/webdav/sharefolder");
+        for (int pos = 0; pos < testXml.size(); pos += 7) {
+            QVERIFY(parser.addData(testXml.mid(pos, 7)));
+            if (pos + 7 >= firstResponseEnd) {
+                // available before the rest arrived
+                QVERIFY(_items.size() >= 1);
+            }
+        }
+        QVERIFY(!_success);
+        QVERIFY(parser.finish());
+        QVERIFY(_success);
+
+        QCOMPARE(_items.size(), 2);
+        QCOMPARE(_items.at(0), QString("/oc/remote.php/webdav/sharefolder"));
+        QCOMPARE(_items.at(1), QString::fromUtf8("/oc/remote.php/webdav/sharefolder/ä.pdf"));
+        QCOMPARE(_subdirs, QStringList() << "/oc/remote.php/webdav/sharefolder/");
+
+        const LsColEntry &dir = _entries.at(0);
+        QVERIFY(dir.isCollection);
+        QCOMPARE(dir.fileId, QByteArray("00004213ocobzus5kn6s"));
+        QCOMPARE(dir.permissions, QByteArray("RDNVCK"));
+        QVERIFY(!(dir.fields & LsColEntry::ContentLength));
+
+        const LsColEntry &file = _entries.at(1);
+        QVERIFY(!file.isCollection);
+        QVERIFY(file.fields & LsColEntry::ResourceType);
+        QCOMPARE(file.etag, QByteArray("\"2fa2f0d9ed49ea0c3e409d49e652dea0\""));
+        QCOMPARE(file.size, qint64(121780));
+        QCOMPARE(file.lastModified, QByteArray("Fri, 06 Feb 2015 13:49:55 GMT"));
+        // returned, but empty
+        QVERIFY(file.fields & LsColEntry::Permissions);
+        QVERIFY(file.permissions.isEmpty());
+        // only in the 404 propstat
+        QVERIFY(!(file.fields & LsColEntry::DownloadUrl));
+    }
+
+    void testParserIncrementalTruncated() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<d:resourcetype><d:collection/></d:resourcetype>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/a";
+
+        LsColXMLParser parser;
+        connect( &parser, SIGNAL(directoryListingEntry(const QString&, const LsColEntry&)),
+                 this, SLOT(slotDirectoryListingEntry(const QString&, const LsColEntry&)) );
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+
+        parser.start(0, "/oc/remote.php/webdav/sharefolder");
+        QVERIFY(parser.addData(testXml));
+        QCOMPARE(_items.size(), 1);
+        // The connection ended in the middle of the document
+        QVERIFY(!parser.finish());
+        QVERIFY(!_success);
+    }
+
+    void testParserSyncCollection() {
+        // A sync-collection REPORT reply (RFC 6578)
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/sub/deep/new.txt</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<d:getetag>\"e1\"</d:getetag>"
+              "<d:resourcetype/>"
+              "<d:getcontentlength>12</d:getcontentlength>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/gone.txt</d:href>"
+              "<d:status>HTTP/1.1 404 Not Found</d:status>"
+              "</d:response>"
+              "<d:sync-token>http://example.com/ns/sync/42</d:sync-token>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+        connect( &parser, SIGNAL(directoryListingEntry(const QString&, const LsColEntry&)),
+                 this, SLOT(slotDirectoryListingEntry(const QString&, const LsColEntry&)) );
+        connect( &parser, SIGNAL(directoryListingRemoved(const QString&)),
+                 this, SLOT(slotDirectoryListingRemoved(const QString&)) );
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+
+        QHash <QString, qint64> sizes;
+        QVERIFY(parser.parse( testXml, &sizes, "/oc/remote.php/webdav/sharefolder" ));
+        QVERIFY(_success);
+
+        QCOMPARE(_items, QStringList() << "/oc/remote.php/webdav/sharefolder/sub/deep/new.txt");
+        QCOMPARE(_entries.at(0).etag, QByteArray("\"e1\""));
+        QCOMPARE(_removed, QStringList() << "/oc/remote.php/webdav/sharefolder/gone.txt");
+        QCOMPARE(parser.syncToken(), QByteArray("http://example.com/ns/sync/42"));
+        QVERIFY(!parser.truncated());
+    }
+
+    void testParserSyncCollectionTruncated() {
+        // The server left out changes: a 507 for the collection itself (RFC 6578 section 3.6)
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/gone.txt</d:href>"
+              "<d:status>HTTP/1.1 404 Not Found</d:status>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "<d:status>HTTP/1.1 507 Insufficient Storage</d:status>"
+              "<d:error><d:number-of-matches-within-limits/></d:error>"
+              "</d:response>"
+              "<d:sync-token>http://example.com/ns/sync/43</d:sync-token>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+        connect( &parser, SIGNAL(directoryListingRemoved(const QString&)),
+                 this, SLOT(slotDirectoryListingRemoved(const QString&)) );
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+
+        QHash <QString, qint64> sizes;
+        QVERIFY(parser.parse( testXml, &sizes, "/oc/remote.php/webdav/sharefolder" ));
+        QVERIFY(_success);
+
+        // the collection is not reported as removed
+        QCOMPARE(_removed, QStringList() << "/oc/remote.php/webdav/sharefolder/gone.txt");
+        QVERIFY(parser.truncated());
+        QCOMPARE(parser.syncToken(), QByteArray("http://example.com/ns/sync/43"));
+    }
+
 };
 
 #endif